@@ -0,0 +1,115 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "chain.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
+CRecentBlockCache recentBlocks;
+
+size_t CCachedBlock::DynamicMemoryUsage() const
+{
+    // The deserialized block is charged at its serialized size, which is a
+    // lower bound that is cheap to get
+    size_t nBlockSize = vSerialized.empty() ? ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) : vSerialized.size();
+    return nBlockSize + vSerialized.capacity();
+}
+
+CRecentBlockCache::CRecentBlockCache() : nMaxBlocks(DEFAULT_RECENT_BLOCKS), nUsage(0)
+{
+}
+
+void CRecentBlockCache::EvictOldest()
+{
+    std::map<uint256, CCachedBlockRef>::iterator it = mapBlocks.find(vOrder.front());
+    vOrder.pop_front();
+    if (it == mapBlocks.end())
+        return;
+    nUsage -= it->second->DynamicMemoryUsage();
+    mapBlocks.erase(it);
+}
+
+void CRecentBlockCache::SetMaxBlocks(size_t nMaxBlocksIn)
+{
+    LOCK(cs);
+    nMaxBlocks = nMaxBlocksIn;
+    while (vOrder.size() > nMaxBlocks)
+        EvictOldest();
+}
+
+void CRecentBlockCache::Add(const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    {
+        LOCK(cs);
+        if (nMaxBlocks == 0 || mapBlocks.count(hash))
+            return;
+    }
+
+    // Serialize outside the lock; the entry is read-only once it is shared
+    CCachedBlock* pentry = new CCachedBlock();
+    CCachedBlockRef pcached(pentry);
+    pentry->block = block;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    pentry->vSerialized.assign(ss.begin(), ss.end());
+
+    size_t nEntryUsage = pcached->DynamicMemoryUsage();
+    if (nEntryUsage > MAX_RECENT_BLOCKS_BYTES)
+        return;
+
+    LOCK(cs);
+    if (!mapBlocks.insert(std::make_pair(hash, pcached)).second)
+        return;
+    vOrder.push_back(hash);
+    nUsage += nEntryUsage;
+    while (vOrder.size() > nMaxBlocks || nUsage > MAX_RECENT_BLOCKS_BYTES)
+        EvictOldest();
+}
+
+CCachedBlockRef CRecentBlockCache::Get(const uint256& hash) const
+{
+    LOCK(cs);
+    std::map<uint256, CCachedBlockRef>::const_iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end())
+        return CCachedBlockRef();
+    return it->second;
+}
+
+void CRecentBlockCache::Clear()
+{
+    LOCK(cs);
+    mapBlocks.clear();
+    vOrder.clear();
+    nUsage = 0;
+}
+
+size_t CRecentBlockCache::Size() const
+{
+    LOCK(cs);
+    return mapBlocks.size();
+}
+
+size_t CRecentBlockCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nUsage;
+}
+
+CCachedBlockRef ReadBlockCached(const CBlockIndex* pindex)
+{
+    CCachedBlockRef pcached = recentBlocks.Get(pindex->GetBlockHash());
+    if (pcached)
+        return pcached;
+
+    CCachedBlock* pentry = new CCachedBlock();
+    pcached.reset(pentry);
+    if (!ReadBlockFromDisk(pentry->block, pindex))
+        return CCachedBlockRef();
+    return pcached;
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+class CBlockIndex;
+
+/** -recentblocks default: number of recently connected blocks kept in memory for ZMQ, REST and RPC readers */
+static const unsigned int DEFAULT_RECENT_BLOCKS = 8;
+/** Memory the recent-block cache may use, whatever -recentblocks says */
+static const size_t MAX_RECENT_BLOCKS_BYTES = 64 * 1024 * 1024;
+
+/** A block as connected, together with its SER_NETWORK serialization */
+class CCachedBlock
+{
+public:
+    CBlock block;
+    std::vector<char> vSerialized; //!< PROTOCOL_VERSION encoding, empty if the block was not read through the cache
+
+    size_t DynamicMemoryUsage() const;
+};
+
+typedef boost::shared_ptr<const CCachedBlock> CCachedBlockRef;
+
+/**
+ * Bounded cache of the last blocks connected to the active chain. Entries are
+ * immutable and handed out by reference, so readers may keep using one (for
+ * instance while ZMQ is still sending its bytes) after it has been evicted.
+ */
+class CRecentBlockCache
+{
+private:
+    mutable CCriticalSection cs;
+    std::map<uint256, CCachedBlockRef> mapBlocks;
+    std::deque<uint256> vOrder; //!< oldest first
+    size_t nMaxBlocks;
+    size_t nUsage;
+
+    void EvictOldest();
+
+public:
+    CRecentBlockCache();
+
+    void SetMaxBlocks(size_t nMaxBlocksIn);
+    void Add(const CBlock& block);
+    CCachedBlockRef Get(const uint256& hash) const;
+    void Clear();
+
+    size_t Size() const;
+    size_t DynamicMemoryUsage() const;
+};
+
+extern CRecentBlockCache recentBlocks;
+
+/**
+ * Return the block of pindex from the recent-block cache, or read it from disk
+ * when it is not there. Blocks read from disk are not added to the cache and
+ * come without serialized bytes. Returns NULL if the block cannot be read.
+ */
+CCachedBlockRef ReadBlockCached(const CBlockIndex* pindex);
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,410 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "chain.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "main.h"
+#include "script/script.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "version.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <boost/thread.hpp>
+
+bool fBlockFilterIndex = DEFAULT_BLOCKFILTERINDEX;
+
+/** Last block of the active chain whose filter is indexed, along with all its ancestors */
+static const CBlockIndex* pindexFilterBest = NULL;
+
+namespace
+{
+/** Writes bits to a byte vector, most significant bit first */
+class CBitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    unsigned char chBuffer;
+    int nOffset; //!< bits of chBuffer in use
+
+public:
+    explicit CBitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), chBuffer(0), nOffset(0) {}
+
+    //! Write the nBits (1..64) low bits of nData
+    void Write(uint64_t nData, int nBits)
+    {
+        while (nBits > 0) {
+            int nTake = std::min(8 - nOffset, nBits);
+            chBuffer |= (nData << (64 - nBits)) >> (64 - 8 + nOffset);
+            nOffset += nTake;
+            nBits -= nTake;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    //! Pad the last byte with zero bits
+    void Flush()
+    {
+        if (nOffset == 0)
+            return;
+        vch.push_back(chBuffer);
+        chBuffer = 0;
+        nOffset = 0;
+    }
+};
+
+/** Reads bits from a stream, most significant bit first */
+class CBitReader
+{
+private:
+    CDataStream& ss;
+    unsigned char chBuffer;
+    int nOffset; //!< bits of chBuffer already read
+
+public:
+    explicit CBitReader(CDataStream& ssIn) : ss(ssIn), chBuffer(0), nOffset(8) {}
+
+    //! Read nBits (0..64) bits; throws std::ios_base::failure past the end
+    uint64_t Read(int nBits)
+    {
+        uint64_t nData = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                ss >> chBuffer;
+                nOffset = 0;
+            }
+            int nTake = std::min(8 - nOffset, nBits);
+            nData <<= nTake;
+            nData |= (unsigned char)(chBuffer << nOffset) >> (8 - nTake);
+            nOffset += nTake;
+            nBits -= nTake;
+        }
+        return nData;
+    }
+};
+
+void GolombRiceEncode(CBitWriter& writer, uint8_t nP, uint64_t x)
+{
+    // Quotient in unary, as that many ones and a zero
+    uint64_t q = x >> nP;
+    while (q > 0) {
+        int nBits = q <= 64 ? (int)q : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+
+    // Remainder in nP bits
+    if (nP > 0)
+        writer.Write(x, nP);
+}
+
+uint64_t GolombRiceDecode(CBitReader& reader, uint8_t nP)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    uint64_t r = reader.Read(nP);
+    return (q << nP) + r;
+}
+
+/** High 64 bits of x * y, which maps a uniform x into [0, y) */
+uint64_t MapIntoRange(uint64_t x, uint64_t y)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)y) >> 64);
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t y_hi = y >> 32, y_lo = y & 0xFFFFFFFF;
+    uint64_t ac = x_hi * y_hi;
+    uint64_t ad = x_hi * y_lo;
+    uint64_t bc = x_lo * y_hi;
+    uint64_t bd = x_lo * y_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+} // anon namespace
+
+GCSFilter::GCSFilter(const Params& paramsIn) : params(paramsIn), nElements(0), nRange(0)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, nElements);
+    vchEncoded.assign(ss.begin(), ss.end());
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, const std::vector<unsigned char>& vchEncodedIn)
+    : params(paramsIn), vchEncoded(vchEncodedIn)
+{
+    CDataStream ss(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nCount = ReadCompactSize(ss);
+    if (nCount > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("GCSFilter : element count too large");
+    nElements = nCount;
+    nRange = (uint64_t)nElements * params.nM;
+
+    // Walk the whole bit stream so that a bad filter is caught here
+    CBitReader reader(ss);
+    for (uint32_t i = 0; i < nElements; i++)
+        GolombRiceDecode(reader, params.nP);
+    if (!ss.empty())
+        throw std::ios_base::failure("GCSFilter : excess data after the encoded set");
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, const ElementSet& elements) : params(paramsIn)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("GCSFilter : too many elements");
+    nElements = elements.size();
+    nRange = (uint64_t)nElements * params.nM;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, nElements);
+    vchEncoded.assign(ss.begin(), ss.end());
+
+    CBitWriter writer(vchEncoded);
+    uint64_t nLast = 0;
+    std::vector<uint64_t> vHashed = BuildHashedSet(elements);
+    BOOST_FOREACH (uint64_t nValue, vHashed) {
+        GolombRiceEncode(writer, params.nP, nValue - nLast);
+        nLast = nValue;
+    }
+    writer.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t nHash = CSipHasher(params.nSipHashK0, params.nSipHashK1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(nHash, nRange);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashed;
+    vHashed.reserve(elements.size());
+    BOOST_FOREACH (const Element& element, elements)
+        vHashed.push_back(HashToRange(element));
+    std::sort(vHashed.begin(), vHashed.end());
+    return vHashed;
+}
+
+bool GCSFilter::MatchInternal(const std::vector<uint64_t>& vQueries) const
+{
+    if (nElements == 0 || vQueries.empty())
+        return false;
+
+    CDataStream ss(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(ss);
+    CBitReader reader(ss);
+
+    // Merge the sorted queries with the sorted set as it is decoded
+    uint64_t nValue = 0;
+    size_t nQuery = 0;
+    for (uint32_t i = 0; i < nElements; i++) {
+        nValue += GolombRiceDecode(reader, params.nP);
+        while (vQueries[nQuery] < nValue) {
+            if (++nQuery == vQueries.size())
+                return false;
+        }
+        if (vQueries[nQuery] == nValue)
+            return true;
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    std::vector<uint64_t> vQueries(1, HashToRange(element));
+    return MatchInternal(vQueries);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    return MatchInternal(BuildHashedSet(elements));
+}
+
+CBlockFilter::CBlockFilter(const uint256& hashBlockIn, const std::vector<unsigned char>& vchEncoded)
+    : hashBlock(hashBlockIn), filter(GetParams(hashBlockIn), vchEncoded)
+{
+}
+
+CBlockFilter::CBlockFilter(const CBlock& block, const CBlockUndo& blockundo)
+    : hashBlock(block.GetHash()), filter(GetParams(hashBlock), GetElements(block, blockundo))
+{
+}
+
+GCSFilter::Params CBlockFilter::GetParams(const uint256& hashBlock)
+{
+    return GCSFilter::Params(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8), BLOCK_FILTER_P, BLOCK_FILTER_M);
+}
+
+GCSFilter::ElementSet CBlockFilter::GetElements(const CBlock& block, const CBlockUndo& blockundo)
+{
+    GCSFilter::ElementSet elements;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH (const CTxOut& txout, tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            // Coinbase and coinstake markers are empty; OP_RETURN data cannot be spent
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    BOOST_FOREACH (const CTxUndo& txundo, blockundo.vtxundo) {
+        BOOST_FOREACH (const CTxInUndo& undo, txundo.vprevout) {
+            const CScript& script = undo.txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    return elements;
+}
+
+uint256 CBlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vchEncoded = filter.GetEncoded();
+    return Hash(vchEncoded.begin(), vchEncoded.end());
+}
+
+uint256 CBlockFilter::ComputeHeader(const uint256& hashPrevHeader) const
+{
+    uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
+
+bool GetBlockFilter(const uint256& hashBlock, CBlockFilterEntry& entry)
+{
+    return pblocktree->ReadBlockFilter(hashBlock, entry);
+}
+
+/** Index filter, the filter of pindex, after the filter of its parent */
+static bool WriteBlockFilter(const CBlockFilter& filter, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    CBlockFilterEntry entry;
+    entry.vchFilter = filter.GetEncoded();
+    if (pindex->pprev) {
+        CBlockFilterEntry entryPrev;
+        if (!GetBlockFilter(pindex->pprev->GetBlockHash(), entryPrev))
+            return error("%s : no filter for block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+        entry.hashHeader = filter.ComputeHeader(entryPrev.hashHeader);
+    } else {
+        entry.hashHeader = filter.ComputeHeader(uint256(0));
+    }
+    if (!pblocktree->WriteBlockFilter(pindex->GetBlockHash(), entry))
+        return error("%s : failed to write the filter of block %s", __func__, pindex->GetBlockHash().ToString());
+    pindexFilterBest = pindex;
+    return true;
+}
+
+bool BlockFilterIndexConnect(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (!pindexFilterBest || pindex->pprev != pindexFilterBest)
+        return true;
+    return WriteBlockFilter(CBlockFilter(block, blockundo), pindex);
+}
+
+void BlockFilterIndexDisconnect(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    // The filters of the disconnected blocks stay, they are valid whenever the blocks are
+    if (pindexFilterBest == pindex)
+        pindexFilterBest = pindex->pprev;
+}
+
+const CBlockIndex* GetBlockFilterIndexBest()
+{
+    AssertLockHeld(cs_main);
+    return pindexFilterBest;
+}
+
+/**
+ * A filter is only written after the filter of its parent, so the indexed
+ * blocks of the active chain run from the genesis block up to some height.
+ * Blocks of other chains may be indexed too, which does not matter here.
+ */
+static const CBlockIndex* FindBlockFilterIndexBest()
+{
+    AssertLockHeld(cs_main);
+    CBlockFilterEntry entry;
+    if (!chainActive.Genesis() || !GetBlockFilter(chainActive.Genesis()->GetBlockHash(), entry))
+        return NULL;
+
+    // Blocks below nLow are indexed, blocks from nHigh on are not
+    int nLow = 1, nHigh = chainActive.Height() + 1;
+    while (nLow < nHigh) {
+        int nMid = nLow + (nHigh - nLow) / 2;
+        if (GetBlockFilter(chainActive[nMid]->GetBlockHash(), entry))
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+    return chainActive[nLow - 1];
+}
+
+void ThreadBlockFilterIndex()
+{
+    RenameThread("bare-filterindex");
+    {
+        LOCK(cs_main);
+        pindexFilterBest = FindBlockFilterIndexBest();
+        LogPrintf("Block filter index at height %d, active chain at %d\n", pindexFilterBest ? pindexFilterBest->nHeight : -1, chainActive.Height());
+    }
+
+    int64_t nNow = GetTime();
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindex;
+        CDiskBlockPos posBlock, posUndo;
+        {
+            LOCK(cs_main);
+            pindex = pindexFilterBest ? chainActive.Next(pindexFilterBest) : chainActive.Genesis();
+            if (!pindex) {
+                // From here on ConnectBlock extends the index
+                LogPrintf("Block filter index is up to date at height %d\n", pindexFilterBest ? pindexFilterBest->nHeight : -1);
+                return;
+            }
+            posBlock = pindex->GetBlockPos();
+            posUndo = pindex->GetUndoPos();
+        }
+
+        // Read without cs_main, the node keeps connecting blocks meanwhile
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, posBlock) || block.GetHash() != pindex->GetBlockHash()) {
+            LogPrintf("%s : failed to read block %s, index stopped\n", __func__, pindex->GetBlockHash().ToString());
+            return;
+        }
+        if (pindex->pprev && (posUndo.IsNull() || !blockundo.ReadFromDisk(posUndo, pindex->pprev->GetBlockHash()))) {
+            LogPrintf("%s : failed to read undo data of block %s, index stopped\n", __func__, pindex->GetBlockHash().ToString());
+            return;
+        }
+        CBlockFilter filter(block, blockundo);
+
+        LOCK(cs_main);
+        // The chain moved while the block was read; look again
+        if (pindex->pprev != pindexFilterBest || !chainActive.Contains(pindex))
+            continue;
+        if (!WriteBlockFilter(filter, pindex)) {
+            LogPrintf("%s : index stopped\n", __func__);
+            return;
+        }
+        if (GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Indexing block filters... at height %d of %d\n", pindex->nHeight, chainActive.Height());
+        }
+    }
+}
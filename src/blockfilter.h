@@ -0,0 +1,141 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Golomb-Rice parameter of the basic block filter (BIP 158) */
+static const uint8_t BLOCK_FILTER_P = 19;
+/** Inverse false positive rate of the basic block filter (BIP 158) */
+static const uint32_t BLOCK_FILTER_M = 784931;
+
+extern bool fBlockFilterIndex;
+
+/**
+ * Golomb-coded set: a compact probabilistic set of byte strings. Elements are
+ * hashed with SipHash into [0, N * M), sorted, and the differences between
+ * neighbours written as Golomb-Rice codes with parameter P. A query for an
+ * element that was not added matches with probability 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    struct Params {
+        uint64_t nSipHashK0;
+        uint64_t nSipHashK1;
+        uint8_t nP;
+        uint32_t nM;
+
+        Params(uint64_t nSipHashK0In = 0, uint64_t nSipHashK1In = 0, uint8_t nPIn = 0, uint32_t nMIn = 1)
+            : nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn), nM(nMIn) {}
+    };
+
+private:
+    Params params;
+    uint32_t nElements;
+    uint64_t nRange; //!< nElements * nM
+    std::vector<unsigned char> vchEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    //! Whether any of the sorted hashed values is in the set
+    bool MatchInternal(const std::vector<uint64_t>& vQueries) const;
+
+public:
+    explicit GCSFilter(const Params& paramsIn = Params());
+    //! Wrap an encoded filter; throws std::ios_base::failure if it does not decode
+    GCSFilter(const Params& paramsIn, const std::vector<unsigned char>& vchEncodedIn);
+    GCSFilter(const Params& paramsIn, const ElementSet& elements);
+
+    uint32_t GetN() const { return nElements; }
+    const Params& GetParams() const { return params; }
+    //! Element count as CompactSize followed by the Golomb-Rice bit stream
+    const std::vector<unsigned char>& GetEncoded() const { return vchEncoded; }
+
+    bool Match(const Element& element) const;
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+/**
+ * The basic filter of a block (BIP 158): every non-empty output script that is
+ * not OP_RETURN, and the scripts of the outputs the block spends, keyed with
+ * the block hash.
+ */
+class CBlockFilter
+{
+private:
+    uint256 hashBlock;
+    GCSFilter filter;
+
+public:
+    CBlockFilter() {}
+    //! Filter of a block already received as encoded bytes
+    CBlockFilter(const uint256& hashBlockIn, const std::vector<unsigned char>& vchEncoded);
+    //! blockundo holds the spent outputs; empty for the genesis block
+    CBlockFilter(const CBlock& block, const CBlockUndo& blockundo);
+
+    static GCSFilter::Params GetParams(const uint256& hashBlock);
+    static GCSFilter::ElementSet GetElements(const CBlock& block, const CBlockUndo& blockundo);
+
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncoded() const { return filter.GetEncoded(); }
+
+    //! Double SHA256 of the encoded filter
+    uint256 GetHash() const;
+    //! Commits to the filter and to all the filters before it
+    uint256 ComputeHeader(const uint256& hashPrevHeader) const;
+};
+
+/** A block filter as kept in the block tree database, keyed by block hash */
+struct CBlockFilterEntry {
+    std::vector<unsigned char> vchFilter;
+    uint256 hashHeader;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(vchFilter);
+        READWRITE(hashHeader);
+    }
+};
+
+/** Filter of a block on any chain, if it was indexed */
+bool GetBlockFilter(const uint256& hashBlock, CBlockFilterEntry& entry);
+
+/**
+ * Index the filter of a block ConnectBlock is connecting, when the index has
+ * reached its parent; otherwise ThreadBlockFilterIndex will get to it. Only
+ * false if the database write fails. Requires cs_main.
+ */
+bool BlockFilterIndexConnect(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex);
+
+/** Step the index back when the active chain drops pindex. Requires cs_main. */
+void BlockFilterIndexDisconnect(const CBlockIndex* pindex);
+
+/** Last block of the active chain that the index covers, and all its ancestors; NULL if none. Requires cs_main. */
+const CBlockIndex* GetBlockFilterIndexBest();
+
+/** Index the filters of the active chain up to the tip, then leave it to BlockFilterIndexConnect */
+void ThreadBlockFilterIndex();
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -161,6 +161,7 @@ public:
     uint256 GetBlockTrust() const;
     uint64_t nStakeModifier;             // hash modifier for proof-of-stake
     unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
+    const CBlockIndex* pindexKernelModifier; // block providing the kernel stake modifier for coins from this block; in-memory only
     COutPoint prevoutStake;
     unsigned int nStakeTime;
     uint256 hashProofOfStake;
@@ -197,6 +198,7 @@ public:
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
+        pindexKernelModifier = NULL;
         prevoutStake.SetNull();
         nStakeTime = 0;
 
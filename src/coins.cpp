@@ -5,149 +5,273 @@
 
 #include "coins.h"
 
+#include "clientversion.h"
+#include "primitives/block.h"
 #include "random.h"
+#include "streams.h"
+#include "version.h"
 
 #include <assert.h>
 
-/**
- * calculate number of bytes for the bitmask, and its number of non-zero bytes
- * each bit in the bitmask represents the availability of one output, but the
- * availabilities of the first two outputs are encoded separately
- */
-void CCoins::CalcMaskSize(unsigned int& nBytes, unsigned int& nNonzeroBytes) const
-{
-    unsigned int nLastUsedByte = 0;
-    for (unsigned int b = 0; 2 + b * 8 < vout.size(); b++) {
-        bool fZero = true;
-        for (unsigned int i = 0; i < 8 && 2 + b * 8 + i < vout.size(); i++) {
-            if (!vout[2 + b * 8 + i].IsNull()) {
-                fZero = false;
-                continue;
-            }
-        }
-        if (!fZero) {
-            nLastUsedByte = b + 1;
-            nNonzeroBytes++;
+SaltedOutpointHasher::SaltedOutpointHasher() : salt(GetRandHash()) {}
+
+const uint32_t CCoinsMap::CHUNK_SIZE;
+const uint32_t CCoinsMap::EMPTY;
+
+CCoinsMap::CCoinsMap() : nEntries(0), nSize(0) {}
+
+CCoinsMap::~CCoinsMap()
+{
+    clear();
+}
+
+size_t CCoinsMap::Probe(const COutPoint& key) const
+{
+    size_t nMask = vIndex.size() - 1;
+    size_t i = Bucket(key);
+    while (vIndex[i] != EMPTY && Entry(vIndex[i] - 1)->first != key)
+        i = (i + 1) & nMask;
+    return i;
+}
+
+void CCoinsMap::Rehash(size_t nBuckets)
+{
+    std::vector<uint32_t> vNewIndex(nBuckets, EMPTY);
+    vIndex.swap(vNewIndex);
+    for (uint32_t nPos = 0; nPos < nEntries; nPos++) {
+        if (vUsed[nPos])
+            vIndex[Probe(Entry(nPos)->first)] = nPos + 1;
+    }
+}
+
+uint32_t CCoinsMap::Allocate()
+{
+    if (!vFree.empty()) {
+        uint32_t nPos = vFree.back();
+        vFree.pop_back();
+        return nPos;
+    }
+    if (nEntries % CHUNK_SIZE == 0)
+        vChunks.push_back(new storage_type[CHUNK_SIZE]);
+    vUsed.push_back(0);
+    return nEntries++;
+}
+
+CCoinsMap::iterator CCoinsMap::begin() const
+{
+    uint32_t nPos = 0;
+    while (nPos < nEntries && !vUsed[nPos])
+        nPos++;
+    return iterator(this, nPos);
+}
+
+CCoinsMap::iterator CCoinsMap::find(const COutPoint& key) const
+{
+    if (nSize == 0)
+        return end();
+    size_t i = Probe(key);
+    if (vIndex[i] == EMPTY)
+        return end();
+    return iterator(this, vIndex[i] - 1);
+}
+
+std::pair<CCoinsMap::iterator, bool> CCoinsMap::emplace(const COutPoint& key, const CCoinsCacheEntry& entry)
+{
+    // Keep the load factor at or below 3/4
+    if ((nSize + 1) * 4 > vIndex.size() * 3)
+        Rehash(std::max((size_t)16, vIndex.size() * 2));
+
+    size_t i = Probe(key);
+    if (vIndex[i] != EMPTY)
+        return std::make_pair(iterator(this, vIndex[i] - 1), false);
+
+    uint32_t nPos = Allocate();
+    new (Entry(nPos)) value_type(key, entry);
+    vUsed[nPos] = 1;
+    vIndex[i] = nPos + 1;
+    nSize++;
+    return std::make_pair(iterator(this, nPos), true);
+}
+
+void CCoinsMap::erase(iterator it)
+{
+    assert(it.map == this && it.nPos < nEntries && vUsed[it.nPos]);
+    size_t nMask = vIndex.size() - 1;
+    size_t i = Probe(Entry(it.nPos)->first);
+    assert(vIndex[i] == it.nPos + 1);
+
+    // Backward shift deletion: pull later members of the probe run into
+    // the hole, so that lookups never need tombstones
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & nMask;
+        if (vIndex[j] == EMPTY)
+            break;
+        size_t k = Bucket(Entry(vIndex[j] - 1)->first);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            vIndex[i] = vIndex[j];
+            i = j;
         }
     }
-    nBytes += nLastUsedByte;
+    vIndex[i] = EMPTY;
+
+    Entry(it.nPos)->~value_type();
+    vUsed[it.nPos] = 0;
+    vFree.push_back(it.nPos);
+    nSize--;
 }
 
-bool CCoins::Spend(const COutPoint& out, CTxInUndo& undo)
+void CCoinsMap::clear()
 {
-    if (out.n >= vout.size())
-        return false;
-    if (vout[out.n].IsNull())
-        return false;
-    undo = CTxInUndo(vout[out.n]);
-    vout[out.n].SetNull();
-    Cleanup();
-    if (vout.size() == 0) {
-        undo.nHeight = nHeight;
-        undo.fCoinBase = fCoinBase;
-        undo.fCoinStake = fCoinStake;
-        undo.nVersion = this->nVersion;
+    for (uint32_t nPos = 0; nPos < nEntries; nPos++) {
+        if (vUsed[nPos])
+            Entry(nPos)->~value_type();
     }
-    return true;
+    for (size_t i = 0; i < vChunks.size(); i++)
+        delete[] vChunks[i];
+    std::vector<storage_type*>().swap(vChunks);
+    std::vector<uint32_t>().swap(vIndex);
+    std::vector<unsigned char>().swap(vUsed);
+    std::vector<uint32_t>().swap(vFree);
+    nEntries = 0;
+    nSize = 0;
 }
 
-bool CCoins::Spend(int nPos)
+size_t CCoinsMap::DynamicMemoryUsage() const
 {
-    CTxInUndo undo;
-    COutPoint out(0, nPos);
-    return Spend(out, undo);
+    return memusage::DynamicUsage(vIndex) + memusage::DynamicUsage(vChunks) +
+           vChunks.size() * memusage::MallocUsage(sizeof(storage_type) * CHUNK_SIZE) +
+           memusage::DynamicUsage(vUsed) + memusage::DynamicUsage(vFree);
 }
 
 
-bool CCoinsView::GetCoins(const uint256& txid, CCoins& coins) const { return false; }
-bool CCoinsView::HaveCoins(const uint256& txid) const { return false; }
+bool CCoinsView::GetCoin(const COutPoint& outpoint, Coin& coin) const { return false; }
+bool CCoinsView::HaveCoin(const COutPoint& outpoint) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(0); }
 bool CCoinsView::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return false; }
 bool CCoinsView::GetStats(CCoinsStats& stats) const { return false; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView* viewIn) : base(viewIn) {}
-bool CCoinsViewBacked::GetCoins(const uint256& txid, CCoins& coins) const { return base->GetCoins(txid, coins); }
-bool CCoinsViewBacked::HaveCoins(const uint256& txid) const { return base->HaveCoins(txid); }
+bool CCoinsViewBacked::GetCoin(const COutPoint& outpoint, Coin& coin) const { return base->GetCoin(outpoint, coin); }
+bool CCoinsViewBacked::HaveCoin(const COutPoint& outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
 bool CCoinsViewBacked::GetStats(CCoinsStats& stats) const { return base->GetStats(stats); }
 
-CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hashBlock(0), cachedCoinsUsage(0) {}
 
-CCoinsViewCache::~CCoinsViewCache()
+size_t CCoinsViewCache::DynamicMemoryUsage() const
 {
-    assert(!hasModifier);
+    return cacheCoins.DynamicMemoryUsage() + cachedCoinsUsage;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256& txid) const
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint& outpoint) const
 {
-    CCoinsMap::iterator it = cacheCoins.find(txid);
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
     if (it != cacheCoins.end())
         return it;
-    CCoins tmp;
-    if (!base->GetCoins(txid, tmp))
+    Coin tmp;
+    if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
-    tmp.swap(ret->second.coins);
-    if (ret->second.coins.IsPruned()) {
-        // The parent only has an empty entry for this txid; we can consider our
+    CCoinsMap::iterator ret = cacheCoins.emplace(outpoint, CCoinsCacheEntry()).first;
+    ret->second.coin.swap(tmp);
+    if (ret->second.coin.IsSpent()) {
+        // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
+    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
     return ret;
 }
 
-bool CCoinsViewCache::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewCache::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coins = it->second.coins;
-        return true;
+        coin = it->second.coin;
+        return !coin.IsSpent();
     }
     return false;
 }
 
-CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256& txid)
+void CCoinsViewCache::AddCoin(const COutPoint& outpoint, const Coin& coin, bool possible_overwrite)
 {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    if (ret.second) {
-        if (!base->GetCoins(txid, ret.first->second.coins)) {
-            // The parent view does not have this entry; mark it as fresh.
-            ret.first->second.coins.Clear();
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        } else if (ret.first->second.coins.IsPruned()) {
-            // The parent view only has a pruned entry for this; mark it as fresh.
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    assert(!coin.IsSpent());
+    if (coin.out.scriptPubKey.IsUnspendable())
+        return;
+    std::pair<CCoinsMap::iterator, bool> inserted = cacheCoins.emplace(outpoint, CCoinsCacheEntry());
+    CCoinsMap::iterator it = inserted.first;
+    bool fresh = false;
+    if (!inserted.second) {
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    }
+    if (!possible_overwrite) {
+        if (!it->second.coin.IsSpent()) {
+            throw std::logic_error("Adding new coin that replaces non-pruned entry");
         }
+        fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
+    }
+    it->second.coin = coin;
+    it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+}
+
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool check)
+{
+    bool fCoinbase = tx.IsCoinBase();
+    bool fCoinstake = tx.IsCoinStake();
+    const uint256& txid = tx.GetHash();
+    for (size_t i = 0; i < tx.vout.size(); ++i) {
+        bool overwrite = check ? cache.HaveCoin(COutPoint(txid, i)) : fCoinbase;
+        // Always set the possible_overwrite flag to AddCoin for coinbase txn, in order to correctly
+        // deal with the pre-BIP30 occurrences of duplicate coinbase transactions.
+        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase, fCoinstake), overwrite);
+    }
+}
+
+bool CCoinsViewCache::SpendCoin(const COutPoint& outpoint, Coin* moveout)
+{
+    CCoinsMap::iterator it = FetchCoin(outpoint);
+    if (it == cacheCoins.end())
+        return false;
+    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (moveout) {
+        *moveout = it->second.coin;
     }
-    // Assume that whenever ModifyCoins is called, the entry will be modified.
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first);
+    if (it->second.flags & CCoinsCacheEntry::FRESH) {
+        cacheCoins.erase(it);
+    } else {
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        it->second.coin.Clear();
+    }
+    return true;
 }
 
-const CCoins* CCoinsViewCache::AccessCoins(const uint256& txid) const
+static const Coin coinEmpty;
+
+const Coin& CCoinsViewCache::AccessCoin(const COutPoint& outpoint) const
 {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
-        return NULL;
+        return coinEmpty;
     } else {
-        return &it->second.coins;
+        return it->second.coin;
     }
 }
 
-bool CCoinsViewCache::HaveCoins(const uint256& txid) const
+bool CCoinsViewCache::HaveCoin(const COutPoint& outpoint) const
+{
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+}
+
+bool CCoinsViewCache::HaveCoinInCache(const COutPoint& outpoint) const
 {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    // We're using vtx.empty() instead of IsPruned here for performance reasons,
-    // as we only care about the case where a transaction was replaced entirely
-    // in a reorganization (which wipes vout entirely, as opposed to spending
-    // which just cleans individual outputs).
-    return (it != cacheCoins.end() && !it->second.coins.vout.empty());
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const
@@ -164,31 +288,52 @@ void CCoinsViewCache::SetBestBlock(const uint256& hashBlockIn)
 
 bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn)
 {
-    assert(!hasModifier);
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    CCoinsMap::iterator it = mapCoins.begin();
+    while (it != mapCoins.end()) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
-                if (!it->second.coins.IsPruned()) {
-                    // The parent cache does not have an entry, while the child
-                    // cache does have (a non-pruned) one. Move the data up, and
-                    // mark it as fresh (if the grandparent did have it, we
-                    // would have pulled it in at first GetCoins).
-                    assert(it->second.flags & CCoinsCacheEntry::FRESH);
-                    CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
-                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                // The parent cache does not have an entry, while the child does
+                // We can ignore it if it's both FRESH and pruned in the child
+                if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin.IsSpent())) {
+                    // Otherwise we will need to create it in the parent
+                    // and move the data up and mark it as dirty
+                    CCoinsCacheEntry& entry = cacheCoins.emplace(it->first, CCoinsCacheEntry()).first->second;
+                    entry.coin.swap(it->second.coin);
+                    cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+                    entry.flags = CCoinsCacheEntry::DIRTY;
+                    // We can mark it FRESH in the parent if it was FRESH in the child
+                    // Otherwise it might have just been flushed from the parent's cache
+                    // and already exist in the grandparent
+                    if (it->second.flags & CCoinsCacheEntry::FRESH)
+                        entry.flags |= CCoinsCacheEntry::FRESH;
                 }
             } else {
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+                // Assert that the child cache entry was not marked FRESH if the
+                // parent cache entry has unspent outputs. If this ever happens,
+                // it means the FRESH flag was misapplied and there is a logic
+                // error in the calling code.
+                if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin.IsSpent())
+                    throw std::logic_error("FRESH flag misapplied to cache entry for base transaction with spendable outputs");
+
+                // Found the entry in the parent cache
+                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent()) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    itUs->second.coins.swap(it->second.coins);
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                    itUs->second.coin.swap(it->second.coin);
+                    cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    // NOTE: It is possible the child has a FRESH flag here in
+                    // the event the entry we found in the parent is pruned. But
+                    // we must not copy that FRESH flag to the parent as that
+                    // pruned state likely still needs to be communicated to the
+                    // grandparent.
                 }
             }
         }
@@ -203,9 +348,19 @@ bool CCoinsViewCache::Flush()
 {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    cachedCoinsUsage = 0;
     return fOk;
 }
 
+void CCoinsViewCache::Uncache(const COutPoint& outpoint)
+{
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end() && it->second.flags == 0) {
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        cacheCoins.erase(it);
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const
 {
     return cacheCoins.size();
@@ -213,9 +368,9 @@ unsigned int CCoinsViewCache::GetCacheSize() const
 
 const CTxOut& CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
-    const CCoins* coins = AccessCoins(input.prevout.hash);
-    assert(coins && coins->IsAvailable(input.prevout.n));
-    return coins->vout[input.prevout.n];
+    const Coin& coin = AccessCoin(input.prevout);
+    assert(!coin.IsSpent());
+    return coin.out;
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
@@ -234,9 +389,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            const COutPoint& prevout = tx.vin[i].prevout;
-            const CCoins* coins = AccessCoins(prevout.hash);
-            if (!coins || !coins->IsAvailable(prevout.n)) {
+            if (!HaveCoin(tx.vin[i].prevout)) {
                 return false;
             }
         }
@@ -250,28 +403,67 @@ double CCoinsViewCache::GetPriority(const CTransaction& tx, int nHeight) const
         return 0.0;
     double dResult = 0.0;
     for (const CTxIn& txin:  tx.vin) {
-        const CCoins* coins = AccessCoins(txin.prevout.hash);
-        assert(coins);
-        if (!coins->IsAvailable(txin.prevout.n)) continue;
-        if (coins->nHeight < nHeight) {
-            dResult += coins->vout[txin.prevout.n].nValue * (nHeight - coins->nHeight); // value * age
+        const Coin& coin = AccessCoin(txin.prevout);
+        if (coin.IsSpent()) continue;
+        if (coin.nHeight < (uint32_t)nHeight) {
+            dResult += coin.out.nValue * (nHeight - coin.nHeight); // value * age
         }
     }
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_)
+static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_SIZE_CURRENT / ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
+
+const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
 {
-    assert(!cache.hasModifier);
-    cache.hasModifier = true;
+    COutPoint iter(txid, 0);
+    while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
+        const Coin& alternate = view.AccessCoin(iter);
+        if (!alternate.IsSpent()) return alternate;
+        ++iter.n;
+    }
+    return coinEmpty;
 }
 
-CCoinsModifier::~CCoinsModifier()
+static void WriteUTXOStatsElement(CDataStream& ss, const COutPoint& outpoint, const Coin& coin)
 {
-    assert(cache.hasModifier);
-    cache.hasModifier = false;
-    it->second.coins.Cleanup();
-    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 4 + (coin.fCoinStake ? 2 : 0) + (coin.fCoinBase ? 1 : 0));
+    ss << coin.out;
+}
+
+void CUTXOStats::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    if (coin.out.scriptPubKey.IsUnspendable()) {
+        totals.nTotalUnspendable += coin.out.nValue;
+        return;
+    }
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    WriteUTXOStatsElement(ss, outpoint, coin);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    totals.nTransactionOutputs++;
+    totals.nSerializedSize += 32 + ::GetSerializeSize(coin, SER_DISK, CLIENT_VERSION);
+    totals.nTotalAmount += coin.out.nValue;
+}
+
+void CUTXOStats::RemoveCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    if (coin.out.scriptPubKey.IsUnspendable()) {
+        totals.nTotalUnspendable -= coin.out.nValue;
+        return;
     }
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    WriteUTXOStatsElement(ss, outpoint, coin);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+    totals.nTransactionOutputs--;
+    totals.nSerializedSize -= 32 + ::GetSerializeSize(coin, SER_DISK, CLIENT_VERSION);
+    totals.nTotalAmount -= coin.out.nValue;
+}
+
+uint256 CUTXOStats::GetHash() const
+{
+    MuHash3072 tmp = muhash;
+    uint256 hash;
+    tmp.Finalize(hash.begin());
+    return hash;
 }
@@ -7,6 +7,9 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "crypto/muhash.h"
+#include "memusage.h"
+#include "primitives/transaction.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -15,308 +18,361 @@
 #include <assert.h>
 #include <stdint.h>
 
-#include <boost/foreach.hpp>
-#include <boost/unordered_map.hpp>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-/** 
-
-    ****Note - for BARE we added fCoinStake to the 2nd bit. Keep in mind when reading the following and adjust as needed.
- * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
+/**
+ * A UTXO entry.
  *
  * Serialized format:
- * - VARINT(nVersion)
- * - VARINT(nCode)
- * - unspentness bitvector, for vout[2] and further; least significant byte first
- * - the non-spent CTxOuts (via CTxOutCompressor)
- * - VARINT(nHeight)
- *
- * The nCode value consists of:
- * - bit 1: IsCoinBase()
- * - bit 2: vout[0] is not spent
- * - bit 4: vout[1] is not spent
- * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
- *   - In case both bit 2 and bit 4 are unset, they encode N-1, as there must be at
- *     least one non-spent output).
- *
- * Example: 0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e
- *          <><><--------------------------------------------><---->
- *          |  \                  |                             /
- *    version   code             vout[1]                  height
- *
- *    - version = 1
- *    - code = 4 (vout[1] is not spent, and 0 non-zero bytes of bitvector follow)
- *    - unspentness bitvector: as 0 non-zero bytes follow, it has length 0
- *    - vout[1]: 835800816115944e077fe7c803cfa57f29b36bf87c1d35
- *               * 8358: compact amount representation for 60000000000 (600 BTC)
- *               * 00: special txout type pay-to-pubkey-hash
- *               * 816115944e077fe7c803cfa57f29b36bf87c1d35: address uint160
- *    - height = 203998
- *
- *
- * Example: 0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b
- *          <><><--><--------------------------------------------------><----------------------------------------------><---->
- *         /  \   \                     |                                                           |                     /
- *  version  code  unspentness       vout[4]                                                     vout[16]           height
- *
- *  - version = 1
- *  - code = 9 (coinbase, neither vout[0] or vout[1] are unspent, 2 (1, +1 because both bit 2 and bit 4 are unset) non-zero bitvector bytes follow)
- *  - unspentness bitvector: bits 2 (0x04) and 14 (0x4000) are set, so vout[2+2] and vout[14+2] are unspent
- *  - vout[4]: 86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee
- *             * 86ef97d579: compact amount representation for 234925952 (2.35 BTC)
- *             * 00: special txout type pay-to-pubkey-hash
- *             * 61b01caab50f1b8e9c50a5057eb43c2d9563a4ee: address uint160
- *  - vout[16]: bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4
- *              * bbd123: compact amount representation for 110397 (0.001 BTC)
- *              * 00: special txout type pay-to-pubkey-hash
- *              * 8c988f1a4a4de2161e0f50aac7f17e7f9555caa4: address uint160
- *  - height = 120891
+ * - VARINT((nHeight << 2) + (fCoinStake << 1) + fCoinBase)
+ * - the non-spent CTxOut (via CTxOutCompressor)
  */
-class CCoins
+class Coin
 {
 public:
-    //! whether transaction is a coinbase
-    bool fCoinBase;
-    bool fCoinStake;
+    //! unspent transaction output
+    CTxOut out;
 
-    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
-    std::vector<CTxOut> vout;
+    //! whether containing transaction was a coinbase
+    unsigned int fCoinBase : 1;
 
-    //! at which height this transaction was included in the active block chain
-    int nHeight;
+    //! whether containing transaction was a coinstake
+    unsigned int fCoinStake : 1;
 
-    //! version of the CTransaction; accesses to this value should probably check for nHeight as well,
-    //! as new tx version will probably only be introduced at certain heights
-    int nVersion;
+    //! at which height this containing transaction was included in the active block chain
+    uint32_t nHeight : 30;
 
-    void FromTx(const CTransaction& tx, int nHeightIn)
-    {
-        fCoinBase = tx.IsCoinBase();
-        fCoinStake = tx.IsCoinStake();
-        vout = tx.vout;
-        nHeight = nHeightIn;
-        nVersion = tx.nVersion;
-        ClearUnspendable();
-    }
+    //! construct a Coin from a CTxOut and height/coinbase/coinstake information.
+    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn) : out(outIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn) {}
 
-    //! construct a CCoins from a CTransaction, at a given height
-    CCoins(const CTransaction& tx, int nHeightIn)
-    {
-        FromTx(tx, nHeightIn);
-    }
+    //! empty constructor
+    Coin() : fCoinBase(false), fCoinStake(false), nHeight(0) {}
 
     void Clear()
     {
+        out.SetNull();
         fCoinBase = false;
         fCoinStake = false;
-        std::vector<CTxOut>().swap(vout);
         nHeight = 0;
-        nVersion = 0;
     }
 
-    //! empty constructor
-    CCoins() : fCoinBase(false), fCoinStake(false), vout(0), nHeight(0), nVersion(0) {}
-
-    //!remove spent outputs at the end of vout
-    void Cleanup()
+    bool IsCoinBase() const
     {
-        while (vout.size() > 0 && vout.back().IsNull())
-            vout.pop_back();
-        if (vout.empty())
-            std::vector<CTxOut>().swap(vout);
+        return fCoinBase;
     }
 
-    void ClearUnspendable()
+    bool IsCoinStake() const
     {
-        BOOST_FOREACH (CTxOut& txout, vout) {
-            if (txout.scriptPubKey.IsUnspendable())
-                txout.SetNull();
-        }
-        Cleanup();
+        return fCoinStake;
     }
 
-    void swap(CCoins& to)
+    //! Either the coin was never added to the set or it has been spent
+    bool IsSpent() const
     {
-        std::swap(to.fCoinBase, fCoinBase);
-        std::swap(to.fCoinStake, fCoinStake);
-        to.vout.swap(vout);
-        std::swap(to.nHeight, nHeight);
-        std::swap(to.nVersion, nVersion);
+        return out.IsNull();
     }
 
-    //! equality test
-    friend bool operator==(const CCoins& a, const CCoins& b)
+    friend bool operator==(const Coin& a, const Coin& b)
     {
-        // Empty CCoins objects are always equal.
-        if (a.IsPruned() && b.IsPruned())
+        // Spent coins are always equal.
+        if (a.IsSpent() && b.IsSpent())
             return true;
         return a.fCoinBase == b.fCoinBase &&
                a.fCoinStake == b.fCoinStake &&
                a.nHeight == b.nHeight &&
-               a.nVersion == b.nVersion &&
-               a.vout == b.vout;
+               a.out == b.out;
     }
-    friend bool operator!=(const CCoins& a, const CCoins& b)
+    friend bool operator!=(const Coin& a, const Coin& b)
     {
         return !(a == b);
     }
 
-    void CalcMaskSize(unsigned int& nBytes, unsigned int& nNonzeroBytes) const;
-
-    bool IsCoinBase() const
+    void swap(Coin& to)
     {
-        return fCoinBase;
-    }
-
-    bool IsCoinStake() const
-    {
-        return fCoinStake;
+        std::swap(to.out, out);
+        bool fTmp = to.fCoinBase;
+        to.fCoinBase = fCoinBase;
+        fCoinBase = fTmp;
+        fTmp = to.fCoinStake;
+        to.fCoinStake = fCoinStake;
+        fCoinStake = fTmp;
+        uint32_t nTmp = to.nHeight;
+        to.nHeight = nHeight;
+        nHeight = nTmp;
     }
 
     unsigned int GetSerializeSize(int nType, int nVersion) const
     {
-        unsigned int nSize = 0;
-        unsigned int nMaskSize = 0, nMaskCode = 0;
-        CalcMaskSize(nMaskSize, nMaskCode);
-        bool fFirst = vout.size() > 0 && !vout[0].IsNull();
-        bool fSecond = vout.size() > 1 && !vout[1].IsNull();
-        assert(fFirst || fSecond || nMaskCode);
-        unsigned int nCode = 8 * (nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) + (fCoinStake ? 2 : 0) + (fFirst ? 4 : 0) + (fSecond ? 8 : 0);
-        // version
-        nSize += ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion);
-        // size of header code
-        nSize += ::GetSerializeSize(VARINT(nCode), nType, nVersion);
-        // spentness bitmask
-        nSize += nMaskSize;
-        // txouts themself
-        for (unsigned int i = 0; i < vout.size(); i++)
-            if (!vout[i].IsNull())
-                nSize += ::GetSerializeSize(CTxOutCompressor(REF(vout[i])), nType, nVersion);
-        // height
-        nSize += ::GetSerializeSize(VARINT(nHeight), nType, nVersion);
-        return nSize;
+        assert(!IsSpent());
+        uint32_t nCode = nHeight * 4 + (fCoinStake ? 2 : 0) + (fCoinBase ? 1 : 0);
+        return ::GetSerializeSize(VARINT(nCode), nType, nVersion) +
+               ::GetSerializeSize(CTxOutCompressor(REF(out)), nType, nVersion);
     }
 
     template <typename Stream>
     void Serialize(Stream& s, int nType, int nVersion) const
     {
-        unsigned int nMaskSize = 0, nMaskCode = 0;
-        CalcMaskSize(nMaskSize, nMaskCode);
-        bool fFirst = vout.size() > 0 && !vout[0].IsNull();
-        bool fSecond = vout.size() > 1 && !vout[1].IsNull();
-        assert(fFirst || fSecond || nMaskCode);
-        unsigned int nCode = 16 * (nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) + (fCoinStake ? 2 : 0) + (fFirst ? 4 : 0) + (fSecond ? 8 : 0);
-        // version
-        ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
-        // header code
+        assert(!IsSpent());
+        uint32_t nCode = nHeight * 4 + (fCoinStake ? 2 : 0) + (fCoinBase ? 1 : 0);
         ::Serialize(s, VARINT(nCode), nType, nVersion);
-        // spentness bitmask
-        for (unsigned int b = 0; b < nMaskSize; b++) {
-            unsigned char chAvail = 0;
-            for (unsigned int i = 0; i < 8 && 2 + b * 8 + i < vout.size(); i++)
-                if (!vout[2 + b * 8 + i].IsNull())
-                    chAvail |= (1 << i);
-            ::Serialize(s, chAvail, nType, nVersion);
-        }
-        // txouts themself
-        for (unsigned int i = 0; i < vout.size(); i++) {
-            if (!vout[i].IsNull())
-                ::Serialize(s, CTxOutCompressor(REF(vout[i])), nType, nVersion);
-        }
-        // coinbase height
-        ::Serialize(s, VARINT(nHeight), nType, nVersion);
+        ::Serialize(s, CTxOutCompressor(REF(out)), nType, nVersion);
     }
 
     template <typename Stream>
     void Unserialize(Stream& s, int nType, int nVersion)
     {
-        unsigned int nCode = 0;
-        // version
-        ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
-        // header code
+        uint32_t nCode = 0;
         ::Unserialize(s, VARINT(nCode), nType, nVersion);
-        fCoinBase = nCode & 1;         //0001 - means coinbase
-        fCoinStake = (nCode & 2) != 0; //0010 coinstake
-        std::vector<bool> vAvail(2, false);
-        vAvail[0] = (nCode & 4) != 0; // 0100
-        vAvail[1] = (nCode & 8) != 0; // 1000
-        unsigned int nMaskCode = (nCode / 16) + ((nCode & 12) != 0 ? 0 : 1);
-        // spentness bitmask
-        while (nMaskCode > 0) {
-            unsigned char chAvail = 0;
-            ::Unserialize(s, chAvail, nType, nVersion);
-            for (unsigned int p = 0; p < 8; p++) {
-                bool f = (chAvail & (1 << p)) != 0;
-                vAvail.push_back(f);
-            }
-            if (chAvail != 0)
-                nMaskCode--;
-        }
-        // txouts themself
-        vout.assign(vAvail.size(), CTxOut());
-        for (unsigned int i = 0; i < vAvail.size(); i++) {
-            if (vAvail[i])
-                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
-        }
-        // coinbase height
-        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
-        Cleanup();
-    }
-
-    //! mark an outpoint spent, and construct undo information
-    bool Spend(const COutPoint& out, CTxInUndo& undo);
-
-    //! mark a vout spent
-    bool Spend(int nPos);
-
-    //! check whether a particular output is still available
-    bool IsAvailable(unsigned int nPos) const
-    {
-        return (nPos < vout.size() && !vout[nPos].IsNull());
+        nHeight = nCode >> 2;
+        fCoinStake = (nCode >> 1) & 1;
+        fCoinBase = nCode & 1;
+        ::Unserialize(s, REF(CTxOutCompressor(out)), nType, nVersion);
     }
 
-    //! check whether the entire CCoins is spent
-    //! note that only !IsPruned() CCoins can be serialized
-    bool IsPruned() const
+    //! Heap memory owned by this coin, as counted by the cache
+    size_t DynamicMemoryUsage() const
     {
-        BOOST_FOREACH (const CTxOut& out, vout)
-            if (!out.IsNull())
-                return false;
-        return true;
+        return memusage::DynamicUsage(out.scriptPubKey);
     }
 };
 
-class CCoinsKeyHasher
+class SaltedOutpointHasher
 {
 private:
     uint256 salt;
 
 public:
-    CCoinsKeyHasher();
+    SaltedOutpointHasher();
 
-    /**
-     * This *must* return size_t. With Boost 1.46 on 32-bit systems the
-     * unordered_map will behave unpredictably if the custom hasher returns a
-     * uint64_t, resulting in failures when syncing the chain (#4634).
-     */
-    size_t operator()(const uint256& key) const
+    size_t operator()(const COutPoint& outpoint) const
     {
-        return key.GetHash(salt);
+        uint64_t h = outpoint.hash.GetHash(salt) ^ ((uint64_t)outpoint.n * 0x9E3779B97F4A7C15ULL);
+        h ^= h >> 31;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 29;
+        return (size_t)h;
     }
 };
 
 struct CCoinsCacheEntry {
-    CCoins coins; // The actual cached data.
+    Coin coin; // The actual cached data.
     unsigned char flags;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        /* Note that FRESH is a performance optimization with which we can
+         * erase coins that are fully spent if we know we do not need to
+         * flush the changes to the parent cache.  It is always safe to
+         * not mark FRESH if that condition is not guaranteed.
+         */
+    };
+
+    CCoinsCacheEntry() : flags(0) {}
+    explicit CCoinsCacheEntry(const Coin& coinIn) : coin(coinIn), flags(0) {}
+};
+
+/**
+ * Map from COutPoint to CCoinsCacheEntry, as used by CCoinsViewCache.
+ *
+ * Entries are allocated from fixed-size chunks and never move once created,
+ * so references handed out by the cache stay valid until their entry is
+ * erased. Lookups go through an open-addressed (linear probing) index of
+ * entry numbers; erased entries are recycled through a free list. Apart from
+ * script data, no allocation happens per entry, and the memory held by the
+ * map itself is known exactly.
+ *
+ * Iterators walk the entry chunks; erasing one entry leaves all other
+ * iterators valid, inserting may not.
+ */
+class CCoinsMap
+{
+public:
+    typedef std::pair<const COutPoint, CCoinsCacheEntry> value_type;
+
+private:
+    static const uint32_t CHUNK_SIZE = 1024;
+    static const uint32_t EMPTY = 0;
+
+    typedef std::aligned_storage<sizeof(value_type), std::alignment_of<value_type>::value>::type storage_type;
+
+    SaltedOutpointHasher hasher;
+    //! Open-addressed index: entry number + 1, or EMPTY. Its size is a power of two.
+    std::vector<uint32_t> vIndex;
+    std::vector<storage_type*> vChunks;
+    std::vector<unsigned char> vUsed;
+    std::vector<uint32_t> vFree;
+    uint32_t nEntries;   //!< entries handed out from the chunks so far
+    size_t nSize;        //!< live entries
+
+    value_type* Entry(uint32_t nPos) const
+    {
+        return reinterpret_cast<value_type*>(&vChunks[nPos / CHUNK_SIZE][nPos % CHUNK_SIZE]);
+    }
+
+    size_t Bucket(const COutPoint& key) const
+    {
+        return hasher(key) & (vIndex.size() - 1);
+    }
+
+    //! Index position holding key, or the empty position where it would go
+    size_t Probe(const COutPoint& key) const;
+    void Rehash(size_t nBuckets);
+    uint32_t Allocate();
+
+public:
+    class const_iterator;
+
+    class iterator
+    {
+    private:
+        const CCoinsMap* map;
+        uint32_t nPos;
+        friend class CCoinsMap;
+        friend class const_iterator;
+
+    public:
+        iterator() : map(NULL), nPos(0) {}
+        iterator(const CCoinsMap* mapIn, uint32_t nPosIn) : map(mapIn), nPos(nPosIn) {}
+
+        value_type& operator*() const { return *map->Entry(nPos); }
+        value_type* operator->() const { return map->Entry(nPos); }
+        iterator& operator++()
+        {
+            do {
+                ++nPos;
+            } while (nPos < map->nEntries && !map->vUsed[nPos]);
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const iterator& other) const { return nPos == other.nPos; }
+        bool operator!=(const iterator& other) const { return nPos != other.nPos; }
+    };
+
+    class const_iterator
+    {
+    private:
+        iterator it;
+
+    public:
+        const_iterator() {}
+        const_iterator(const iterator& itIn) : it(itIn) {}
+
+        const value_type& operator*() const { return *it; }
+        const value_type* operator->() const { return &*it; }
+        const_iterator& operator++()
+        {
+            ++it;
+            return *this;
+        }
+        bool operator==(const const_iterator& other) const { return it == other.it; }
+        bool operator!=(const const_iterator& other) const { return it != other.it; }
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsMap();
+    ~CCoinsMap();
+
+    iterator begin() const;
+    iterator end() const { return iterator(this, nEntries); }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const COutPoint& key) const;
+    //! Insert an entry for key unless one exists; returns it and whether it was inserted
+    std::pair<iterator, bool> emplace(const COutPoint& key, const CCoinsCacheEntry& entry);
+    void erase(iterator it);
+    //! Remove all entries and release their memory
+    void clear();
+
+    //! Memory held by the map itself, excluding what the coins own
+    size_t DynamicMemoryUsage() const;
+
+private:
+    CCoinsMap(const CCoinsMap&);
+    CCoinsMap& operator=(const CCoinsMap&);
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/** Running totals of the UTXO set */
+struct CUTXOTotals {
+    int64_t nTransactionOutputs;
+    int64_t nSerializedSize;   //!< same measure as CCoinsStats::nSerializedSize
+    CAmount nTotalAmount;
+    CAmount nTotalUnspendable; //!< value sent to provably unspendable outputs, never added to the set
+
+    CUTXOTotals() : nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0), nTotalUnspendable(0) {}
+
+    CUTXOTotals& operator+=(const CUTXOTotals& other)
+    {
+        nTransactionOutputs += other.nTransactionOutputs;
+        nSerializedSize += other.nSerializedSize;
+        nTotalAmount += other.nTotalAmount;
+        nTotalUnspendable += other.nTotalUnspendable;
+        return *this;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(nTotalUnspendable);
+    }
+};
+
+/**
+ * Incrementally maintained statistics of the UTXO set: running totals and a
+ * MuHash3072 of all (outpoint, coin) pairs. The same type is used for the
+ * changes made by one block, which are then added to the running state.
+ */
+class CUTXOStats
+{
+public:
+    uint256 hashBlock; //!< block the running state corresponds to
+    CUTXOTotals totals;
+    MuHash3072 muhash;
+
+    CUTXOStats() : hashBlock(0) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void RemoveCoin(const COutPoint& outpoint, const Coin& coin);
+
+    //! Apply a delta; hashBlock is left to the caller
+    CUTXOStats& operator+=(const CUTXOStats& delta)
+    {
+        totals += delta.totals;
+        muhash *= delta.muhash;
+        return *this;
+    }
+
+    //! Hash of the set. Expensive: computes a 3072-bit modular inverse.
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        unsigned char num[Num3072::BYTE_SIZE], den[Num3072::BYTE_SIZE];
+        if (!ser_action.ForRead())
+            muhash.GetState(num, den);
+        READWRITE(hashBlock);
+        READWRITE(totals);
+        READWRITE(FLATDATA(num));
+        READWRITE(FLATDATA(den));
+        if (ser_action.ForRead())
+            muhash.SetState(num, den);
+    }
+};
 
 struct CCoinsStats {
     int nHeight;
@@ -335,17 +391,16 @@ struct CCoinsStats {
 class CCoinsView
 {
 public:
-    //! Retrieve the CCoins (unspent transaction outputs) for a given txid
-    virtual bool GetCoins(const uint256& txid, CCoins& coins) const;
+    //! Retrieve the Coin (unspent transaction output) for a given outpoint.
+    virtual bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
 
-    //! Just check whether we have data for a given txid.
-    //! This may (but cannot always) return true for fully spent transactions
-    virtual bool HaveCoins(const uint256& txid) const;
+    //! Just check whether a given outpoint is unspent.
+    virtual bool HaveCoin(const COutPoint& outpoint) const;
 
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
-    //! Do a bulk modification (multiple CCoins changes + BestBlock change).
+    //! Do a bulk modification (multiple Coin changes + BestBlock change).
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
 
@@ -365,16 +420,14 @@ protected:
 
 public:
     CCoinsViewBacked(CCoinsView* viewIn);
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView& viewIn);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
 };
 
-class CCoinsViewCache;
-
 /** Flags for nSequence and nLockTime locks */
 enum {
     /* Interpret sequence numbers as relative lock-time constraints. */
@@ -388,63 +441,56 @@ enum {
 static const unsigned int STANDARD_LOCKTIME_VERIFY_FLAGS = LOCKTIME_VERIFY_SEQUENCE |
                                                            LOCKTIME_MEDIAN_TIME_PAST;
 
-/** 
- * A reference to a mutable cache entry. Encapsulating it allows us to run
- *  cleanup code after the modification is finished, and keeping track of
- *  concurrent modifications. 
- */
-class CCoinsModifier
-{
-private:
-    CCoinsViewCache& cache;
-    CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
-
-public:
-    CCoins* operator->() { return &it->second.coins; }
-    CCoins& operator*() { return it->second.coins; }
-    ~CCoinsModifier();
-    friend class CCoinsViewCache;
-};
-
 /** CCoinsView that adds a memory cache for transactions to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
-    /* Whether this cache has an active modifier. */
-    bool hasModifier;
-
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
-     * declared as "const".  
+     * declared as "const".
      */
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner Coin objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
-    ~CCoinsViewCache();
 
     // Standard CCoinsView methods
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256& hashBlock);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
 
     /**
-     * Return a pointer to CCoins in the cache, or NULL if not found. This is
-     * more efficient than GetCoins. Modifications to other cache entries are
-     * allowed while accessing the returned pointer.
+     * Check if we have the given utxo already loaded in this cache.
+     * The semantics are the same as HaveCoin(), but no calls to
+     * the backing CCoinsView are made.
      */
-    const CCoins* AccessCoins(const uint256& txid) const;
+    bool HaveCoinInCache(const COutPoint& outpoint) const;
 
     /**
-     * Return a modifiable reference to a CCoins. If no entry with the given
-     * txid exists, a new one is created. Simultaneous modifications are not
-     * allowed.
+     * Return a reference to Coin in the cache, or a pruned one if not found.
+     * The reference stays valid until the coin is spent or the cache is
+     * flushed.
      */
-    CCoinsModifier ModifyCoins(const uint256& txid);
+    const Coin& AccessCoin(const COutPoint& outpoint) const;
+
+    /**
+     * Add a coin. Set possible_overwrite to true if an unspent version may
+     * already exist in the cache.
+     */
+    void AddCoin(const COutPoint& outpoint, const Coin& coin, bool possible_overwrite);
+
+    /**
+     * Spend a coin. Pass moveto in order to get the deleted data.
+     * If no unspent output exists for the passed outpoint, this call
+     * has no effect.
+     */
+    bool SpendCoin(const COutPoint& outpoint, Coin* moveto = NULL);
 
     /**
      * Push the modifications applied to this cache to its base.
@@ -453,9 +499,18 @@ public:
      */
     bool Flush();
 
-    //! Calculate the size of the cache (in number of transactions)
+    /**
+     * Removes the UTXO with the given outpoint from the cache, if it is
+     * not modified.
+     */
+    void Uncache(const COutPoint& outpoint);
+
+    //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of bare coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -474,11 +529,25 @@ public:
 
     const CTxOut& GetOutputFor(const CTxIn& input) const;
 
-    friend class CCoinsModifier;
-
 private:
-    CCoinsMap::iterator FetchCoins(const uint256& txid);
-    CCoinsMap::const_iterator FetchCoins(const uint256& txid) const;
+    CCoinsMap::iterator FetchCoin(const COutPoint& outpoint) const;
+
+    /**
+     * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
+     */
+    CCoinsViewCache(const CCoinsViewCache&);
 };
 
+//! Utility function to add all of a transaction's outputs to a cache.
+// When check is false, this assumes that overwrites are only possible for coinbase transactions.
+// When check is true, the underlying view may be queried to determine whether an addition is
+// an overwrite.
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool check = false);
+
+//! Utility function to find any unspent output with a given txid.
+// This function can be quite expensive because in the event of a transaction
+// which is not found in the cache, it probes every output index a block could
+// hold, so it should be used with care.
+const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
+
 #endif // BITCOIN_COINS_H
@@ -0,0 +1,206 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace
+{
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+
+/** 2^3072 - MAX_PRIME_DIFF is the largest prime below 2^3072 */
+const limb_t MAX_PRIME_DIFF = 1103717;
+const limb_t MAX_LIMB = (limb_t)-1;
+
+limb_t ReadLimb(const unsigned char* ptr)
+{
+    return Num3072::LIMB_SIZE == 64 ? (limb_t)ReadLE64(ptr) : (limb_t)ReadLE32(ptr);
+}
+
+void WriteLimb(unsigned char* ptr, limb_t x)
+{
+    if (Num3072::LIMB_SIZE == 64)
+        WriteLE64(ptr, (uint64_t)x);
+    else
+        WriteLE32(ptr, (uint32_t)x);
+}
+}
+
+Num3072::Num3072()
+{
+    SetToOne();
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++)
+        limbs[i] = ReadLimb(data + i * (LIMB_SIZE / 8));
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; i++)
+        WriteLimb(out + i * (LIMB_SIZE / 8), limbs[i]);
+}
+
+/** Whether the value is at least the modulus (it is always below 2^3072) */
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= MAX_LIMB - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; i++) {
+        if (limbs[i] != MAX_LIMB)
+            return false;
+    }
+    return true;
+}
+
+/** Subtract the modulus, i.e. add MAX_PRIME_DIFF and drop bit 3072 */
+void Num3072::FullReduce()
+{
+    double_limb_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; i++) {
+        c += limbs[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook product into 2 * LIMBS limbs. a may alias this.
+    limb_t t[2 * LIMBS];
+    for (int i = 0; i < 2 * LIMBS; i++)
+        t[i] = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        double_limb_t c = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            c += (double_limb_t)limbs[i] * a.limbs[j] + t[i + j];
+            t[i + j] = (limb_t)c;
+            c >>= LIMB_SIZE;
+        }
+        t[i + LIMBS] = (limb_t)c;
+    }
+
+    // Reduce: high * 2^3072 == high * MAX_PRIME_DIFF (mod p)
+    double_limb_t c = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        c += (double_limb_t)t[i + LIMBS] * MAX_PRIME_DIFF + t[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    // The remaining carry is at most ~2^22; fold it in once more
+    c *= MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS && c; i++) {
+        c += limbs[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    if (c) {
+        // Wrapped past 2^3072 again, which leaves a tiny value behind
+        limbs[0] += MAX_PRIME_DIFF;
+    }
+    if (IsOverflow())
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat: a^(p-2) == a^-1 (mod p). p - 2 has all bits set except in
+    // the lowest limb, which is MAX_LIMB - MAX_PRIME_DIFF - 1.
+    const limb_t low = MAX_LIMB - MAX_PRIME_DIFF - 1;
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; i--) {
+        limb_t e = i == 0 ? low : MAX_LIMB;
+        for (int b = LIMB_SIZE - 1; b >= 0; b--) {
+            result.Multiply(result);
+            if ((e >> b) & 1)
+                result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+
+    // Expand the 256-bit key to 3072 bits with SHA512 in counter mode
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; i++)
+        CSHA512().Write(key, sizeof(key)).Write(&i, 1).Finalize(expanded + i * CSHA512::OUTPUT_SIZE);
+
+    Num3072 num(expanded);
+    if (num.IsOverflow())
+        num.FullReduce();
+    return num;
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[32])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
+
+void MuHash3072::GetState(unsigned char (&num)[Num3072::BYTE_SIZE], unsigned char (&den)[Num3072::BYTE_SIZE]) const
+{
+    numerator.ToBytes(num);
+    denominator.ToBytes(den);
+}
+
+void MuHash3072::SetState(const unsigned char (&num)[Num3072::BYTE_SIZE], const unsigned char (&den)[Num3072::BYTE_SIZE])
+{
+    numerator = Num3072(num);
+    denominator = Num3072(den);
+}
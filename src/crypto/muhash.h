@@ -0,0 +1,85 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An element of the multiplicative group of integers modulo 2^3072 - 1103717. */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef uint64_t limb_t;
+    typedef unsigned __int128 double_limb_t;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint32_t limb_t;
+    typedef uint64_t double_limb_t;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const int LIMBS = 3072 / LIMB_SIZE;
+    static const size_t BYTE_SIZE = 384;
+
+    limb_t limbs[LIMBS];
+
+    //! Initializes to one
+    Num3072();
+    //! Interprets 384 bytes as a little-endian number; the value must be below the modulus
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+private:
+    friend class MuHash3072;
+
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A multiset hash: the hash of a set of byte strings that can be updated
+ * by adding or removing single elements, and that does not depend on the
+ * order in which that happened.
+ *
+ * Each element is expanded to a number modulo a 3072-bit prime, and the
+ * set is represented by the product of its elements. Removing elements
+ * multiplies the denominator instead, so that updates stay cheap; only
+ * Finalize() has to compute a modular inverse. Two MuHash3072 objects can
+ * be combined with *= and /=, which is used to apply the changes of a
+ * whole block at once.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    //! An empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Write the 32-byte hash of the set. Normalizes the internal state.
+    void Finalize(unsigned char out[32]);
+
+    //! Raw state, as 2 * 384 bytes (numerator, denominator)
+    void GetState(unsigned char (&num)[Num3072::BYTE_SIZE], unsigned char (&den)[Num3072::BYTE_SIZE]) const;
+    void SetState(const unsigned char (&num)[Num3072::BYTE_SIZE], const unsigned char (&den)[Num3072::BYTE_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -129,7 +129,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
         // array of requests
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(valRequest.get_array(), &HTTPQueueWork);
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -20,6 +20,8 @@
 #include <sys/stat.h>
 #include <signal.h>
 
+#include <atomic>
+
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/thread.h>
@@ -61,6 +63,22 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item running an arbitrary function */
+class HTTPFunctionItem : public HTTPClosure
+{
+public:
+    HTTPFunctionItem(const boost::function<void(void)>& func) : func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -189,6 +207,8 @@ static WorkQueue<HTTPClosure>* workQueue = 0;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Set by InterruptHTTPServer so workers stop streaming chunked replies
+static std::atomic<bool> fStreamsInterrupted(false);
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -440,6 +460,17 @@ bool InitHTTPServer()
     return true;
 }
 
+bool HTTPQueueWork(const boost::function<void(void)>& func)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPFunctionItem> item(new HTTPFunctionItem(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
 boost::thread threadHTTP;
 
 bool StartHTTPServer()
@@ -463,6 +494,7 @@ void InterruptHTTPServer()
         }
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
+    fStreamsInterrupted = true;
     if (workQueue)
         workQueue->Interrupt();
 }
@@ -542,6 +574,10 @@ HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
 }
 HTTPRequest::~HTTPRequest()
 {
+    if (stream && !replySent) {
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        WriteReplyEnd();
+    }
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
@@ -607,6 +643,105 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** Flow control of a chunked reply, shared between the worker producing it
+ * and the main http thread writing it out.
+ */
+class HTTPReplyStream
+{
+public:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    size_t nQueued;  //!< bytes passed to WriteReplyChunk and not yet written to the client
+    size_t nHanded;  //!< part of nQueued already handed to libevent
+    bool fClosed;    //!< connection is gone; the evhttp_request must not be touched any more
+
+    HTTPReplyStream() : nQueued(0), nHanded(0), fClosed(false) {}
+};
+
+/** Main thread: the connection of a chunked reply was closed */
+static void http_stream_close_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPReplyStream* stream = (HTTPReplyStream*)arg;
+    boost::unique_lock<boost::mutex> lock(stream->cs);
+    stream->fClosed = true;
+    stream->cond.notify_all();
+}
+
+/** Main thread: everything handed to libevent so far has been written */
+static void http_stream_written_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPReplyStream* stream = (HTTPReplyStream*)arg;
+    boost::unique_lock<boost::mutex> lock(stream->cs);
+    stream->nQueued -= stream->nHanded;
+    stream->nHanded = 0;
+    stream->cond.notify_all();
+}
+
+static void http_stream_start(struct evhttp_request* req, int nStatus, boost::shared_ptr<HTTPReplyStream> stream)
+{
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req), http_stream_close_cb, stream.get());
+    evhttp_send_reply_start(req, nStatus, NULL);
+}
+
+static void http_stream_chunk(struct evhttp_request* req, struct evbuffer* buf, boost::shared_ptr<HTTPReplyStream> stream)
+{
+    // fClosed only changes on this thread, in http_stream_close_cb
+    if (!stream->fClosed) {
+        {
+            boost::unique_lock<boost::mutex> lock(stream->cs);
+            stream->nHanded += evbuffer_get_length(buf);
+        }
+        evhttp_send_reply_chunk_with_cb(req, buf, http_stream_written_cb, stream.get());
+    }
+    evbuffer_free(buf);
+}
+
+static void http_stream_end(struct evhttp_request* req, boost::shared_ptr<HTTPReplyStream> stream)
+{
+    if (stream->fClosed)
+        return;
+    // Sending the end may free the connection; the stream must not hear about it
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req), NULL, NULL);
+    evhttp_send_reply_end(req);
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && req && !stream);
+    stream.reset(new HTTPReplyStream());
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(http_stream_start, req, nStatus, stream));
+    ev->trigger(0);
+}
+
+bool HTTPRequest::WriteReplyChunk(const char* data, size_t size)
+{
+    assert(!replySent && req && stream);
+    {
+        boost::unique_lock<boost::mutex> lock(stream->cs);
+        while (!stream->fClosed && !fStreamsInterrupted && stream->nQueued > MAX_HTTP_STREAM_BUFFER)
+            stream->cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+        if (stream->fClosed || fStreamsInterrupted)
+            return false;
+        stream->nQueued += size;
+    }
+    struct evbuffer* buf = evbuffer_new();
+    if (!buf)
+        return false;
+    evbuffer_add(buf, data, size);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(http_stream_chunk, req, buf, stream));
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && req && stream);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(http_stream_end, req, stream));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
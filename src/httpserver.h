@@ -9,17 +9,21 @@
 #include <stdint.h>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 
 static const int DEFAULT_RPC_SERIALIZE_VERSION = 1;
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Bytes of a chunked reply that may wait to be written to the client before the producer blocks */
+static const size_t MAX_HTTP_STREAM_BUFFER = 4 * 1024 * 1024;
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+class HTTPReplyStream;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -45,6 +49,11 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Run a function on one of the -rpcthreads worker threads.
+ * Returns false if the work queue is full.
+ */
+bool HTTPQueueWork(const boost::function<void(void)>& func);
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -58,6 +67,7 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    boost::shared_ptr<HTTPReplyStream> stream; // set by WriteReplyStart
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -113,6 +123,27 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply sent in chunked transfer encoding, for bodies that are
+     * too large to build in memory. Follow with WriteReplyChunk calls and
+     * finish with WriteReplyEnd. Do not use WriteReply on the same request.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Send the next chunk of a reply started with WriteReplyStart. Blocks
+     * while more than MAX_HTTP_STREAM_BUFFER bytes wait to be written to the
+     * client. Returns false once the client has gone away or the server is
+     * shutting down; stop producing and call WriteReplyEnd then.
+     */
+    bool WriteReplyChunk(const char* data, size_t size);
+
+    /**
+     * Finish a chunked reply. Like WriteReply this gives the request back
+     * to the main thread.
+     */
+    void WriteReplyEnd();
 };
 
 /** Event handler closure.
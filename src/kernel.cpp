@@ -6,8 +6,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/assign/list_of.hpp>
+#include <boost/thread.hpp>
 
+#include <atomic>
+
+#include "crypto/common.h"
 #include "db.h"
+#include "hash.h"
 #include "kernel.h"
 #include "script/interpreter.h"
 #include "timedata.h"
@@ -245,29 +250,42 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
+    LOCK(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlockFrom);
+    if (mi == mapBlockIndex.end())
         return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
-    nStakeModifierHeight = pindexFrom->nHeight;
-    nStakeModifierTime = pindexFrom->GetBlockTime();
-    int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
-    const CBlockIndex* pindex = pindexFrom;
-    CBlockIndex* pindexNext = chainActive[pindexFrom->nHeight + 1];
-
-    // loop to find the stake modifier later by a selection interval
-    while (nStakeModifierTime < pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval) {
-        if (!pindexNext) {
-            // Should never happen
-            return error("Null pindexNext\n");
-        }
-
-        pindex = pindexNext;
-        pindexNext = chainActive[pindexNext->nHeight + 1];
-        if (pindex->GeneratedStakeModifier()) {
-            nStakeModifierHeight = pindex->nHeight;
-            nStakeModifierTime = pindex->GetBlockTime();
+    CBlockIndex* pindexFrom = mi->second;
+
+    // The selected block only depends on the active chain between the origin
+    // height and itself, so a cached selection stays valid for as long as it
+    // remains part of the active chain (all of its ancestors do as well).
+    const CBlockIndex* pindex = pindexFrom->pindexKernelModifier;
+    if (!pindex || !chainActive.Contains(pindex)) {
+        nStakeModifierHeight = pindexFrom->nHeight;
+        nStakeModifierTime = pindexFrom->GetBlockTime();
+        int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
+        pindex = pindexFrom;
+        CBlockIndex* pindexNext = chainActive[pindexFrom->nHeight + 1];
+
+        // loop to find the stake modifier later by a selection interval
+        while (nStakeModifierTime < pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval) {
+            if (!pindexNext) {
+                // Should never happen
+                return error("Null pindexNext\n");
+            }
+
+            pindex = pindexNext;
+            pindexNext = chainActive[pindexNext->nHeight + 1];
+            if (pindex->GeneratedStakeModifier()) {
+                nStakeModifierHeight = pindex->nHeight;
+                nStakeModifierTime = pindex->GetBlockTime();
+            }
         }
+        pindexFrom->pindexKernelModifier = pindex;
     }
+
+    nStakeModifierHeight = pindex->nHeight;
+    nStakeModifierTime = pindex->GetBlockTime();
     nStakeModifier = pindex->nStakeModifier;
     return true;
 }
@@ -290,11 +308,13 @@ bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTarget
 }
 
 //instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
+    if (!pindexFrom)
+        return error("CheckStakeKernelHash() : null pindexFrom");
+
     //assign new variables to make it easier to read
-    int64_t nValueIn = txPrev.vout[prevout.n].nValue;
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
+    unsigned int nTimeBlockFrom = pindexFrom->GetBlockTime();
 
     if (nTimeTx < nTimeBlockFrom) // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
@@ -311,7 +331,7 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     uint64_t nStakeModifier = 0;
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
-    if (!GetKernelStakeModifier(blockFrom.GetHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
+    if (!GetKernelStakeModifier(pindexFrom->GetBlockHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
         LogPrintf("CheckStakeKernelHash(): failed to get kernel stake modifier \n");
         return false;
     }
@@ -351,8 +371,8 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
             LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
                 std::to_string(nStakeModifier).c_str(), nStakeModifierHeight,
                 DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", blockFrom.GetBlockTime()).c_str());
+                pindexFrom->nHeight,
+                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pindexFrom->GetBlockTime()).c_str());
             LogPrintf("CheckStakeKernelHash() : pass protocol=%s modifier=%s nTimeBlockFrom=%u prevoutHash=%s nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
                 "0.3",
                 std::to_string(nStakeModifier).c_str(),
@@ -367,6 +387,177 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     return fSuccess;
 }
 
+bool PrepareStakeKernelCandidate(CStakeKernelCandidate& candidate, unsigned int nBits)
+{
+    uint64_t nStakeModifier = 0;
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    if (!GetKernelStakeModifier(candidate.pindexFrom->GetBlockHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+        return false;
+
+    candidate.nTimeBlockFrom = candidate.pindexFrom->GetBlockTime();
+
+    // same weighting as stakeTargetHit(), done once per coin instead of once per hash
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    candidate.bnTarget = (uint256(candidate.nValueIn) / 100) * bnTargetPerCoinDay;
+
+    // same layout as the stream hashed by stakeHash()
+    WriteLE64(candidate.prefix, nStakeModifier);
+    WriteLE32(candidate.prefix + 8, candidate.nTimeBlockFrom);
+    WriteLE32(candidate.prefix + 12, candidate.prevout.n);
+    memcpy(candidate.prefix + 16, candidate.prevout.hash.begin(), 32);
+    return true;
+}
+
+static std::atomic<uint64_t> nKernelSearchHashes(0);
+static std::atomic<int64_t> nKernelSearchMicros(0);
+
+double GetStakeKernelHashRate()
+{
+    int64_t nMicros = nKernelSearchMicros;
+    if (nMicros <= 0)
+        return 0;
+    return (double)nKernelSearchHashes * 1000000.0 / nMicros;
+}
+
+int64_t GetStakeKernelSearchTime()
+{
+    return nKernelSearchMicros;
+}
+
+struct CStakeKernelSearch {
+    const std::vector<CStakeKernelCandidate>& vCandidates;
+    unsigned int nTimeTx;
+    unsigned int nHashDrift;
+    unsigned int nTimeTxMin;
+    int nHeightStart;
+    std::atomic<int> nBest;             //! lowest candidate index that hit so far
+    std::atomic<uint64_t> nHashes;
+    std::vector<unsigned int> vTimeFound;
+    std::vector<uint256> vHashFound;
+
+    CStakeKernelSearch(const std::vector<CStakeKernelCandidate>& vCandidatesIn, unsigned int nTimeTxIn, unsigned int nHashDriftIn, unsigned int nTimeTxMinIn)
+        : vCandidates(vCandidatesIn), nTimeTx(nTimeTxIn), nHashDrift(nHashDriftIn), nTimeTxMin(nTimeTxMinIn),
+          nHeightStart(chainActive.Height()), nBest(vCandidatesIn.size()), nHashes(0),
+          vTimeFound(vCandidatesIn.size()), vHashFound(vCandidatesIn.size()) {}
+
+    // Hash the timestamps of candidates nStart, nStart + nStride, ... until one hits
+    void Run(size_t nStart, size_t nStride)
+    {
+        unsigned char buf[52];
+        uint64_t nLocalHashes = 0;
+        for (size_t i = nStart; i < vCandidates.size() && (int)i < nBest; i += nStride) {
+            //new block came in, move on
+            if (chainActive.Height() != nHeightStart)
+                break;
+
+            const CStakeKernelCandidate& candidate = vCandidates[i];
+            if (nTimeTx < candidate.nTimeBlockFrom || candidate.nTimeBlockFrom + nStakeMinAge > nTimeTx)
+                continue;
+
+            memcpy(buf, candidate.prefix, sizeof(candidate.prefix));
+            for (unsigned int j = 0; j < nHashDrift; j++) {
+                unsigned int nTryTime = nTimeTx + nHashDrift - j;
+                if (nTryTime <= nTimeTxMin)
+                    break;
+
+                WriteLE32(buf + 48, nTryTime);
+                uint256 hashProofOfStake;
+                CHash256().Write(buf, sizeof(buf)).Finalize(hashProofOfStake.begin());
+                nLocalHashes++;
+                if (hashProofOfStake < candidate.bnTarget) {
+                    vTimeFound[i] = nTryTime;
+                    vHashFound[i] = hashProofOfStake;
+                    int nPrev = nBest;
+                    while ((int)i < nPrev && !nBest.compare_exchange_weak(nPrev, (int)i)) {}
+                    break;
+                }
+            }
+        }
+        nHashes += nLocalHashes;
+    }
+};
+
+bool SearchStakeKernel(const std::vector<CStakeKernelCandidate>& vCandidates, unsigned int& nTimeTx, unsigned int nHashDrift, unsigned int nTimeTxMin, int& nKernel, uint256& hashProofOfStake)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    CStakeKernelSearch search(vCandidates, nTimeTx, nHashDrift, nTimeTxMin);
+
+    int nThreads = GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+    if (nThreads <= 0)
+        nThreads = std::max(1, (int)boost::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, (int)(vCandidates.size() / STAKE_SEARCH_MIN_CANDIDATES_PER_THREAD) + 1);
+
+    if (nThreads <= 1) {
+        search.Run(0, 1);
+    } else {
+        boost::thread_group threadGroup;
+        for (int i = 1; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CStakeKernelSearch::Run, &search, i, nThreads));
+        search.Run(0, nThreads);
+        threadGroup.join_all();
+    }
+
+    nKernelSearchHashes = search.nHashes.load();
+    nKernelSearchMicros = std::max(GetTimeMicros() - nTimeStart, (int64_t)1);
+
+    {
+        LOCK(cs_main);
+        mapHashedBlocks.clear();
+        mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+    }
+
+    if (fDebug || GetBoolArg("-printcoinstake", false))
+        LogPrintf("SearchStakeKernel() : %u candidates, %d threads, %u hashes in %dus\n",
+            vCandidates.size(), nThreads, (uint64_t)search.nHashes, (int64_t)nKernelSearchMicros);
+
+    if (search.nBest >= (int)vCandidates.size())
+        return false;
+
+    nKernel = search.nBest;
+    nTimeTx = search.vTimeFound[nKernel];
+    hashProofOfStake = search.vHashFound[nKernel];
+    return true;
+}
+
+// Find the output spent by the kernel and the block it was confirmed in
+bool GetKernelStakeInput(const COutPoint& prevout, CTxOut& txoutPrev, const CBlockIndex*& pindexFrom)
+{
+    AssertLockHeld(cs_main);
+    pindexFrom = NULL;
+
+    // Fast path: the kernel is still unspent on the active chain, so the UTXO set
+    // gives us the output and the height of the block that created it
+    const Coin& coin = pcoinsTip->AccessCoin(prevout);
+    if (!coin.IsSpent()) {
+        const CBlockIndex* pindex = chainActive[coin.nHeight];
+        if (pindex) {
+            txoutPrev = coin.out;
+            pindexFrom = pindex;
+            return true;
+        }
+    }
+
+    // Slow path: the kernel is already spent on the active chain (e.g. the block
+    // builds on a fork), fall back to the transaction index. Only the transaction
+    // itself is read, the header data comes from the block index.
+    uint256 hashBlock;
+    CTransaction txPrev;
+    if (!GetTransaction(prevout.hash, txPrev, hashBlock, true))
+        return error("GetKernelStakeInput() : read txPrev failed");
+    if (prevout.n >= txPrev.vout.size())
+        return error("GetKernelStakeInput() : prevout index out of range");
+
+    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
+    if (it == mapBlockIndex.end())
+        return error("GetKernelStakeInput() : block of txPrev not indexed");
+
+    txoutPrev = txPrev.vout[prevout.n];
+    pindexFrom = it->second;
+    return true;
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
 {
@@ -377,32 +568,19 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx.vin[0];
 
-    // First try finding the previous transaction in database
-    uint256 hashBlock;
-    CTransaction txPrev;
-    if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-        return error("CheckProofOfStake() : INFO: read txPrev failed");
+    CTxOut txoutPrev;
+    const CBlockIndex* pindexFrom = NULL;
+    if (!GetKernelStakeInput(txin.prevout, txoutPrev, pindexFrom))
+        return error("CheckProofOfStake() : INFO: failed to find kernel input %s", txin.prevout.ToString());
 
     //verify signature and script
-    if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey,
-        tx.wit.vtxinwit.size() > 0 ? &tx.wit.vtxinwit[0].scriptWitness : NULL, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0, txPrev.vout[txin.prevout.n].nValue)))
+    if (!VerifyScript(txin.scriptSig, txoutPrev.scriptPubKey,
+        tx.wit.vtxinwit.size() > 0 ? &tx.wit.vtxinwit[0].scriptWitness : NULL, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0, txoutPrev.nValue)))
         return error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str());
 
-    CBlockIndex* pindex = NULL;
-    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
-    if (it != mapBlockIndex.end())
-        pindex = it->second;
-    else
-        return error("CheckProofOfStake() : read block failed");
-
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
-        return error("CheckProofOfStake(): INFO: failed to find block");
-
     unsigned int nInterval = 0;
     unsigned int nTime = block.nTime;
-        if (!CheckStakeKernelHash(block.nBits, blockprev, txPrev, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug) && (nTime > 1505247602))
+    if (!CheckStakeKernelHash(block.nBits, pindexFrom, txoutPrev.nValue, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug) && (nTime > 1505247602))
         return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx.GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str()); // may occur during initial download or if behind on block chain sync
 
     return true;
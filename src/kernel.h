@@ -25,7 +25,41 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 // Sets hashProofOfStake on success return
 uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+
+/** A stake input with the constant part of its kernel hash precomputed */
+struct CStakeKernelCandidate {
+    COutPoint prevout;
+    const CBlockIndex* pindexFrom;
+    int64_t nValueIn;
+    unsigned int nTimeBlockFrom;
+    uint256 bnTarget;           //! hash target weighted by the coin value
+    unsigned char prefix[48];   //! nStakeModifier | nTimeBlockFrom | prevout.n | prevout.hash
+
+    CStakeKernelCandidate(const COutPoint& prevoutIn, const CBlockIndex* pindexFromIn, int64_t nValueInIn)
+        : prevout(prevoutIn), pindexFrom(pindexFromIn), nValueIn(nValueInIn), nTimeBlockFrom(0) {}
+};
+
+//! -stakethreads default (0 = one per core)
+static const int DEFAULT_STAKE_THREADS = 0;
+//! Candidates handled per search thread before another thread is worth starting
+static const unsigned int STAKE_SEARCH_MIN_CANDIDATES_PER_THREAD = 256;
+
+// Fetch the stake modifier and serialize the constant kernel hash prefix
+bool PrepareStakeKernelCandidate(CStakeKernelCandidate& candidate, unsigned int nBits);
+
+// Search the candidates for a kernel hash meeting the target, spread over -stakethreads workers.
+// Each candidate tries the timestamps nTimeTx + nHashDrift down to nTimeTx + 1, stopping at nTimeTxMin.
+// On success nKernel is the first candidate (in input order) that hits, nTimeTx the timestamp used.
+bool SearchStakeKernel(const std::vector<CStakeKernelCandidate>& vCandidates, unsigned int& nTimeTx, unsigned int nHashDrift, unsigned int nTimeTxMin, int& nKernel, uint256& hashProofOfStake);
+
+// Kernel hashes per second and duration (in microseconds) of the last kernel search
+double GetStakeKernelHashRate();
+int64_t GetStakeKernelSearchTime();
+
+// Locate the output spent by a stake kernel and the index of the block that created it.
+// Served from the UTXO set when possible so that no block file has to be read.
+bool GetKernelStakeInput(const COutPoint& prevout, CTxOut& txoutPrev, const CBlockIndex*& pindexFrom);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
@@ -147,6 +147,21 @@ bool CBasicKeyStore::HaveWatchOnly() const
     return (!setWatchOnly.empty());
 }
 
+void CBasicKeyStore::GetCScripts(std::vector<CScript>& vScriptsRet) const
+{
+    LOCK(cs_KeyStore);
+    vScriptsRet.clear();
+    vScriptsRet.reserve(mapScripts.size());
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        vScriptsRet.push_back(it->second);
+}
+
+void CBasicKeyStore::GetWatchOnly(WatchOnlySet& setWatchOnlyRet) const
+{
+    LOCK(cs_KeyStore);
+    setWatchOnlyRet = setWatchOnly;
+}
+
 bool CBasicKeyStore::AddMultiSig(const CScript& dest)
 {
     LOCK(cs_KeyStore);
@@ -117,6 +117,10 @@ public:
     virtual bool HaveWatchOnly(const CScript& dest) const override;
     virtual bool HaveWatchOnly() const override;
 
+    //! Copies of the redeem and watch-only scripts, for matching many outputs without taking cs_KeyStore for each
+    void GetCScripts(std::vector<CScript>& vScriptsRet) const;
+    void GetWatchOnly(WatchOnlySet& setWatchOnlyRet) const;
+
     virtual bool AddMultiSig(const CScript& dest) override;
     virtual bool RemoveMultiSig(const CScript& dest) override;
     virtual bool HaveMultiSig(const CScript& dest) const override;
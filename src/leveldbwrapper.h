@@ -59,6 +59,11 @@ public:
 
         batch.Delete(slKey);
     }
+
+    void Clear()
+    {
+        batch.Clear();
+    }
 };
 
 class CLevelDBWrapper
@@ -168,6 +173,24 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterate over the database as it was when the snapshot was taken
+    leveldb::Iterator* NewIterator(const leveldb::Snapshot* snapshot)
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot;
+        return pdb->NewIterator(options);
+    }
+
+    const leveldb::Snapshot* GetSnapshot()
+    {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot* snapshot)
+    {
+        pdb->ReleaseSnapshot(snapshot);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
@@ -12,6 +12,9 @@
 #include "addrman.h"
 #include "alert.h"
 #include "base58.h"
+#include "blockcache.h"
+#include "blockencodings.h"
+#include "blockfilter.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -20,9 +23,11 @@
 #include "init.h"
 #include "kernel.h"
 #include "masternode-budget.h"
+#include "masternode-collateral.h"
 #include "masternode-payments.h"
 #include "masternodeman.h"
 #include "merkleblock.h"
+#include "msgverify.h"
 #include "net.h"
 #include "obfuscation.h"
 #include "protocol.h"
@@ -86,7 +91,7 @@ bool fAddrIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 unsigned int nBytesPerSigOp = DEFAULT_BYTES_PER_SIGOP;
 bool fAlerts = DEFAULT_ALERTS;
 
@@ -180,12 +185,25 @@ struct QueuedBlock {
     int64_t nTime;              //! Time of "getdata" request in microseconds.
     int nValidatedQueuedBefore; //! Number of blocks queued with validated headers (globally) at the time this one is requested.
     bool fValidatedHeaders;     //! Whether this block has validated headers at the time of request.
+    boost::shared_ptr<PartiallyDownloadedBlock> partialBlock; //! Optional, used for cmpctblock reconstruction.
 };
 map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
+/** A block that arrived before its parent's data, held until the parent is connected. */
+struct ParkedBlock {
+    boost::shared_ptr<CBlock> pblock;
+    NodeId nodeFrom;
+    int64_t nTime;
+};
+/** Blocks held back for their parent, by hash and by parent hash. Protected by cs_main. */
+map<uint256, ParkedBlock> mapParkedBlocks;
+multimap<uint256, uint256> mapParkedBlocksByPrev;
+/** Serialized size of all blocks in mapParkedBlocks. */
+size_t nParkedBlocksSize = 0;
+
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
@@ -236,6 +254,8 @@ struct CNodeState {
     CBlockIndex* pindexLastCommonBlock;
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted;
+    //! When to give up on headers synchronization with this peer (in microseconds).
+    int64_t nHeadersSyncTimeout;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
     list<QueuedBlock> vBlocksInFlight;
@@ -244,6 +264,13 @@ struct CNodeState {
     bool fPreferredDownload;
     //! Whether this peer can give us witnesses
     bool fHaveWitness;
+    //! Whether this peer sends and accepts our (witness-serialized, version 1) compact blocks
+    bool fSupportsDesiredCmpctVersion;
+    //! Whether this peer wants new blocks announced with cmpctblock rather than inv
+    bool fPreferHeaderAndIDs;
+    //! Whether we want this peer to announce new blocks to us with cmpctblock, and what we last told it
+    bool fWantHeaderAndIDs;
+    bool fSentWantHeaderAndIDs;
 
     CNodeState()
     {
@@ -254,16 +281,24 @@ struct CNodeState {
         hashLastUnknownBlock = uint256(0);
         pindexLastCommonBlock = NULL;
         fSyncStarted = false;
+        nHeadersSyncTimeout = 0;
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
         fHaveWitness = false;
+        fSupportsDesiredCmpctVersion = false;
+        fPreferHeaderAndIDs = false;
+        fWantHeaderAndIDs = false;
+        fSentWantHeaderAndIDs = false;
     }
 };
 
 /** Map maintaining per-node state. Requires cs_main. */
 map<NodeId, CNodeState> mapNodeState;
 
+/** Peers asked to announce new blocks to us with cmpctblock, least recently useful first. Requires cs_main. */
+list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
 // Requires cs_main.
 CNodeState* State(NodeId pnode)
 {
@@ -319,6 +354,7 @@ void FinalizeNode(NodeId nodeid)
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
@@ -338,7 +374,7 @@ void MarkBlockAsReceived(const uint256& hash)
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex = NULL)
+void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex = NULL, list<QueuedBlock>::iterator* pit = NULL)
 {
     CNodeState* state = State(nodeid);
     assert(state != NULL);
@@ -351,6 +387,92 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
     state->nBlocksInFlight++;
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    if (pit)
+        *pit = it;
+}
+
+/**
+ * Ask a peer for the chain leading up to hashStop: as headers when syncing
+ * headers-first, as block invs otherwise. Requires cs_main.
+ */
+void PushGetBlocks(CNode* pnode, const uint256& hashStop)
+{
+    if (Params().HeadersFirstSyncingActive())
+        pnode->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), hashStop);
+    else
+        pnode->PushMessage(NetMsgType::GETBLOCKS, chainActive.GetLocator(), hashStop);
+}
+
+// Requires cs_main.
+void EraseParkedBlock(const uint256& hash)
+{
+    map<uint256, ParkedBlock>::iterator it = mapParkedBlocks.find(hash);
+    if (it == mapParkedBlocks.end())
+        return;
+
+    pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapParkedBlocksByPrev.equal_range(it->second.pblock->hashPrevBlock);
+    for (; range.first != range.second; range.first++) {
+        if (range.first->second == hash) {
+            mapParkedBlocksByPrev.erase(range.first);
+            break;
+        }
+    }
+    nParkedBlocksSize -= ::GetSerializeSize(*it->second.pblock, SER_NETWORK, PROTOCOL_VERSION);
+    mapParkedBlocks.erase(it);
+}
+
+/**
+ * Hold on to a block whose parent we do not have the data of yet. Blocks
+ * are downloaded in parallel, but proof-of-stake can only be checked once
+ * the parent is connected. Returns false if there is no room for it.
+ * Requires cs_main.
+ */
+bool ParkBlock(NodeId nodeid, const CBlock& block)
+{
+    const uint256 hash = block.GetHash();
+    if (mapParkedBlocks.count(hash))
+        return true;
+
+    // Drop blocks whose parent never showed up
+    int64_t nNow = GetTime();
+    vector<uint256> vExpired;
+    for (map<uint256, ParkedBlock>::iterator it = mapParkedBlocks.begin(); it != mapParkedBlocks.end(); it++) {
+        if (it->second.nTime < nNow - PARKED_BLOCK_EXPIRY)
+            vExpired.push_back(it->first);
+    }
+    BOOST_FOREACH (const uint256& hashExpired, vExpired)
+        EraseParkedBlock(hashExpired);
+
+    unsigned int nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (mapParkedBlocks.size() >= BLOCK_DOWNLOAD_WINDOW || nParkedBlocksSize + nSize > MAX_PARKED_BLOCKS_SIZE)
+        return false;
+
+    ParkedBlock parked = {boost::shared_ptr<CBlock>(new CBlock(block)), nodeid, nNow};
+    mapParkedBlocks.insert(make_pair(hash, parked));
+    mapParkedBlocksByPrev.insert(make_pair(block.hashPrevBlock, hash));
+    nParkedBlocksSize += nSize;
+    return true;
+}
+
+/**
+ * Ask a peer that just gave us a new tip to announce blocks with cmpctblock
+ * from now on. As per BIP152 only three peers are asked at a time; the one
+ * that has been useful least recently makes room. The requests are sent
+ * from SendMessages.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid)
+{
+    CNodeState* state = State(nodeid);
+    if (!state->fSupportsDesiredCmpctVersion)
+        return;
+
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
+    if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
+        State(lNodesAnnouncingHeaderAndIDs.front())->fWantHeaderAndIDs = false;
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+    }
+    state->fWantHeaderAndIDs = true;
+    lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
 }
 
 /** Check whether the last unknown block a peer advertized is not yet known. */
@@ -445,6 +567,9 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    // Blocks fetched ahead of their parent wait in memory; once that fills up, stay close to our chain.
+    if (nParkedBlocksSize >= MAX_PARKED_BLOCKS_SIZE / 2)
+        nWindowEnd = state->pindexLastCommonBlock->nHeight + MAX_BLOCKS_IN_TRANSIT_PER_PEER;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
@@ -470,6 +595,9 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             if (pindex->nStatus & BLOCK_HAVE_DATA) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (mapParkedBlocks.count(pindex->GetBlockHash())) {
+                // Downloaded already, waiting for its parent.
+                continue;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -545,6 +673,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CCoinsViewDB* pcoinsdbview = NULL;
 CCoinsViewCache* pcoinsTip = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CSporkDB* pSporkDB = NULL;
@@ -817,11 +946,11 @@ int GetInputAge(CTxIn& vin)
         CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
-        const CCoins* coins = view.AccessCoins(vin.prevout.hash);
+        const Coin& coin = view.AccessCoin(vin.prevout);
 
-        if (coins) {
-            if (coins->nHeight < 0) return 0;
-            return (chainActive.Tip()->nHeight + 1) - coins->nHeight;
+        if (!coin.IsSpent()) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) return 0;
+            return (chainActive.Tip()->nHeight + 1) - coin.nHeight;
         } else
             return -1;
     }
@@ -1047,6 +1176,15 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
 {
     AssertLockHeld(cs_main);
@@ -1107,25 +1245,27 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                return false;
+        }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // only helps filling in pfMissingInputs (to determine missing vs spent).
         for (const CTxIn txin : tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return false;
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(error("AcceptToMemoryPool : inputs already spent"),
-                REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -1207,7 +1347,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 hash.ToString(),
                 nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
-        
+        // Once the pool has been trimmed, require at least the fee rate of what was evicted
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (!ignoreFees && mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+            return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d", hash.ToString(), nFees, mempoolRejectFee),
+                REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+            return state.DoS(0, error("AcceptToMemoryPool : %s %s", hash.ToString(), errString), REJECT_NONSTANDARD, "too-long-mempool-chain");
+
         unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
         if (!Params().RequireStandard()) {
             scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
@@ -1242,6 +1397,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // trim mempool and check if tx was trimmed
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1263,28 +1423,32 @@ bool ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, uint256 &hashBlock
     return true;
 }
 
-bool FindTransactionsByDestination(const CTxDestination &dest, std::set<CExtDiskTxPos> &setpos) {
-    uint160 addrid;
-    const CKeyID *pkeyid = boost::get<CKeyID>(&dest);
-    if (pkeyid) {
-        addrid = static_cast<uint160>(*pkeyid);
+bool GetAddressIndexKey(const CTxDestination& dest, unsigned char& type, uint160& hashBytes)
+{
+    if (const CKeyID* pkeyid = boost::get<CKeyID>(&dest)) {
+        type = ADDRESS_INDEX_P2PKH;
+        hashBytes = *pkeyid;
+    } else if (const CScriptID* pscriptid = boost::get<CScriptID>(&dest)) {
+        type = ADDRESS_INDEX_P2SH;
+        hashBytes = *pscriptid;
+    } else if (const WitnessV0KeyHash* pkeyhash = boost::get<WitnessV0KeyHash>(&dest)) {
+        type = ADDRESS_INDEX_P2WPKH;
+        hashBytes = *pkeyhash;
+    } else if (const WitnessV0ScriptHash* pscripthash = boost::get<WitnessV0ScriptHash>(&dest)) {
+        type = ADDRESS_INDEX_P2WSH;
+        hashBytes = Hash160(pscripthash->begin(), pscripthash->end());
     } else {
-        const CScriptID *pscriptid = boost::get<CScriptID>(&dest);
-        if (pscriptid) {
-            addrid = static_cast<uint160>(*pscriptid);
-        } else {
-            return false;
-        }
+        return false;
     }
+    return true;
+}
 
-    LOCK(cs_main);
-    if (!fAddrIndex)
-        return false;
-    std::vector<CExtDiskTxPos> vPos;
-    if (!pblocktree->ReadAddrIndex(addrid, vPos))
+bool GetAddressIndexKey(const CScript& script, unsigned char& type, uint160& hashBytes)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(script, dest))
         return false;
-    setpos.insert(vPos.begin(), vPos.end());
-    return true;
+    return GetAddressIndexKey(dest, type, hashBytes);
 }
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool isDSTX)
@@ -1337,25 +1501,20 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                    return false;
+            }
 
             // do all inputs exist?
-            // Note that this does not check for the presence of actual outputs (see the next check for that),
-            // only helps filling in pfMissingInputs (to determine missing vs spent).
             for (const CTxIn txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
                 }
             }
 
-            // are the actual inputs available?
-            if (!view.HaveInputs(tx))
-                return state.Invalid(error("AcceptableInputs : inputs already spent"),
-                    REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
             // Bring the best block into scope
             view.GetBestBlock();
 
@@ -1469,45 +1628,45 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow)
 {
     CBlockIndex* pindexSlow = NULL;
-    {
-        LOCK(cs_main);
-        {
-            if (mempool.lookup(hash, txOut)) {
-                return true;
-            }
-        }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception& e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s : txid mismatch", __func__);
-                return true;
-            }
+    // The mempool has its own lock, and the transaction index and block
+    // files are only appended to, so neither needs cs_main
+    if (mempool.lookup(hash, txOut)) {
+        return true;
+    }
 
-            // transaction not found in the index, nothing more can be done
-            return false;
+    if (fTxIndex) {
+        CDiskTxPos postx;
+        if (pblocktree->ReadTxIndex(hash, postx)) {
+            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+            if (file.IsNull())
+                return error("%s: OpenBlockFile failed", __func__);
+            CBlockHeader header;
+            try {
+                file >> header;
+                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                file >> txOut;
+            } catch (std::exception& e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+            hashBlock = header.GetHash();
+            if (txOut.GetHash() != hash)
+                return error("%s : txid mismatch", __func__);
+            return true;
         }
 
+        // transaction not found in the index, nothing more can be done
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
-                CCoinsViewCache& view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1582,6 +1741,36 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CDiskBlockPos& pos)
+{
+    // Step back over the index header WriteBlockToDisk put in front of the block
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk : invalid block position %d:%u", pos.nFile, pos.nPos);
+    hpos.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk : OpenBlockFile failed");
+
+    try {
+        MessageStartChars pchMessageStart;
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE))
+            return error("ReadRawBlockFromDisk : no block header at %d:%u", pos.nFile, pos.nPos);
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("ReadRawBlockFromDisk : block at %d:%u too large (%u bytes)", pos.nFile, pos.nPos, nSize);
+        vchBlock.resize(nSize);
+        if (nSize > 0)
+            filein.read(&vchBlock[0], nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
@@ -1789,14 +1978,16 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-            txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
-            assert(ret);
+            Coin coin;
+            bool is_spent = inputs.SpendCoin(txin.prevout, &coin);
+            assert(is_spent);
+            // Every undo record carries the coin metadata, so nVersion is unused
+            txundo.vprevout.push_back(CTxInUndo(coin.out, coin.fCoinBase, coin.fCoinStake, coin.nHeight, 0));
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 bool CScriptCheck::operator()()
@@ -1828,20 +2019,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             const COutPoint& prevout = tx.vin[i].prevout;
-            const CCoins* coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
-                if (nSpendHeight - coins->nHeight < Params().COINBASE_MATURITY())
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
+                if (nSpendHeight - (int)coin.nHeight < Params().COINBASE_MATURITY())
                     return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coins->nHeight, coins->IsCoinStake()),
+                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - (int)coin.nHeight, coin.IsCoinStake()),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs() : txin values out of range"),
                     REJECT_INVALID, "bad-txns-inputvalues-outofrange");
         }
@@ -1872,11 +2063,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint& prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1888,7 +2079,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                             flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1909,7 +2100,32 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
     return true;
 }
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+/**
+ * Restore the coin spent by an input from its undo record. Undo records
+ * written before per-outpoint coins only carry metadata for the last spent
+ * output of a transaction; for the others it is taken from a sibling output.
+ * Inconsistencies with the view clear fClean; returns false only when the
+ * coin cannot be restored at all.
+ */
+static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out, Coin& coin, bool& fClean)
+{
+    if (view.HaveCoin(out))
+        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
+
+    coin = Coin(undo.txout, undo.nHeight, undo.fCoinBase, undo.fCoinStake);
+    if (undo.nHeight == 0) {
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return false;
+        coin.nHeight = alternate.nHeight;
+        coin.fCoinBase = alternate.fCoinBase;
+        coin.fCoinStake = alternate.fCoinStake;
+    }
+    view.AddCoin(out, coin, !fClean);
+    return true;
+}
+
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CUTXOStats* pstatsDelta)
 {
     if (pindex->GetBlockHash() != view.GetBestBlock())
         LogPrintf("%s : pindex=%s view=%s\n", __func__, pindex->GetBlockHash().GetHex(), view.GetBestBlock().GetHex());
@@ -1930,32 +2146,42 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    // the address index is only rolled back for the real chain, not for VerifyDB's scratch view
+    bool fUpdateAddressIndex = fAddrIndex && !pfClean;
+    CAddressIndexBatch addressIndex;
+    unsigned char type;
+    uint160 hashBytes;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction& tx = block.vtx[i];
 
         uint256 hash = tx.GetHash();
 
-        // Check that all outputs are available and match the outputs in the block itself
-        // exactly. Note that transactions with only provably unspendable outputs won't
-        // have outputs available even in the block itself, so we handle that case
-        // specially with outsEmpty.
-        {
-            CCoins outsEmpty;
-            CCoinsModifier outs = view.ModifyCoins(hash);
-            outs->ClearUnspendable();
-
-            CCoins outsBlock(tx, pindex->nHeight);
-            // The CCoins serialization does not serialize negative numbers.
-            // No network rules currently depend on the version here, so an inconsistency is harmless
-            // but it must be corrected before txout nversion ever influences a network rule.
-            if (outsBlock.nVersion < 0)
-                outs->nVersion = outsBlock.nVersion;
-            if (*outs != outsBlock)
-                fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
+        if (fUpdateAddressIndex) {
+            for (unsigned int k = tx.vout.size(); k-- > 0;) {
+                const CTxOut& out = tx.vout[k];
+                if (!GetAddressIndexKey(out.scriptPubKey, type, hashBytes))
+                    continue;
+                addressIndex.vDeltas.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, k, false), CAddressIndexValue()));
+                addressIndex.vUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, hash, k), CAddressUnspentValue()));
+                addressIndex.mapBalance[std::make_pair(type, hashBytes)].nReceived -= out.nValue;
+            }
+        }
 
-            // remove outputs
-            outs->Clear();
+        // Check that all outputs are available and match the outputs in the block itself
+        // exactly.
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (pstatsDelta)
+                pstatsDelta->RemoveCoin(COutPoint(hash, o), Coin(tx.vout[o], pindex->nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || (uint32_t)pindex->nHeight != coin.nHeight ||
+                    tx.IsCoinBase() != (bool)coin.fCoinBase || tx.IsCoinStake() != (bool)coin.fCoinStake)
+                    fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
+            }
         }
 
         // restore inputs
@@ -1966,24 +2192,20 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint& out = tx.vin[j].prevout;
                 const CTxInUndo& undo = txundo.vprevout[j];
-                CCoinsModifier coins = view.ModifyCoins(out.hash);
-                if (undo.nHeight != 0) {
-                    // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
-                    coins->Clear();
-                    coins->fCoinBase = undo.fCoinBase;
-                    coins->nHeight = undo.nHeight;
-                    coins->nVersion = undo.nVersion;
-                } else {
-                    if (coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
+                Coin coin;
+                if (!ApplyTxInUndo(undo, view, out, coin, fClean))
+                    return error("DisconnectBlock() : undo data for %s has no height and no sibling outputs", out.ToString());
+                if (pstatsDelta)
+                    pstatsDelta->AddCoin(out, coin);
+
+                if (fUpdateAddressIndex) {
+                    if (GetAddressIndexKey(undo.txout.scriptPubKey, type, hashBytes)) {
+                        addressIndex.vDeltas.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, j, true), CAddressIndexValue()));
+                        addressIndex.vUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, out.hash, out.n), CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, coin.nHeight)));
+                        addressIndex.mapBalance[std::make_pair(type, hashBytes)].nSent -= undo.txout.nValue;
+                    }
+                    addressIndex.vSpent.push_back(std::make_pair(out, CSpentIndexValue()));
                 }
-                if (coins->IsAvailable(out.n))
-                    fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
-                if (coins->vout.size() < out.n + 1)
-                    coins->vout.resize(out.n + 1);
-                coins->vout[out.n] = undo.txout;
 
                 // erase the spent input
                 mapStakeSpent.erase(out);
@@ -1994,6 +2216,9 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
+    if (fUpdateAddressIndex && !pblocktree->UpdateAddressIndex(addressIndex, false))
+        return error("DisconnectBlock() : failed to roll back address index");
+
     if (pfClean) {
         *pfClean = fClean;
         return true;
@@ -2042,39 +2267,52 @@ bool RecalculateBARESupply(int nHeightStart)
 
     CBlockIndex* pindex = chainActive[nHeightStart];
     CAmount nSupplyPrev = pindex->pprev->nMoneySupply;
+    CUTXOTotals totalsPrev;
+    bool fHaveTotalsPrev = pblocktree->ReadUTXOTotals(pindex->pprev->GetBlockHash(), totalsPrev);
 
     while (true) {
         if (pindex->nHeight % 1000 == 0)
             LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
 
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
+        CUTXOTotals totals;
+        bool fHaveTotals = pblocktree->ReadUTXOTotals(pindex->GetBlockHash(), totals);
+        if (fHaveTotals && fHaveTotalsPrev) {
+            // Every output ever created is either unspent or burnt, so the
+            // UTXO set totals give the supply change without reading the block
+            pindex->nMoneySupply = nSupplyPrev + (totals.nTotalAmount + totals.nTotalUnspendable) -
+                                   (totalsPrev.nTotalAmount + totalsPrev.nTotalUnspendable);
+        } else {
+            CBlock block;
+            assert(ReadBlockFromDisk(block, pindex));
 
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        for (const CTransaction tx : block.vtx) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                if (tx.IsCoinBase())
-                    break;
+            CAmount nValueIn = 0;
+            CAmount nValueOut = 0;
+            for (const CTransaction tx : block.vtx) {
+                for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                    if (tx.IsCoinBase())
+                        break;
 
-                COutPoint prevout = tx.vin[i].prevout;
-                CTransaction txPrev;
-                uint256 hashBlock;
-                assert(GetTransaction(prevout.hash, txPrev, hashBlock, true));
-                nValueIn += txPrev.vout[prevout.n].nValue;
-            }
+                    COutPoint prevout = tx.vin[i].prevout;
+                    CTransaction txPrev;
+                    uint256 hashBlock;
+                    assert(GetTransaction(prevout.hash, txPrev, hashBlock, true));
+                    nValueIn += txPrev.vout[prevout.n].nValue;
+                }
 
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                if (i == 0 && tx.IsCoinStake())
-                    continue;
+                for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                    if (i == 0 && tx.IsCoinStake())
+                        continue;
 
-                nValueOut += tx.vout[i].nValue;
+                    nValueOut += tx.vout[i].nValue;
+                }
             }
+            pindex->nMoneySupply = nSupplyPrev + nValueOut - nValueIn;
         }
 
         // Rewrite money supply
-        pindex->nMoneySupply = nSupplyPrev + nValueOut - nValueIn;
         nSupplyPrev = pindex->nMoneySupply;
+        totalsPrev = totals;
+        fHaveTotalsPrev = fHaveTotals;
 
         assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
 
@@ -2092,34 +2330,25 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-// Index either: a) every data push >=8 bytes,  b) if no such pushes, the entire script
-void static BuildAddrIndex(const CScript &script, const CExtDiskTxPos &pos, std::vector<std::pair<uint160, CExtDiskTxPos> > &out)
-{
-    CScript::const_iterator pc = script.begin();
-    CScript::const_iterator pend = script.end();
-    std::vector<unsigned char> data;
-    opcodetype opcode;
-    bool fHaveData = false;
-    while (pc < pend) {
-        script.GetOp(pc, opcode, data);
-        if (0 <= opcode && opcode <= OP_PUSHDATA4 && data.size() >= 8) { // data element
-            uint160 addrid;
-            if (data.size() <= 20) {
-                memcpy(&addrid, &data[0], data.size());
-            } else {
-                addrid = Hash160(data);
-            }
-            out.push_back(std::make_pair(addrid, pos));
-            fHaveData = true;
+/** Collect the UTXO set changes of a connected block: its outputs are added, the coins it spent removed */
+static void GetBlockUTXOStatsDelta(const CBlock& block, const CBlockUndo& blockundo, int nHeight, CUTXOStats& delta)
+{
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256& hash = tx.GetHash();
+        for (unsigned int o = 0; o < tx.vout.size(); o++)
+            delta.AddCoin(COutPoint(hash, o), Coin(tx.vout[o], nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+        if (i == 0 || tx.IsCoinBase())
+            continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const CTxInUndo& undo = txundo.vprevout[j];
+            delta.RemoveCoin(tx.vin[j].prevout, Coin(undo.txout, undo.nHeight, undo.fCoinBase, undo.fCoinStake));
         }
     }
-    if (!fHaveData) {
-        uint160 addrid = Hash160(script);
-        out.push_back(std::make_pair(addrid, pos));
-    }
 }
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked, CUTXOStats* pstatsDelta)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
@@ -2162,10 +2391,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // two in the chain that violate it. This prevents exploiting the issue against nodes in their
     if (!pindex->phashBlock) {
         BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                    REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                        REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
@@ -2175,14 +2405,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nFees = 0;
     int nInputs = 0;
     int64_t nSigOpsCost = 0;
-    CExtDiskTxPos pos(CDiskTxPos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size())), pindex->nHeight);
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPosTxid;
-    std::vector<std::pair<uint160, CExtDiskTxPos> > vPosAddrid;
-        if (fTxIndex)
+    CAddressIndexBatch addressIndex;
+    if (fTxIndex)
         vPosTxid.reserve(block.vtx.size());
-    if (fAddrIndex)
-        vPosAddrid.reserve(block.vtx.size() * 4);
-    vPosTxid.reserve(block.vtx.size());
     CBlockUndo blockundo;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     CAmount nValueOut = 0;
@@ -2231,17 +2458,35 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (fTxIndex)
             vPosTxid.push_back(std::make_pair(tx.GetHash(), pos));
         if (fAddrIndex) {
+            const uint256 hash = tx.GetHash();
+            unsigned char type;
+            uint160 hashBytes;
             if (!tx.IsCoinBase()) {
-                BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-                    CCoins coins;
-                    view.GetCoins(txin.prevout.hash, coins);
-                    if (coins.IsAvailable(txin.prevout.n)) {
-                        BuildAddrIndex(coins.vout[txin.prevout.n].scriptPubKey, pos, vPosAddrid);
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const COutPoint& prevout = tx.vin[j].prevout;
+                    const Coin& coin = view.AccessCoin(prevout);
+                    if (coin.IsSpent())
+                        continue;
+                    const CTxOut& prev = coin.out;
+                    if (GetAddressIndexKey(prev.scriptPubKey, type, hashBytes)) {
+                        addressIndex.vDeltas.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, j, true), CAddressIndexValue(-prev.nValue, pos)));
+                        addressIndex.vUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, prevout.hash, prevout.n), CAddressUnspentValue()));
+                        addressIndex.mapBalance[std::make_pair(type, hashBytes)].nSent += prev.nValue;
+                    } else {
+                        type = ADDRESS_INDEX_NONE;
+                        hashBytes = 0;
                     }
+                    addressIndex.vSpent.push_back(std::make_pair(prevout, CSpentIndexValue(hash, j, pindex->nHeight, prev.nValue, type, hashBytes)));
                 }
             }
-            BOOST_FOREACH(const CTxOut &txout, tx.vout)
-            BuildAddrIndex(txout.scriptPubKey, pos, vPosAddrid);
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                if (!GetAddressIndexKey(out.scriptPubKey, type, hashBytes))
+                    continue;
+                addressIndex.vDeltas.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, k, false), CAddressIndexValue(out.nValue, pos)));
+                addressIndex.vUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, hash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+                addressIndex.mapBalance[std::make_pair(type, hashBytes)].nReceived += out.nValue;
+            }
         }
 
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
@@ -2278,6 +2523,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fJustCheck)
         return true;
 
+    if (pstatsDelta)
+        GetBlockUTXOStatsDelta(block, blockundo, pindex->nHeight, *pstatsDelta);
+
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
         if (pindex->GetUndoPos().IsNull()) {
@@ -2301,8 +2549,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return state.Error("Failed to write transaction index");
 
     if (fAddrIndex)
-        if (!pblocktree->AddAddrIndex(vPosAddrid))
+        if (!pblocktree->UpdateAddressIndex(addressIndex, true))
             return state.Error("Failed to write address index");
+
+    if (fBlockFilterIndex)
+        if (!BlockFilterIndexConnect(block, blockundo, pindex))
+            return state.Error("Failed to write block filter index");
     
         // add new entries
     for (const CTransaction tx: block.vtx) {
@@ -2345,6 +2597,60 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     return true;
 }
 
+/** Rolling UTXO set statistics as of pcoinsTip's best block, if fUTXOStatsValid */
+static CUTXOStats utxoStatsTip;
+static bool fUTXOStatsValid = false;
+
+/** Advance the rolling UTXO set statistics by one connected or disconnected block */
+static void UpdateUTXOStats(const uint256& hashFrom, const uint256& hashTo, const CUTXOStats& delta)
+{
+    if (!fUTXOStatsValid)
+        return;
+    if (utxoStatsTip.hashBlock != hashFrom) {
+        LogPrintf("%s : statistics are for block %s, not %s; disabled until restart\n", __func__, utxoStatsTip.hashBlock.ToString(), hashFrom.ToString());
+        fUTXOStatsValid = false;
+        return;
+    }
+    utxoStatsTip += delta;
+    utxoStatsTip.hashBlock = hashTo;
+    if (!pblocktree->WriteUTXOTotals(hashTo, utxoStatsTip.totals))
+        LogPrintf("%s : failed to write UTXO set totals for block %s\n", __func__, hashTo.ToString());
+}
+
+bool LoadUTXOStats(CCoinsViewDB* pcoinsdb)
+{
+    LOCK(cs_main);
+    fUTXOStatsValid = false;
+    CUTXOStats stats;
+    if (pblocktree->ReadUTXOStats(stats) && stats.hashBlock == pcoinsTip->GetBestBlock()) {
+        utxoStatsTip = stats;
+        fUTXOStatsValid = true;
+        return true;
+    }
+
+    LogPrintf("Computing UTXO set statistics, this may take a while...\n");
+    FlushStateToDisk();
+    if (!pcoinsdb->GetUTXOStats(stats))
+        return false;
+    if (!pblocktree->WriteUTXOStats(stats))
+        return error("%s : failed to write UTXO set statistics", __func__);
+    if (stats.hashBlock != uint256(0))
+        pblocktree->WriteUTXOTotals(stats.hashBlock, stats.totals);
+    LogPrintf("UTXO set statistics at %s: %d outputs, total %s\n", stats.hashBlock.ToString(), stats.totals.nTransactionOutputs, FormatMoney(stats.totals.nTotalAmount));
+    utxoStatsTip = stats;
+    fUTXOStatsValid = true;
+    return true;
+}
+
+bool GetUTXOStats(CUTXOStats& stats)
+{
+    LOCK(cs_main);
+    if (!fUTXOStatsValid)
+        return false;
+    stats = utxoStatsTip;
+    return true;
+}
+
 enum FlushStateMode {
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
@@ -2362,9 +2668,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     static int64_t nLastWrite = 0;
     try {
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
-            // Typical CCoins structures on disk are around 100 bytes in size.
+            // Typical Coin records on disk are well below 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
             // an overestimation, as most will delete an existing entry or
@@ -2391,6 +2697,8 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 }
                 setDirtyBlockIndex.erase(it++);
             }
+            if (fUTXOStatsValid && !pblocktree->WriteUTXOStats(utxoStatsTip))
+                return state.Error("Failed to write UTXO set statistics");
             pblocktree->Sync();
             // Finally flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
@@ -2429,6 +2737,9 @@ void static UpdateTip(CBlockIndex* pindexNew)
 
     cvBlockChange.notify_all();
 
+    // Collateral lookups were answered against the previous tip
+    masternodeCollateral.TipChanged();
+
     // Check the version of the last 100 blocks to see if we need to upgrade:
     static bool fWarned = false;
     if (!IsInitialBlockDownload() && !fWarned) {
@@ -2464,9 +2775,13 @@ bool static DisconnectTip(CValidationState& state, bool fBare)
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CUTXOStats statsDelta;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &statsDelta))
             return error("DisconnectTip() : DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        UpdateUTXOStats(pindexDelete->GetBlockHash(), pindexDelete->pprev->GetBlockHash(), statsDelta);
+        if (fBlockFilterIndex)
+            BlockFilterIndexDisconnect(pindexDelete);
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
@@ -2530,7 +2845,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked);
+        CUTXOStats statsDelta;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked, &statsDelta);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2542,6 +2858,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
         nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        UpdateUTXOStats(pindexNew->pprev ? pindexNew->pprev->GetBlockHash() : uint256(0), pindexNew->GetBlockHash(), statsDelta);
     }
     int64_t nTime4 = GetTimeMicros();
     nTimeFlush += nTime4 - nTime3;
@@ -2563,6 +2880,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    // Keep the block at hand for the ZMQ, REST and RPC readers that ask for it next
+    recentBlocks.Add(*pblock);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH (const CTransaction& tx, txConflicted) {
@@ -2847,12 +3166,37 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
         if (!fInitialDownload) {
             uint256 hashNewTip = pindexNewTip->GetBlockHash();
             // Relay inventory, but don't relay old inventory during initial block download.
+            // Peers that asked for it get the block itself as a cmpctblock instead.
             int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
+            std::set<NodeId> setCmpctPeers;
+            if (pblock && pblock->GetHash() == hashNewTip) {
+                LOCK(cs_main);
+                for (map<NodeId, CNodeState>::const_iterator it = mapNodeState.begin(); it != mapNodeState.end(); ++it) {
+                    if (it->second.fSupportsDesiredCmpctVersion && it->second.fPreferHeaderAndIDs)
+                        setCmpctPeers.insert(it->first);
+                }
+            }
+            boost::shared_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock;
+            if (!setCmpctPeers.empty())
+                pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(*pblock));
             {
+                CInv inv(MSG_BLOCK, hashNewTip);
                 LOCK(cs_vNodes);
-                BOOST_FOREACH (CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                BOOST_FOREACH (CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    if (!setCmpctPeers.count(pnode->GetId())) {
+                        pnode->PushInventory(inv);
+                        continue;
+                    }
+                    {
+                        LOCK(pnode->cs_inventory);
+                        if (!pnode->setInventoryKnown.insert(inv).second)
+                            continue; // we got it from this peer
+                    }
+                    LogPrint("net", "sending cmpctblock %s to peer=%d\n", hashNewTip.ToString(), pnode->id);
+                    pnode->PushMessage(NetMsgType::CMPCTBLOCK, *pcmpctblock);
+                }
             }
             // Notify external listeners about the new tip.
             // Note: uiInterface, should switch main signals.
@@ -2965,10 +3309,6 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
     pindexNew->nSequenceId = 0;
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
-    //mark as PoS seen
-    if (pindexNew->IsProofOfStake())
-        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end()) {
@@ -2978,30 +3318,6 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
 
         //update previous block pointer
         pindexNew->pprev->pnext = pindexNew;
-
-        // ppcoin: compute chain trust score
-        pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
-
-        // ppcoin: compute stake entropy bit for stake modifier
-        if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
-            LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
-
-        // ppcoin: record proof-of-stake hash value
-        if (pindexNew->IsProofOfStake()) {
-            if (!mapProofOfStake.count(hash))
-                LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
-            pindexNew->hashProofOfStake = mapProofOfStake[hash];
-        }
-
-        // ppcoin: compute stake modifier
-        uint64_t nStakeModifier = 0;
-        bool fGeneratedStakeModifier = false;
-        if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
-            LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
-        pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-        pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
-        if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
-            LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, std::to_string(nStakeModifier));
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
@@ -3017,11 +3333,53 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
     return pindexNew;
 }
 
+/**
+ * Fill in the proof-of-stake data of a block index entry. This needs the
+ * coinstake, which a header does not carry, so it is done once the block
+ * itself arrives; its parent must have gone through this already.
+ */
+static void SetBlockIndexStakeData(const CBlock& block, CBlockIndex* pindexNew)
+{
+    const uint256 hash = block.GetHash();
+    if (block.IsProofOfStake()) {
+        pindexNew->SetProofOfStake();
+        pindexNew->prevoutStake = block.vtx[1].vin[0].prevout;
+        pindexNew->nStakeTime = block.nTime;
+        //mark as PoS seen
+        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+    }
+    if (pindexNew->pprev == NULL)
+        return;
+
+    // ppcoin: compute chain trust score
+    pindexNew->bnChainTrust = pindexNew->pprev->bnChainTrust + pindexNew->GetBlockTrust();
+
+    // ppcoin: compute stake entropy bit for stake modifier
+    if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
+        LogPrintf("%s : SetStakeEntropyBit() failed \n", __func__);
+
+    // ppcoin: record proof-of-stake hash value
+    if (pindexNew->IsProofOfStake()) {
+        if (!mapProofOfStake.count(hash))
+            LogPrintf("%s : hashProofOfStake not found in map \n", __func__);
+        pindexNew->hashProofOfStake = mapProofOfStake[hash];
+    }
+
+    // ppcoin: compute stake modifier
+    uint64_t nStakeModifier = 0;
+    bool fGeneratedStakeModifier = false;
+    if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
+        LogPrintf("%s : ComputeNextStakeModifier() failed \n", __func__);
+    pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+    pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
+    if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
+        LogPrintf("%s : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", __func__, pindexNew->nHeight, std::to_string(nStakeModifier));
+}
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBlockIndex* pindexNew, const CDiskBlockPos& pos)
 {
-    if (block.IsProofOfStake())
-        pindexNew->SetProofOfStake();
+    SetBlockIndexStakeData(block, pindexNew);
     pindexNew->nTx = block.vtx.size();
     pindexNew->nChainTx = 0;
     pindexNew->nFile = pos.nFile;
@@ -3800,7 +4158,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
         //if we get this far, check if the prev block is our prev block, if not then request sync and return false
         BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
         if (mi == mapBlockIndex.end()) {
-            pfrom->PushMessage(NetMsgType::GETBLOCKS, chainActive.GetLocator(), uint256(0));
+            PushGetBlocks(pfrom, uint256(0));
             return false;
         }
     }
@@ -4120,7 +4478,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -4256,6 +4614,7 @@ bool InitBlockIndex()
     pblocktree->WriteFlag("txindex", fTxIndex);
     fAddrIndex = GetBoolArg("-addrindex", true);
     pblocktree->WriteFlag("addrindex", fAddrIndex);
+    pblocktree->WriteInt("addrindexversion", ADDRESS_INDEX_VERSION);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4595,7 +4954,8 @@ bool static AlreadyHave(const CInv& inv)
         bool txInMap = false;
         txInMap = mempool.exists(inv.hash);
         return txInMap || mapOrphanTransactions.count(inv.hash) ||
-               pcoinsTip->HaveCoins(inv.hash);
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
     }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -4669,7 +5029,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_WITNESS_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_WITNESS_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -4697,7 +5057,15 @@ void static ProcessGetData(CNode* pfrom)
                         pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         pfrom->PushMessage(NetMsgType::BLOCK, block);
-                    else // MSG_FILTERED_BLOCK)
+                    else if (inv.type == MSG_CMPCT_BLOCK) {
+                        // A peer asking for an old block is unlikely to have its transactions
+                        // in its mempool, so the full block is cheaper for both sides.
+                        if (mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                            CBlockHeaderAndShortTxIDs cmpctblock(block);
+                            pfrom->PushMessage(NetMsgType::CMPCTBLOCK, cmpctblock);
+                        } else
+                            pfrom->PushMessage(NetMsgType::BLOCK, block);
+                    } else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
@@ -4884,6 +5252,105 @@ void static ProcessGetData(CNode* pfrom)
 }
 
 bool fRequestedSporksIDB = false;
+// Requires cs_main.
+static bool HaveBlockData(const uint256& hash)
+{
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    return mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA);
+}
+
+/** Process the blocks that were held back for hashParent, and in turn their children */
+static void ProcessParkedBlocks(const uint256& hashParent)
+{
+    deque<uint256> queue(1, hashParent);
+    while (!queue.empty()) {
+        vector<ParkedBlock> vChildren;
+        {
+            LOCK(cs_main);
+            vector<uint256> vHashes;
+            pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapParkedBlocksByPrev.equal_range(queue.front());
+            for (; range.first != range.second; range.first++)
+                vHashes.push_back(range.first->second);
+            BOOST_FOREACH (const uint256& hash, vHashes) {
+                vChildren.push_back(mapParkedBlocks[hash]);
+                EraseParkedBlock(hash);
+            }
+        }
+        queue.pop_front();
+
+        BOOST_FOREACH (ParkedBlock& parked, vChildren) {
+            CValidationState state;
+            ProcessNewBlock(state, NULL, parked.pblock.get());
+            LOCK(cs_main);
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0 && State(parked.nodeFrom))
+                Misbehaving(parked.nodeFrom, nDoS);
+            if (HaveBlockData(parked.pblock->GetHash()))
+                queue.push_back(parked.pblock->GetHash());
+        }
+    }
+}
+
+/** Ask a peer for a block in full, after a compact block for it could not be used. Requires cs_main. */
+static void RequestFullBlock(CNode* pfrom, const uint256& hash)
+{
+    vector<CInv> vInv(1, CInv(State(pfrom->GetId())->fHaveWitness ? MSG_WITNESS_BLOCK : MSG_BLOCK, hash));
+    pfrom->PushMessage(NetMsgType::GETDATA, vInv);
+}
+
+/**
+ * Complete the compact block in flight from this peer with the transactions
+ * it sent. Returns true if block now holds the reconstructed block. Requires
+ * cs_main.
+ */
+static bool FillCompactBlock(CNode* pfrom, const BlockTransactions& resp, CBlock& block)
+{
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+    if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock || it->second.first != pfrom->GetId()) {
+        LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+        return false;
+    }
+
+    ReadStatus status = it->second.second->partialBlock->FillBlock(block, resp.txn);
+    if (status == READ_STATUS_INVALID) {
+        MarkBlockAsReceived(resp.blockhash);
+        Misbehaving(pfrom->GetId(), 100);
+        LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+        return false;
+    } else if (status == READ_STATUS_FAILED) {
+        // Most likely a short id collision
+        MarkBlockAsReceived(resp.blockhash);
+        RequestFullBlock(pfrom, resp.blockhash);
+        return false;
+    }
+    return true;
+}
+
+/** Process a block rebuilt from a compact block, as if it had been received in full */
+static void ProcessCompactBlock(CNode* pfrom, CBlock& block, const string& strCommand)
+{
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage(NetMsgType::REJECT, strCommand, state.GetRejectCode(),
+            state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+        return;
+    }
+
+    {
+        // The peer was first to give us our new tip: have it announce with cmpctblock
+        LOCK(cs_main);
+        if (chainActive.Tip()->GetBlockHash() == block.GetHash())
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom->GetId());
+    }
+    ProcessParkedBlocks(block.GetHash());
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     if (fDebug)
@@ -5051,6 +5518,28 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Tell our peer we can provide version 1 cmpctblocks, but don't
+            // ask for announcements until it has given us a block first
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            pfrom->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::SENDCMPCT) {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == 1) {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            // Short ids are computed from wtxids, so both sides need witness data
+            state->fSupportsDesiredCmpctVersion = state->fHaveWitness;
+            state->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
     }
 
 
@@ -5161,12 +5650,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     // time the block arrives, the header chain leading up to it is already validated. Not
                     // doing this will result in the received block being rejected as an orphan in case it is
                     // not a direct successor.
-                    if (State(pfrom->GetId())->fHaveWitness &&
-                       (GetSporkValue(SPORK_17_SEGWIT_ACTIVATION) > chainActive.Tip()->nTime || State(pfrom->GetId())->fHaveWitness)) {
-                        inv.type = MSG_WITNESS_BLOCK;
+                    bool fNearTip = chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20;
+                    if (Params().HeadersFirstSyncingActive()) {
+                        pfrom->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
+                    if (!Params().HeadersFirstSyncingActive() || fNearTip) {
+                        if (State(pfrom->GetId())->fHaveWitness &&
+                           (GetSporkValue(SPORK_17_SEGWIT_ACTIVATION) > chainActive.Tip()->nTime || State(pfrom->GetId())->fHaveWitness)) {
+                            inv.type = MSG_WITNESS_BLOCK;
+                        }
+                        // Close to the tip, the announced block most likely builds on it and
+                        // its transactions are in our mempool: fetch it as a cmpctblock.
+                        if (State(pfrom->GetId())->fSupportsDesiredCmpctVersion && fNearTip)
+                            inv.type = MSG_CMPCT_BLOCK;
+                        vToFetch.push_back(inv);
+                        if (Params().HeadersFirstSyncingActive())
+                            MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
                     }
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
                 }
             }
 
@@ -5203,13 +5705,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         ProcessGetData(pfrom);
     }
 
-    else if (strCommand == "getheaders"){
+    else if (strCommand == NetMsgType::GETHEADERS) {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
         LOCK(cs_main);
-        if (IsInitialBlockDownload())
+        if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
+            LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
             return true;
+        }
         CBlockIndex* pindex = NULL;
         if (locator.IsNull()){
             BlockMap::iterator mi = mapBlockIndex.find(hashStop);
@@ -5229,10 +5733,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
-        pfrom->PushMessage("headers", vHeaders);
+        pfrom->PushMessage(NetMsgType::HEADERS, vHeaders);
     }
 
-    else if (strCommand == NetMsgType::GETBLOCKS || strCommand == NetMsgType::GETHEADERS) {
+    else if (strCommand == NetMsgType::GETBLOCKS) {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -5264,44 +5768,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == NetMsgType::HEADERS && Params().HeadersFirstSyncingActive()) {
-        CBlockLocator locator;
-        uint256 hashStop;
-        vRecv >> locator >> hashStop;
-
-        LOCK(cs_main);
-
-        if (IsInitialBlockDownload())
-            return true;
-
-        CBlockIndex* pindex = NULL;
-        if (locator.IsNull()) {
-            // If locator is null, return the hashStop block
-            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end())
-                return true;
-            pindex = (*mi).second;
-        } else {
-            // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
-            if (pindex)
-                pindex = chainActive.Next(pindex);
-        }
-
-        // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
-        vector<CBlock> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        if (fDebug)
-            LogPrintf("getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
-        for (; pindex; pindex = chainActive.Next(pindex)) {
-            vHeaders.push_back(pindex->GetBlockHeader());
-            if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
-                break;
-        }
-        pfrom->PushMessage(NetMsgType::HEADERS, vHeaders);
-    }
-
-
     else if (strCommand == NetMsgType::TX || strCommand == NetMsgType::DSTX) {
         vector<uint256> vWorkQueue;
         vector<uint256> vEraseQueue;
@@ -5467,7 +5933,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive() && !fImporting && !fReindex) // Ignore headers received while importing
+    else if (strCommand == NetMsgType::HEADERS && Params().HeadersFirstSyncingActive() && !fImporting && !fReindex) // Ignore headers received while importing
     {
         std::vector<CBlockHeader> headers;
 
@@ -5499,9 +5965,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 return error("non-continuous headers sequence");
             }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
+            // The proof-of-stake data of the index entry is filled in once the block itself arrives
             if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
@@ -5520,13 +5984,141 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
-            LogPrintf("more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
+            LogPrint("net", "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
             pfrom->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexLast), uint256(0));
         }
 
         CheckBlockIndex();
     }
 
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        const uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hash.ToString(), pfrom->id);
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            BlockMap::iterator miPrev = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+            if (miPrev == mapBlockIndex.end()) {
+                // We are missing its parent, sync up to it
+                PushGetBlocks(pfrom, hash);
+                return true;
+            }
+
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                return true;
+
+            CNodeState* nodestate = State(pfrom->GetId());
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId() && itInFlight->second.second->partialBlock)
+                return true; // Already reconstructing it
+
+            // Reconstruction only pays off for blocks on top of our tip, whose
+            // transactions we are likely to have; fetch anything else in full
+            if (miPrev->second != chainActive.Tip() || !nodestate->fSupportsDesiredCmpctVersion) {
+                RequestFullBlock(pfrom, hash);
+                return true;
+            }
+
+            list<QueuedBlock>::iterator itQueued;
+            MarkBlockAsInFlight(pfrom->GetId(), hash, NULL, &itQueued);
+            itQueued->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+            PartiallyDownloadedBlock& partialBlock = *itQueued->partialBlock;
+            ReadStatus status = partialBlock.InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Duplicate short ids
+                MarkBlockAsReceived(hash);
+                RequestFullBlock(pfrom, hash);
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock.IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (req.indexes.empty()) {
+                BlockTransactions txn;
+                txn.blockhash = hash;
+                fBlockReconstructed = FillCompactBlock(pfrom, txn, block);
+            } else {
+                req.blockhash = hash;
+                pfrom->PushMessage(NetMsgType::GETBLOCKTXN, req);
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessCompactBlock(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN) {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            return error("%s : cannot load block %s from disk", __func__, req.blockhash.ToString());
+
+        // Answering with the full block for old blocks makes a peer that
+        // spams getblocktxn to trigger disk reads pay for them in bandwidth
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->PushMessage(NetMsgType::BLOCK, block);
+            return true;
+        }
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage(NetMsgType::BLOCKTXN, resp);
+    }
+
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+            fBlockReconstructed = FillCompactBlock(pfrom, resp, block);
+        }
+
+        if (fBlockReconstructed)
+            ProcessCompactBlock(pfrom, block, strCommand);
+    }
+
+
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
@@ -5535,9 +6127,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        if (Params().HeadersFirstSyncingActive()) {
+            LOCK(cs_main);
+            BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+            if (miPrev != mapBlockIndex.end() && !(miPrev->second->nStatus & BLOCK_HAVE_DATA) && !HaveBlockData(inv.hash)) {
+                // Downloaded ahead of its parent: keep it until the parent is connected
+                pfrom->AddInventoryKnown(inv);
+                MarkBlockAsReceived(inv.hash);
+                if (ParkBlock(pfrom->GetId(), block))
+                    LogPrint("net", "parked block %s until its parent arrives, peer=%d\n", inv.hash.ToString(), pfrom->id);
+                return true;
+            }
+        }
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), block.GetHash()) != pfrom->vBlockRequested.end()) {
+            if (Params().HeadersFirstSyncingActive()) {
+                LOCK(cs_main);
+                PushGetBlocks(pfrom, block.GetHash());
+            } else if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), block.GetHash()) != pfrom->vBlockRequested.end()) {
                 //we already asked for this block, so lets work backwards and ask for the previous block
                 pfrom->PushMessage(NetMsgType::GETBLOCKS, chainActive.GetLocator(), block.hashPrevBlock);
                 pfrom->vBlockRequested.push_back(block.hashPrevBlock);
@@ -5550,7 +6158,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             pfrom->AddInventoryKnown(inv);
 
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
+            bool fAlreadyHave;
+            {
+                LOCK(cs_main);
+                fAlreadyHave = Params().HeadersFirstSyncingActive() ? HaveBlockData(inv.hash) : mapBlockIndex.count(inv.hash);
+            }
+            if (!fAlreadyHave) {
                 ProcessNewBlock(state, pfrom, &block);
                 int nDoS;
                 if(state.IsInvalid(nDoS)) {
@@ -5563,6 +6176,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 }
                 //disconnect this node if its old protocol version
                 pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
+
+                ProcessParkedBlocks(inv.hash);
             } else {
                 LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
             }
@@ -5835,6 +6450,10 @@ bool ProcessMessages(CNode* pfrom)
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // Check the signatures of queued masternode, budget, spork and SwiftX messages
+    // on the verification threads while earlier messages are being processed
+    QueueMessageVerify(pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -5849,8 +6468,9 @@ bool ProcessMessages(CNode* pfrom)
         //            msg.hdr.nMessageSize, msg.vRecv.size(),
         //            msg.complete() ? "Y" : "N");
 
-        // end, if an incomplete message is found
-        if (!msg.complete())
+        // end, if an incomplete message is found, or one still being verified:
+        // a peer's messages are processed in the order they were sent
+        if (!msg.ready())
             break;
 
         // at this point, any failure means we can delete the current message
@@ -5887,6 +6507,9 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nTimeReceived = msg.nTime;
+        int64_t nTimeVerify = msg.pverify ? msg.pverify->nTimeVerify.load() : 0;
+        int64_t nTimeStart = GetTimeMicros();
         try {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
             boost::this_thread::interruption_point();
@@ -5909,6 +6532,8 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        pfrom->RecordMessageLatency(strCommand, nTimeReceived, nTimeVerify + GetTimeMicros() - nTimeStart);
+
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -6020,6 +6645,14 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             pto->PushMessage(NetMsgType::REJECT, (string) "block", reject.chRejectCode, reject.strRejectReason, reject.hashBlock);
         state.rejects.clear();
 
+        // Message: sendcmpct, when we changed our mind about cmpctblock announcements from this peer
+        if (state.fWantHeaderAndIDs != state.fSentWantHeaderAndIDs) {
+            bool fAnnounceUsingCMPCTBLOCK = state.fWantHeaderAndIDs;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            pto->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+            state.fSentWantHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+
         // Start block sync
         if (pindexBestHeader == NULL)
             pindexBestHeader = chainActive.Tip();
@@ -6029,10 +6662,37 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), uint256(0));
-                pto->PushMessage(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                if (Params().HeadersFirstSyncingActive()) {
+                    // Give the peer time to send us the headers we expect to be missing, at one per target spacing
+                    state.nHeadersSyncTimeout = GetTimeMicros() + HEADERS_DOWNLOAD_TIMEOUT_BASE + HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER * (GetAdjustedTime() - pindexBestHeader->GetBlockTime()) / Params().TargetSpacing();
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), uint256(0));
+                } else {
+                    pto->PushMessage(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                }
+            }
+        }
+
+        // Headers sync timeout: if our only sync peer has not brought our headers close to today in time, let
+        // another preferred peer have a go. Only once the headers are caught up do we stop checking.
+        if (state.fSyncStarted && state.nHeadersSyncTimeout < std::numeric_limits<int64_t>::max()) {
+            if (pindexBestHeader->GetBlockTime() <= GetAdjustedTime() - 6 * 60 * 60) {
+                if (GetTimeMicros() > state.nHeadersSyncTimeout && nSyncStarted == 1 && (nPreferredDownload - state.fPreferredDownload >= 1)) {
+                    if (pto->fWhitelisted) {
+                        LogPrintf("Timeout downloading headers from whitelisted peer=%d, not disconnecting\n", pto->id);
+                    } else {
+                        LogPrintf("Timeout downloading headers from peer=%d, disconnecting\n", pto->id);
+                        pto->fDisconnect = true;
+                        return true;
+                    }
+                    // Reset the sync state so that another peer is picked for headers sync
+                    state.fSyncStarted = false;
+                    nSyncStarted--;
+                    state.nHeadersSyncTimeout = 0;
+                }
+            } else {
+                state.nHeadersSyncTimeout = std::numeric_limits<int64_t>::max();
             }
         }
 
@@ -6114,8 +6774,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             NodeId staller = -1;
             FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
-                if (State(pto->GetId())->fHaveWitness || GetSporkValue(SPORK_17_SEGWIT_ACTIVATION) > pindex->pprev->nTime) {
-                    vGetData.push_back(CInv(State(staller)->fHaveWitness ? MSG_WITNESS_BLOCK : MSG_BLOCK, pindex->GetBlockHash()));
+                if (state.fHaveWitness || GetSporkValue(SPORK_17_SEGWIT_ACTIVATION) > pindex->pprev->nTime) {
+                    vGetData.push_back(CInv(state.fHaveWitness ? MSG_WITNESS_BLOCK : MSG_BLOCK, pindex->GetBlockHash()));
                     MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
                     LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                         pindex->nHeight, pto->id);
@@ -46,6 +46,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CSporkDB;
 class CBloomFilter;
 class CInv;
@@ -62,6 +63,18 @@ static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 static const unsigned int DEFAULT_BLOCK_MAX_COST = 3000000;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
@@ -80,6 +93,11 @@ static const unsigned int MAX_BLOCK_SERIALIZED_SIZE = 4000000;
 static const int64_t MAX_BLOCK_COST = 4000000;
 /** The maximum allowed size for a block excluding witness data, in bytes (network rule) */
 static const unsigned int MAX_BLOCK_BASE_SIZE = 1000000;
+/** Maximum depth of blocks we're willing to serve as compact blocks to peers
+ *  when requested. For older blocks, a regular BLOCK response will be sent. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of blocks we're willing to respond to GETBLOCKTXN requests for. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -106,6 +124,14 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Proof-of-stake blocks can only be checked on top of their parent, so blocks that arrive ahead of it
+ *  are held in memory until it is connected. This caps the memory used for them, in bytes. */
+static const unsigned int MAX_PARKED_BLOCKS_SIZE = 64 * 1024 * 1024;
+/** Time (in seconds) after which a block held back for its parent is dropped. */
+static const int64_t PARKED_BLOCK_EXPIRY = 10 * 60;
+/** Time (in microseconds) a headers sync peer gets before we try another one, plus the time it gets per expected header. */
+static const int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000;
+static const int64_t HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER = 1000;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
@@ -144,7 +170,7 @@ extern bool fTxIndex;
 extern bool fAddrIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fVerifyingBlocks;
@@ -255,11 +281,18 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Load the rolling UTXO set statistics, or rebuild them from the coin database if they are missing or stale. */
+bool LoadUTXOStats(CCoinsViewDB* pcoinsdb);
+/** Copy the UTXO set statistics as of the current tip; false if they are not available. */
+bool GetUTXOStats(CUTXOStats& stats);
 
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
 
+/** Expire transactions older than age seconds, then evict the cheapest packages until the pool fits in limit bytes */
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
 int GetInputAge(CTxIn& vin);
@@ -308,43 +341,238 @@ struct CDiskTxPos : public CDiskBlockPos {
     }
 };
 
-struct CExtDiskTxPos : public CDiskTxPos
-{
-    unsigned int nHeight;
+/** Address types tracked by the address index (-addrindex) */
+enum AddressIndexType {
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_P2PKH = 1,
+    ADDRESS_INDEX_P2SH = 2,
+    ADDRESS_INDEX_P2WPKH = 3,
+    ADDRESS_INDEX_P2WSH = 4,
+};
+
+/**
+ * Key of one address index entry: every output paying to and every input
+ * spending from an address gets one, ordered by height and position in block.
+ */
+struct CAddressIndexKey {
+    unsigned char type;
+    uint160 hashBytes;
+    int nBlockHeight;
+    unsigned int nTxIndex;
+    uint256 txhash;
+    unsigned int nIndex;
+    bool fSpending;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        READWRITE(BIGENDIAN32(nBlockHeight));
+        READWRITE(BIGENDIAN32(nTxIndex));
+        READWRITE(txhash);
+        READWRITE(BIGENDIAN32(nIndex));
+        READWRITE(fSpending);
+    }
+
+    CAddressIndexKey(unsigned char typeIn, const uint160& hashIn, int nHeightIn, unsigned int nTxIndexIn, const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn) :
+        type(typeIn), hashBytes(hashIn), nBlockHeight(nHeightIn), nTxIndex(nTxIndexIn), txhash(txhashIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    CAddressIndexKey()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        type = ADDRESS_INDEX_NONE;
+        hashBytes = 0;
+        nBlockHeight = 0;
+        nTxIndex = 0;
+        txhash = 0;
+        nIndex = 0;
+        fSpending = false;
+    }
+};
+
+/** Seek key for iterating the address index from a given height and position */
+struct CAddressIndexIteratorKey {
+    unsigned char type;
+    uint160 hashBytes;
+    int nBlockHeight;
+    unsigned int nTxIndex;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        READWRITE(BIGENDIAN32(nBlockHeight));
+        READWRITE(BIGENDIAN32(nTxIndex));
+    }
+
+    CAddressIndexIteratorKey(unsigned char typeIn, const uint160& hashIn, int nHeightIn, unsigned int nTxIndexIn) :
+        type(typeIn), hashBytes(hashIn), nBlockHeight(nHeightIn), nTxIndex(nTxIndexIn) {}
+};
+
+struct CAddressIndexValue {
+    CAmount nValue; // positive when received, negative when spent
+    CDiskTxPos txpos;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nValue);
+        READWRITE(txpos);
+    }
+
+    CAddressIndexValue(CAmount nValueIn, const CDiskTxPos& txposIn) : nValue(nValueIn), txpos(txposIn) {}
+
+    CAddressIndexValue()
+    {
+        nValue = 0;
+    }
+};
+
+struct CAddressUnspentKey {
+    unsigned char type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int nIndex;
 
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-            READWRITE(*(CDiskTxPos*)this);
-            READWRITE(VARINT(nHeight));
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(BIGENDIAN32(nIndex));
+    }
+
+    CAddressUnspentKey(unsigned char typeIn, const uint160& hashIn, const uint256& txhashIn, unsigned int nIndexIn) :
+        type(typeIn), hashBytes(hashIn), txhash(txhashIn), nIndex(nIndexIn) {}
+
+    CAddressUnspentKey()
+    {
+        type = ADDRESS_INDEX_NONE;
+        hashBytes = 0;
+        txhash = 0;
+        nIndex = 0;
     }
+};
+
+struct CAddressUnspentValue {
+    CAmount nValue;
+    CScript script;
+    int nBlockHeight;
+
+    ADD_SERIALIZE_METHODS;
 
-    CExtDiskTxPos(const CDiskTxPos &pos, int nHeightIn) : CDiskTxPos(pos), nHeight(nHeightIn) {
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nValue);
+        READWRITE(script);
+        READWRITE(nBlockHeight);
     }
 
-    CExtDiskTxPos() {
+    CAddressUnspentValue(CAmount nValueIn, const CScript& scriptIn, int nHeightIn) : nValue(nValueIn), script(scriptIn), nBlockHeight(nHeightIn) {}
+
+    CAddressUnspentValue()
+    {
         SetNull();
     }
 
-    void SetNull() {
-        CDiskTxPos::SetNull();
-        nHeight = 0;
+    void SetNull()
+    {
+        nValue = -1;
+        script.clear();
+        nBlockHeight = 0;
     }
 
-    friend bool operator==(const CExtDiskTxPos &a, const CExtDiskTxPos &b) {
-        return (a.nHeight == b.nHeight && a.nFile == b.nFile && a.nPos == b.nPos && a.nTxOffset == b.nTxOffset);
+    bool IsNull() const { return nValue == -1; }
+};
+
+/** Link from a spent output to the input that spent it */
+struct CSpentIndexValue {
+    uint256 txid;
+    unsigned int nInputIndex;
+    int nBlockHeight;
+    CAmount nValue;
+    unsigned char addressType;
+    uint160 addressHash;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(txid);
+        READWRITE(VARINT(nInputIndex));
+        READWRITE(VARINT(nBlockHeight));
+        READWRITE(nValue);
+        READWRITE(addressType);
+        READWRITE(addressHash);
     }
 
-    friend bool operator!=(const CExtDiskTxPos &a, const CExtDiskTxPos &b) {
-        return !(a == b);
+    CSpentIndexValue(const uint256& txidIn, unsigned int nInputIndexIn, int nHeightIn, CAmount nValueIn, unsigned char typeIn, const uint160& hashIn) :
+        txid(txidIn), nInputIndex(nInputIndexIn), nBlockHeight(nHeightIn), nValue(nValueIn), addressType(typeIn), addressHash(hashIn) {}
+
+    CSpentIndexValue()
+    {
+        SetNull();
     }
 
-    friend bool operator<(const CExtDiskTxPos &a, const CExtDiskTxPos &b) {
-        if (a.nHeight < b.nHeight) return true;
-        if (a.nHeight > b.nHeight) return false;
-        return ((const CDiskTxPos)a < (const CDiskTxPos)b);
+    void SetNull()
+    {
+        txid = 0;
+        nInputIndex = 0;
+        nBlockHeight = 0;
+        nValue = 0;
+        addressType = ADDRESS_INDEX_NONE;
+        addressHash = 0;
     }
+
+    bool IsNull() const { return txid == 0; }
+};
+
+/** Running totals per address, so balances do not require a history scan */
+struct CAddressBalance {
+    CAmount nReceived;
+    CAmount nSent;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nReceived);
+        READWRITE(nSent);
+    }
+
+    CAddressBalance() : nReceived(0), nSent(0) {}
+
+    CAmount GetBalance() const { return nReceived - nSent; }
+};
+
+/**
+ * All address index changes caused by connecting or disconnecting one block.
+ * Unspent and spent entries with a null value are erased; balance entries
+ * are deltas applied to the stored totals.
+ */
+struct CAddressIndexBatch {
+    std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> > vDeltas;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    std::vector<std::pair<COutPoint, CSpentIndexValue> > vSpent;
+    std::map<std::pair<unsigned char, uint160>, CAddressBalance> mapBalance;
 };
 
 CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree);
@@ -464,8 +692,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
 
     bool operator()();
@@ -489,8 +717,14 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized bytes of the block at pos, exactly as stored in blk?????.dat */
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CDiskBlockPos& pos);
 bool ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, uint256 &hashBlock);
-bool FindTransactionsByDestination(const CTxDestination &dest, std::set<CExtDiskTxPos> &setpos);
+/** Map a destination or output script to its address index type and hash */
+bool GetAddressIndexKey(const CTxDestination& dest, unsigned char& type, uint160& hashBytes);
+bool GetAddressIndexKey(const CScript& script, unsigned char& type, uint160& hashBytes);
+/** Current on-disk format of the address index */
+static const int ADDRESS_INDEX_VERSION = 2;
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -499,13 +733,13 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::set<CExtDisk
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
  *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CUTXOStats* pstatsDelta = NULL);
 
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocksAndReprocess(int blocks);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false);
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false, CUTXOStats* pstatsDelta = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -611,6 +845,9 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/** Global variable that points to the coin database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB* pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
@@ -76,6 +76,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetStrMessage() const;
     void Relay();
 
     std::string GetVoteString()
@@ -128,6 +129,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetStrMessage() const;
     void Relay();
 
     uint256 GetHash()
@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-collateral.h"
+#include "main.h"
+#include "masternode.h"
+#include "script/standard.h"
+#include "txmempool.h"
+
+CMasternodeCollateral masternodeCollateral;
+
+const char* GetCollateralStatusString(CollateralStatus status)
+{
+    switch (status) {
+    case COLLATERAL_OK:
+        return "ok";
+    case COLLATERAL_BUSY:
+        return "busy";
+    case COLLATERAL_SPENT:
+        return "spent or unknown";
+    case COLLATERAL_INVALID_AMOUNT:
+        return "wrong amount";
+    case COLLATERAL_INVALID_PUBKEY:
+        return "does not pay to the collateral key";
+    case COLLATERAL_IMMATURE:
+        return "not enough confirmations";
+    }
+    return "unknown";
+}
+
+CollateralStatus CMasternodeCollateral::Check(const COutPoint& outpoint, const CPubKey& pubKeyCollateral, int64_t& nConfirmedTimeRet)
+{
+    // mempool spends do not move the tip, so they are never cached
+    if (mempool.isSpent(outpoint))
+        return COLLATERAL_SPENT;
+
+    CCollateralEntry entry;
+    bool fCached = false;
+    {
+        LOCK(cs);
+        std::map<COutPoint, CCollateralEntry>::const_iterator it = mapCache.find(outpoint);
+        if (it != mapCache.end()) {
+            entry = it->second;
+            fCached = true;
+        }
+    }
+
+    if (!fCached) {
+        TRY_LOCK(cs_main, lockMain);
+        if (!lockMain)
+            return COLLATERAL_BUSY;
+
+        const Coin& coin = pcoinsTip->AccessCoin(outpoint);
+        entry.fUnspent = !coin.IsSpent();
+        entry.out = coin.out;
+        entry.nConfirmations = 0;
+        entry.nConfirmedTime = 0;
+        if (entry.fUnspent) {
+            entry.nConfirmations = chainActive.Height() + 1 - coin.nHeight;
+            // block for the collateral tx -> 1 confirmation
+            CBlockIndex* pConfIndex = chainActive[coin.nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1];
+            if (pConfIndex)
+                entry.nConfirmedTime = pConfIndex->GetBlockTime();
+        }
+
+        // still under cs_main, so TipChanged cannot run in between and leave a stale entry
+        LOCK(cs);
+        if (mapCache.size() >= MAX_COLLATERAL_CACHE_SIZE)
+            mapCache.clear();
+        mapCache[outpoint] = entry;
+    }
+
+    if (!entry.fUnspent)
+        return COLLATERAL_SPENT;
+    if (entry.out.nValue != MASTERNODE_COLLATERAL_AMOUNT)
+        return COLLATERAL_INVALID_AMOUNT;
+    if (entry.out.scriptPubKey != GetScriptForDestination(pubKeyCollateral.GetID()))
+        return COLLATERAL_INVALID_PUBKEY;
+    if (entry.nConfirmations < MASTERNODE_MIN_CONFIRMATIONS)
+        return COLLATERAL_IMMATURE;
+
+    nConfirmedTimeRet = entry.nConfirmedTime;
+    return COLLATERAL_OK;
+}
+
+void CMasternodeCollateral::TipChanged()
+{
+    LOCK(cs);
+    mapCache.clear();
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MASTERNODE_COLLATERAL_H
+#define MASTERNODE_COLLATERAL_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "sync.h"
+
+#include <map>
+
+/** Value of the output a masternode locks as collateral */
+static const CAmount MASTERNODE_COLLATERAL_AMOUNT = 1000 * COIN;
+/** Outpoints remembered between two blocks; the cache starts over when full */
+static const unsigned int MAX_COLLATERAL_CACHE_SIZE = 50000;
+
+enum CollateralStatus {
+    COLLATERAL_OK,
+    COLLATERAL_BUSY,           // cs_main was taken, nothing was checked; try again later
+    COLLATERAL_SPENT,          // not in the UTXO set, or spent by a mempool transaction
+    COLLATERAL_INVALID_AMOUNT, // output is not MASTERNODE_COLLATERAL_AMOUNT
+    COLLATERAL_INVALID_PUBKEY, // output does not pay to the collateral key
+    COLLATERAL_IMMATURE        // fewer than MASTERNODE_MIN_CONFIRMATIONS
+};
+
+const char* GetCollateralStatusString(CollateralStatus status);
+
+class CMasternodeCollateral;
+extern CMasternodeCollateral masternodeCollateral;
+
+//
+// CMasternodeCollateral : Checks masternode collateral with a single UTXO set lookup
+//
+
+class CMasternodeCollateral
+{
+private:
+    struct CCollateralEntry {
+        bool fUnspent;
+        CTxOut out;
+        int nConfirmations;
+        int64_t nConfirmedTime; // time of the block giving MASTERNODE_MIN_CONFIRMATIONS, 0 if not there yet
+    };
+
+    CCriticalSection cs;
+    // UTXO lookups against the current tip, dropped by TipChanged()
+    std::map<COutPoint, CCollateralEntry> mapCache;
+
+public:
+    /**
+     * Whether outpoint is unspent, holds MASTERNODE_COLLATERAL_AMOUNT, pays
+     * to pubKeyCollateral and has MASTERNODE_MIN_CONFIRMATIONS confirmations.
+     * On COLLATERAL_OK nConfirmedTimeRet is the time of the block in which the
+     * collateral got MASTERNODE_MIN_CONFIRMATIONS; the masternode must not have
+     * signed its announcement before that.
+     */
+    CollateralStatus Check(const COutPoint& outpoint, const CPubKey& pubKeyCollateral, int64_t& nConfirmedTimeRet);
+
+    /** Called by UpdateTip whenever a block is connected or disconnected */
+    void TipChanged();
+};
+
+#endif
@@ -432,7 +432,7 @@ bool CMasternodePaymentWinner::Sign(CKey& keyMasternode, CPubKey& pubKeyMasterno
     std::string errorMessage;
     std::string strMasterNodeSignMessage;
 
-    std::string strMessage = vinMasternode.prevout.ToStringShort() + std::to_string(nBlockHeight) + payee.ToString();
+    std::string strMessage = GetStrMessage();
 
     if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrint("masternode","CMasternodePing::Sign() - Error: %s\n", errorMessage.c_str());
@@ -507,13 +507,46 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
             CMasternodeBlockPayees blockPayees(winnerIn.nBlockHeight);
             mapMasternodeBlocks[winnerIn.nBlockHeight] = blockPayees;
         }
-    }
 
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        CMasternodeBlockPayees& blockPayees = mapMasternodeBlocks[winnerIn.nBlockHeight];
+        blockPayees.AddPayee(winnerIn.payee, 1);
+        if (blockPayees.HasPayeeWithVotes(winnerIn.payee, MNPAYMENTS_LASTPAID_VOTES))
+            mapPayeeVotedHeights[winnerIn.payee].insert(winnerIn.nBlockHeight);
+    }
 
     return true;
 }
 
+int CMasternodePayments::GetLastVotedHeight(const CScript& payee, int nMinHeight, int nMaxHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator mi = mapPayeeVotedHeights.find(payee);
+    if (mi == mapPayeeVotedHeights.end())
+        return 0;
+
+    // highest voted height that is not above nMaxHeight
+    std::set<int>::const_iterator it = mi->second.upper_bound(nMaxHeight);
+    if (it == mi->second.begin())
+        return 0;
+    --it;
+    return *it >= nMinHeight ? *it : 0;
+}
+
+void CMasternodePayments::RebuildPayeeVoteIndex()
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    mapPayeeVotedHeights.clear();
+    for (std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.begin(); it != mapMasternodeBlocks.end(); ++it) {
+        LOCK(cs_vecPayments);
+        BOOST_FOREACH (const CMasternodePayee& payee, it->second.vecPayments) {
+            if (payee.nVotes >= MNPAYMENTS_LASTPAID_VOTES)
+                mapPayeeVotedHeights[payee.scriptPubKey].insert(it->first);
+        }
+    }
+}
+
 bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
     LOCK(cs_vecPayments);
@@ -639,7 +672,20 @@ void CMasternodePayments::CleanPaymentList()
             LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
             masternodeSync.mapSeenSyncMNW.erase((*it).first);
             mapMasternodePayeeVotes.erase(it++);
-            mapMasternodeBlocks.erase(winner.nBlockHeight);
+
+            std::map<int, CMasternodeBlockPayees>::iterator itBlock = mapMasternodeBlocks.find(winner.nBlockHeight);
+            if (itBlock != mapMasternodeBlocks.end()) {
+                LOCK(cs_vecPayments);
+                BOOST_FOREACH (const CMasternodePayee& payee, itBlock->second.vecPayments) {
+                    std::map<CScript, std::set<int> >::iterator itPayee = mapPayeeVotedHeights.find(payee.scriptPubKey);
+                    if (itPayee == mapPayeeVotedHeights.end())
+                        continue;
+                    itPayee->second.erase(winner.nBlockHeight);
+                    if (itPayee->second.empty())
+                        mapPayeeVotedHeights.erase(itPayee);
+                }
+                mapMasternodeBlocks.erase(itBlock);
+            }
         } else {
             ++it;
         }
@@ -756,12 +802,17 @@ void CMasternodePaymentWinner::Relay()
     RelayInv(inv);
 }
 
+std::string CMasternodePaymentWinner::GetStrMessage() const
+{
+    return vinMasternode.prevout.ToStringShort() + std::to_string(nBlockHeight) + payee.ToString();
+}
+
 bool CMasternodePaymentWinner::SignatureValid()
 {
     CMasternode* pmn = mnodeman.Find(vinMasternode);
 
     if (pmn != NULL) {
-        std::string strMessage = vinMasternode.prevout.ToStringShort() + std::to_string(nBlockHeight) + payee.ToString();
+        std::string strMessage = GetStrMessage();
 
         std::string errorMessage = "";
         if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage)) {
@@ -24,6 +24,8 @@ extern CMasternodePayments masternodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED 6
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
+// votes a payee needs at a height for it to count as paid there
+#define MNPAYMENTS_LASTPAID_VOTES 2
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -194,6 +196,7 @@ public:
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool IsValid(CNode* pnode, std::string& strError);
     bool SignatureValid();
+    std::string GetStrMessage() const;
     void Relay();
 
     void AddPayee(CScript payeeIn)
@@ -239,6 +242,8 @@ public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
     std::map<uint256, int> mapMasternodesLastVote; //prevout.hash + prevout.n, nBlockHeight
+    // heights at which a payee has at least MNPAYMENTS_LASTPAID_VOTES votes, derived from mapMasternodeBlocks
+    std::map<CScript, std::set<int> > mapPayeeVotedHeights;
 
     CMasternodePayments()
     {
@@ -251,6 +256,7 @@ public:
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPayeeVotedHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -263,6 +269,8 @@ public:
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nNotBlockHeight);
+    int GetLastVotedHeight(const CScript& payee, int nMinHeight, int nMaxHeight);
+    void RebuildPayeeVoteIndex();
 
     bool CanVote(COutPoint outMasternode, int nBlockHeight)
     {
@@ -294,6 +302,8 @@ public:
     {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildPayeeVoteIndex();
     }
 };
 
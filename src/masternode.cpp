@@ -6,6 +6,7 @@
 #include "masternode.h"
 #include "addrman.h"
 #include "consensus/validation.h"
+#include "masternode-collateral.h"
 #include "masternodeman.h"
 #include "obfuscation.h"
 #include "sync.h"
@@ -165,7 +166,6 @@ uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight)
     if (chainActive.Tip() == NULL) return 0;
 
     uint256 hash = 0;
-    uint256 aux = vin.prevout.hash + vin.prevout.n;
 
     if (!GetBlockHash(hash, nBlockHeight)) {
         LogPrint("masternode","CalculateScore ERROR - nHeight %d - Returned 0\n", nBlockHeight);
@@ -176,12 +176,19 @@ uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight)
     ss << hash;
     uint256 hash2 = ss.GetHash();
 
+    return CalculateScore(hash, hash2);
+}
+
+uint256 CMasternode::CalculateScore(const uint256& hashBlock, const uint256& hashBlockHash) const
+{
+    uint256 aux = vin.prevout.hash + vin.prevout.n;
+
     CHashWriter ss2(SER_GETHASH, PROTOCOL_VERSION);
-    ss2 << hash;
+    ss2 << hashBlock;
     ss2 << aux;
     uint256 hash3 = ss2.GetHash();
 
-    uint256 r = (hash3 > hash2 ? hash3 - hash2 : hash2 - hash3);
+    uint256 r = (hash3 > hashBlockHash ? hash3 - hashBlockHash : hashBlockHash - hash3);
 
     return r;
 }
@@ -214,32 +221,22 @@ void CMasternode::Check(bool forceCheck)
     }
 
     if (!unitTest) {
-        CValidationState state;
-        CMutableTransaction tx = CMutableTransaction();
-        CTxOut vout = CTxOut(999.99 * COIN, obfuScationPool.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-
-        {
-            TRY_LOCK(cs_main, lockMain);
-            if (!lockMain) return;
-
-            if (!AcceptableInputs(mempool, state, CTransaction(tx), false, NULL)) {
-                activeState = MASTERNODE_VIN_SPENT;
-                return;
-            }
+        int64_t nConfirmedTime = 0;
+        CollateralStatus status = masternodeCollateral.Check(vin.prevout, pubKeyCollateralAddress, nConfirmedTime);
+        if (status == COLLATERAL_BUSY) return;
+
+        if (status == COLLATERAL_SPENT) {
+            activeState = MASTERNODE_VIN_SPENT;
+            return;
         }
     }
 
     activeState = MASTERNODE_ENABLED; // OK
 }
 
-int64_t CMasternode::SecondsSincePayment()
+int64_t CMasternode::SecondsSincePayment(int nMnCount)
 {
-    CScript pubkeyScript;
-    pubkeyScript = GetScriptForDestination(pubKeyCollateralAddress.GetID());
-
-    int64_t sec = (GetAdjustedTime() - GetLastPaid());
+    int64_t sec = (GetAdjustedTime() - GetLastPaid(nMnCount));
     int64_t month = 60 * 60 * 24 * 30;
     if (sec < month) return sec; //if it's less than 30 days, give seconds
 
@@ -252,7 +249,7 @@ int64_t CMasternode::SecondsSincePayment()
     return month + hash.GetCompact(false);
 }
 
-int64_t CMasternode::GetLastPaid()
+int64_t CMasternode::GetLastPaid(int nMnCount)
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
     if (pindexPrev == NULL) return false;
@@ -268,36 +265,24 @@ int64_t CMasternode::GetLastPaid()
     // use a deterministic offset to break a tie -- 2.5 minutes
     int64_t nOffset = hash.GetCompact(false) % 150;
 
-    if (chainActive.Tip() == NULL) return false;
+    if (nMnCount == -1)
+        nMnCount = mnodeman.CountEnabled();
 
-    const CBlockIndex* BlockReading = chainActive.Tip();
+    // look back 1.25 cycles from the tip
+    int nLookback = nMnCount * 1.25;
+    if (nLookback <= 0) return 0;
 
-    int nMnCount = mnodeman.CountEnabled() * 1.25;
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if (n >= nMnCount) {
-            return 0;
-        }
-        n++;
-
-        if (masternodePayments.mapMasternodeBlocks.count(BlockReading->nHeight)) {
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if (masternodePayments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2)) {
-                return BlockReading->nTime + nOffset;
-            }
-        }
+    /*
+        Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
+        to converge on the same payees quickly, then keep the same schedule.
+    */
+    int nHeight = masternodePayments.GetLastVotedHeight(mnpayee, std::max(pindexPrev->nHeight - nLookback + 1, 1), pindexPrev->nHeight);
+    if (nHeight <= 0) return 0;
 
-        if (BlockReading->pprev == NULL) {
-            assert(BlockReading);
-            break;
-        }
-        BlockReading = BlockReading->pprev;
-    }
+    const CBlockIndex* BlockReading = chainActive[nHeight];
+    if (BlockReading == NULL) return 0;
 
-    return 0;
+    return BlockReading->nTime + nOffset;
 }
 
 std::string CMasternode::GetStatus()
@@ -548,12 +533,14 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
     // masternode is not enabled yet/already, nothing to update
     if (!pmn->IsEnabled()) return true;
 
-    // mn.pubkey = pubkey, IsVinAssociatedWithPubkey is validated once below,
+    // mn.pubkey = pubkey, the collateral check validates it once below,
     //   after that they just need to match
     if (pmn->pubKeyCollateralAddress == pubKeyCollateralAddress && !pmn->IsBroadcastedWithin(MASTERNODE_MIN_MNB_SECONDS)) {
         //take the newest entry
         LogPrint("masternode","mnb - Got updated entry for %s\n", vin.prevout.hash.ToString());
         if (pmn->UpdateFromNewBroadcast((*this))) {
+            mnodeman.UpdateIndexes(*pmn);
+            mnodeman.InvalidateRankTables();
             pmn->Check();
             if (pmn->IsEnabled()) Relay();
         }
@@ -573,6 +560,25 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS)
     // incorrect ping or its sigTime
     if(lastPing == CMasternodePing() || !lastPing.CheckAndUpdate(nDoS, false, true)) return false;
 
+    // make sure the collateral is unspent, matured and paid to the key that signed this mnb
+    //  - one UTXO lookup, cached until the next block
+    int64_t nConfirmedTime = 0;
+    CollateralStatus status = masternodeCollateral.Check(vin.prevout, pubKeyCollateralAddress, nConfirmedTime);
+    if (status == COLLATERAL_BUSY || status == COLLATERAL_IMMATURE) {
+        if (status == COLLATERAL_IMMATURE)
+            LogPrint("masternode","mnb - Input must have at least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
+        // not mnb fault or maybe we miss few blocks, let this mnb to be checked again later
+        mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
+        masternodeSync.mapSeenSyncMNB.erase(GetHash());
+        return false;
+    }
+    if (status != COLLATERAL_OK) {
+        LogPrint("masternode","mnb - Collateral %s %s\n", vin.prevout.ToString(), GetCollateralStatusString(status));
+        if (status == COLLATERAL_INVALID_AMOUNT || status == COLLATERAL_INVALID_PUBKEY)
+            nDoS = 33;
+        return false;
+    }
+
     // search existing Masternode list
     CMasternode* pmn = mnodeman.Find(vin);
 
@@ -584,52 +590,14 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS)
             mnodeman.Remove(pmn->vin);
     }
 
-    CValidationState state;
-    CMutableTransaction tx = CMutableTransaction();
-    CTxOut vout = CTxOut(999.99 * COIN, obfuScationPool.collateralPubKey);
-    tx.vin.push_back(vin);
-    tx.vout.push_back(vout);
-
-    {
-        TRY_LOCK(cs_main, lockMain);
-        if (!lockMain) {
-            // not mnb fault, let it to be checked again later
-            mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
-            masternodeSync.mapSeenSyncMNB.erase(GetHash());
-            return false;
-        }
-
-        if (!AcceptableInputs(mempool, state, CTransaction(tx), false, NULL)) {
-            //set nDos
-            state.IsInvalid(nDoS);
-            return false;
-        }
-    }
-
     LogPrint("masternode", "mnb - Accepted Masternode entry\n");
 
-    if (GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS) {
-        LogPrint("masternode","mnb - Input must have at least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
-        // maybe we miss few blocks, let this mnb to be checked again later
-        mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
-        masternodeSync.mapSeenSyncMNB.erase(GetHash());
-        return false;
-    }
-
     // verify that sig time is legit in past
     // should be at least not earlier than block when 1000 BARE tx got MASTERNODE_MIN_CONFIRMATIONS
-    uint256 hashBlock = 0;
-    CTransaction tx2;
-    GetTransaction(vin.prevout.hash, tx2, hashBlock, true);
-    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-    if (mi != mapBlockIndex.end() && (*mi).second) {
-        CBlockIndex* pMNIndex = (*mi).second;                                                        // block for 1000 BARE tx -> 1 confirmation
-        CBlockIndex* pConfIndex = chainActive[pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
-        if (pConfIndex->GetBlockTime() > sigTime) {
-            LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
-                sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
-            return false;
-        }
+    if (nConfirmedTime > sigTime) {
+        LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
+            sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, nConfirmedTime);
+        return false;
     }
 
     LogPrint("masternode","mnb - Got NEW Masternode entry - %s - %lli \n", vin.prevout.hash.ToString(), sigTime);
@@ -726,7 +694,7 @@ bool CMasternodePing::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     std::string strMasterNodeSignMessage;
 
     sigTime = GetAdjustedTime();
-    std::string strMessage = vin.ToString() + blockHash.ToString() + std::to_string(sigTime);
+    std::string strMessage = GetStrMessage();
 
     if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrint("masternode","CMasternodePing::Sign() - Error: %s\n", errorMessage);
@@ -741,8 +709,13 @@ bool CMasternodePing::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     return true;
 }
 
+std::string CMasternodePing::GetStrMessage() const
+{
+    return vin.ToString() + blockHash.ToString() + std::to_string(sigTime);
+}
+
 bool CMasternodePing::VerifySignature(CPubKey& pubKeyMasternode, int &nDos) {
-	std::string strMessage = vin.ToString() + blockHash.ToString() + std::to_string(sigTime);
+	std::string strMessage = GetStrMessage();
 	std::string errorMessage = "";
 
 	if(!obfuScationSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage)){
@@ -62,6 +62,7 @@ public:
     bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true, bool fCheckSigTimeOnly = false);
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool VerifySignature(CPubKey& pubKeyMasternode, int &nDos);
+    std::string GetStrMessage() const;
     void Relay();
 
     uint256 GetHash()
@@ -192,6 +193,8 @@ public:
     }
 
     uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    // score against a block hash whose own hash (hashBlockHash) was computed by the caller
+    uint256 CalculateScore(const uint256& hashBlock, const uint256& hashBlockHash) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -218,7 +221,8 @@ public:
         READWRITE(nLastScanningErrorBlockHeight);
     }
 
-    int64_t SecondsSincePayment();
+    // nMnCount is the number of enabled masternodes, -1 to count them
+    int64_t SecondsSincePayment(int nMnCount = -1);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -281,7 +285,7 @@ public:
         return strStatus;
     }
 
-    int64_t GetLastPaid();
+    int64_t GetLastPaid(int nMnCount = -1);
     bool IsValidNetAddr();
 };
 
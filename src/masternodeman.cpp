@@ -8,7 +8,9 @@
 #include "addrman.h"
 #include "consensus/validation.h"
 #include "masternode.h"
+#include "masternode-collateral.h"
 #include "obfuscation.h"
+#include "random.h"
 #include "spork.h"
 #include "util.h"
 #include <boost/filesystem.hpp>
@@ -193,11 +195,79 @@ void DumpMasternodes()
     LogPrint("masternode","Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
+CMasternodeIndexHasher::CMasternodeIndexHasher()
+{
+    salt = GetRandHash();
+}
+
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
 }
 
+void CMasternodeMan::IndexMasternode(CMasternode& mn)
+{
+    AssertLockHeld(cs);
+
+    CIndexEntry entry;
+    entry.pmn = &mn;
+    entry.keyIDCollateral = mn.pubKeyCollateralAddress.GetID();
+    entry.keyIDMasternode = mn.pubKeyMasternode.GetID();
+    mapIndexByVin[mn.vin.prevout] = entry;
+    mapIndexByPayee.insert(make_pair(entry.keyIDCollateral, &mn));
+    mapIndexByPubKey.insert(make_pair(entry.keyIDMasternode, &mn));
+}
+
+static void EraseIndexEntry(boost::unordered_multimap<CKeyID, CMasternode*, CMasternodeIndexHasher>& mapIndex, const CKeyID& keyID, const CMasternode* pmn)
+{
+    typedef boost::unordered_multimap<CKeyID, CMasternode*, CMasternodeIndexHasher>::iterator Iter;
+    std::pair<Iter, Iter> range = mapIndex.equal_range(keyID);
+    for (Iter it = range.first; it != range.second; ++it) {
+        if (it->second == pmn) {
+            mapIndex.erase(it);
+            return;
+        }
+    }
+}
+
+void CMasternodeMan::UnindexMasternode(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+
+    boost::unordered_map<COutPoint, CIndexEntry, CMasternodeIndexHasher>::iterator it = mapIndexByVin.find(mn.vin.prevout);
+    if (it == mapIndexByVin.end() || it->second.pmn != &mn)
+        return;
+
+    EraseIndexEntry(mapIndexByPayee, it->second.keyIDCollateral, &mn);
+    EraseIndexEntry(mapIndexByPubKey, it->second.keyIDMasternode, &mn);
+    mapIndexByVin.erase(it);
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    AssertLockHeld(cs);
+
+    mapIndexByVin.clear();
+    mapIndexByPayee.clear();
+    mapIndexByPubKey.clear();
+    BOOST_FOREACH (CMasternode& mn, vMasternodes)
+        IndexMasternode(mn);
+    mapRankTables.clear();
+}
+
+void CMasternodeMan::UpdateIndexes(CMasternode& mn)
+{
+    LOCK(cs);
+
+    // only entries owned by the list are indexed
+    boost::unordered_map<COutPoint, CIndexEntry, CMasternodeIndexHasher>::iterator it = mapIndexByVin.find(mn.vin.prevout);
+    if (it == mapIndexByVin.end() || it->second.pmn != &mn)
+        return;
+
+    UnindexMasternode(mn);
+    IndexMasternode(mn);
+}
+
 bool CMasternodeMan::Add(CMasternode& mn)
 {
     LOCK(cs);
@@ -209,6 +279,8 @@ bool CMasternodeMan::Add(CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        IndexMasternode(vMasternodes.back());
+        InvalidateRankTables();
         return true;
     }
 
@@ -247,7 +319,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
-    vector<CMasternode>::iterator it = vMasternodes.begin();
+    std::list<CMasternode>::iterator it = vMasternodes.begin();
     while (it != vMasternodes.end()) {
         if ((*it).activeState == CMasternode::MASTERNODE_REMOVE ||
             (*it).activeState == CMasternode::MASTERNODE_VIN_SPENT ||
@@ -278,7 +350,9 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
                 }
             }
 
+            UnindexMasternode(*it);
             it = vMasternodes.erase(it);
+            InvalidateRankTables();
         } else {
             ++it;
         }
@@ -340,6 +414,10 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    mapIndexByVin.clear();
+    mapIndexByPayee.clear();
+    mapIndexByPubKey.clear();
+    mapRankTables.clear();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -438,12 +516,17 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
 CMasternode* CMasternodeMan::Find(const CScript& payee)
 {
     LOCK(cs);
-    CScript payee2;
 
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &mn;
+    // masternodes are paid to the P2PKH script of their collateral key
+    CTxDestination dest;
+    if (!ExtractDestination(payee, dest) || !boost::get<CKeyID>(&dest))
+        return NULL;
+
+    typedef boost::unordered_multimap<CKeyID, CMasternode*, CMasternodeIndexHasher>::iterator Iter;
+    std::pair<Iter, Iter> range = mapIndexByPayee.equal_range(boost::get<CKeyID>(dest));
+    for (Iter it = range.first; it != range.second; ++it) {
+        if (GetScriptForDestination(it->second->pubKeyCollateralAddress.GetID()) == payee)
+            return it->second;
     }
     return NULL;
 }
@@ -452,11 +535,10 @@ CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    boost::unordered_map<COutPoint, CIndexEntry, CMasternodeIndexHasher>::iterator it = mapIndexByVin.find(vin.prevout);
+    if (it == mapIndexByVin.end())
+        return NULL;
+    return it->second.pmn;
 }
 
 
@@ -464,9 +546,11 @@ CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
+    typedef boost::unordered_multimap<CKeyID, CMasternode*, CMasternodeIndexHasher>::iterator Iter;
+    std::pair<Iter, Iter> range = mapIndexByPubKey.equal_range(pubKeyMasternode.GetID());
+    for (Iter it = range.first; it != range.second; ++it) {
+        if (it->second->pubKeyMasternode == pubKeyMasternode)
+            return it->second;
     }
     return NULL;
 }
@@ -502,7 +586,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are masternodes
         if (mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(nMnCount), mn.vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -591,119 +675,146 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight,
     return winner;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const CMasternodeRankTable* CMasternodeMan::GetRankTable(int64_t nBlockHeight, int minProtocol, int nFlags)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
-    int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
-    int64_t nMasternode_Age = 0;
+    AssertLockHeld(cs);
 
-    //make sure we know about this block
+    pair<int64_t, pair<int, int> > key = make_pair(nBlockHeight, make_pair(minProtocol, nFlags));
+    std::map<pair<int64_t, pair<int, int> >, CMasternodeRankTable>::iterator it = mapRankTables.find(key);
+    if (it != mapRankTables.end() && GetTime() - it->second.nTimeCreated < MASTERNODE_RANK_CACHE_SECONDS)
+        return &it->second;
+
+    // the block hash only needs to be hashed once for all masternodes
     uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    uint256 hash2 = 0;
+    bool fHaveBlock = GetBlockHash(hash, nBlockHeight);
+    if (fHaveBlock) {
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << hash;
+        hash2 = ss.GetHash();
+    }
 
-    // scan for winner
+    CMasternodeRankTable table;
+    table.nTimeCreated = GetTime();
+    table.vecScores.reserve(vMasternodes.size());
     BOOST_FOREACH (CMasternode& mn, vMasternodes) {
         if (mn.protocolVersion < minProtocol) {
             LogPrint("masternode","Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
             continue;                                                       // Skip obsolete versions
         }
 
-        if (IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
-            nMasternode_Age = GetAdjustedTime() - mn.sigTime;
-            if ((nMasternode_Age) < nMasternode_Min_Age) {
+        if ((nFlags & RANK_MIN_AGE) && IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
+            int64_t nMasternode_Age = GetAdjustedTime() - mn.sigTime;
+            if (nMasternode_Age < MN_WINNER_MINIMUM_AGE) {
                 if (fDebug) LogPrint("masternode","Skipping just activated Masternode. Age: %ld\n", nMasternode_Age);
                 continue;                                                   // Skip masternodes younger than (default) 1 hour
             }
         }
-        if (fOnlyActive) {
+
+        if (nFlags & (RANK_ONLY_ACTIVE | RANK_DISABLED_LAST)) {
             mn.Check();
-            if (!mn.IsEnabled()) continue;
+            if (!mn.IsEnabled()) {
+                if (nFlags & RANK_DISABLED_LAST)
+                    table.vecScores.push_back(make_pair(9999, mn.vin));
+                continue;
+            }
         }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
 
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
+        // an unknown block scores every masternode 0, same as CalculateScore()
+        int64_t n2 = fHaveBlock ? mn.CalculateScore(hash, hash2).GetCompact(false) : 0;
+        table.vecScores.push_back(make_pair(n2, mn.vin));
     }
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
+    sort(table.vecScores.rbegin(), table.vecScores.rend(), CompareScoreTxIn());
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecMasternodeScores) {
-        rank++;
-        if (s.second.prevout == vin.prevout) {
-            return rank;
-        }
-    }
+    for (unsigned int i = 0; i < table.vecScores.size(); i++)
+        table.mapRanks.insert(make_pair(table.vecScores[i].second.prevout, i + 1));
+
+    // blocks we don't know yet would make every score 0, rebuild those on the next call
+    if (!fHaveBlock)
+        table.nTimeCreated = 0;
 
-    return -1;
+    if (mapRankTables.size() >= MASTERNODE_RANK_CACHE_SIZE && !mapRankTables.count(key))
+        mapRankTables.erase(mapRankTables.begin()); // lowest height
+
+    CMasternodeRankTable& cached = mapRankTables[key];
+    cached = table;
+    return &cached;
 }
 
-std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
+void CMasternodeMan::InvalidateRankTables()
 {
-    std::vector<pair<int64_t, CMasternode> > vecMasternodeScores;
-    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
+    LOCK(cs);
+    mapRankTables.clear();
+}
+
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
 
     //make sure we know about this block
     uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
+    if (!GetBlockHash(hash, nBlockHeight)) return -1;
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        mn.Check();
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, RANK_MIN_AGE | (fOnlyActive ? RANK_ONLY_ACTIVE : 0));
+    std::map<COutPoint, int>::const_iterator it = pTable->mapRanks.find(vin.prevout);
+    if (it == pTable->mapRanks.end())
+        return -1;
 
-        if (mn.protocolVersion < minProtocol) continue;
+    return it->second;
+}
 
-        if (!mn.IsEnabled()) {
-            vecMasternodeScores.push_back(make_pair(9999, mn));
-            continue;
-        }
+std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
+{
+    LOCK(cs);
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
 
-        vecMasternodeScores.push_back(make_pair(n2, mn));
-    }
+    //make sure we know about this block
+    uint256 hash = 0;
+    if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, RANK_DISABLED_LAST);
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode) & s, vecMasternodeScores) {
+    BOOST_FOREACH (const PAIRTYPE(int64_t, CTxIn) & s, pTable->vecScores) {
         rank++;
-        vecMasternodeRanks.push_back(make_pair(rank, s.second));
+        CMasternode* pmn = Find(s.second);
+        if (pmn)
+            vecMasternodeRanks.push_back(make_pair(rank, *pmn));
     }
 
     return vecMasternodeRanks;
 }
 
-CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+std::vector<pair<int, CTxIn> > CMasternodeMan::GetMasternodeRankList(int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        if (mn.protocolVersion < minProtocol) continue;
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled()) continue;
-        }
+    std::vector<pair<int, CTxIn> > vecRanks;
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    //make sure we know about this block
+    uint256 hash = 0;
+    if (!GetBlockHash(hash, nBlockHeight)) return vecRanks;
 
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, RANK_MIN_AGE | (fOnlyActive ? RANK_ONLY_ACTIVE : 0));
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
+    vecRanks.reserve(pTable->vecScores.size());
+    for (unsigned int i = 0; i < pTable->vecScores.size(); i++)
+        vecRanks.push_back(make_pair(i + 1, pTable->vecScores[i].second));
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecMasternodeScores) {
-        rank++;
-        if (rank == nRank) {
-            return Find(s.second);
-        }
-    }
+    return vecRanks;
+}
 
-    return NULL;
+CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
+
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, fOnlyActive ? RANK_ONLY_ACTIVE : 0);
+    if (nRank < 1 || nRank > (int)pTable->vecScores.size())
+        return NULL;
+
+    return Find(pTable->vecScores[nRank - 1].second);
 }
 
 void CMasternodeMan::ProcessMasternodeConnections()
@@ -748,15 +859,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             return;
         }
 
-        // make sure the vout that was signed is related to the transaction that spawned the Masternode
-        //  - this is expensive, so it's only done once per Masternode
-        if (!obfuScationSigner.IsVinAssociatedWithPubkey(mnb.vin, mnb.pubKeyCollateralAddress)) {
-            LogPrintf("CMasternodeMan::ProcessMessage() : mnb - Got mismatched pubkey and vin\n");
-            Misbehaving(pfrom->GetId(), 33);
-            return;
-        }
-
-        // make sure it's still unspent
+        // make sure the collateral is unspent and paid to the key that signed the mnb
         //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
         if (mnb.CheckInputsAndAdd(nDoS)) {
             // use this as a peer
@@ -934,7 +1037,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         if (pmn != NULL) {
             // count == -1 when it's a new entry
             //   e.g. We don't want the entry relayed/time updated when we're syncing the list
-            // mn.pubkey = pubkey, IsVinAssociatedWithPubkey is validated once below,
+            // mn.pubkey = pubkey, the collateral check validates it once below,
             //   after that they just need to match
             if (count == -1 && pmn->pubKeyCollateralAddress == pubkey && (GetAdjustedTime() - pmn->nLastDsee > MASTERNODE_MIN_MNB_SECONDS)) {
                 if (pmn->protocolVersion > GETHEADERS_VERSION && sigTime - pmn->lastPing.sigTime < MASTERNODE_MIN_MNB_SECONDS) return;
@@ -948,6 +1051,8 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                         pmn->addr = addr;
                         //fake ping
                         pmn->lastPing = CMasternodePing(vin);
+                        UpdateIndexes(*pmn);
+                        InvalidateRankTables();
                     }
                     pmn->nLastDsee = sigTime;
                     pmn->Check();
@@ -970,35 +1075,22 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             return;
         }
         mapSeenDsee.insert(make_pair(vin.prevout, pubkey));
-        // make sure the vout that was signed is related to the transaction that spawned the Masternode
-        //  - this is expensive, so it's only done once per Masternode
-        if (!obfuScationSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
+
+        // make sure the vout that was signed is the unspent collateral of the Masternode
+        //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
+        int64_t nConfirmedTime = 0;
+        CollateralStatus status = masternodeCollateral.Check(vin.prevout, pubkey, nConfirmedTime);
+        if (status == COLLATERAL_BUSY) return;
+        if (status == COLLATERAL_INVALID_AMOUNT || status == COLLATERAL_INVALID_PUBKEY) {
             LogPrintf("CMasternodeMan::ProcessMessage() : dsee - Got mismatched pubkey and vin\n");
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
 
-
         LogPrint("masternode", "dsee - Got NEW OLD Masternode entry %s\n", vin.prevout.hash.ToString());
 
-        // make sure it's still unspent
-        //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
-
-        CValidationState state;
-        CMutableTransaction tx = CMutableTransaction();
-        CTxOut vout = CTxOut(999.99 * COIN, obfuScationPool.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-
-        bool fAcceptable = false;
-        {
-            TRY_LOCK(cs_main, lockMain);
-            if (!lockMain) return;
-            fAcceptable = AcceptableInputs(mempool, state, CTransaction(tx), false, NULL);
-        }
-
-        if (fAcceptable) {
-            if (GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS) {
+        if (status != COLLATERAL_SPENT) {
+            if (status == COLLATERAL_IMMATURE) {
                 LogPrintf("CMasternodeMan::ProcessMessage() : dsee - Input must have least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
                 Misbehaving(pfrom->GetId(), 20);
                 return;
@@ -1006,18 +1098,10 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
             // verify that sig time is legit in past
             // should be at least not earlier than block when 1000 BARE tx got MASTERNODE_MIN_CONFIRMATIONS
-            uint256 hashBlock = 0;
-            CTransaction tx2;
-            GetTransaction(vin.prevout.hash, tx2, hashBlock, true);
-            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-            if (mi != mapBlockIndex.end() && (*mi).second) {
-                CBlockIndex* pMNIndex = (*mi).second;                                                        // block for 1000 BARE tx -> 1 confirmation
-                CBlockIndex* pConfIndex = chainActive[pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
-                if (pConfIndex->GetBlockTime() > sigTime) {
-                    LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
-                        sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
-                    return;
-                }
+            if (nConfirmedTime > sigTime) {
+                LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
+                    sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, nConfirmedTime);
+                return;
             }
 
             // use this as a peer
@@ -1048,15 +1132,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                         pnode->PushMessage(NetMsgType::DSEE, vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
             }
         } else {
-            LogPrint("masternode","dsee - Rejected Masternode entry %s\n", vin.prevout.hash.ToString());
-
-            int nDoS = 0;
-            if (state.IsInvalid(nDoS)) {
-                LogPrint("masternode","dsee - %s from %i %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(),
-                    pfrom->GetId(), pfrom->cleanSubVer.c_str());
-                if (nDoS > 0)
-                    Misbehaving(pfrom->GetId(), nDoS);
-            }
+            LogPrint("masternode","dsee - Rejected Masternode entry %s (collateral spent)\n", vin.prevout.hash.ToString());
         }
     }
 
@@ -1135,11 +1211,13 @@ void CMasternodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
 
-    vector<CMasternode>::iterator it = vMasternodes.begin();
+    std::list<CMasternode>::iterator it = vMasternodes.begin();
     while (it != vMasternodes.end()) {
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
+            UnindexMasternode(*it);
             vMasternodes.erase(it);
+            InvalidateRankTables();
             break;
         }
         ++it;
@@ -1159,7 +1237,10 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         CMasternode mn(mnb);
         Add(mn);
     } else {
-    	pmn->UpdateFromNewBroadcast(mnb);
+    	if (pmn->UpdateFromNewBroadcast(mnb)) {
+            UpdateIndexes(*pmn);
+            InvalidateRankTables();
+        }
     }
 }
 
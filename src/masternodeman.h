@@ -14,11 +14,19 @@
 #include "sync.h"
 #include "util.h"
 
+#include <list>
+
+#include <boost/unordered_map.hpp>
+
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
 
 #define MINIMUM_PROTOCOL_VERSION_OLD_PING 70003
 
+// how long a cached rank table may be reused, masternode states are only rechecked this often anyway
+#define MASTERNODE_RANK_CACHE_SECONDS MASTERNODE_CHECK_SECONDS
+#define MASTERNODE_RANK_CACHE_SIZE 32
+
 using namespace std;
 
 class CMasternodeMan;
@@ -50,8 +58,52 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
+/** Masternodes ordered by score for one block height
+ */
+class CMasternodeRankTable
+{
+public:
+    int64_t nTimeCreated;
+    // (score, vin) sorted from best to worst
+    std::vector<pair<int64_t, CTxIn> > vecScores;
+    // 1-based rank of every collateral in vecScores
+    std::map<COutPoint, int> mapRanks;
+
+    CMasternodeRankTable() : nTimeCreated(0) {}
+};
+
+/** Salted hasher for the CMasternodeMan lookup indexes
+ */
+class CMasternodeIndexHasher
+{
+private:
+    uint256 salt;
+
+public:
+    CMasternodeIndexHasher();
+
+    size_t operator()(const COutPoint& outpoint) const
+    {
+        return outpoint.hash.GetHash(salt) ^ outpoint.n;
+    }
+
+    size_t operator()(const CKeyID& keyID) const
+    {
+        uint256 key = 0;
+        memcpy(key.begin(), keyID.begin(), keyID.size());
+        return key.GetHash(salt);
+    }
+};
+
 class CMasternodeMan
 {
+public:
+    enum RankFlags {
+        RANK_ONLY_ACTIVE = (1 << 0),   // skip masternodes that are not enabled
+        RANK_MIN_AGE = (1 << 1),       // skip masternodes younger than MN_WINNER_MINIMUM_AGE once payments are enforced
+        RANK_DISABLED_LAST = (1 << 2), // keep disabled masternodes, ranked after all enabled ones
+    };
+
 private:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -59,14 +111,32 @@ private:
     // critical section to protect the inner data structures specifically on messaging
     mutable CCriticalSection cs_process_message;
 
-    // map to hold all MNs
-    std::vector<CMasternode> vMasternodes;
+    // list to hold all MNs, elements never move so pointers stay valid until the entry is removed
+    std::list<CMasternode> vMasternodes;
+
+    // lookup indexes into vMasternodes, keyed by collateral outpoint, collateral address and masternode key
+    struct CIndexEntry {
+        CMasternode* pmn;
+        CKeyID keyIDCollateral;
+        CKeyID keyIDMasternode;
+    };
+    boost::unordered_map<COutPoint, CIndexEntry, CMasternodeIndexHasher> mapIndexByVin;
+    boost::unordered_multimap<CKeyID, CMasternode*, CMasternodeIndexHasher> mapIndexByPayee;
+    boost::unordered_multimap<CKeyID, CMasternode*, CMasternodeIndexHasher> mapIndexByPubKey;
+
+    void IndexMasternode(CMasternode& mn);
+    void UnindexMasternode(const CMasternode& mn);
+    void RebuildIndexes();
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mWeAskedForMasternodeList;
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
+    // rank tables by (block height, (min protocol, RankFlags)), dropped whenever the list changes
+    std::map<pair<int64_t, pair<int, int> >, CMasternodeRankTable> mapRankTables;
+
+    const CMasternodeRankTable* GetRankTable(int64_t nBlockHeight, int minProtocol, int nFlags);
 
 public:
     // Keep track of all broadcasts I've seen
@@ -83,7 +153,16 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
         LOCK(cs);
-        READWRITE(vMasternodes);
+        // stored as a vector to keep mncache.dat compatible
+        if (ser_action.ForRead()) {
+            std::vector<CMasternode> vecMasternodes;
+            READWRITE(vecMasternodes);
+            vMasternodes.assign(vecMasternodes.begin(), vecMasternodes.end());
+            RebuildIndexes();
+        } else {
+            std::vector<CMasternode> vecMasternodes(vMasternodes.begin(), vMasternodes.end());
+            READWRITE(vecMasternodes);
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -111,6 +190,12 @@ public:
     /// Clear Masternode vector
     void Clear();
 
+    /// Drop cached rank tables after the list changed
+    void InvalidateRankTables();
+
+    /// Refresh the key indexes of an entry after its keys were changed in place
+    void UpdateIndexes(CMasternode& mn);
+
     int CountEnabled(int protocolVersion = -1);
 
     void CountNetworks(int protocolVersion, int& ipv4, int& ipv6, int& onion);
@@ -134,10 +219,12 @@ public:
     std::vector<CMasternode> GetFullMasternodeVector()
     {
         Check();
-        return vMasternodes;
+        LOCK(cs);
+        return std::vector<CMasternode>(vMasternodes.begin(), vMasternodes.end());
     }
 
     std::vector<pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol = 0);
+    std::vector<pair<int, CTxIn> > GetMasternodeRankList(int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
     int GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
     CMasternode* GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
 
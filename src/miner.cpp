@@ -29,8 +29,14 @@
 #include "masternode-payments.h"
 #include "spork.h"
 
+#include <boost/bind.hpp>
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
+
+#include <limits>
 
 using namespace std;
 
@@ -41,52 +47,654 @@ using namespace std;
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. Block assembly therefore selects whole
+// packages - a transaction together with its not yet included in-mempool
+// ancestors - ordered by the fee rate of the package. Once a package has
+// been added, the ancestor state of its in-mempool descendants no longer
+// reflects what they would add to the block; CTxMemPoolModifiedEntry tracks
+// those descendants with the already included ancestors subtracted.
 //
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCostWithAncestors = entry->GetSigOpCostWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    int64_t nSigOpCostWithAncestors;
+};
+
+/** Sort modified entries by ancestor fee rate, highest first (see CompareTxMemPoolEntryByAncestorFee) */
+struct CompareModifiedEntryByAncestorFee {
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2)
+            return a.iter->GetTx().GetHash() < b.iter->GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+struct CompareTxIterByAddress {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+/** A transaction has more in-mempool ancestors than any of its parents */
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+struct CompareTxIterByAncestorFee {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const
+    {
+        return entry.iter;
+    }
+};
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareTxIterByAddress>,
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntryByAncestorFee> > >
+    indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion {
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator()(CTxMemPoolModifiedEntry& e)
     {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCostWithAncestors -= iter->GetSigOpCost();
     }
+
+    CTxMemPool::txiter iter;
 };
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockCost = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+// Coin age priority of a mempool entry, used by the -blockprioritysize pass
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+struct TxCoinAgePriorityCompare {
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByAncestorFee()(*b.second, *a.second); // Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
+
+static const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+
+// Selections older than this many seconds are rebuilt from scratch
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 60;
+
+// Give up on filling the block after this many packages in a row did not fit
+static const int MAX_CONSECUTIVE_FAILURES = 1000;
+
+/** Order a package so that every transaction follows its in-mempool parents */
+static void SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries)
 {
-    bool byFee;
+    sortedEntries.clear();
+    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
+    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+}
 
+/**
+ * Check that every transaction of an ordered package may go into a block at
+ * nHeight on top of view. On success the package's coins are applied to view
+ * and the fee of each transaction is returned in vFees.
+ */
+static bool TestPackageForBlock(const std::vector<CTxMemPool::txiter>& sortedEntries, CCoinsViewCache& view, int nHeight, bool fIncludeWitness, std::vector<CAmount>& vFees)
+{
+    CCoinsViewCache viewPackage(&view);
+    vFees.clear();
+    BOOST_FOREACH (CTxMemPool::txiter it, sortedEntries) {
+        const CTransaction& tx = it->GetTx();
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+            return false;
+        if (!fIncludeWitness && !tx.wit.IsNull())
+            return false; // cannot accept witness transactions into a non-witness block
+        if (!viewPackage.HaveInputs(tx))
+            return false;
+
+        CAmount nTxFees = viewPackage.GetValueIn(tx) - tx.GetValueOut();
+
+        // Note that flags: we don't want to set mempool/IsStandard()
+        // policy here, but we still have to ensure that the block we
+        // create only contains transactions that are valid in new blocks.
+        CValidationState state;
+        if (!CheckInputs(tx, state, viewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+            return false;
+
+        CTxUndo txundo;
+        UpdateCoins(tx, state, viewPackage, txundo, nHeight);
+        vFees.push_back(nTxFees);
+    }
+    viewPackage.Flush();
+    return true;
+}
+
+/**
+ * Add the in-mempool descendants of the newly included entries to
+ * mapModifiedTx, with the included ancestors removed from their package.
+ */
+static void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, const CTxMemPool::setEntries& inBlock, indexed_modified_transaction_set& mapModifiedTx)
+{
+    BOOST_FOREACH (const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        BOOST_FOREACH (CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc) || inBlock.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                update_for_parent_inclusion updater(it);
+                updater(modEntry);
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
+/**
+ * Long-lived transaction selection for CreateNewBlock.
+ *
+ * The transactions selected on top of the current tip are kept between calls,
+ * together with the coins view they were checked against. Mempool
+ * notifications tell the builder which entries arrived since the last
+ * template and whether any selected entry left the pool. As long as the tip,
+ * the block limits and the selected set are unchanged and the last block
+ * still had room, a new template only has to place the newly arrived
+ * packages. Anything else, and every BLOCK_TEMPLATE_REBUILD_INTERVAL seconds,
+ * falls back to a full selection.
+ *
+ * Selection state is only touched with cs_main and mempool.cs held; the
+ * notification state and statistics are guarded by cs.
+ */
+class CBlockTemplateBuilder
+{
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    struct Limits {
+        unsigned int nBlockMaxCost;
+        unsigned int nBlockMaxSize;
+        unsigned int nBlockPrioritySize;
+        unsigned int nBlockMinSize;
+        bool fNeedSizeAccounting;
+        bool fIncludeWitness;
+
+        bool operator==(const Limits& other) const
+        {
+            return nBlockMaxCost == other.nBlockMaxCost && nBlockMaxSize == other.nBlockMaxSize &&
+                   nBlockPrioritySize == other.nBlockPrioritySize && nBlockMinSize == other.nBlockMinSize &&
+                   fNeedSizeAccounting == other.fNeedSizeAccounting && fIncludeWitness == other.fIncludeWitness;
+        }
+    };
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    CBlockTemplateBuilder() : fConnected(false), fInvalidated(true), pviewBase(NULL), nLastFullBuild(0)
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+        memset(&stats, 0, sizeof(stats));
+        ResetSelection();
+    }
+
+    ~CBlockTemplateBuilder()
+    {
+        connAdded.disconnect();
+        connRemoved.disconnect();
+        connPrioritised.disconnect();
+    }
+
+    /**
+     * Append the selected mempool transactions for a block on top of
+     * pindexPrev to pblocktemplate. Returns whether a full selection was
+     * needed.
+     */
+    bool Fill(CBlockTemplate* pblocktemplate, const CBlockIndex* pindexPrev, const Limits& limitsIn, CAmount& nFeesOut, int64_t& nBlockCostOut, int64_t& nBlockSigOpsCostOut, unsigned int& nBlockTxOut);
+
+    /** Drop the selection, e.g. after the template failed validation */
+    void Invalidate()
+    {
+        LOCK(cs);
+        fInvalidated = true;
+    }
+
+    void RecordBuild(bool fFullBuild, int64_t nMicros, unsigned int nTx)
+    {
+        LOCK(cs);
+        stats.nBuilds++;
+        stats.nTotalBuildMicros += nMicros;
+        stats.nLastBuildMicros = nMicros;
+        stats.nMaxBuildMicros = std::max(stats.nMaxBuildMicros, nMicros);
+        stats.nLastBlockTx = nTx;
+        if (fFullBuild) {
+            stats.nFullBuilds++;
+            stats.nLastFullBuildMicros = nMicros;
         }
     }
+
+    void GetStats(CBlockTemplateStats& statsOut)
+    {
+        LOCK(cs);
+        statsOut = stats;
+    }
+
+private:
+    CCriticalSection cs;
+    bool fConnected;
+    boost::signals2::connection connAdded;
+    boost::signals2::connection connRemoved;
+    boost::signals2::connection connPrioritised;
+    //! Entries added to the mempool since the last template
+    std::set<uint256> setPendingAdded;
+    //! Set when a selected entry leaves the pool or a fee delta changes
+    bool fInvalidated;
+    CBlockTemplateStats stats;
+
+    // Selection state for the block on top of hashTip
+    uint256 hashTip;
+    Limits limits;
+    CCoinsView* pviewBase;
+    int64_t nLastFullBuild;
+    boost::scoped_ptr<CCoinsViewCache> pview;
+    std::vector<CTxMemPool::txiter> vSelected;
+    std::vector<CAmount> vSelectedFees;
+    CTxMemPool::setEntries inBlock;
+    std::set<uint256> setSelectedHashes;
+    bool fFull; //!< a package was left out for lack of room
+    uint64_t nBlockSize;
+    int64_t nBlockCost;
+    int64_t nBlockSigOpsCost;
+    CAmount nFees;
+
+    void ResetSelection()
+    {
+        pview.reset();
+        vSelected.clear();
+        vSelectedFees.clear();
+        inBlock.clear();
+        setSelectedHashes.clear();
+        fFull = false;
+        nBlockSize = 1000;
+        nBlockCost = nBlockSize * WITNESS_SCALE_FACTOR;
+        nBlockSigOpsCost = 400;
+        nFees = 0;
+    }
+
+    bool PackageFits(uint64_t packageSize, int64_t packageSigOpsCost) const
+    {
+        if (nBlockCost + (int64_t)packageSize * WITNESS_SCALE_FACTOR >= limits.nBlockMaxCost)
+            return false;
+        if (limits.fNeedSizeAccounting && nBlockSize + packageSize >= limits.nBlockMaxSize)
+            return false;
+        return nBlockSigOpsCost + packageSigOpsCost < MAX_BLOCK_SIGOPS_COST;
+    }
+
+    void AddToBlock(const std::vector<CTxMemPool::txiter>& sortedEntries, const std::vector<CAmount>& vFees, bool fPrintPriority);
+    void AddPriorityTxs(int nHeight, bool fPrintPriority);
+    void AddPackageTxs(int nHeight, bool fPrintPriority);
+    bool AddNewPackages(const std::set<uint256>& setAdded, int nHeight, bool fPrintPriority);
+
+    void TransactionAdded(const CTransaction& tx)
+    {
+        LOCK(cs);
+        setPendingAdded.insert(tx.GetHash());
+    }
+
+    void TransactionRemoved(const CTransaction& tx)
+    {
+        LOCK(cs);
+        const uint256 hash = tx.GetHash();
+        setPendingAdded.erase(hash);
+        if (setSelectedHashes.count(hash))
+            fInvalidated = true;
+    }
+
+    void TransactionPrioritised(const uint256& hash)
+    {
+        LOCK(cs);
+        fInvalidated = true;
+    }
 };
 
+static CBlockTemplateBuilder templateBuilder;
+
+void GetBlockTemplateStats(CBlockTemplateStats& stats)
+{
+    templateBuilder.GetStats(stats);
+}
+
+void CBlockTemplateBuilder::AddToBlock(const std::vector<CTxMemPool::txiter>& sortedEntries, const std::vector<CAmount>& vFees, bool fPrintPriority)
+{
+    for (size_t i = 0; i < sortedEntries.size(); i++) {
+        CTxMemPool::txiter it = sortedEntries[i];
+        vSelected.push_back(it);
+        vSelectedFees.push_back(vFees[i]);
+        inBlock.insert(it);
+        setSelectedHashes.insert(it->GetTx().GetHash());
+        nBlockSize += it->GetTxSize();
+        nBlockCost += it->GetTxSize() * WITNESS_SCALE_FACTOR;
+        nBlockSigOpsCost += it->GetSigOpCost();
+        nFees += vFees[i];
+
+        if (fPrintPriority) {
+            LogPrintf("fee %s txid %s\n",
+                CFeeRate(it->GetModifiedFee(), it->GetTxSize()).ToString(), it->GetTx().GetHash().ToString());
+        }
+    }
+}
+
+// Fill nBlockPrioritySize bytes with the highest coin age priority
+// transactions, regardless of the fees they pay
+void CBlockTemplateBuilder::AddPriorityTxs(int nHeight, bool fPrintPriority)
+{
+    std::vector<TxCoinAgePriority> vecPriority;
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi) {
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+
+    // Transactions waiting for an in-mempool parent to be included
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    CTxMemPool::setEntries failedTx;
+    std::vector<CTxMemPool::txiter> sortedEntries;
+    std::vector<CAmount> vFees;
+    TxCoinAgePriorityCompare comparer;
+    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+
+    while (!vecPriority.empty()) {
+        // Take highest priority transaction off the priority queue:
+        double dPriority = vecPriority.front().first;
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        vecPriority.pop_back();
+
+        if (inBlock.count(iter) || failedTx.count(iter))
+            continue;
+
+        bool fParentsInBlock = true;
+        BOOST_FOREACH (CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter)) {
+            if (!inBlock.count(parent)) {
+                fParentsInBlock = false;
+                break;
+            }
+        }
+        if (!fParentsInBlock) {
+            waitPriMap.insert(std::make_pair(iter, dPriority));
+            continue;
+        }
+
+        // Stop once past the priority size or out of high-priority transactions
+        if (nBlockSize + iter->GetTxSize() >= limits.nBlockPrioritySize || !AllowFree(dPriority))
+            break;
+
+        if (!PackageFits(iter->GetTxSize(), iter->GetSigOpCost()))
+            continue;
+
+        sortedEntries.assign(1, iter);
+        if (!TestPackageForBlock(sortedEntries, *pview, nHeight, limits.fIncludeWitness, vFees)) {
+            failedTx.insert(iter);
+            continue;
+        }
+        if (fPrintPriority)
+            LogPrintf("priority %.1f txid %s\n", dPriority, iter->GetTx().GetHash().ToString());
+        AddToBlock(sortedEntries, vFees, fPrintPriority);
+
+        // Add transactions that depend on this one to the priority queue
+        BOOST_FOREACH (CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter)) {
+            std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator wpiter = waitPriMap.find(child);
+            if (wpiter != waitPriMap.end()) {
+                vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                waitPriMap.erase(wpiter);
+            }
+        }
+    }
+}
+
+// Fill the rest of the block with packages, highest ancestor fee rate first.
+// mapModifiedTx holds entries whose ancestors are already partly in the
+// block; they compete with the untouched mapTx entries.
+void CBlockTemplateBuilder::AddPackageTxs(int nHeight, bool fPrintPriority)
+{
+    indexed_modified_transaction_set mapModifiedTx;
+    UpdatePackagesForAdded(inBlock, CTxMemPool::setEntries(), mapModifiedTx);
+
+    CTxMemPool::setEntries failedTx;
+    std::vector<CTxMemPool::txiter> sortedEntries;
+    std::vector<CAmount> vFees;
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    int nConsecutiveFailed = 0;
+
+    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
+        // Skip entries already handled, or tracked with reduced state in mapModifiedTx
+        if (mi != mempool.mapTx.get<ancestor_score>().end()) {
+            CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+            if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it)) {
+                ++mi;
+                continue;
+            }
+        }
+
+        // Pick the better of the next mapTx entry and the best modified entry
+        CTxMemPool::txiter iter;
+        bool fUsingModified = false;
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                CompareModifiedEntryByAncestorFee()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                ++mi;
+            }
+        }
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        int64_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            packageSigOpsCost = modit->nSigOpCostWithAncestors;
+        }
+
+        // Skip low fee packages once we're past the minimum block size;
+        // everything left has an even lower package fee rate
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= limits.nBlockMinSize)
+            break;
+
+        if (!PackageFits(packageSize, packageSigOpsCost)) {
+            fFull = true;
+            if (fUsingModified) {
+                // This entry only gets smaller as more ancestors are
+                // included, but don't keep retrying it
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
+            }
+            if (++nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockCost > (int64_t)limits.nBlockMaxCost - 4000)
+                break; // Give up if we're close to full and haven't succeeded in a while
+            continue;
+        }
+
+        CTxMemPool::setEntries ancestors;
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end();) {
+            if (inBlock.count(*ait))
+                ancestors.erase(ait++);
+            else
+                ++ait;
+        }
+        ancestors.insert(iter);
+
+        SortForBlock(ancestors, sortedEntries);
+        if (!TestPackageForBlock(sortedEntries, *pview, nHeight, limits.fIncludeWitness, vFees)) {
+            if (fUsingModified)
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+            failedTx.insert(iter);
+            continue;
+        }
+        nConsecutiveFailed = 0;
+
+        AddToBlock(sortedEntries, vFees, fPrintPriority);
+        BOOST_FOREACH (CTxMemPool::txiter it, sortedEntries)
+            mapModifiedTx.erase(it);
+
+        UpdatePackagesForAdded(ancestors, inBlock, mapModifiedTx);
+    }
+}
+
+// Place the packages of entries that arrived since the last template on top
+// of the kept selection. Returns false when the block has no room left for
+// them, in which case only a full selection gives the best block.
+bool CBlockTemplateBuilder::AddNewPackages(const std::set<uint256>& setAdded, int nHeight, bool fPrintPriority)
+{
+    std::vector<CTxMemPool::txiter> vAdded;
+    vAdded.reserve(setAdded.size());
+    BOOST_FOREACH (const uint256& hash, setAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it != mempool.mapTx.end())
+            vAdded.push_back(it);
+    }
+    std::sort(vAdded.begin(), vAdded.end(), CompareTxIterByAncestorFee());
+
+    std::vector<CTxMemPool::txiter> sortedEntries;
+    std::vector<CAmount> vFees;
+    BOOST_FOREACH (CTxMemPool::txiter iter, vAdded) {
+        if (inBlock.count(iter))
+            continue; // already placed as the ancestor of a better package
+
+        CTxMemPool::setEntries ancestors;
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        ancestors.insert(iter);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOpsCost = 0;
+        for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end();) {
+            if (inBlock.count(*ait)) {
+                ancestors.erase(ait++);
+                continue;
+            }
+            packageSize += (*ait)->GetTxSize();
+            packageFees += (*ait)->GetModifiedFee();
+            packageSigOpsCost += (*ait)->GetSigOpCost();
+            ++ait;
+        }
+
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= limits.nBlockMinSize)
+            continue;
+        if (!PackageFits(packageSize, packageSigOpsCost))
+            return false;
+
+        SortForBlock(ancestors, sortedEntries);
+        if (!TestPackageForBlock(sortedEntries, *pview, nHeight, limits.fIncludeWitness, vFees))
+            continue;
+        AddToBlock(sortedEntries, vFees, fPrintPriority);
+    }
+    return true;
+}
+
+bool CBlockTemplateBuilder::Fill(CBlockTemplate* pblocktemplate, const CBlockIndex* pindexPrev, const Limits& limitsIn, CAmount& nFeesOut, int64_t& nBlockCostOut, int64_t& nBlockSigOpsCostOut, unsigned int& nBlockTxOut)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    if (!fConnected) {
+        connAdded = mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateBuilder::TransactionAdded, this, _1));
+        connRemoved = mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateBuilder::TransactionRemoved, this, _1));
+        connPrioritised = mempool.NotifyEntryPrioritised.connect(boost::bind(&CBlockTemplateBuilder::TransactionPrioritised, this, _1));
+        fConnected = true;
+    }
+
+    const int nHeight = pindexPrev->nHeight + 1;
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+
+    std::set<uint256> setAdded;
+    bool fRebuild;
+    {
+        LOCK(cs);
+        setAdded.swap(setPendingAdded);
+        fRebuild = fInvalidated || hashTip != pindexPrev->GetBlockHash() || pviewBase != pcoinsTip ||
+                   !(limits == limitsIn) || GetTime() - nLastFullBuild > BLOCK_TEMPLATE_REBUILD_INTERVAL ||
+                   (fFull && !setAdded.empty());
+        fInvalidated = false;
+    }
+
+    if (!fRebuild && !setAdded.empty() && !AddNewPackages(setAdded, nHeight, fPrintPriority))
+        fRebuild = true;
+
+    if (fRebuild) {
+        ResetSelection();
+        hashTip = pindexPrev->GetBlockHash();
+        limits = limitsIn;
+        pviewBase = pcoinsTip;
+        pview.reset(new CCoinsViewCache(pcoinsTip));
+        nLastFullBuild = GetTime();
+
+        if (limits.nBlockPrioritySize > 0)
+            AddPriorityTxs(nHeight, fPrintPriority);
+        AddPackageTxs(nHeight, fPrintPriority);
+    }
+
+    CBlock* pblock = &pblocktemplate->block;
+    for (size_t i = 0; i < vSelected.size(); i++) {
+        pblock->vtx.push_back(vSelected[i]->GetTx());
+        pblocktemplate->vTxFees.push_back(vSelectedFees[i]);
+        pblocktemplate->vTxSigOpsCost.push_back(vSelected[i]->GetSigOpCost());
+    }
+    nFeesOut = nFees;
+    nBlockCostOut = nBlockCost;
+    nBlockSigOpsCostOut = nBlockSigOpsCost;
+    nBlockTxOut = vSelected.size();
+    return fRebuild;
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -206,184 +814,22 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
     {
         LOCK2(cs_main, mempool.cs);
 
+        int64_t nTimeStart = GetTimeMicros();
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        int64_t nBlockSigOpsCost = 400;
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-
-            // Legacy limits on sigOps:
-            int64_t nTxSigOpsCost = mi->second.GetSigOpCost();
-            if (nBlockSigOpsCost + nTxSigOpsCost >= MAX_BLOCK_SIGOPS_COST)
-                continue;
-            
-            nBlockSigOpsCost += nTxSigOpsCost;
-            pblocktemplate->vTxSigOpsCost.push_back(nTxSigOpsCost);
-
-            for (const CTxIn& txin : tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // zBARE spends can have very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = fNeedSizeAccounting ? ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) : 0;
-            int64_t nTxCost = mi->second.GetTxCost();
-            dPriority = tx.ComputePriority(dPriority, nTxCost);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        int64_t nBlockCost = nBlockSize * WITNESS_SCALE_FACTOR;
-        int64_t nBlockTx = 0;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            int64_t nTxCost = nTxSize * WITNESS_SCALE_FACTOR;
+        CBlockTemplateBuilder::Limits limits;
+        limits.nBlockMaxCost = nBlockMaxCost;
+        limits.nBlockMaxSize = nBlockMaxSize;
+        limits.nBlockPrioritySize = nBlockPrioritySize;
+        limits.nBlockMinSize = nBlockMinSize;
+        limits.fNeedSizeAccounting = fNeedSizeAccounting;
+        limits.fIncludeWitness = fIncludeWitness;
 
-            if (!fIncludeWitness && !tx.wit.IsNull())
-                continue; // cannot accept witness transactions into a non-witness block
-
-            if (nBlockCost + nTxCost >= nBlockMaxCost)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockCost + nTxCost >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            nBlockCost += nTxCost;
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nFees += nTxFees;
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        int64_t nBlockCost = 0;
+        int64_t nBlockSigOpsCost = 0;
+        unsigned int nBlockTx = 0;
+        bool fFullBuild = templateBuilder.Fill(pblocktemplate.get(), pindexPrev, limits, nFees, nBlockCost, nBlockSigOpsCost, nBlockTx);
 
         if (!fProofOfStake) {
             //Masternode and general budget payments
@@ -434,11 +880,20 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         }
 
 
-        CValidationState state;
-        if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
-            mempool.clear();
-            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, state.GetRejectReason()));
+        // Every transaction of an incremental build was checked against the
+        // kept coins view when it was placed; the coinstake is new each time.
+        if (fFullBuild || fProofOfStake) {
+            CValidationState state;
+            if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
+                templateBuilder.Invalidate();
+                mempool.clear();
+                throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, state.GetRejectReason()));
+            }
         }
+
+        int64_t nTimeBuild = GetTimeMicros() - nTimeStart;
+        templateBuilder.RecordBuild(fFullBuild, nTimeBuild, nBlockTx);
+        LogPrint("bench", "CreateNewBlock(): %s build of %u txs in %.2fms\n", fFullBuild ? "full" : "incremental", nBlockTx, nTimeBuild * 0.001);
     }
 
     return pblocktemplate.release();
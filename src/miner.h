@@ -18,6 +18,17 @@ class CWallet;
 
 struct CBlockTemplate;
 
+/** Block template assembly counters, reported by getmininginfo */
+struct CBlockTemplateStats {
+    uint64_t nBuilds;              //!< templates assembled
+    uint64_t nFullBuilds;          //!< ... of which selected all transactions from scratch
+    int64_t nLastBuildMicros;      //!< latency of the last build
+    int64_t nLastFullBuildMicros;  //!< latency of the last full build
+    int64_t nMaxBuildMicros;       //!< worst latency seen
+    int64_t nTotalBuildMicros;     //!< sum of all build latencies
+    unsigned int nLastBlockTx;     //!< mempool transactions in the last template
+};
+
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
@@ -25,6 +36,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+/** Copy the block template assembly counters */
+void GetBlockTemplateStats(CBlockTemplateStats& stats);
 /** Check mined block */
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
 
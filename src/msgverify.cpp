@@ -0,0 +1,166 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "msgverify.h"
+
+#include "main.h"
+#include "masternode-budget.h"
+#include "masternode-payments.h"
+#include "masternode-sync.h"
+#include "masternode.h"
+#include "net.h"
+#include "obfuscation.h"
+#include "spork.h"
+#include "swifttx.h"
+#include "util.h"
+
+#include <deque>
+
+#include <boost/thread.hpp>
+
+/** A received message copied out for the verification threads */
+struct CMessageVerifyJob {
+    std::string strCommand;
+    CDataStream vRecv;
+    boost::shared_ptr<CNetMessageVerify> pverify;
+
+    CMessageVerifyJob() : vRecv(SER_NETWORK, PROTOCOL_VERSION) {}
+};
+
+static std::deque<CMessageVerifyJob> queueVerify;
+static boost::mutex mutexVerify;
+static boost::condition_variable condVerify;
+static int nVerifyThreads = 0;
+static int nIdleVerifyThreads = 0;
+
+bool IsMessageVerifiedAhead(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::MNB || strCommand == NetMsgType::MNP ||
+           strCommand == NetMsgType::MNW || strCommand == NetMsgType::MVOTE ||
+           strCommand == NetMsgType::FBVOTE || strCommand == NetMsgType::TXLVOTE ||
+           strCommand == NetMsgType::SPORK;
+}
+
+/** Recover the signers of a message, mirroring the checks its handler makes */
+static void RecoverSigners(const std::string& strCommand, CDataStream& vRecv)
+{
+    if (strCommand == NetMsgType::MNB) {
+        CMasternodeBroadcast mnb;
+        vRecv >> mnb;
+        if (obfuScationSigner.RecoverSigner(mnb.sig, mnb.GetNewStrMessage()) != mnb.pubKeyCollateralAddress.GetID())
+            obfuScationSigner.RecoverSigner(mnb.sig, mnb.GetOldStrMessage());
+        obfuScationSigner.RecoverSigner(mnb.lastPing.vchSig, mnb.lastPing.GetStrMessage());
+    } else if (strCommand == NetMsgType::MNP) {
+        CMasternodePing mnp;
+        vRecv >> mnp;
+        obfuScationSigner.RecoverSigner(mnp.vchSig, mnp.GetStrMessage());
+    } else if (strCommand == NetMsgType::MNW) {
+        CMasternodePaymentWinner winner;
+        vRecv >> winner;
+        obfuScationSigner.RecoverSigner(winner.vchSig, winner.GetStrMessage());
+    } else if (strCommand == NetMsgType::MVOTE) {
+        CBudgetVote vote;
+        vRecv >> vote;
+        obfuScationSigner.RecoverSigner(vote.vchSig, vote.GetStrMessage());
+    } else if (strCommand == NetMsgType::FBVOTE) {
+        CFinalizedBudgetVote vote;
+        vRecv >> vote;
+        obfuScationSigner.RecoverSigner(vote.vchSig, vote.GetStrMessage());
+    } else if (strCommand == NetMsgType::TXLVOTE) {
+        CConsensusVote ctx;
+        vRecv >> ctx;
+        obfuScationSigner.RecoverSigner(ctx.vchMasterNodeSignature, ctx.GetStrMessage());
+    } else if (strCommand == NetMsgType::SPORK) {
+        CSporkMessage spork;
+        vRecv >> spork;
+        obfuScationSigner.RecoverSigner(spork.vchSig, spork.GetStrMessage());
+    }
+}
+
+static void ThreadMessageVerify()
+{
+    RenameThread("bare-msgverify");
+    std::vector<CMessageVerifyJob> vBatch;
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexVerify);
+            nIdleVerifyThreads++;
+            while (queueVerify.empty())
+                condVerify.wait(lock);
+            nIdleVerifyThreads--;
+            // Take a batch, as CCheckQueue does: large enough to keep locking
+            // rare during vote floods, small enough to leave work for the others
+            unsigned int nNow = std::max(1U, std::min(MSGVERIFY_BATCH_SIZE, (unsigned int)queueVerify.size() / (nVerifyThreads + nIdleVerifyThreads + 1)));
+            vBatch.assign(queueVerify.begin(), queueVerify.begin() + nNow);
+            queueVerify.erase(queueVerify.begin(), queueVerify.begin() + nNow);
+        }
+
+        BOOST_FOREACH (CMessageVerifyJob& job, vBatch) {
+            int64_t nTimeStart = GetTimeMicros();
+            try {
+                RecoverSigners(job.strCommand, job.vRecv);
+            } catch (std::exception& e) {
+                // Malformed; the handler rejects it when it gets to it
+                LogPrint("net", "ThreadMessageVerify(%s) : %s\n", SanitizeString(job.strCommand), e.what());
+            }
+            job.pverify->nTimeVerify = GetTimeMicros() - nTimeStart;
+            job.pverify->fDone = true;
+        }
+        vBatch.clear();
+        WakeMessageHandler();
+    }
+}
+
+void QueueMessageVerify(CNode* pnode)
+{
+    if (fLiteMode)
+        return;
+    {
+        boost::lock_guard<boost::mutex> lock(mutexVerify);
+        if (nVerifyThreads == 0)
+            return;
+    }
+    // Masternode, budget and SwiftX messages are dropped until then
+    bool fSynced = masternodeSync.IsBlockchainSynced();
+
+    std::vector<CMessageVerifyJob> vJobs;
+    unsigned int nAhead = 0;
+    BOOST_FOREACH (CNetMessage& msg, pnode->vRecvMsg) {
+        if (nAhead >= MAX_MSGVERIFY_AHEAD || !msg.complete())
+            break;
+        if (msg.pverify) {
+            if (!msg.pverify->fDone)
+                nAhead++;
+            continue;
+        }
+        std::string strCommand = msg.hdr.GetCommand();
+        if (!IsMessageVerifiedAhead(strCommand) || (!fSynced && strCommand != NetMsgType::SPORK))
+            continue;
+
+        msg.pverify.reset(new CNetMessageVerify());
+        vJobs.push_back(CMessageVerifyJob());
+        vJobs.back().strCommand = strCommand;
+        vJobs.back().vRecv = msg.vRecv;
+        vJobs.back().pverify = msg.pverify;
+        nAhead++;
+    }
+    if (vJobs.empty())
+        return;
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutexVerify);
+        queueVerify.insert(queueVerify.end(), vJobs.begin(), vJobs.end());
+    }
+    condVerify.notify_all();
+}
+
+void StartMessageVerifyThreads(boost::thread_group& threadGroup, int nThreads)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutexVerify);
+        nVerifyThreads = nThreads;
+    }
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(&ThreadMessageVerify);
+}
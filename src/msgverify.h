@@ -0,0 +1,40 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MSGVERIFY_H
+#define BITCOIN_MSGVERIFY_H
+
+#include <string>
+
+class CNode;
+
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
+/** -msgverifythreads default: threads checking masternode, budget, spork and SwiftX signatures (0 = on the message handler thread) */
+static const int DEFAULT_MSGVERIFY_THREADS = 2;
+/** Maximum number of message verification threads */
+static const int MAX_MSGVERIFY_THREADS = 16;
+/** Number of one peer's received messages that may be verifying at the same time */
+static const unsigned int MAX_MSGVERIFY_AHEAD = 64;
+/** Most messages a verification thread takes from the queue at once */
+static const unsigned int MSGVERIFY_BATCH_SIZE = 16;
+
+/** Whether the signatures of a command are checked on the message verification threads */
+bool IsMessageVerifiedAhead(const std::string& strCommand);
+
+/**
+ * Hand the signature checks of a peer's received subsystem messages to the
+ * verification threads. The signers they recover are picked up by
+ * CObfuScationSigner::VerifyMessage once the message is processed, which still
+ * happens on the message handler thread in the order the peer sent them.
+ * Requires LOCK(pnode->cs_vRecvMsg).
+ */
+void QueueMessageVerify(CNode* pnode);
+
+void StartMessageVerifyThreads(boost::thread_group& threadGroup, int nThreads);
+
+#endif // BITCOIN_MSGVERIFY_H
@@ -38,6 +38,10 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -114,11 +118,53 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+/** Set when a message came in, so that ThreadMessageHandler does not sleep through it. Protected by mutexMsgProc. */
+static bool fMsgProcWake = false;
+static boost::mutex mutexMsgProc;
+
+/** Whether the socket loop runs on epoll rather than select() */
+static bool fUseEpoll = false;
+#ifdef HAVE_SYS_EPOLL_H
+static int hEpoll = -1;
+#endif
 
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+void WakeMessageHandler()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutexMsgProc);
+        fMsgProcWake = true;
+    }
+    messageHandlerCondition.notify_one();
+}
+
+/** Add a socket to the epoll set, edge-triggered; ptr identifies it in the events */
+static bool WatchSocket(SOCKET hSocket, void* ptr)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (!fUseEpoll)
+        return true;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = ptr;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hSocket, &event) != 0) {
+        LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(errno));
+        return false;
+    }
+#endif
+    return true;
+}
+
+static void WatchNodeSocket(CNode* pnode)
+{
+    if (!WatchSocket(pnode->hSocket, pnode))
+        pnode->fDisconnect = true;
+}
+
 void AddOneShot(string strDest)
 {
     LOCK(cs_vOneShots);
@@ -431,6 +477,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
+        WatchNodeSocket(pnode);
 
         {
             LOCK(cs_vNodes);
@@ -709,11 +756,28 @@ void CNode::copyStats(CNodeStats& stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_msgLatency);
+        stats.mapLatencyPerMsgCmd = mapLatencyPerMsgCmd;
+    }
 }
 #undef X
 
+void CNode::RecordMessageLatency(const std::string& strCommand, int64_t nTimeReceived, int64_t nProcessTime)
+{
+    int64_t nLatency = std::max(GetTimeMicros() - nTimeReceived, nProcessTime);
+
+    LOCK(cs_msgLatency);
+    CMsgLatencyStats& stats = mapLatencyPerMsgCmd[GetMessageSubsystem(strCommand) == MSG_SUBSYSTEM_UNKNOWN ? "*other*" : strCommand];
+    stats.nCount++;
+    stats.nLatencyTotal += nLatency;
+    stats.nLatencyMax = std::max(stats.nLatencyMax, nLatency);
+    stats.nProcessTimeTotal += nProcessTime;
+}
+
 // requires LOCK(cs_vRecvMsg)
-bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
+bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes, bool& fComplete)
 {
     while (nBytes > 0) {
         // get current incomplete message, or create a new one
@@ -743,7 +807,7 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            fComplete = true;
         }
     }
 
@@ -842,70 +906,322 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+/** Disconnect the nodes flagged for it, and delete disconnected nodes nobody holds a reference to anymore */
+static void DisconnectNodes(unsigned int& nPrevNodeCount)
+{
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
+            }
+        }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
+                        }
+                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
+                }
+            }
+        }
+    }
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (!fUseEpoll && !IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+        WatchNodeSocket(pnode);
+
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+}
+
+/**
+ * Read from a node's socket once. Returns false when there is nothing more
+ * to read for now: the socket would block, was closed or failed.
+ * Requires cs_vRecvMsg.
+ */
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        bool fComplete = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, fComplete))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        if (fComplete)
+            WakeMessageHandler();
+        return pnode->hSocket != INVALID_SOCKET;
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else if (nBytes < 0) {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+/** Whether to read more from a node: not while it has a complete message waiting and its receive buffer is full. Requires cs_vRecvMsg. */
+static bool WantsRecvData(CNode* pnode)
+{
+    return pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+           pnode->GetTotalRecvSize() <= ReceiveFloodSize();
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/** Most socket events handled per epoll_wait() call */
+static const int MAX_EPOLL_EVENTS = 256;
+/** Interval, in milliseconds, of the passes over all nodes for disconnection and inactivity */
+static const int64_t SOCKET_HOUSEKEEPING_INTERVAL = 100;
+
+/**
+ * Socket loop on epoll. Sockets are edge-triggered, so readiness is only
+ * reported once: nodes that signalled it stay in setRecvReady/setSendReady
+ * (holding a reference) until their socket would block again. That way only
+ * nodes with something to do are visited, and only the periodic
+ * housekeeping looks at all of them.
+ */
+static void SocketHandlerEpoll()
 {
     unsigned int nPrevNodeCount = 0;
+    int64_t nLastHousekeeping = 0;
+    set<CNode*> setRecvReady;
+    set<CNode*> setSendReady;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
     while (true) {
-        //
-        // Disconnect nodes
-        //
+        int64_t nNow = GetTimeMillis();
+        if (nNow - nLastHousekeeping >= SOCKET_HOUSEKEEPING_INTERVAL) {
+            nLastHousekeeping = nNow;
+            DisconnectNodes(nPrevNodeCount);
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodes)
+                InactivityCheck(pnode);
+        }
+
+        // Nodes left ready from last time were throttled or busy: come back to them soon
+        int nTimeout = (setRecvReady.empty() && setSendReady.empty()) ? SOCKET_HOUSEKEEPING_INTERVAL : 50;
+        int nEvents = epoll_wait(hEpoll, events, MAX_EPOLL_EVENTS, nTimeout);
+        boost::this_thread::interruption_point();
+        if (nEvents < 0) {
+            if (errno != EINTR) {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+                MilliSleep(nTimeout);
+            }
+            nEvents = 0;
+        }
+
+        vector<const ListenSocket*> vListenReady;
         {
             LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+            for (int i = 0; i < nEvents; i++) {
+                const ListenSocket* plisten = NULL;
+                BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket)
+                    if (events[i].data.ptr == &hListenSocket)
+                        plisten = &hListenSocket;
+                if (plisten) {
+                    vListenReady.push_back(plisten);
+                    continue;
+                }
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                CNode* pnode = (CNode*)events[i].data.ptr;
+                if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && setRecvReady.insert(pnode).second)
+                    pnode->AddRef();
+                if ((events[i].events & EPOLLOUT) && setSendReady.insert(pnode).second)
+                    pnode->AddRef();
+            }
+        }
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+        //
+        // Accept new connections
+        //
+        BOOST_FOREACH (const ListenSocket* plisten, vListenReady)
+            AcceptConnection(*plisten);
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
+        vector<CNode*> vRelease;
+
+        //
+        // Send
+        //
+        for (set<CNode*>::iterator it = setSendReady.begin(); it != setSendReady.end();) {
+            CNode* pnode = *it;
+            bool fDone = true;
+            if (pnode->hSocket != INVALID_SOCKET) {
+                // Whatever SocketSendData leaves queued did not fit in the socket buffer,
+                // so another EPOLLOUT is due once it drains
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend) {
+                    if (!pnode->vSendMsg.empty())
+                        SocketSendData(pnode);
+                } else {
+                    fDone = false;
                 }
             }
+            if (fDone) {
+                vRelease.push_back(pnode);
+                setSendReady.erase(it++);
+            } else {
+                it++;
+            }
         }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+
+        //
+        // Receive
+        //
+        for (set<CNode*>::iterator it = setRecvReady.begin(); it != setRecvReady.end();) {
+            boost::this_thread::interruption_point();
+            CNode* pnode = *it;
+            bool fDone = (pnode->hSocket == INVALID_SOCKET);
+            if (!fDone) {
+                // As with select(), drain the send queue before receiving more (TCP flow control)
+                bool fSendPending;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    fSendPending = !lockSend || !pnode->vSendMsg.empty();
+                }
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && !fSendPending) {
+                    while (WantsRecvData(pnode)) {
+                        if (!SocketRecvData(pnode)) {
+                            fDone = true;
+                            break;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
                 }
             }
+            if (fDone) {
+                vRelease.push_back(pnode);
+                setRecvReady.erase(it++);
+            } else {
+                it++;
+            }
         }
-        size_t vNodesSize;
-        {
+
+        if (!vRelease.empty()) {
             LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
-        }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+            BOOST_FOREACH (CNode* pnode, vRelease)
+                pnode->Release();
         }
+    }
+}
+#endif
+
+/** Socket loop on select(): rebuilds the descriptor sets and visits every node on each pass */
+static void SocketHandlerSelect()
+{
+    unsigned int nPrevNodeCount = 0;
+    while (true) {
+        DisconnectNodes(nPrevNodeCount);
 
         //
         // Find which sockets have data to receive
@@ -962,8 +1278,7 @@ void ThreadSocketHandler()
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    if (lockRecv && WantsRecvData(pnode))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -989,49 +1304,8 @@ void ThreadSocketHandler()
         // Accept new connections
         //
         BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
+            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                AcceptConnection(hListenSocket);
         }
 
         //
@@ -1054,33 +1328,8 @@ void ThreadSocketHandler()
                 continue;
             if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                if (lockRecv)
+                    SocketRecvData(pnode);
             }
 
             //
@@ -1097,22 +1346,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1122,6 +1356,17 @@ void ThreadSocketHandler()
     }
 }
 
+void ThreadSocketHandler()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (fUseEpoll) {
+        SocketHandlerEpoll();
+        return;
+    }
+#endif
+    SocketHandlerSelect();
+}
+
 
 #ifdef USE_UPNP
 void ThreadMapPort()
@@ -1509,9 +1754,6 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant* grantOu
 
 void ThreadMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
-
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true) {
         vector<CNode*> vNodesCopy;
@@ -1542,7 +1784,7 @@ void ThreadMessageHandler()
                         pnode->CloseSocketDisconnect();
 
                     if (pnode->nSendSize < SendBufferSize()) {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
+                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].ready())) {
                             fSleep = false;
                         }
                     }
@@ -1566,8 +1808,10 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
+        boost::unique_lock<boost::mutex> lock(mutexMsgProc);
+        if (fSleep && !fMsgProcWake)
             messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        fMsgProcWake = false;
     }
 }
 
@@ -1768,6 +2012,17 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (GetBoolArg("-netepoll", true)) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1)
+            LogPrintf("epoll_create1 failed (%s), falling back to select()\n", NetworkErrorString(errno));
+        fUseEpoll = hEpoll != -1;
+    }
+    BOOST_FOREACH (ListenSocket& hListenSocket, vhListenSocket)
+        WatchSocket(hListenSocket.socket, &hListenSocket);
+#endif
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -1828,6 +2083,10 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+        if (hEpoll != -1)
+            close(hEpoll);
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -20,6 +20,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -29,6 +30,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/thread/thread.hpp>
 
@@ -76,6 +78,7 @@ bool BindListenPort(const CService& bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
+void WakeMessageHandler();
 
 typedef int NodeId;
 
@@ -147,6 +150,17 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** How long the messages of one command took to be processed */
+struct CMsgLatencyStats {
+    uint64_t nCount;
+    int64_t nLatencyTotal;    //!< microseconds from receipt until processed, summed
+    int64_t nLatencyMax;
+    int64_t nProcessTimeTotal; //!< microseconds spent verifying and processing, summed
+
+    CMsgLatencyStats() : nCount(0), nLatencyTotal(0), nLatencyMax(0), nProcessTimeTotal(0) {}
+};
+typedef std::map<std::string, CMsgLatencyStats> mapMsgCmdLatency_t;
+
 class CNodeStats
 {
 public:
@@ -167,9 +181,18 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    mapMsgCmdLatency_t mapLatencyPerMsgCmd;
 };
 
 
+/** Signature checks of a received message running ahead of it on the message verification threads */
+struct CNetMessageVerify {
+    std::atomic<bool> fDone;
+    std::atomic<int64_t> nTimeVerify; //!< microseconds spent verifying
+
+    CNetMessageVerify() : fDone(false), nTimeVerify(0) {}
+};
+
 class CNetMessage
 {
 public:
@@ -184,6 +207,8 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
+    boost::shared_ptr<CNetMessageVerify> pverify; // set once handed to the message verification threads
+
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
     {
         hdrbuf.resize(24);
@@ -200,6 +225,12 @@ public:
         return (hdr.nMessageSize == nDataPos);
     }
 
+    // complete, and not waiting on the message verification threads
+    bool ready() const
+    {
+        return complete() && (!pverify || pverify->fDone);
+    }
+
     void SetVersion(int nVersionIn)
     {
         hdrbuf.SetVersion(nVersionIn);
@@ -293,6 +324,8 @@ public:
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
+    mapMsgCmdLatency_t mapLatencyPerMsgCmd;
+    CCriticalSection cs_msgLatency;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -409,8 +442,11 @@ public:
         return total;
     }
 
-    // requires LOCK(cs_vRecvMsg)
-    bool ReceiveMsgBytes(const char* pch, unsigned int nBytes);
+    // requires LOCK(cs_vRecvMsg); sets fComplete if a message was completed
+    bool ReceiveMsgBytes(const char* pch, unsigned int nBytes, bool& fComplete);
+
+    // account a processed message to its command; unknown commands are pooled under "*other*"
+    void RecordMessageLatency(const std::string& strCommand, int64_t nTimeReceived, int64_t nProcessTime);
 
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
@@ -2081,24 +2081,6 @@ std::string CObfuscationPool::GetMessageByID(int messageID)
     }
 }
 
-bool CObfuScationSigner::IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey)
-{
-    CScript payee2;
-    payee2 = GetScriptForDestination(pubkey.GetID());
-
-    CTransaction txVin;
-    uint256 hash;
-    if (GetTransaction(vin.prevout.hash, txVin, hash, true)) {
-        BOOST_FOREACH (CTxOut out, txVin.vout) {
-            if (out.nValue == 1000 * COIN) {
-                if (out.scriptPubKey == payee2) return true;
-            }
-        }
-    }
-
-    return false;
-}
-
 bool CObfuScationSigner::SetKey(std::string strSecret, std::string& errorMessage, CKey& key, CPubKey& pubkey)
 {
     CBitcoinSecret vchSecret;
@@ -2141,22 +2123,108 @@ bool CObfuScationSigner::SignMessage(std::string strMessage, std::string& errorM
     return true;
 }
 
+static uint256 RecoveredSignerKey(const uint256& hashMessage, const vector<unsigned char>& vchSig)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << hashMessage << vchSig;
+    return ss.GetHash();
+}
+
 bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    uint256 hashMessage = ss.GetHash();
+
+    // Use the signer if this signature verified before, or if a verification
+    // thread already recovered it
+    uint256 keySig = RecoveredSignerKey(hashMessage, vchSig);
+    CKeyID keyID;
+    bool fRecovered = false;
+    bool fCached = false;
+    {
+        LOCK(cs_recovered);
+        std::map<uint256, CKeyID>::const_iterator itVerified = mapVerified.find(keySig);
+        if (itVerified != mapVerified.end()) {
+            keyID = itVerified->second;
+            fRecovered = true;
+            fCached = true;
+        } else if (!mapRecovered.empty()) {
+            std::map<uint256, CKeyID>::iterator it = mapRecovered.find(keySig);
+            if (it != mapRecovered.end()) {
+                keyID = it->second;
+                mapRecovered.erase(it);
+                fRecovered = true;
+            }
+        }
+    }
 
-    CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    if (!fRecovered) {
+        CPubKey pubkey2;
+        if (pubkey2.RecoverCompact(hashMessage, vchSig))
+            keyID = pubkey2.GetID();
+    }
+
+    if (keyID.IsNull()) {
         errorMessage = _("Error recovering public key.");
         return false;
     }
 
-    if (fDebug && pubkey2.GetID() != pubkey.GetID())
-        LogPrintf("CObfuScationSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
+    if (keyID != pubkey.GetID()) {
+        if (fDebug)
+            LogPrintf("CObfuScationSigner::VerifyMessage -- keys don't match: %s %s\n", keyID.ToString(), pubkey.GetID().ToString());
+        return false;
+    }
 
-    return (pubkey2.GetID() == pubkey.GetID());
+    if (!fCached) {
+        LOCK(cs_recovered);
+        if (mapVerified.insert(make_pair(keySig, keyID)).second)
+            vVerifiedOrder.push_back(keySig);
+        while (mapVerified.size() > MAX_VERIFIED_SIGNATURES) {
+            mapVerified.erase(vVerifiedOrder.front());
+            vVerifiedOrder.pop_front();
+        }
+    }
+
+    return true;
+}
+
+CKeyID CObfuScationSigner::RecoverSigner(const vector<unsigned char>& vchSig, const std::string& strMessage)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic;
+    ss << strMessage;
+    uint256 hashMessage = ss.GetHash();
+
+    // Relays of a message that verified before, or that another thread is
+    // holding for VerifyMessage already, need no second recovery
+    uint256 key = RecoveredSignerKey(hashMessage, vchSig);
+    {
+        LOCK(cs_recovered);
+        std::map<uint256, CKeyID>::const_iterator it = mapVerified.find(key);
+        if (it != mapVerified.end())
+            return it->second;
+        it = mapRecovered.find(key);
+        if (it != mapRecovered.end())
+            return it->second;
+    }
+
+    CKeyID keyID;
+    CPubKey pubkey;
+    if (pubkey.RecoverCompact(hashMessage, vchSig))
+        keyID = pubkey.GetID();
+
+    LOCK(cs_recovered);
+    if (mapRecovered.insert(make_pair(key, keyID)).second)
+        vRecoveredOrder.push_back(key);
+    // Entries VerifyMessage already used are erased from the map only, so the
+    // order queue can hold stale keys; erasing those is a no-op.
+    while (mapRecovered.size() > MAX_RECOVERED_SIGNERS || vRecoveredOrder.size() > 2 * MAX_RECOVERED_SIGNERS) {
+        mapRecovered.erase(vRecoveredOrder.front());
+        vRecoveredOrder.pop_front();
+    }
+    return keyID;
 }
 
 bool CObfuscationQueue::Sign()
@@ -47,6 +47,10 @@ class CActiveMasternode;
 
 static const CAmount OBFUSCATION_COLLATERAL = (10 * COIN);
 static const CAmount OBFUSCATION_POOL_MAX = (99999.99 * COIN);
+//! Recovered signers kept for VerifyMessage; ones never asked for are dropped oldest first
+static const unsigned int MAX_RECOVERED_SIGNERS = 20000;
+//! Signatures VerifyMessage found valid, kept so relays of the same message are not checked again
+static const unsigned int MAX_VERIFIED_SIGNATURES = 50000;
 
 extern CObfuscationPool obfuScationPool;
 extern CObfuScationSigner obfuScationSigner;
@@ -245,9 +249,18 @@ public:
  */
 class CObfuScationSigner
 {
+private:
+    /// Signers recovered ahead of VerifyMessage by the message verification threads, keyed by
+    /// hash of (message hash, signature). A null key id records a signature that did not recover.
+    std::map<uint256, CKeyID> mapRecovered;
+    std::deque<uint256> vRecoveredOrder;
+    /// Signatures that passed VerifyMessage, same key, with the key id that made them. Unlike
+    /// mapRecovered entries they are not used up, so every relay of a ping or vote hits them.
+    std::map<uint256, CKeyID> mapVerified;
+    std::deque<uint256> vVerifiedOrder;
+    CCriticalSection cs_recovered;
+
 public:
-    /// Is the inputs associated with this public key? (and there is 1000 BARE - checking if valid masternode)
-    bool IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey);
     /// Set the private/public key values, returns true if successful
     bool GetKeysFromSecret(std::string strSecret, CKey& keyRet, CPubKey& pubkeyRet);
     /// Set the private/public key values, returns true if successful
@@ -256,6 +269,8 @@ public:
     bool SignMessage(std::string strMessage, std::string& errorMessage, std::vector<unsigned char>& vchSig, CKey key);
     /// Verify the message, returns true if succcessful
     bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage);
+    /// Recover the signer of a message ahead of time; the next VerifyMessage of it uses the result instead of recovering again
+    CKeyID RecoverSigner(const std::vector<unsigned char>& vchSig, const std::string& strMessage);
 };
 
 /** Used to keep track of current status of Obfuscation pool
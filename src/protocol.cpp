@@ -130,6 +130,75 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::BLOCKTXN
 };
 
+static std::map<std::string, MessageSubsystem> BuildMessageSubsystems()
+{
+    std::map<std::string, MessageSubsystem> mapSubsystems;
+    for (unsigned int i = 0; i < ARRAYLEN(allNetMessageTypes); i++)
+        mapSubsystems[allNetMessageTypes[i]] = MSG_SUBSYSTEM_CHAIN;
+
+    mapSubsystems[NetMsgType::MNB] = MSG_SUBSYSTEM_MASTERNODE;
+    mapSubsystems[NetMsgType::MNP] = MSG_SUBSYSTEM_MASTERNODE;
+    mapSubsystems[NetMsgType::MNW] = MSG_SUBSYSTEM_MASTERNODE;
+    mapSubsystems[NetMsgType::MNGET] = MSG_SUBSYSTEM_MASTERNODE;
+    mapSubsystems[NetMsgType::DSEG] = MSG_SUBSYSTEM_MASTERNODE;
+    mapSubsystems[NetMsgType::DSEE] = MSG_SUBSYSTEM_MASTERNODE;
+    mapSubsystems[NetMsgType::DSEEP] = MSG_SUBSYSTEM_MASTERNODE;
+    mapSubsystems[NetMsgType::SSC] = MSG_SUBSYSTEM_MASTERNODE;
+
+    mapSubsystems[NetMsgType::MPROP] = MSG_SUBSYSTEM_BUDGET;
+    mapSubsystems[NetMsgType::MVOTE] = MSG_SUBSYSTEM_BUDGET;
+    mapSubsystems[NetMsgType::FBS] = MSG_SUBSYSTEM_BUDGET;
+    mapSubsystems[NetMsgType::FBVOTE] = MSG_SUBSYSTEM_BUDGET;
+    mapSubsystems[NetMsgType::MNVS] = MSG_SUBSYSTEM_BUDGET;
+
+    mapSubsystems[NetMsgType::SPORK] = MSG_SUBSYSTEM_SPORK;
+    mapSubsystems[NetMsgType::GETSPORKS] = MSG_SUBSYSTEM_SPORK;
+    mapSubsystems[NetMsgType::GETSPORK] = MSG_SUBSYSTEM_SPORK;
+
+    mapSubsystems[NetMsgType::IX] = MSG_SUBSYSTEM_SWIFTTX;
+    mapSubsystems[NetMsgType::TXLVOTE] = MSG_SUBSYSTEM_SWIFTTX;
+
+    mapSubsystems[NetMsgType::DSA] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSQ] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSI] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSSU] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSS] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSF] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSC] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSR] = MSG_SUBSYSTEM_OBFUSCATION;
+    mapSubsystems[NetMsgType::DSTX] = MSG_SUBSYSTEM_OBFUSCATION;
+    return mapSubsystems;
+}
+
+MessageSubsystem GetMessageSubsystem(const std::string& strCommand)
+{
+    static const std::map<std::string, MessageSubsystem> mapSubsystems = BuildMessageSubsystems();
+    std::map<std::string, MessageSubsystem>::const_iterator it = mapSubsystems.find(strCommand);
+    if (it == mapSubsystems.end())
+        return MSG_SUBSYSTEM_UNKNOWN;
+    return it->second;
+}
+
+const char* GetMessageSubsystemName(MessageSubsystem subsystem)
+{
+    switch (subsystem) {
+    case MSG_SUBSYSTEM_CHAIN:
+        return "chain";
+    case MSG_SUBSYSTEM_MASTERNODE:
+        return "masternode";
+    case MSG_SUBSYSTEM_BUDGET:
+        return "budget";
+    case MSG_SUBSYSTEM_SPORK:
+        return "spork";
+    case MSG_SUBSYSTEM_SWIFTTX:
+        return "swifttx";
+    case MSG_SUBSYSTEM_OBFUSCATION:
+        return "obfuscation";
+    default:
+        return "unknown";
+    }
+}
+
 static const char* ppszTypeName[] =
     {
         "ERROR",
@@ -148,7 +217,8 @@ static const char* ppszTypeName[] =
         "mn quorum",
         "mn announce",
         "mn ping",
-        "dstx"};
+        "dstx",
+        "cmpctblock"};
 
 CMessageHeader::CMessageHeader()
 {
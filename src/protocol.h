@@ -259,6 +259,20 @@ extern const char *GETBLOCKTXN;
 extern const char *BLOCKTXN;
 };
 
+/** The subsystem a message command belongs to */
+enum MessageSubsystem {
+    MSG_SUBSYSTEM_UNKNOWN,     //!< not a known command
+    MSG_SUBSYSTEM_CHAIN,       //!< peers, addresses, blocks and transactions
+    MSG_SUBSYSTEM_MASTERNODE,  //!< masternode list, pings and payment winners
+    MSG_SUBSYSTEM_BUDGET,      //!< budget proposals, finalized budgets and their votes
+    MSG_SUBSYSTEM_SPORK,
+    MSG_SUBSYSTEM_SWIFTTX,
+    MSG_SUBSYSTEM_OBFUSCATION,
+};
+
+MessageSubsystem GetMessageSubsystem(const std::string& strCommand);
+const char* GetMessageSubsystemName(MessageSubsystem subsystem);
+
 
 /** Message header.
  * (4) message start.
@@ -415,11 +429,12 @@ enum GetDataMsg {
     MSG_MASTERNODE_ANNOUNCE,
     MSG_MASTERNODE_PING,
     MSG_DSTX,
+    MSG_CMPCT_BLOCK, //!< Defined in BIP152; numbered after the masternode types here
     MSG_WITNESS_BLOCK = MSG_BLOCK | MSG_WITNESS_FLAG,
     MSG_WITNESS_TX = MSG_TX | MSG_WITNESS_FLAG,
     MSG_FILTERED_WITNESS_BLOCK = MSG_FILTERED_BLOCK | MSG_WITNESS_FLAG,
 };
 
-const int MSG_TYPE_MAX = MSG_DSTX;
+const int MSG_TYPE_MAX = MSG_CMPCT_BLOCK;
 
 #endif // BITCOIN_PROTOCOL_H
@@ -3,6 +3,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockcache.h"
+#include "blockfilter.h"
 #include "chain.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
@@ -23,6 +25,9 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const int MAX_REST_BLOCKRANGE = 10000;     //blocks streamed by one /rest/blockrange/ request
+static const int MAX_REST_HEADERRANGE = 200000;   //headers streamed by one /rest/headerrange/ request
+static const size_t REST_STREAM_CHUNK_SIZE = 1 << 20; //bytes gathered before a chunk of a streamed reply is sent
 
 enum RetFormat {
     RF_UNDEF,
@@ -42,7 +47,7 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
+    uint32_t nTxVer; // Not known for per-outpoint coins, always 0; kept for the binary format
     uint32_t nHeight;
     CTxOut out;
 
@@ -57,6 +62,48 @@ struct CCoin {
     }
 };
 
+/** Record of /rest/headerrange/: a block header followed by the proof-of-stake
+ * data of its block index entry, so the stake chain can be followed without
+ * fetching whole blocks */
+struct CStakeHeader {
+    CBlockHeader header;
+    int32_t nHeight;
+    uint32_t nFlags;
+    uint64_t nStakeModifier;
+    int64_t nMint;
+    int64_t nMoneySupply;
+    COutPoint prevoutStake; // proof-of-stake blocks only
+    uint32_t nStakeTime;    // proof-of-stake blocks only
+
+    CStakeHeader(const CBlockIndex* pindex) : header(pindex->GetBlockHeader()),
+                                              nHeight(pindex->nHeight),
+                                              nFlags(pindex->nFlags),
+                                              nStakeModifier(pindex->nStakeModifier),
+                                              nMint(pindex->nMint),
+                                              nMoneySupply(pindex->nMoneySupply),
+                                              prevoutStake(pindex->prevoutStake),
+                                              nStakeTime(pindex->nStakeTime)
+    {
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(header);
+        READWRITE(nHeight);
+        READWRITE(nFlags);
+        READWRITE(nStakeModifier);
+        READWRITE(nMint);
+        READWRITE(nMoneySupply);
+        if (nFlags & CBlockIndex::BLOCK_PROOF_OF_STAKE) {
+            READWRITE(prevoutStake);
+            READWRITE(nStakeTime);
+        }
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, bool include_hex, int serialize_flags);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
@@ -190,6 +237,116 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Parse the <start>/<count> part of a streamed range request and clip it to the active chain */
+static bool ParseRange(HTTPRequest* req, const string& strRange, int nMaxCount, int& nStart, int& nCount)
+{
+    vector<string> path;
+    boost::split(path, strRange, boost::is_any_of("/"));
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No range specified. Use <start>/<count>.bin");
+
+    if (!ParseInt32(path[0], &nStart) || nStart < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid start height: " + path[0]);
+    if (!ParseInt32(path[1], &nCount) || nCount < 1 || nCount > nMaxCount)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Count out of range: " + path[1]);
+
+    AssertLockHeld(cs_main);
+    if (nStart > chainActive.Height())
+        return RESTERR(req, HTTP_NOT_FOUND, "Start height beyond the chain tip: " + path[0]);
+    nCount = std::min(nCount, chainActive.Height() - nStart + 1);
+    return true;
+}
+
+static bool rest_blockrange(HTTPRequest* req,
+                            const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    if (rf != RF_BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin)");
+
+    int nStart, nCount;
+    std::vector<CDiskBlockPos> vPos;
+    {
+        LOCK(cs_main);
+        if (!ParseRange(req, params[0], MAX_REST_BLOCKRANGE, nStart, nCount))
+            return false;
+        vPos.reserve(nCount);
+        for (int nHeight = nStart; nHeight < nStart + nCount; nHeight++) {
+            const CBlockIndex* pindex = chainActive[nHeight];
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                return RESTERR(req, HTTP_NOT_FOUND, strprintf("Block %d not available (pruned data)", nHeight));
+            vPos.push_back(pindex->GetBlockPos());
+        }
+    }
+
+    // Blocks are copied from blk?????.dat as stored, one after another, and
+    // never deserialized. The count lets clients notice a stream cut short by
+    // a read error, which can no longer change the status line.
+    req->WriteHeader("Content-Type", "application/octet-stream");
+    req->WriteHeader("X-Block-Count", strprintf("%d", nCount));
+    req->WriteReplyStart(HTTP_OK);
+
+    std::string strChunk;
+    std::vector<char> vchBlock;
+    bool fOpen = true;
+    for (unsigned int i = 0; i < vPos.size() && fOpen; i++) {
+        if (!ReadRawBlockFromDisk(vchBlock, vPos[i]))
+            break;
+        strChunk.append(vchBlock.begin(), vchBlock.end());
+        if (strChunk.size() >= REST_STREAM_CHUNK_SIZE) {
+            fOpen = req->WriteReplyChunk(strChunk.data(), strChunk.size());
+            strChunk.clear();
+        }
+    }
+    if (fOpen && !strChunk.empty())
+        req->WriteReplyChunk(strChunk.data(), strChunk.size());
+    req->WriteReplyEnd();
+    return true;
+}
+
+static bool rest_headerrange(HTTPRequest* req,
+                             const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    if (rf != RF_BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin)");
+
+    int nStart, nCount;
+    std::vector<const CBlockIndex*> headers;
+    {
+        LOCK(cs_main);
+        if (!ParseRange(req, params[0], MAX_REST_HEADERRANGE, nStart, nCount))
+            return false;
+        headers.reserve(nCount);
+        for (int nHeight = nStart; nHeight < nStart + nCount; nHeight++)
+            headers.push_back(chainActive[nHeight]);
+    }
+
+    req->WriteHeader("Content-Type", "application/octet-stream");
+    req->WriteHeader("X-Block-Count", strprintf("%d", nCount));
+    req->WriteReplyStart(HTTP_OK);
+
+    CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+    bool fOpen = true;
+    for (unsigned int i = 0; i < headers.size() && fOpen; i++) {
+        ssHeaders << CStakeHeader(headers[i]);
+        if (ssHeaders.size() >= REST_STREAM_CHUNK_SIZE) {
+            fOpen = req->WriteReplyChunk(&ssHeaders[0], ssHeaders.size());
+            ssHeaders.clear();
+        }
+    }
+    if (fOpen && !ssHeaders.empty())
+        req->WriteReplyChunk(&ssHeaders[0], ssHeaders.size());
+    req->WriteReplyEnd();
+    return true;
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -204,7 +361,6 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -214,31 +370,41 @@ static bool rest_block(HTTPRequest* req,
         pblockindex = mapBlockIndex[hash];
         if (!(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
-
-        if (!ReadBlockFromDisk(block, pblockindex))
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
+    CCachedBlockRef pcached = ReadBlockCached(pblockindex);
+    if (!pcached)
+        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+    // Recently connected blocks come with their serialization
+    string strBlock;
+    if (rf == RF_BINARY || rf == RF_HEX) {
+        int nSerFlags = RPCSerializationFlags();
+        if (!pcached->vSerialized.empty() && nSerFlags == 0) {
+            strBlock.assign(pcached->vSerialized.begin(), pcached->vSerialized.end());
+        } else {
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | nSerFlags);
+            ssBlock << pcached->block;
+            strBlock = ssBlock.str();
+        }
+    }
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
         req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryBlock);
+        req->WriteReply(HTTP_OK, strBlock);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(strBlock.begin(), strBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
+        UniValue objBlock = blockToJSON(pcached->block, pblockindex, showTxDetails);
         string strJSON = objBlock.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
@@ -264,6 +430,70 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+static bool rest_blockfilter(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    string hashStr = params[0];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    if (!fBlockFilterIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Block filters are not enabled (-blockfilterindex)");
+
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+    }
+
+    CBlockFilterEntry entry;
+    if (!GetBlockFilter(hash, entry))
+        return RESTERR(req, HTTP_NOT_FOUND, "filter of " + hashStr + " not indexed yet");
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssFilter(SER_NETWORK, PROTOCOL_VERSION);
+        ssFilter << entry;
+        string binaryFilter = ssFilter.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryFilter);
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ssFilter(SER_NETWORK, PROTOCOL_VERSION);
+        ssFilter << entry;
+        string strHex = HexStr(ssFilter.begin(), ssFilter.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue objFilter(UniValue::VOBJ);
+        objFilter.push_back(Pair("blockhash", hash.GetHex()));
+        objFilter.push_back(Pair("filter", HexStr(entry.vchFilter)));
+        objFilter.push_back(Pair("header", entry.hashHeader.GetHex()));
+        string strJSON = objFilter.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -504,21 +734,14 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            Coin coin;
+            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+                hits[i] = true;
+                CCoin restCoin;
+                restCoin.nTxVer = 0;
+                restCoin.nHeight = coin.nHeight;
+                restCoin.out = coin.out;
+                outs.push_back(restCoin);
             }
 
             bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
@@ -595,10 +818,13 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blockfilter/", rest_blockfilter},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/blockrange/", rest_blockrange},
+      {"/rest/headerrange/", rest_headerrange},
       {"/rest/getutxos", rest_getutxos},
 };
 
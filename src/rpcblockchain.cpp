@@ -6,6 +6,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "blockcache.h"
+#include "blockfilter.h"
 #include "checkpoints.h"
 #include "clientversion.h"
 #include "consensus/validation.h"
@@ -83,9 +85,14 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", block.GetHash().GetHex()));
     int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    CBlockIndex* pnext = NULL;
+    {
+        LOCK(cs_main);
+        // Only report confirmations if the block is on the main chain
+        if (chainActive.Contains(blockindex))
+            confirmations = chainActive.Height() - blockindex->nHeight + 1;
+        pnext = chainActive.Next(blockindex);
+    }
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("strippedsize", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)));
     result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
@@ -111,7 +118,6 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex* pnext = chainActive.Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
 
@@ -171,16 +177,22 @@ UniValue mempoolToJSON(bool fVerbose = false)
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        BOOST_FOREACH (const CTxMemPoolEntry& e, mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+            info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
             info.push_back(Pair("time", e.GetTime()));
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH (const CTxIn& txin, tx.vin) {
@@ -227,10 +239,17 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "  \"transactionid\" : {       (json object)\n"
             "    \"size\" : n,             (numeric) transaction size in bytes\n"
             "    \"fee\" : n,              (numeric) transaction fee in bare\n"
+            "    \"modifiedfee\" : n,      (numeric) transaction fee with fee deltas used for mining priority\n"
             "    \"time\" : n,             (numeric) local time transaction entered pool in seconds since 1 Jan 1970 GMT\n"
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees (see above) of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) of in-mempool ancestors (including this one)\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -318,8 +337,6 @@ UniValue getblock(const UniValue& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("getblock", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\"") + HelpExampleRpc("getblock", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\""));
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
 
@@ -327,23 +344,32 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+    }
 
-    if (!ReadBlockFromDisk(block, pblockindex))
+    // Block files are only appended to, so the block is read and
+    // converted without cs_main; batches of getblock run side by side
+    CCachedBlockRef pcached = ReadBlockCached(pblockindex);
+    if (!pcached)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (!fVerbose) {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
+        int nSerFlags = RPCSerializationFlags();
+        if (!pcached->vSerialized.empty() && nSerFlags == 0)
+            return HexStr(pcached->vSerialized.begin(), pcached->vSerialized.end());
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | nSerFlags);
+        ssBlock << pcached->block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex);
+    return blockToJSON(pcached->block, pblockindex);
 }
 
 UniValue getblockheader(const UniValue& params, bool fHelp)
@@ -398,30 +424,96 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getblockfilter \"hash\"\n"
+            "\nReturns the compact filter (BIP 158 basic filter) of block 'hash'. Requires -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"hash\"          (string, required) The block hash\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"xxxx\",  (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hash\",  (string) the filter header, committing to this filter and the ones before it\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockfilter", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\"") + HelpExampleRpc("getblockfilter", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\""));
+
+    if (!fBlockFilterIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block filters are not enabled, restart with -blockfilterindex");
+
+    uint256 hash(params[0].get_str());
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    }
+
+    CBlockFilterEntry entry;
+    if (!GetBlockFilter(hash, entry))
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not found, the block filter index has not reached this block");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(entry.vchFilter)));
+    ret.push_back(Pair("header", entry.hashHeader.GetHex()));
+    return ret;
+}
+
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "The default \"muhash\" statistics are maintained as blocks are connected and return instantly.\n"
+            "\"hash_serialized\" scans the whole set and may take some time.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=\"muhash\") \"muhash\" or \"hash_serialized\"\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (hash_serialized only)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (hash_serialized only)\n"
+            "  \"muhash\": \"hash\",   (string) The rolling multiset hash of the set (muhash only)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"total_unspendable_amount\": x.xxx   (numeric) The total amount burnt in unspendable outputs (muhash only)\n"
             "}\n"
             "\nExamples:\n" +
-            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleRpc("gettxoutsetinfo", ""));
+            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleCli("gettxoutsetinfo", "\"hash_serialized\"") +
+            HelpExampleRpc("gettxoutsetinfo", ""));
 
-    LOCK(cs_main);
+    std::string strHashType = params.size() > 0 ? params[0].get_str() : "muhash";
+    if (strHashType != "muhash" && strHashType != "hash_serialized")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type: " + strHashType);
 
     UniValue ret(UniValue::VOBJ);
 
+    CUTXOStats utxostats;
+    if (strHashType == "muhash" && GetUTXOStats(utxostats)) {
+        int nHeight = -1;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(utxostats.hashBlock);
+            if (mi != mapBlockIndex.end())
+                nHeight = mi->second->nHeight;
+        }
+        // Finalizing takes a modular inversion, so do it outside cs_main
+        ret.push_back(Pair("height", (int64_t)nHeight));
+        ret.push_back(Pair("bestblock", utxostats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", utxostats.totals.nTransactionOutputs));
+        ret.push_back(Pair("bytes_serialized", utxostats.totals.nSerializedSize));
+        ret.push_back(Pair("muhash", utxostats.GetHash().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(utxostats.totals.nTotalAmount)));
+        ret.push_back(Pair("total_unspendable_amount", ValueFromAmount(utxostats.totals.nTotalUnspendable)));
+        return ret;
+    }
+
+    LOCK(cs_main);
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
@@ -461,7 +553,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -482,34 +573,232 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out))
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n < 0 || (unsigned int)n >= coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex* pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
+
+    return ret;
+}
+
+/** Collects the coins paying to one of a set of scripts; Visit() runs on the scanning threads */
+class CScanTxOutSetVisitor : public CCoinsScanVisitor
+{
+public:
+    const std::set<CScript>& setScripts;
+    CCriticalSection cs;
+    std::map<COutPoint, Coin> mapFound;
+
+    CScanTxOutSetVisitor(const std::set<CScript>& setScriptsIn) : setScripts(setScriptsIn) {}
+
+    void Visit(const COutPoint& outpoint, const Coin& coin)
+    {
+        if (!setScripts.count(coin.out.scriptPubKey))
+            return;
+        LOCK(cs);
+        mapFound[outpoint] = coin;
+    }
+};
+
+/** Progress of the running scantxoutset, NULL if there is none */
+static CCriticalSection cs_scantxoutset;
+static CCoinsScanProgress* pscanProgress = NULL;
+
+/** Publishes the progress of a scan for its lifetime, allowing only one scan at a time */
+class CScanTxOutSetReserver
+{
+    bool fReserved;
+
+public:
+    CScanTxOutSetReserver() : fReserved(false) {}
+
+    bool Reserve(CCoinsScanProgress* pprogress)
+    {
+        LOCK(cs_scantxoutset);
+        if (pscanProgress)
+            return false;
+        pscanProgress = pprogress;
+        fReserved = true;
+        return true;
+    }
+
+    ~CScanTxOutSetReserver()
+    {
+        if (fReserved) {
+            LOCK(cs_scantxoutset);
+            pscanProgress = NULL;
+        }
+    }
+};
+
+/** Add the scripts a scan object stands for: an address, addr(ADDRESS), raw(HEX) or combo(PUBKEY) */
+static void ParseScanObject(const std::string& strObject, std::set<CScript>& setScripts)
+{
+    std::string strType, strArg = strObject;
+    size_t nOpen = strObject.find('(');
+    if (nOpen != std::string::npos && strObject[strObject.size() - 1] == ')') {
+        strType = strObject.substr(0, nOpen);
+        strArg = strObject.substr(nOpen + 1, strObject.size() - nOpen - 2);
+    }
 
+    if (strType.empty() || strType == "addr") {
+        CTxDestination dest = DecodeDestination(strArg);
+        if (!IsValidDestination(dest))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + strArg);
+        setScripts.insert(GetScriptForDestination(dest));
+    } else if (strType == "raw") {
+        if (!IsHex(strArg))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid script hex: " + strArg);
+        std::vector<unsigned char> vch = ParseHex(strArg);
+        setScripts.insert(CScript(vch.begin(), vch.end()));
+    } else if (strType == "combo") {
+        CPubKey pubkey(ParseHex(strArg));
+        if (!IsHex(strArg) || !pubkey.IsFullyValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid public key: " + strArg);
+        setScripts.insert(GetScriptForRawPubKey(pubkey));
+        setScripts.insert(GetScriptForDestination(pubkey.GetID()));
+        if (pubkey.IsCompressed()) {
+            CScript witness = GetScriptForDestination(WitnessV0KeyHash(pubkey.GetID()));
+            setScripts.insert(witness);
+            setScripts.insert(GetScriptForDestination(CScriptID(witness)));
+        }
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown scan object type: " + strType);
+    }
+}
+
+UniValue scantxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "scantxoutset \"action\" ( [scanobjects,...] )\n"
+            "\nScans the unspent transaction output set for outputs paying to any of the given scan objects.\n"
+            "The scan runs on a consistent snapshot of the set, on several threads, without blocking the node.\n"
+            "\nArguments:\n"
+            "1. \"action\"      (string, required) \"start\" to scan, \"abort\" to stop a running scan, \"status\" to report its progress\n"
+            "2. \"scanobjects\" (array, required for \"start\") Array of scan objects\n"
+            "    [\n"
+            "      \"object\"   (string) An address, \"addr(ADDRESS)\", \"raw(SCRIPTHEX)\", or \"combo(PUBKEY)\"\n"
+            "                 for the pay-to-pubkey, pay-to-pubkey-hash and (compressed keys) witness key hash outputs of a key\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult (start):\n"
+            "{\n"
+            "  \"success\": true|false,     (boolean) Whether the scan completed\n"
+            "  \"searched_items\": n,       (numeric) The number of unspent outputs scanned\n"
+            "  \"height\": n,               (numeric) The height of the block the scanned set corresponds to\n"
+            "  \"bestblock\": \"hash\",       (string) The hash of that block\n"
+            "  \"unspents\": [\n"
+            "    {\n"
+            "      \"txid\": \"hash\",         (string) The transaction id\n"
+            "      \"vout\": n,              (numeric) The output index\n"
+            "      \"scriptPubKey\": \"hex\",  (string) The output script\n"
+            "      \"amount\": x.xxx,        (numeric) The output value in bare\n"
+            "      \"height\": n             (numeric) The height the output was created at\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"total_amount\": x.xxx      (numeric) The total value of the unspent outputs found\n"
+            "}\n"
+            "\nResult (status):\n"
+            "{ \"progress\": n }   (numeric) Percentage of the set scanned so far, or null if no scan is running\n"
+            "\nResult (abort):\n"
+            "true|false          (boolean) Whether a running scan was asked to stop\n"
+            "\nExamples:\n" +
+            HelpExampleCli("scantxoutset", "start \"[\\\"addr(address)\\\"]\"") +
+            HelpExampleRpc("scantxoutset", "\"start\", [\"addr(address)\"]"));
+
+    std::string strAction = params[0].get_str();
+    if (strAction == "status") {
+        LOCK(cs_scantxoutset);
+        if (!pscanProgress)
+            return NullUniValue;
+        UniValue ret(UniValue::VOBJ);
+        ret.push_back(Pair("progress", pscanProgress->nRangesDone * 100 / CCoinsViewDB::SCAN_RANGES));
+        return ret;
+    }
+    if (strAction == "abort") {
+        LOCK(cs_scantxoutset);
+        if (!pscanProgress)
+            return false;
+        pscanProgress->fAbort = true;
+        return true;
+    }
+    if (strAction != "start")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid action: " + strAction);
+
+    if (params.size() < 2)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "scanobjects argument is required for the start action");
+    std::set<CScript> setScripts;
+    const UniValue& scanobjects = params[1].get_array();
+    for (unsigned int i = 0; i < scanobjects.size(); i++)
+        ParseScanObject(scanobjects[i].get_str(), setScripts);
+
+    CCoinsScanProgress progress;
+    CScanTxOutSetReserver reserver;
+    if (!reserver.Reserve(&progress))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan already in progress, use action \"abort\" or \"status\"");
+
+    const leveldb::Snapshot* snapshot = NULL;
+    uint256 hashBlock;
+    int nHeight = -1;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        snapshot = pcoinsdbview->GetSnapshot();
+        hashBlock = pcoinsTip->GetBestBlock();
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end())
+            nHeight = mi->second->nHeight;
+    }
+
+    int nThreads = std::max(1, (int)boost::thread::hardware_concurrency());
+    CScanTxOutSetVisitor visitor(setScripts);
+    bool fSuccess = pcoinsdbview->ParallelScan(snapshot, visitor, nThreads, progress);
+    pcoinsdbview->ReleaseSnapshot(snapshot);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("success", fSuccess));
+    ret.push_back(Pair("searched_items", (uint64_t)progress.nCoins));
+    ret.push_back(Pair("height", nHeight));
+    ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+    UniValue unspents(UniValue::VARR);
+    CAmount nTotal = 0;
+    for (std::map<COutPoint, Coin>::const_iterator it = visitor.mapFound.begin(); it != visitor.mapFound.end(); ++it) {
+        UniValue unspent(UniValue::VOBJ);
+        unspent.push_back(Pair("txid", it->first.hash.GetHex()));
+        unspent.push_back(Pair("vout", (int)it->first.n));
+        unspent.push_back(Pair("scriptPubKey", HexStr(it->second.out.scriptPubKey.begin(), it->second.out.scriptPubKey.end())));
+        unspent.push_back(Pair("amount", ValueFromAmount(it->second.out.nValue)));
+        unspent.push_back(Pair("height", (int)it->second.nHeight));
+        unspents.push_back(unspent);
+        nTotal += it->second.out.nValue;
+    }
+    ret.push_back(Pair("unspents", unspents));
+    ret.push_back(Pair("total_amount", ValueFromAmount(nTotal)));
     return ret;
 }
 
@@ -754,7 +1043,10 @@ UniValue mempoolInfoToJSON()
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
-    //ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
     return ret;
 }
@@ -769,6 +1061,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum feerate (bare per KB) for tx to be accepted\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getmempoolinfo", "") + HelpExampleRpc("getmempoolinfo", ""));
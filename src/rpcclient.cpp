@@ -84,10 +84,14 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"searchrawtransactions", 1 },
         {"searchrawtransactions", 2 },
         {"searchrawtransactions", 3 },
-        {"searchrawtransactions", 4 },
+        {"getaddressdeltas", 1},
+        {"getaddressdeltas", 2},
+        {"getaddressdeltas", 3},
+        {"getspentinfo", 1},
         {"sendrawtransaction", 2},
         {"gettxout", 1},
         {"gettxout", 2},
+        {"scantxoutset", 1},
         {"lockunspent", 0},
         {"lockunspent", 1},
         {"importprivkey", 2},
@@ -117,6 +121,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"submitbudget", 7},
         // disabled until removal of the legacy 'masternode' command
         //{"startmasternode", 1},
+        {"getmasternoderank", 0},
         {"mnvoteraw", 1},
         {"mnvoteraw", 4},
         {"reservebalance", 0},
@@ -857,6 +857,54 @@ UniValue getmasternodescores (const UniValue& params, bool fHelp)
 }
 
 
+UniValue getmasternoderank(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmasternoderank ( height )\n"
+            "\nList enabled masternodes in the rank order used for payment votes and SwiftX at a block height\n"
+
+            "\nArguments:\n"
+            "1. height      (numeric, optional) Block height the scores are computed from (default: current height)\n"
+
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"rank\": n,           (numeric) Masternode Rank\n"
+            "    \"txhash\": \"hash\",    (string) Collateral transaction hash\n"
+            "    \"outidx\": n,         (numeric) Collateral transaction output index\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getmasternoderank", "") + HelpExampleCli("getmasternoderank", "1000") + HelpExampleRpc("getmasternoderank", "1000"));
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindex = chainActive.Tip();
+        if (!pindex) return NullUniValue;
+        nHeight = pindex->nHeight;
+    }
+    if (params.size() == 1) {
+        nHeight = params[0].get_int();
+        if (nHeight <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height");
+    }
+
+    UniValue ret(UniValue::VARR);
+    std::vector<pair<int, CTxIn> > vecRanks = mnodeman.GetMasternodeRankList(nHeight, ActiveProtocol());
+    BOOST_FOREACH (const PAIRTYPE(int, CTxIn) & s, vecRanks) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("rank", s.first));
+        obj.push_back(Pair("txhash", s.second.prevout.hash.ToString()));
+        obj.push_back(Pair("outidx", (uint64_t)s.second.prevout.n));
+        ret.push_back(obj);
+    }
+
+    return ret;
+}
+
 bool DecodeHexMnb(CMasternodeBroadcast& mnb, std::string strHexMnb) {
 
     if (!IsHex(strHexMnb))
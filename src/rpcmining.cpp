@@ -241,6 +241,15 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"blocktemplate\": {         (json object) block template assembly statistics\n"
+            "    \"builds\": n,             (numeric) templates assembled since startup\n"
+            "    \"fullbuilds\": n,         (numeric) ... of which selected all transactions from scratch\n"
+            "    \"lastbuildus\": n,        (numeric) latency of the last build in microseconds\n"
+            "    \"lastfullbuildus\": n,    (numeric) latency of the last full build in microseconds\n"
+            "    \"avgbuildus\": n,         (numeric) average build latency in microseconds\n"
+            "    \"maxbuildus\": n,         (numeric) worst build latency in microseconds\n"
+            "    \"lastblocktx\": n         (numeric) mempool transactions in the last template\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getmininginfo", "") + HelpExampleRpc("getmininginfo", ""));
@@ -258,6 +267,18 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
+
+    CBlockTemplateStats stats;
+    GetBlockTemplateStats(stats);
+    UniValue templateObj(UniValue::VOBJ);
+    templateObj.push_back(Pair("builds",          stats.nBuilds));
+    templateObj.push_back(Pair("fullbuilds",      stats.nFullBuilds));
+    templateObj.push_back(Pair("lastbuildus",     stats.nLastBuildMicros));
+    templateObj.push_back(Pair("lastfullbuildus", stats.nLastFullBuildMicros));
+    templateObj.push_back(Pair("avgbuildus",      stats.nBuilds ? stats.nTotalBuildMicros / (int64_t)stats.nBuilds : 0));
+    templateObj.push_back(Pair("maxbuildus",      stats.nMaxBuildMicros));
+    templateObj.push_back(Pair("lastblocktx",     (uint64_t)stats.nLastBlockTx));
+    obj.push_back(Pair("blocktemplate", templateObj));
 #ifdef ENABLE_WALLET
     obj.push_back(Pair("generate",         getgenerate(params, false)));
     obj.push_back(Pair("hashespersec",     gethashespersec(params, false)));
@@ -484,18 +505,18 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     }
 
     // Update block
+    // Templates are assembled incrementally, so a changed mempool is picked
+    // up right away instead of being throttled
     static CBlockIndex* pindexPrev;
-    static int64_t nStart;
     static CBlockTemplate* pblocktemplate;
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5)) {
+        mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast) {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = NULL;
 
         // Store the chainActive.Tip() used before CreateNewBlock, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
 
         // Create new block
         if (pblocktemplate) {
@@ -623,6 +623,8 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"mnsync\": true|false,             (boolean) if masternode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"kernelhashrate\": n,              (numeric) stake kernel hashes per second during the last search\n"
+            "  \"kernelsearchtime\": n,            (numeric) duration of the last stake kernel search in milliseconds\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getstakingstatus", "") + HelpExampleRpc("getstakingstatus", ""));
@@ -649,6 +651,8 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
     else if (mapHashedBlocks.count(chainActive.Tip()->nHeight - 1) && nLastCoinStakeSearchInterval)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
+    obj.push_back(Pair("kernelhashrate", GetStakeKernelHashRate()));
+    obj.push_back(Pair("kernelsearchtime", (double)GetStakeKernelSearchTime() / 1000));
 
     return obj;
 }
@@ -104,7 +104,18 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"latencypermsg\": {         (json object) Processing of the messages received, by command\n"
+            "      \"command\": {\n"
+            "        \"subsystem\": \"xxx\",   (string) chain, masternode, budget, spork, swifttx, obfuscation or unknown\n"
+            "        \"count\": n,            (numeric) Number of messages processed\n"
+            "        \"latency\": n,          (numeric) Average seconds from receipt until processed\n"
+            "        \"maxlatency\": n,       (numeric) Most seconds from receipt until processed\n"
+            "        \"processtime\": n       (numeric) Average seconds spent verifying and processing\n"
+            "      },\n"
+            "      ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -155,6 +166,19 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
+        UniValue latencyPerMsgCmd(UniValue::VOBJ);
+        for (mapMsgCmdLatency_t::const_iterator it = stats.mapLatencyPerMsgCmd.begin(); it != stats.mapLatencyPerMsgCmd.end(); ++it) {
+            const CMsgLatencyStats& latency = it->second;
+            UniValue entry(UniValue::VOBJ);
+            entry.push_back(Pair("subsystem", GetMessageSubsystemName(GetMessageSubsystem(it->first))));
+            entry.push_back(Pair("count", latency.nCount));
+            entry.push_back(Pair("latency", ((double)latency.nLatencyTotal) / latency.nCount / 1e6));
+            entry.push_back(Pair("maxlatency", ((double)latency.nLatencyMax) / 1e6));
+            entry.push_back(Pair("processtime", ((double)latency.nProcessTimeTotal) / latency.nCount / 1e6));
+            latencyPerMsgCmd.push_back(Pair(it->first, entry));
+        }
+        obj.push_back(Pair("latencypermsg", latencyPerMsgCmd));
+
         ret.push_back(obj);
     }
 
@@ -20,6 +20,7 @@
 #include "script/sign.h"
 #include "script/standard.h"
 #include "swifttx.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "utilmoneystr.h"
 #ifdef ENABLE_WALLET
@@ -113,6 +114,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry,
 
     if (!hashBlock.IsNull()) {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
+        LOCK(cs_main);
         BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end() && (*mi).second) {
             CBlockIndex* pindex = (*mi).second;
@@ -130,23 +132,61 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry,
     }
 }
 
-UniValue searchrawtransactions(const UniValue& params, bool fHelp)
+static void ParseAddressIndexParam(const UniValue& param, unsigned char& type, uint160& hashBytes)
 {
-    if (fHelp || params.size() < 1 || params.size() > 4)
-        throw runtime_error("searchrawtransactions <address> [verbose=1] [skip=0] [count=100]\n");
-    
     if (!fAddrIndex)
         throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
-    
-    if (!IsValidDestinationString(params[0].get_str()))
+
+    if (!IsValidDestinationString(param.get_str()))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
 
-    CTxDestination dest = DecodeDestination(params[0].get_str());
-    
-    std::set<CExtDiskTxPos> setpos;
-    if (!FindTransactionsByDestination(dest, setpos))
-        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
-    
+    if (!GetAddressIndexKey(DecodeDestination(param.get_str()), type, hashBytes))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Address type is not supported by the address index");
+}
+
+/** Resume cursors are the serialized (height, position in block) of the next transaction to return */
+static std::string EncodeAddressIndexCursor(int nHeight, unsigned int nTxIndex)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << nHeight << nTxIndex;
+    return HexStr(ss.begin(), ss.end());
+}
+
+static void DecodeAddressIndexCursor(const std::string& strCursor, int& nHeight, unsigned int& nTxIndex)
+{
+    std::vector<unsigned char> vch = ParseHex(strCursor);
+    CDataStream ss(vch, SER_DISK, CLIENT_VERSION);
+    try {
+        ss >> nHeight >> nTxIndex;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    if (!ss.empty() || nHeight < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+}
+
+UniValue searchrawtransactions(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 5)
+        throw runtime_error(
+            "searchrawtransactions \"address\" ( verbose skip count \"cursor\" )\n"
+            "\nReturns the transactions touching an address, oldest first. Requires -addrindex.\n"
+
+            "\nArguments:\n"
+            "1. \"address\"   (string, required) The bare address\n"
+            "2. verbose       (numeric, optional, default=1) If 0, return hex-encoded transactions\n"
+            "3. skip          (numeric, optional, default=0) Number of transactions to skip, negative counts from the end\n"
+            "4. count         (numeric, optional, default=100) Maximum number of transactions to return\n"
+            "5. \"cursor\"    (string, optional) Resume after the previous page; \"\" starts from the beginning.\n"
+            "                 When given, the result is an object with \"transactions\" and the next \"cursor\" (null when done)\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("searchrawtransactions", "\"address\"") + HelpExampleCli("searchrawtransactions", "\"address\" 1 0 100 \"\"") + HelpExampleRpc("searchrawtransactions", "\"address\", 1, 0, 100, \"\""));
+
+    unsigned char type;
+    uint160 hashBytes;
+    ParseAddressIndexParam(params[0], type, hashBytes);
+
     int nSkip = 0;
     int nCount = 100;
     bool fVerbose = true;
@@ -156,22 +196,44 @@ UniValue searchrawtransactions(const UniValue& params, bool fHelp)
         nSkip = params[2].get_int();
     if (params.size() > 3)
         nCount = params[3].get_int();
-    
+    if (nCount < 0)
+        nCount = 0;
+
+    bool fCursor = params.size() > 4;
+    int nStartHeight = 0;
+    unsigned int nStartTxIndex = 0;
+    if (fCursor) {
+        if (nSkip < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip cannot be combined with a cursor");
+        if (!params[4].get_str().empty())
+            DecodeAddressIndexCursor(params[4].get_str(), nStartHeight, nStartTxIndex);
+    }
+
+    // only read as far as the requested page, unless counting from the end
+    size_t nMaxTxs = nSkip < 0 ? 0 : (size_t)nSkip + nCount;
+    std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> > vEntries;
+    if (nCount > 0 && !pblocktree->ReadAddressIndex(type, hashBytes, vEntries, nStartHeight, nStartTxIndex, 0, nMaxTxs))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+
+    std::vector<const CAddressIndexKey*> vTxKeys;
+    std::vector<CDiskTxPos> vTxPos;
+    for (std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> >::const_iterator it = vEntries.begin(); it != vEntries.end(); it++) {
+        if (vTxKeys.empty() || vTxKeys.back()->txhash != it->first.txhash) {
+            vTxKeys.push_back(&it->first);
+            vTxPos.push_back(it->second.txpos);
+        }
+    }
+
     if (nSkip < 0)
-        nSkip += setpos.size();
+        nSkip += vTxKeys.size();
     if (nSkip < 0)
         nSkip = 0;
-    if (nCount < 0)
-        nCount = 0;
-    
-    std::set<CExtDiskTxPos>::const_iterator it = setpos.begin();
-    while (it != setpos.end() && nSkip--) it++;
-    
+
     UniValue result(UniValue::VARR);
-    while (it != setpos.end() && nCount--) {
+    for (size_t i = nSkip; i < vTxKeys.size() && i < (size_t)nSkip + nCount; i++) {
         CTransaction tx;
         uint256 hashBlock;
-        if (!ReadTransaction(tx, *it, hashBlock))
+        if (!ReadTransaction(tx, vTxPos[i], hashBlock))
             throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
         if (fVerbose) {
             UniValue object(UniValue::VOBJ);
@@ -183,8 +245,222 @@ UniValue searchrawtransactions(const UniValue& params, bool fHelp)
             string strHex = HexStr(ssTx.begin(), ssTx.end());
             result.push_back(strHex);
         }
-        it++;
     }
+
+    if (!fCursor)
+        return result;
+
+    UniValue page(UniValue::VOBJ);
+    page.push_back(Pair("transactions", result));
+    if (nMaxTxs > 0 && vTxKeys.size() == nMaxTxs)
+        page.push_back(Pair("cursor", EncodeAddressIndexCursor(vTxKeys.back()->nBlockHeight, vTxKeys.back()->nTxIndex + 1)));
+    else
+        page.push_back(Pair("cursor", NullUniValue));
+    return page;
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the confirmed balance of an address. Requires -addrindex.\n"
+
+            "\nArguments:\n"
+            "1. \"address\"   (string, required) The bare address\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\" : x.xxx,   (numeric) The current balance in bare\n"
+            "  \"received\" : x.xxx,  (numeric) The total amount received in bare\n"
+            "  \"sent\" : x.xxx       (numeric) The total amount spent in bare\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressbalance", "\"address\"") + HelpExampleRpc("getaddressbalance", "\"address\""));
+
+    unsigned char type;
+    uint160 hashBytes;
+    ParseAddressIndexParam(params[0], type, hashBytes);
+
+    CAddressBalance balance;
+    if (!pblocktree->ReadAddressBalance(type, hashBytes, balance))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot read address balance");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("balance", ValueFromAmount(balance.GetBalance())));
+    result.push_back(Pair("received", ValueFromAmount(balance.nReceived)));
+    result.push_back(Pair("sent", ValueFromAmount(balance.nSent)));
+    return result;
+}
+
+static bool CompareUnspentHeight(const std::pair<CAddressUnspentKey, CAddressUnspentValue>& a, const std::pair<CAddressUnspentKey, CAddressUnspentValue>& b)
+{
+    return a.second.nBlockHeight < b.second.nBlockHeight;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos \"address\"\n"
+            "\nReturns the unspent outputs of an address, oldest first. Requires -addrindex.\n"
+
+            "\nArguments:\n"
+            "1. \"address\"   (string, required) The bare address\n"
+
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"txid\",      (string) The transaction id\n"
+            "    \"vout\" : n,             (numeric) The output index\n"
+            "    \"scriptPubKey\" : \"hex\", (string) The output script\n"
+            "    \"amount\" : x.xxx,       (numeric) The output value in bare\n"
+            "    \"height\" : n            (numeric) The height of the block containing the output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressutxos", "\"address\"") + HelpExampleRpc("getaddressutxos", "\"address\""));
+
+    unsigned char type;
+    uint160 hashBytes;
+    ParseAddressIndexParam(params[0], type, hashBytes);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    if (!pblocktree->ReadAddressUnspentIndex(type, hashBytes, vUnspent))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot read address unspent outputs");
+    std::stable_sort(vUnspent.begin(), vUnspent.end(), CompareUnspentHeight);
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vUnspent.begin(); it != vUnspent.end(); it++) {
+        UniValue output(UniValue::VOBJ);
+        output.push_back(Pair("txid", it->first.txhash.GetHex()));
+        output.push_back(Pair("vout", (int)it->first.nIndex));
+        output.push_back(Pair("scriptPubKey", HexStr(it->second.script.begin(), it->second.script.end())));
+        output.push_back(Pair("amount", ValueFromAmount(it->second.nValue)));
+        output.push_back(Pair("height", it->second.nBlockHeight));
+        result.push_back(output);
+    }
+    return result;
+}
+
+UniValue getaddressdeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 5)
+        throw runtime_error(
+            "getaddressdeltas \"address\" ( start end count \"cursor\" )\n"
+            "\nReturns the balance changes of an address, oldest first. Requires -addrindex.\n"
+
+            "\nArguments:\n"
+            "1. \"address\"   (string, required) The bare address\n"
+            "2. start         (numeric, optional, default=0) First block height\n"
+            "3. end           (numeric, optional, default=0) Last block height, 0 for the tip\n"
+            "4. count         (numeric, optional, default=0) Maximum number of transactions, 0 for all\n"
+            "5. \"cursor\"    (string, optional) Cursor returned by the previous page; overrides start\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"deltas\" : [\n"
+            "    {\n"
+            "      \"txid\" : \"txid\",  (string) The transaction id\n"
+            "      \"index\" : n,        (numeric) The input index when spending, the output index otherwise\n"
+            "      \"height\" : n,       (numeric) The block height\n"
+            "      \"blockindex\" : n,   (numeric) The position of the transaction in the block\n"
+            "      \"amount\" : x.xxx    (numeric) The balance change in bare, negative when spending\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"cursor\" : \"cursor\"  (string) Cursor for the next page, null when done\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressdeltas", "\"address\" 0 0 100") + HelpExampleRpc("getaddressdeltas", "\"address\", 0, 0, 100"));
+
+    unsigned char type;
+    uint160 hashBytes;
+    ParseAddressIndexParam(params[0], type, hashBytes);
+
+    int nStartHeight = 0;
+    int nEndHeight = 0;
+    int nCount = 0;
+    unsigned int nStartTxIndex = 0;
+    if (params.size() > 1)
+        nStartHeight = params[1].get_int();
+    if (params.size() > 2)
+        nEndHeight = params[2].get_int();
+    if (params.size() > 3)
+        nCount = params[3].get_int();
+    if (params.size() > 4 && !params[4].get_str().empty())
+        DecodeAddressIndexCursor(params[4].get_str(), nStartHeight, nStartTxIndex);
+    if (nStartHeight < 0 || nEndHeight < 0 || nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative start, end or count");
+
+    std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> > vEntries;
+    if (!pblocktree->ReadAddressIndex(type, hashBytes, vEntries, nStartHeight, nStartTxIndex, nEndHeight, nCount))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot read address index");
+
+    UniValue deltas(UniValue::VARR);
+    size_t nTxs = 0;
+    for (std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> >::const_iterator it = vEntries.begin(); it != vEntries.end(); it++) {
+        if (it == vEntries.begin() || it->first.txhash != (it - 1)->first.txhash)
+            nTxs++;
+        UniValue delta(UniValue::VOBJ);
+        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
+        delta.push_back(Pair("index", (int)it->first.nIndex));
+        delta.push_back(Pair("height", it->first.nBlockHeight));
+        delta.push_back(Pair("blockindex", (int)it->first.nTxIndex));
+        delta.push_back(Pair("amount", ValueFromAmount(it->second.nValue)));
+        deltas.push_back(delta);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("deltas", deltas));
+    if (nCount > 0 && nTxs == (size_t)nCount)
+        result.push_back(Pair("cursor", EncodeAddressIndexCursor(vEntries.back().first.nBlockHeight, vEntries.back().first.nTxIndex + 1)));
+    else
+        result.push_back(Pair("cursor", NullUniValue));
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getspentinfo \"txid\" n\n"
+            "\nReturns the input that spent a transaction output. Requires -addrindex.\n"
+
+            "\nArguments:\n"
+            "1. \"txid\"   (string, required) The transaction id\n"
+            "2. n          (numeric, required) The output index\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\" : \"txid\",  (string) The spending transaction id\n"
+            "  \"index\" : n,        (numeric) The spending input index\n"
+            "  \"height\" : n        (numeric) The height of the block containing the spending transaction\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getspentinfo", "\"txid\" 0") + HelpExampleRpc("getspentinfo", "\"txid\", 0"));
+
+    if (!fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+
+    uint256 hash = ParseHashV(params[0], "txid");
+    int n = params[1].get_int();
+    if (n < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid output index");
+
+    CSpentIndexValue value;
+    if (!pblocktree->ReadSpentIndex(COutPoint(hash, n), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int)value.nInputIndex));
+    result.push_back(Pair("height", value.nBlockHeight));
     return result;
 }
 
@@ -255,14 +531,13 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("getrawtransaction", "\"mytxid\"") + HelpExampleCli("getrawtransaction", "\"mytxid\" 1") + HelpExampleRpc("getrawtransaction", "\"mytxid\", 1"));
 
-    LOCK(cs_main);
-
     uint256 hash = ParseHashV(params[0], "parameter 1");
 
     bool fVerbose = false;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    // GetTransaction and TxToJSON take cs_main only where they need it
     CTransaction tx;
     uint256 hashBlock = 0;
     if (!GetTransaction(hash, tx, hashBlock, true))
@@ -692,9 +967,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         BOOST_FOREACH(const CTxIn& txin, mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -749,20 +1022,22 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                COutPoint out(txid, nOut);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + coins->vout[nOut].scriptPubKey.ToString() + "\nvs:\n" +
+                    err = err + coin.out.scriptPubKey.ToString() + "\nvs:\n" +
                         scriptPubKey.ToString();
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                    newcoin.out.nValue = AmountFromValue(find_value(prevOut, "amount"));
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, newcoin, true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -820,13 +1095,13 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CScript& prevPubKey = coin.out.scriptPubKey;
+        const CAmount& amount = coin.out.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -895,9 +1170,12 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
         fSwiftX = params[2].get_bool();
 
     CCoinsViewCache& view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx.vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         if (fSwiftX) {
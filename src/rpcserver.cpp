@@ -282,12 +282,12 @@ static const CRPCCommand vRPCCommands[] =
         /* Overall control/query calls */
         {"control", "getinfo", &getinfo, true, false, false}, /* uses wallet if enabled */
         {"control", "help", &help, true, true, false},
-        {"control", "stop", &stop, true, true, false},
+        {"control", "stop", &stop, true, false, false},
 
         /* P2P networking */
         {"network", "getnetworkinfo", &getnetworkinfo, true, false, false},
-        {"network", "addnode", &addnode, true, true, false},
-        {"network", "disconnectnode", &disconnectnode, true, true, false},
+        {"network", "addnode", &addnode, true, false, false},
+        {"network", "disconnectnode", &disconnectnode, true, false, false},
         {"network", "getaddednodeinfo", &getaddednodeinfo, true, true, false},
         {"network", "getconnectioncount", &getconnectioncount, true, false, false},
         {"network", "getnettotals", &getnettotals, true, true, false},
@@ -299,19 +299,21 @@ static const CRPCCommand vRPCCommands[] =
 
         /* Block chain and UTXO */
         {"blockchain", "getblockchaininfo", &getblockchaininfo, true, false, false},
-        {"blockchain", "getbestblockhash", &getbestblockhash, true, false, false},
-        {"blockchain", "getblockcount", &getblockcount, true, false, false},
-        {"blockchain", "getblock", &getblock, true, false, false},
-        {"blockchain", "getblockhash", &getblockhash, true, false, false},
-        {"blockchain", "getblockheader", &getblockheader, false, false, false},
+        {"blockchain", "getbestblockhash", &getbestblockhash, true, true, false},
+        {"blockchain", "getblockcount", &getblockcount, true, true, false},
+        {"blockchain", "getblock", &getblock, true, true, false},
+        {"blockchain", "getblockhash", &getblockhash, true, true, false},
+        {"blockchain", "getblockheader", &getblockheader, false, true, false},
+        {"blockchain", "getblockfilter", &getblockfilter, true, true, false},
         {"blockchain", "getchaintips", &getchaintips, true, false, false},
         {"blockchain", "getdifficulty", &getdifficulty, true, false, false},
         {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false},
         {"blockchain", "getrawmempool", &getrawmempool, true, false, false},
-        {"blockchain", "gettxout", &gettxout, true, false, false},
+        {"blockchain", "gettxout", &gettxout, true, true, false},
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false},
-        {"blockchain", "invalidateblock", &invalidateblock, true, true, false},
-        {"blockchain", "reconsiderblock", &reconsiderblock, true, true, false},
+        {"blockchain", "invalidateblock", &invalidateblock, true, false, false},
+        {"blockchain", "reconsiderblock", &reconsiderblock, true, false, false},
+        {"blockchain", "scantxoutset", &scantxoutset, true, false, false},
         {"blockchain", "verifychain", &verifychain, true, false, false},
 
         /* Mining */
@@ -319,22 +321,26 @@ static const CRPCCommand vRPCCommands[] =
         {"mining", "getmininginfo", &getmininginfo, true, false, false},
         {"mining", "getnetworkhashps", &getnetworkhashps, true, false, false},
         {"mining", "prioritisetransaction", &prioritisetransaction, true, false, false},
-        {"mining", "submitblock", &submitblock, true, true, false},
-        {"mining", "reservebalance", &reservebalance, true, true, false},
+        {"mining", "submitblock", &submitblock, true, false, false},
+        {"mining", "reservebalance", &reservebalance, true, false, false},
 
 #ifdef ENABLE_WALLET
         /* Coin generation */
         {"generating", "getgenerate", &getgenerate, true, false, false},
         {"generating", "gethashespersec", &gethashespersec, true, false, false},
-        {"generating", "setgenerate", &setgenerate, true, true, false},
+        {"generating", "setgenerate", &setgenerate, true, false, false},
 #endif
 
         /* Raw transactions */
         {"rawtransactions", "createrawtransaction", &createrawtransaction, true, false, false},
-        {"rawtransactions", "decoderawtransaction", &decoderawtransaction, true, false, false},
-        {"rawtransactions", "decodescript", &decodescript, true, false, false},
-        {"rawtransactions", "getrawtransaction", &getrawtransaction, true, false, false},
+        {"rawtransactions", "decoderawtransaction", &decoderawtransaction, true, true, false},
+        {"rawtransactions", "decodescript", &decodescript, true, true, false},
+        {"rawtransactions", "getrawtransaction", &getrawtransaction, true, true, false},
         {"rawtransactions", "searchrawtransactions", &searchrawtransactions, true, false, false},
+        {"rawtransactions", "getaddressbalance", &getaddressbalance, true, true, false},
+        {"rawtransactions", "getaddressutxos", &getaddressutxos, true, true, false},
+        {"rawtransactions", "getaddressdeltas", &getaddressdeltas, true, true, false},
+        {"rawtransactions", "getspentinfo", &getspentinfo, true, true, false},
         {"rawtransactions", "sendrawtransaction", &sendrawtransaction, false, false, false},
         {"rawtransactions", "signrawtransaction", &signrawtransaction, false, false, false}, /* uses wallet if enabled */
 
@@ -342,45 +348,46 @@ static const CRPCCommand vRPCCommands[] =
         {"util", "createmultisig", &createmultisig, true, true, false},
         {"util", "createwitnessaddress", &createwitnessaddress, true, true, false},
         {"util", "validateaddress", &validateaddress, true, false, false}, /* uses wallet if enabled */
-        {"util", "verifymessage", &verifymessage, true, false, false},
+        {"util", "verifymessage", &verifymessage, true, true, false},
         {"util", "estimatefee", &estimatefee, true, true, false},
         {"util", "estimatepriority", &estimatepriority, true, true, false},
 
         /* Not shown in help */
-        {"hidden", "invalidateblock", &invalidateblock, true, true, false},
-        {"hidden", "reconsiderblock", &reconsiderblock, true, true, false},
+        {"hidden", "invalidateblock", &invalidateblock, true, false, false},
+        {"hidden", "reconsiderblock", &reconsiderblock, true, false, false},
         {"hidden", "setmocktime", &setmocktime, true, false, false},
 
         /* BARE features */
-        {"bare", "masternode", &masternode, true, true, false},
+        {"bare", "masternode", &masternode, true, false, false},
         {"bare", "listmasternodes", &listmasternodes, true, true, false},
-        {"bare", "createmasternodebroadcast", &createmasternodebroadcast, true, true, false},
+        {"bare", "createmasternodebroadcast", &createmasternodebroadcast, true, false, false},
         {"bare", "decodemasternodebroadcast", &decodemasternodebroadcast, true, true, false},
-        {"bare", "relaymasternodebroadcast", &relaymasternodebroadcast, true, true, false},
+        {"bare", "relaymasternodebroadcast", &relaymasternodebroadcast, true, false, false},
         {"bare", "getmasternodecount", &getmasternodecount, true, true, false},
-        {"bare", "masternodeconnect", &masternodeconnect, true, true, false},
+        {"bare", "masternodeconnect", &masternodeconnect, true, false, false},
         {"bare", "masternodecurrent", &masternodecurrent, true, true, false},
-        {"bare", "masternodedebug", &masternodedebug, true, true, false},
-        {"bare", "startmasternode", &startmasternode, true, true, false},
+        {"bare", "masternodedebug", &masternodedebug, true, false, false},
+        {"bare", "startmasternode", &startmasternode, true, false, false},
         {"bare", "createmasternodekey", &createmasternodekey, true, true, false},
-        {"bare", "getmasternodeoutputs", &getmasternodeoutputs, true, true, false},
+        {"bare", "getmasternodeoutputs", &getmasternodeoutputs, true, false, false},
         {"bare", "listmasternodeconf", &listmasternodeconf, true, true, false},
         {"bare", "getmasternodestatus", &getmasternodestatus, true, true, false},
         {"bare", "getmasternodewinners", &getmasternodewinners, true, true, false},
         {"bare", "getmasternodescores", &getmasternodescores, true, true, false},
-        {"bare", "mnbudget", &mnbudget, true, true, false},
-        {"bare", "preparebudget", &preparebudget, true, true, false},
-        {"bare", "submitbudget", &submitbudget, true, true, false},
-        {"bare", "mnbudgetvote", &mnbudgetvote, true, true, false},
+        {"bare", "getmasternoderank", &getmasternoderank, true, true, false},
+        {"bare", "mnbudget", &mnbudget, true, false, false},
+        {"bare", "preparebudget", &preparebudget, true, false, false},
+        {"bare", "submitbudget", &submitbudget, true, false, false},
+        {"bare", "mnbudgetvote", &mnbudgetvote, true, false, false},
         {"bare", "getbudgetvotes", &getbudgetvotes, true, true, false},
         {"bare", "getnextsuperblock", &getnextsuperblock, true, true, false},
         {"bare", "getbudgetprojection", &getbudgetprojection, true, true, false},
         {"bare", "getbudgetinfo", &getbudgetinfo, true, true, false},
-        {"bare", "mnbudgetrawvote", &mnbudgetrawvote, true, true, false},
-        {"bare", "mnfinalbudget", &mnfinalbudget, true, true, false},
-        {"bare", "checkbudgets", &checkbudgets, true, true, false},
-        {"bare", "mnsync", &mnsync, true, true, false},
-        {"bare", "spork", &spork, true, true, false},
+        {"bare", "mnbudgetrawvote", &mnbudgetrawvote, true, false, false},
+        {"bare", "mnfinalbudget", &mnfinalbudget, true, false, false},
+        {"bare", "checkbudgets", &checkbudgets, true, false, false},
+        {"bare", "mnsync", &mnsync, true, false, false},
+        {"bare", "spork", &spork, true, false, false},
         {"bare", "getpoolinfo", &getpoolinfo, true, true, false},
         {"bare", "makekeypair", &makekeypair, true, true, false},
 #ifdef ENABLE_WALLET
@@ -557,11 +564,96 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/** Whether a batch entry may run at the same time as its threadSafe neighbours */
+static bool IsThreadSafeRequest(const UniValue& req)
 {
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    if (!valMethod.isStr())
+        return false;
+    const CRPCCommand* pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->threadSafe;
+}
+
+/** A run of consecutive threadSafe batch entries, executed by the request's own thread and helper workers */
+class CRPCBatchRun
+{
+public:
+    const UniValue& vReq;
+    const unsigned int nBegin, nEnd;
+    std::vector<UniValue> vResults;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    unsigned int nNext;   //!< next entry to claim
+    int nRunning;         //!< entries claimed but not finished
+
+    CRPCBatchRun(const UniValue& vReqIn, unsigned int nBeginIn, unsigned int nEndIn) : vReq(vReqIn), nBegin(nBeginIn), nEnd(nEndIn), vResults(nEndIn - nBeginIn), nNext(nBeginIn), nRunning(0) {}
+};
+
+/**
+ * Execute entries of a run until none are left to claim. Helpers can start
+ * after the run is over; they find nothing to claim and never touch vReq,
+ * which only lives as long as the request.
+ */
+static void RPCBatchRunWork(boost::shared_ptr<CRPCBatchRun> run)
+{
+    while (true) {
+        unsigned int nIdx;
+        {
+            boost::lock_guard<boost::mutex> lock(run->mutex);
+            if (run->nNext == run->nEnd)
+                return;
+            nIdx = run->nNext++;
+            run->nRunning++;
+        }
+        UniValue result = JSONRPCExecOne(run->vReq[nIdx]);
+        {
+            boost::lock_guard<boost::mutex> lock(run->mutex);
+            run->vResults[nIdx - run->nBegin] = result;
+            run->nRunning--;
+        }
+        run->cond.notify_all();
+    }
+}
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCQueueWorkFn& queueWork)
+{
+    int nConcurrency = queueWork ? std::max((int)GetArg("-rpcbatchconcurrency", DEFAULT_RPC_BATCH_CONCURRENCY), 1) : 1;
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    unsigned int reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        unsigned int nEnd = reqIdx;
+        if (nConcurrency > 1) {
+            while (nEnd < vReq.size() && IsThreadSafeRequest(vReq[nEnd]))
+                nEnd++;
+        }
+        if (nEnd - reqIdx < 2) {
+            // Anything that may change state runs alone, so the entries
+            // around it see its effects in the order they were sent
+            ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+            reqIdx++;
+            continue;
+        }
+
+        boost::shared_ptr<CRPCBatchRun> run(new CRPCBatchRun(vReq, reqIdx, nEnd));
+        int nHelpers = std::min(nConcurrency - 1, (int)(nEnd - reqIdx) - 1);
+        for (int i = 0; i < nHelpers; i++) {
+            if (!queueWork(boost::bind(&RPCBatchRunWork, run)))
+                break;
+        }
+        RPCBatchRunWork(run);
+        {
+            boost::unique_lock<boost::mutex> lock(run->mutex);
+            while (run->nRunning > 0)
+                run->cond.wait(lock);
+        }
+        for (unsigned int i = 0; i < run->vResults.size(); i++)
+            ret.push_back(run->vResults[i]);
+        reqIdx = nEnd;
+    }
 
     return ret.write() + "\n";
 }
@@ -121,7 +121,7 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
-    bool threadSafe;
+    bool threadSafe; //!< read-only; may run alongside other threadSafe entries of a batch
     bool reqWallet;
 };
 
@@ -260,6 +260,10 @@ extern UniValue decodescript(const UniValue& params, bool fHelp);
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue sendrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue searchrawtransactions(const UniValue& params, bool fHelp);
+extern UniValue getaddressbalance(const UniValue& params, bool fHelp);
+extern UniValue getaddressutxos(const UniValue& params, bool fHelp);
+extern UniValue getaddressdeltas(const UniValue& params, bool fHelp);
+extern UniValue getspentinfo(const UniValue& params, bool fHelp);
 
 
 extern UniValue getblockcount(const UniValue& params, bool fHelp); // in rpcblockchain.cpp
@@ -271,8 +275,10 @@ extern UniValue getrawmempool(const UniValue& params, bool fHelp);
 extern UniValue getblockhash(const UniValue& params, bool fHelp);
 extern UniValue getblock(const UniValue& params, bool fHelp);
 extern UniValue getblockheader(const UniValue& params, bool fHelp);
+extern UniValue getblockfilter(const UniValue& params, bool fHelp);
 extern UniValue getfeeinfo(const UniValue& params, bool fHelp);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
+extern UniValue scantxoutset(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
 extern UniValue getchaintips(const UniValue& params, bool fHelp);
@@ -297,6 +303,7 @@ extern UniValue listmasternodeconf(const UniValue& params, bool fHelp);
 extern UniValue getmasternodestatus(const UniValue& params, bool fHelp);
 extern UniValue getmasternodewinners(const UniValue& params, bool fHelp);
 extern UniValue getmasternodescores(const UniValue& params, bool fHelp);
+extern UniValue getmasternoderank(const UniValue& params, bool fHelp);
 
 extern UniValue mnbudget(const UniValue& params, bool fHelp); // in rpcmasternode-budget.cpp
 extern UniValue preparebudget(const UniValue& params, bool fHelp);
@@ -323,6 +330,18 @@ extern UniValue getstakingstatus(const UniValue& params, bool fHelp);
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+
+/** Default for -rpcbatchconcurrency: RPC worker threads one batch request may use at once */
+static const int DEFAULT_RPC_BATCH_CONCURRENCY = 4;
+
+/** Queues a function on another RPC worker thread; false if it could not be queued */
+typedef boost::function<bool(const boost::function<void(void)>&)> RPCQueueWorkFn;
+
+/**
+ * Execute a batch of requests and return the replies in order. Consecutive
+ * entries for threadSafe commands are spread over up to -rpcbatchconcurrency
+ * worker threads when queueWork is given; everything else runs in sequence.
+ */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCQueueWorkFn& queueWork = RPCQueueWorkFn());
 
 #endif // BITCOIN_RPCSERVER_H
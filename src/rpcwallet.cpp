@@ -2134,6 +2134,12 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "  \"keypoololdest\": xxxxxx,    (numeric) the timestamp (seconds since GMT epoch) of the oldest pre-generated key in the key pool\n"
             "  \"keypoolsize\": xxxx,        (numeric) how many new keys are pre-generated\n"
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
+            "  \"scanning\":                 (object) the running rescan, or false if there is none\n"
+            "  {\n"
+            "    \"duration\": xxxx,          (numeric) seconds since the rescan started\n"
+            "    \"progress\": x.xxxx,        (numeric) share of the blocks to rescan that are done, from 0 to 1\n"
+            "    \"eta\": xxxx                (numeric, optional) estimated seconds left, once some progress was made\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getwalletinfo", "") + HelpExampleRpc("getwalletinfo", ""));
@@ -2148,6 +2154,20 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("keypoolsize", (int)pwalletMain->GetKeyPoolSize()));
     if (pwalletMain->IsCrypted())
         obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
+
+    int64_t nScanStartTime = pwalletMain->nScanStartTime;
+    if (nScanStartTime) {
+        UniValue scanning(UniValue::VOBJ);
+        int64_t nDuration = GetTime() - nScanStartTime;
+        double dProgress = pwalletMain->dScanProgress;
+        scanning.push_back(Pair("duration", nDuration));
+        scanning.push_back(Pair("progress", dProgress));
+        if (dProgress > 0.0)
+            scanning.push_back(Pair("eta", (int64_t)(nDuration * (1.0 - dProgress) / dProgress)));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
@@ -5,13 +5,18 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <boost/scoped_array.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+
+#include <atomic>
+#include <limits>
 
 namespace {
 
@@ -19,66 +24,224 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Entries are salted SHA256 hashes of (signature hash, public key, signature)
+ * kept in a fixed table sized from -maxsigcachesize. Each entry may live in
+ * one of SIGCACHE_LOCATIONS slots chosen by its own hash, cuckoo style.
+ *
+ * Lookups take no lock: every slot is a small seqlock, and a lookup that
+ * races with a writer on the same slot simply reports a miss, which only
+ * costs a signature verification. Writers are serialized by cs_insert,
+ * which is cheap next to the ECDSA check that precedes every insert.
+ *
+ * Eviction is generation based. A new generation starts after every
+ * (slots / 2) inserts, and slots written before the previous generation, or
+ * erased after their signature was seen in a block, are free for reuse.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const unsigned int SIGCACHE_LOCATIONS = 4;
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    struct Slot {
+        std::atomic<uint32_t> nSequence;   //!< odd while a writer is updating the slot
+        std::atomic<uint32_t> nGeneration; //!< 0 for an empty or erased slot
+        std::atomic<uint64_t> key[4];
+    };
+
+private:
+    //! Salted hasher, to keep attackers from targeting slots
+    CSHA256 saltedHasher;
+    boost::scoped_array<Slot> slots;
+    uint32_t nSlots;
+    //! Maximum number of relocations for one insert
+    unsigned int nMaxDepth;
+
+    boost::mutex cs_insert;
+    std::atomic<uint32_t> nGeneration;
+    uint32_t nInsertsThisGeneration;
+
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        CSHA256(saltedHasher).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+    static void SplitEntry(const uint256& entry, uint64_t (&key)[4])
+    {
+        const unsigned char* p = entry.begin();
+        for (int i = 0; i < 4; i++)
+            key[i] = ReadLE64(p + 8 * i);
+    }
+
+    void Locations(const uint64_t (&key)[4], uint32_t (&locs)[SIGCACHE_LOCATIONS]) const
+    {
+        // Map 32 bits of the (already uniformly distributed) entry onto
+        // [0, nSlots) without a division
+        for (unsigned int i = 0; i < SIGCACHE_LOCATIONS; i++)
+            locs[i] = (uint32_t)(((key[i] & 0xffffffff) * (uint64_t)nSlots) >> 32);
+    }
+
+    bool Matches(const Slot& slot, const uint64_t (&key)[4]) const
+    {
+        uint32_t nSeq = slot.nSequence.load(std::memory_order_acquire);
+        if (nSeq & 1)
+            return false;
+        bool fMatch = true;
+        for (int i = 0; i < 4; i++)
+            fMatch &= (slot.key[i].load(std::memory_order_relaxed) == key[i]);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return fMatch && slot.nSequence.load(std::memory_order_relaxed) == nSeq;
+    }
+
+    // Requires cs_insert
+    void WriteSlot(Slot& slot, const uint64_t (&key)[4], uint32_t nGen)
+    {
+        uint32_t nSeq = slot.nSequence.load(std::memory_order_relaxed);
+        slot.nSequence.store(nSeq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < 4; i++)
+            slot.key[i].store(key[i], std::memory_order_relaxed);
+        slot.nGeneration.store(nGen, std::memory_order_relaxed);
+        slot.nSequence.store(nSeq + 2, std::memory_order_release);
+    }
+
+    bool IsFree(const Slot& slot, uint32_t nCurrent) const
+    {
+        uint32_t nGen = slot.nGeneration.load(std::memory_order_relaxed);
+        return nGen == 0 || nGen + 1 < nCurrent;
+    }
+
+public:
+    CSignatureCache() : nSlots(0), nMaxDepth(0), nGeneration(1), nInsertsThisGeneration(0)
+    {
+        uint256 nonce = GetRandHash();
+        // We want the nonce to be 64 bytes long to force the hasher to process
+        // this chunk, which makes later hash computations more efficient. We
+        // just write our 32-byte entropy twice to fill the 64 bytes.
+        saltedHasher.Write(nonce.begin(), 32);
+        saltedHasher.Write(nonce.begin(), 32);
+    }
+
+    /** Allocate the table; not safe to call while the cache is in use */
+    size_t Setup(size_t nBytes)
+    {
+        nSlots = std::max((size_t)SIGCACHE_LOCATIONS, std::min(nBytes / sizeof(Slot), (size_t)std::numeric_limits<uint32_t>::max()));
+        slots.reset(new Slot[nSlots]);
+        for (uint32_t i = 0; i < nSlots; i++) {
+            slots[i].nSequence.store(0, std::memory_order_relaxed);
+            slots[i].nGeneration.store(0, std::memory_order_relaxed);
+            for (int j = 0; j < 4; j++)
+                slots[i].key[j].store(0, std::memory_order_relaxed);
+        }
+        nMaxDepth = 1;
+        while (((uint64_t)1 << nMaxDepth) < nSlots)
+            nMaxDepth++;
+        nGeneration.store(1);
+        nInsertsThisGeneration = 0;
+        return nSlots;
+    }
+
+    bool Get(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey, bool fErase)
+    {
+        if (!slots)
+            return false;
+
+        uint256 entry;
+        ComputeEntry(entry, hash, vchSig, pubKey);
+        uint64_t key[4];
+        SplitEntry(entry, key);
+        uint32_t locs[SIGCACHE_LOCATIONS];
+        Locations(key, locs);
+
+        for (unsigned int i = 0; i < SIGCACHE_LOCATIONS; i++) {
+            Slot& slot = slots[locs[i]];
+            if (Matches(slot, key)) {
+                // Signatures seen in a block are unlikely to be needed again
+                if (fErase)
+                    slot.nGeneration.store(0, std::memory_order_relaxed);
+                return true;
+            }
+        }
         return false;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    void Set(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        if (!slots)
+            return;
+
+        uint256 entry;
+        ComputeEntry(entry, hash, vchSig, pubKey);
+        uint64_t key[4];
+        SplitEntry(entry, key);
+
+        boost::unique_lock<boost::mutex> lock(cs_insert);
+
+        uint32_t nCurrent = nGeneration.load(std::memory_order_relaxed);
+        if (++nInsertsThisGeneration > nSlots / 2) {
+            nGeneration.store(++nCurrent, std::memory_order_relaxed);
+            nInsertsThisGeneration = 1;
+        }
+
+        uint32_t locs[SIGCACHE_LOCATIONS];
+        Locations(key, locs);
+        for (unsigned int i = 0; i < SIGCACHE_LOCATIONS; i++) {
+            if (Matches(slots[locs[i]], key))
+                return;
         }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        // Place the entry in a free location, or displace the occupant of
+        // one to another of its locations. Entries still homeless after
+        // nMaxDepth moves are dropped.
+        uint32_t nGen = nCurrent;
+        uint32_t nLastLoc = nSlots;
+        for (unsigned int depth = 0; depth < nMaxDepth; depth++) {
+            for (unsigned int i = 0; i < SIGCACHE_LOCATIONS; i++) {
+                if (IsFree(slots[locs[i]], nCurrent)) {
+                    WriteSlot(slots[locs[i]], key, nGen);
+                    return;
+                }
+            }
+
+            uint32_t nLoc = locs[(depth + insecure_rand()) % SIGCACHE_LOCATIONS];
+            if (nLoc == nLastLoc)
+                nLoc = locs[(depth + 1) % SIGCACHE_LOCATIONS];
+            Slot& victim = slots[nLoc];
+            uint64_t victimKey[4];
+            for (int i = 0; i < 4; i++)
+                victimKey[i] = victim.key[i].load(std::memory_order_relaxed);
+            uint32_t nVictimGen = victim.nGeneration.load(std::memory_order_relaxed);
+            WriteSlot(victim, key, nGen);
+
+            for (int i = 0; i < 4; i++)
+                key[i] = victimKey[i];
+            nGen = nVictimGen;
+            nLastLoc = nLoc;
+            Locations(key, locs);
+        }
     }
 };
 
+CSignatureCache signatureCache;
+
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void InitSignatureCache()
 {
-    static CSignatureCache signatureCache;
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t)1 << 20);
+    if (nMaxCacheSize == 0) {
+        LogPrintf("Signature cache disabled\n");
+        return;
+    }
+    size_t nElems = signatureCache.Setup(nMaxCacheSize);
+    LogPrintf("Using %u MiB out of %u requested for signature cache, able to store %u elements\n",
+        (nElems * sizeof(CSignatureCache::Slot)) >> 20, nMaxCacheSize >> 20, nElems);
+}
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (signatureCache.Get(sighash, vchSig, pubkey, !store))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
@@ -10,6 +10,12 @@
 
 #include <vector>
 
+// DoS prevention: limit cache size to 32MiB, about 800000 entries at 40
+// bytes each. The table is allocated once at startup.
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+// Maximum sig cache size allowed
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
@@ -23,4 +29,7 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size the signature cache from -maxsigcachesize (in MiB) */
+void InitSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
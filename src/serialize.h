@@ -430,6 +430,8 @@ I ReadVarInt(Stream& is)
 
 #define FLATDATA(obj) REF(CFlatData((char*)&(obj), (char*)&(obj) + sizeof(obj)))
 #define VARINT(obj) REF(WrapVarInt(REF(obj)))
+#define BIGENDIAN32(obj) REF(CBigEndian32(REF(obj)))
+#define COMPACTSIZE(obj) REF(CCompactSize(REF(obj)))
 #define LIMITED_STRING(obj, n) REF(LimitedString<n>(REF(obj)))
 
 /** 
@@ -499,6 +501,66 @@ public:
     }
 };
 
+/**
+ * Fixed-size big-endian encoding of a 32-bit integer, so that serialized
+ * database keys sort in numeric order.
+ */
+class CBigEndian32
+{
+protected:
+    uint32_t& n;
+
+public:
+    CBigEndian32(uint32_t& nIn) : n(nIn) {}
+    CBigEndian32(int32_t& nIn) : n((uint32_t&)nIn) {}
+
+    unsigned int GetSerializeSize(int, int) const
+    {
+        return 4;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int, int) const
+    {
+        unsigned char buf[4] = {(unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n};
+        s.write((char*)buf, 4);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int, int)
+    {
+        unsigned char buf[4];
+        s.read((char*)buf, 4);
+        n = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+    }
+};
+
+class CCompactSize
+{
+protected:
+    uint64_t& n;
+
+public:
+    CCompactSize(uint64_t& nIn) : n(nIn) {}
+
+    unsigned int GetSerializeSize(int, int) const
+    {
+        return GetSizeOfCompactSize(n);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int, int) const
+    {
+        WriteCompactSize<Stream>(s, n);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int, int)
+    {
+        n = ReadCompactSize<Stream>(s);
+    }
+};
+
 template <size_t Limit>
 class LimitedString
 {
@@ -77,6 +77,7 @@ public:
     uint256 GetHash() const;
 
     bool SignatureValid();
+    std::string GetStrMessage() const;
     bool Sign();
 
     ADD_SERIALIZE_METHODS;
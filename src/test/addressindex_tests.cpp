@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "main.h"
+#include "serialize.h"
+#include "streams.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static std::string SerializeKey(const CAddressIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::make_pair('A', key);
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_bigendian)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    uint32_t n = 0x01020304;
+    ss << BIGENDIAN32(n);
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), "01020304");
+
+    uint32_t m = 0;
+    ss >> BIGENDIAN32(m);
+    BOOST_CHECK_EQUAL(m, n);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_key_order)
+{
+    // keys of one address must sort by height, then position in block,
+    // as LevelDB iterates them in byte order
+    uint160 hashBytes = 1;
+    uint256 txhash = 7;
+    CAddressIndexKey a(ADDRESS_INDEX_P2PKH, hashBytes, 255, 3, txhash, 0, false);
+    CAddressIndexKey b(ADDRESS_INDEX_P2PKH, hashBytes, 256, 0, txhash, 0, false);
+    CAddressIndexKey c(ADDRESS_INDEX_P2PKH, hashBytes, 256, 1, txhash, 0, false);
+    CAddressIndexKey d(ADDRESS_INDEX_P2PKH, hashBytes, 65536, 0, txhash, 0, false);
+    BOOST_CHECK(SerializeKey(a) < SerializeKey(b));
+    BOOST_CHECK(SerializeKey(b) < SerializeKey(c));
+    BOOST_CHECK(SerializeKey(c) < SerializeKey(d));
+
+    // a seek key is a prefix of the first entry it should land on
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::make_pair('A', CAddressIndexIteratorKey(ADDRESS_INDEX_P2PKH, hashBytes, 256, 1));
+    std::string strSeek = ss.str();
+    BOOST_CHECK(strSeek > SerializeKey(b));
+    BOOST_CHECK(strSeek <= SerializeKey(c));
+    BOOST_CHECK_EQUAL(SerializeKey(c).compare(0, strSeek.size(), strSeek), 0);
+
+    // other address types never interleave
+    CAddressIndexKey e(ADDRESS_INDEX_P2SH, hashBytes, 0, 0, txhash, 0, false);
+    BOOST_CHECK(SerializeKey(d) < SerializeKey(e));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_destinations)
+{
+    unsigned char type;
+    uint160 hashBytes;
+    CKeyID keyID(uint160(42));
+    BOOST_CHECK(GetAddressIndexKey(GetScriptForDestination(keyID), type, hashBytes));
+    BOOST_CHECK_EQUAL(type, ADDRESS_INDEX_P2PKH);
+    BOOST_CHECK(hashBytes == keyID);
+
+    CScriptID scriptID(uint160(43));
+    BOOST_CHECK(GetAddressIndexKey(GetScriptForDestination(scriptID), type, hashBytes));
+    BOOST_CHECK_EQUAL(type, ADDRESS_INDEX_P2SH);
+    BOOST_CHECK(hashBytes == scriptID);
+
+    CScript nulldata;
+    nulldata << OP_RETURN;
+    BOOST_CHECK(!GetAddressIndexKey(nulldata, type, hashBytes));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
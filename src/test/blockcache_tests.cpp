@@ -0,0 +1,71 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+static CBlock MakeBlock()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(recent_block_cache)
+{
+    CRecentBlockCache cache;
+    cache.SetMaxBlocks(3);
+
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 5; i++) {
+        vBlocks.push_back(MakeBlock());
+        cache.Add(vBlocks.back());
+    }
+
+    // Only the last three are kept, with their serialization
+    BOOST_CHECK_EQUAL(cache.Size(), 3U);
+    BOOST_CHECK(!cache.Get(vBlocks[0].GetHash()));
+    BOOST_CHECK(!cache.Get(vBlocks[1].GetHash()));
+    for (int i = 2; i < 5; i++) {
+        CCachedBlockRef pcached = cache.Get(vBlocks[i].GetHash());
+        BOOST_CHECK(pcached);
+        BOOST_CHECK(pcached->block.GetHash() == vBlocks[i].GetHash());
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vBlocks[i];
+        BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == pcached->vSerialized);
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() > 0);
+
+    // A reference handed out survives eviction
+    CCachedBlockRef pkept = cache.Get(vBlocks[2].GetHash());
+    cache.SetMaxBlocks(1);
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+    BOOST_CHECK(!cache.Get(vBlocks[2].GetHash()));
+    BOOST_CHECK(pkept->block.GetHash() == vBlocks[2].GetHash());
+
+    // Zero disables the cache
+    cache.SetMaxBlocks(0);
+    cache.Add(MakeBlock());
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
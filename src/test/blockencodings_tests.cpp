@@ -0,0 +1,117 @@
+// Copyright (c) 2011-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "main.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+static CBlock BuildBlockTestCase()
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    block.vtx.resize(3);
+    block.vtx[0] = tx;
+    block.nVersion = 42;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    block.vtx[1] = tx;
+
+    tx.vin.resize(10);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout.hash = GetRandHash();
+        tx.vin[i].prevout.n = 0;
+    }
+    block.vtx[2] = tx;
+
+    bool mutated;
+    block.hashMerkleRoot = block.BuildMerkleTree(&mutated);
+    assert(!mutated);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlockTestCase());
+
+    // Put the second transaction in the mempool, the third has to be requested
+    pool.addUnchecked(block.vtx[1].GetHash(), CTxMemPoolEntry(block.vtx[1], 0, 0, 0.0, 1));
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+    BOOST_CHECK_EQUAL(shortIDs2.BlockTxCount(), block.vtx.size());
+    BOOST_CHECK_EQUAL(shortIDs2.GetShortID(block.vtx[2].GetWitnessHash()), shortIDs.GetShortID(block.vtx[2].GetWitnessHash()));
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+
+    // A wrong transaction breaks the merkle root
+    {
+        PartiallyDownloadedBlock partialBlockCopy = partialBlock;
+        CBlock block2;
+        std::vector<CTransaction> vtx_missing(1, block.vtx[1]);
+        BOOST_CHECK(partialBlockCopy.FillBlock(block2, vtx_missing) == READ_STATUS_FAILED);
+    }
+
+    // Too few or too many transactions are invalid
+    {
+        PartiallyDownloadedBlock partialBlockCopy = partialBlock;
+        CBlock block2;
+        BOOST_CHECK(partialBlockCopy.FillBlock(block2, std::vector<CTransaction>()) == READ_STATUS_INVALID);
+    }
+
+    CBlock block3;
+    std::vector<CTransaction> vtx_missing(1, block.vtx[2]);
+    BOOST_CHECK(partialBlock.FillBlock(block3, vtx_missing) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block3.GetHash().ToString(), block.GetHash().ToString());
+    bool mutated;
+    BOOST_CHECK_EQUAL(block3.BuildMerkleTree(&mutated).ToString(), block.hashMerkleRoot.ToString());
+    BOOST_CHECK(!mutated);
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest)
+{
+    BlockTransactionsRequest req1;
+    req1.blockhash = GetRandHash();
+    req1.indexes.resize(4);
+    req1.indexes[0] = 0;
+    req1.indexes[1] = 1;
+    req1.indexes[2] = 3;
+    req1.indexes[3] = 4;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req1;
+
+    BlockTransactionsRequest req2;
+    stream >> req2;
+
+    BOOST_CHECK_EQUAL(req1.blockhash.ToString(), req2.blockhash.ToString());
+    BOOST_CHECK_EQUAL(req1.indexes.size(), req2.indexes.size());
+    for (size_t i = 0; i < req1.indexes.size(); i++)
+        BOOST_CHECK_EQUAL(req1.indexes[i], req2.indexes[i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
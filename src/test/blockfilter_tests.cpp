@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "hash.h"
+#include "main.h"
+#include "random.h"
+#include "script/script.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockfilter_tests)
+
+static GCSFilter::Element RandomElement()
+{
+    GCSFilter::Element element(32);
+    GetRandBytes(&element[0], element.size());
+    return element;
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; i++) {
+        included.insert(RandomElement());
+        excluded.insert(RandomElement());
+    }
+
+    GCSFilter filter(GCSFilter::Params(0, 0, 10, 1 << 10), included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100U);
+    BOOST_FOREACH (const GCSFilter::Element& element, included)
+        BOOST_CHECK(filter.Match(element));
+
+    // False positives are rare with M = 1024
+    int nFalsePositives = 0;
+    BOOST_FOREACH (const GCSFilter::Element& element, excluded)
+        nFalsePositives += filter.Match(element) ? 1 : 0;
+    BOOST_CHECK(nFalsePositives < 10);
+
+    GCSFilter::ElementSet mixed(excluded);
+    mixed.insert(*included.begin());
+    BOOST_CHECK(filter.MatchAny(mixed));
+
+    // Decoding gives back the same set
+    GCSFilter decoded(filter.GetParams(), filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100U);
+    BOOST_CHECK(decoded.GetEncoded() == filter.GetEncoded());
+    BOOST_FOREACH (const GCSFilter::Element& element, included)
+        BOOST_CHECK(decoded.Match(element));
+
+    // Truncated or padded data is refused
+    std::vector<unsigned char> vchBad(filter.GetEncoded());
+    vchBad.pop_back();
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), vchBad), std::ios_base::failure);
+    vchBad = filter.GetEncoded();
+    vchBad.push_back(0);
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), vchBad), std::ios_base::failure);
+
+    // An empty set is just its count and matches nothing
+    GCSFilter empty(filter.GetParams(), GCSFilter::ElementSet());
+    BOOST_CHECK(empty.GetEncoded() == std::vector<unsigned char>(1, 0));
+    BOOST_CHECK(!empty.MatchAny(included));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript scriptIncluded = CScript() << OP_DUP << OP_HASH160 << RandomElement() << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript scriptSpent = CScript() << RandomElement() << OP_CHECKSIG;
+    CScript scriptData = CScript() << OP_RETURN << RandomElement();
+    CScript scriptOther = CScript() << OP_HASH160 << RandomElement() << OP_EQUAL;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.push_back(CTxOut(1, scriptIncluded));
+    tx.vout.push_back(CTxOut(0, scriptData));
+    tx.vout.push_back(CTxOut(0, CScript()));
+
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(1, scriptSpent)));
+
+    CBlockFilter filter(block, blockundo);
+    BOOST_CHECK(filter.GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(filter.GetFilter().GetN(), 2U);
+    BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptIncluded.begin(), scriptIncluded.end())));
+    BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptSpent.begin(), scriptSpent.end())));
+    BOOST_CHECK(!filter.GetFilter().Match(GCSFilter::Element(scriptData.begin(), scriptData.end())));
+    BOOST_CHECK(!filter.GetFilter().Match(GCSFilter::Element(scriptOther.begin(), scriptOther.end())));
+
+    // The filter read back is keyed the same way
+    CBlockFilter decoded(block.GetHash(), filter.GetEncoded());
+    BOOST_CHECK(decoded.GetHash() == filter.GetHash());
+    BOOST_CHECK(decoded.GetFilter().Match(GCSFilter::Element(scriptSpent.begin(), scriptSpent.end())));
+
+    // The header chains the filter hash onto the previous header
+    uint256 hashPrevHeader = GetRandHash();
+    uint256 hashFilter = filter.GetHash();
+    BOOST_CHECK(filter.ComputeHeader(hashPrevHeader) == Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end()));
+    BOOST_CHECK(filter.ComputeHeader(hashPrevHeader) != filter.ComputeHeader(uint256(0)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,7 +3,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "clientversion.h"
 #include "random.h"
+#include "streams.h"
 #include "uint256.h"
 
 #include <vector>
@@ -16,27 +18,27 @@ namespace
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -44,10 +46,13 @@ public:
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // Same optimization used in CCoinsViewDB is to only write dirty entries.
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
             }
             mapCoins.erase(it++);
         }
@@ -58,6 +63,25 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = cacheCoins.DynamicMemoryUsage();
+        size_t count = 0;
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coin.DynamicMemoryUsage();
+            count++;
+        }
+        BOOST_CHECK_EQUAL(GetCacheSize(), count);
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -67,7 +91,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -85,12 +109,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool missed_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -103,38 +127,43 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
+            COutPoint outpoint(txid, insecure_rand() % 4);
+            Coin& coin = result[outpoint];
+            const Coin& entry = stack.back()->AccessCoin(outpoint);
+            BOOST_CHECK(coin == entry);
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (coin.IsSpent()) {
                     added_an_entry = true;
                 } else {
                     updated_an_entry = true;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(outpoint, newcoin, !coin.IsSpent() || insecure_rand() & 1);
+                coin = newcoin;
             } else {
-                coins.Clear();
-                entry->Clear();
+                stack.back()->SpendCoin(outpoint);
+                coin.Clear();
                 removed_an_entry = true;
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    found_an_entry = true;
                 }
             }
+            for (size_t n = 0; n < stack.size(); n++)
+                stack[n]->SelfTest();
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +180,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +204,104 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+// Insert and erase random outpoints in a CCoinsMap and check it against a
+// std::map, so that probing, backward shift deletion, slot reuse and growth
+// are all exercised.
+BOOST_AUTO_TEST_CASE(coins_map_test)
+{
+    CCoinsMap map;
+    std::map<COutPoint, CAmount> expected;
+
+    std::vector<uint256> txids(64);
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        txids[i] = GetRandHash();
+    }
+
+    for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
+        COutPoint outpoint(txids[insecure_rand() % txids.size()], insecure_rand() % 64);
+        CCoinsMap::iterator it = map.find(outpoint);
+        BOOST_CHECK_EQUAL(it != map.end(), expected.count(outpoint) == 1);
+        if (it == map.end()) {
+            Coin coin;
+            coin.out.nValue = insecure_rand();
+            std::pair<CCoinsMap::iterator, bool> ret = map.emplace(outpoint, CCoinsCacheEntry(coin));
+            BOOST_CHECK(ret.second);
+            BOOST_CHECK(ret.first->first == outpoint);
+            expected[outpoint] = coin.out.nValue;
+        } else {
+            BOOST_CHECK_EQUAL(it->second.coin.out.nValue, expected[outpoint]);
+            if (insecure_rand() % 2 == 0) {
+                map.erase(it);
+                expected.erase(outpoint);
+            } else {
+                BOOST_CHECK(!map.emplace(outpoint, CCoinsCacheEntry()).second);
+            }
+        }
+        BOOST_CHECK_EQUAL(map.size(), expected.size());
+    }
+
+    size_t count = 0;
+    for (CCoinsMap::iterator it = map.begin(); it != map.end(); ++it) {
+        BOOST_CHECK_EQUAL(it->second.coin.out.nValue, expected[it->first]);
+        count++;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+}
+
+// Apply random block-sized deltas to a running CUTXOStats, and check that it
+// always matches statistics computed from scratch over the resulting set.
+BOOST_AUTO_TEST_CASE(utxo_stats_test)
+{
+    std::map<COutPoint, Coin> utxos;
+    CUTXOStats running;
+
+    for (unsigned int block = 0; block < 20; block++) {
+        CUTXOStats delta;
+        for (unsigned int i = 0; i < 10; i++) {
+            if (!utxos.empty() && insecure_rand() % 3 == 0) {
+                std::map<COutPoint, Coin>::iterator it = utxos.begin();
+                delta.RemoveCoin(it->first, it->second);
+                utxos.erase(it);
+            } else {
+                Coin coin;
+                coin.out.nValue = insecure_rand() % 100000;
+                coin.out.scriptPubKey = CScript() << OP_TRUE;
+                coin.nHeight = block;
+                coin.fCoinBase = i == 0;
+                COutPoint outpoint(GetRandHash(), insecure_rand() % 4);
+                delta.AddCoin(outpoint, coin);
+                utxos[outpoint] = coin;
+            }
+        }
+        // Burnt outputs only count towards the unspendable total
+        Coin burnt;
+        burnt.out.nValue = 7;
+        burnt.out.scriptPubKey = CScript() << OP_RETURN;
+        delta.AddCoin(COutPoint(GetRandHash(), 0), burnt);
+        running += delta;
+
+        CUTXOStats full;
+        for (std::map<COutPoint, Coin>::iterator it = utxos.begin(); it != utxos.end(); ++it)
+            full.AddCoin(it->first, it->second);
+        BOOST_CHECK_EQUAL(running.totals.nTransactionOutputs, (int64_t)utxos.size());
+        BOOST_CHECK_EQUAL(running.totals.nTransactionOutputs, full.totals.nTransactionOutputs);
+        BOOST_CHECK_EQUAL(running.totals.nSerializedSize, full.totals.nSerializedSize);
+        BOOST_CHECK_EQUAL(running.totals.nTotalAmount, full.totals.nTotalAmount);
+        BOOST_CHECK_EQUAL(running.totals.nTotalUnspendable, 7 * (block + 1));
+        BOOST_CHECK(running.GetHash() == full.GetHash());
+    }
+
+    // The running state survives a database round trip
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << running;
+    CUTXOStats loaded;
+    ss >> loaded;
+    BOOST_CHECK(loaded.GetHash() == running.GetHash());
+    BOOST_CHECK_EQUAL(loaded.totals.nTotalAmount, running.totals.nTotalAmount);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
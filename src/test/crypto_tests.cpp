@@ -2,6 +2,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/muhash.h"
 #include "crypto/rfc6979_hmac_sha256.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
@@ -282,4 +283,59 @@ BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
             ("7597887cbd76321f32e30440679a22cf7f8d9d2eac390e581fea091ce202ba94"));
 }
 
+static std::vector<unsigned char> MuHashFinal(MuHash3072 muhash)
+{
+    std::vector<unsigned char> out(32);
+    muhash.Finalize(&out[0]);
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    unsigned char a[] = {0x01};
+    unsigned char b[] = {0x02, 0x03};
+    unsigned char c[] = {0x04, 0x05, 0x06};
+
+    // Inverse: x * x^-1 == 1
+    MuHash3072 one;
+    MuHash3072 x;
+    x.Insert(a, sizeof(a));
+    unsigned char num[Num3072::BYTE_SIZE], den[Num3072::BYTE_SIZE];
+    x.GetState(num, den);
+    Num3072 n(num);
+    n.Multiply(n.GetInverse());
+    unsigned char nbytes[Num3072::BYTE_SIZE], onebytes[Num3072::BYTE_SIZE];
+    n.ToBytes(nbytes);
+    Num3072().ToBytes(onebytes);
+    BOOST_CHECK(memcmp(nbytes, onebytes, sizeof(nbytes)) == 0);
+
+    // The hash does not depend on insertion order
+    MuHash3072 abc, cba;
+    abc.Insert(a, sizeof(a)).Insert(b, sizeof(b)).Insert(c, sizeof(c));
+    cba.Insert(c, sizeof(c)).Insert(b, sizeof(b)).Insert(a, sizeof(a));
+    BOOST_CHECK(MuHashFinal(abc) == MuHashFinal(cba));
+    BOOST_CHECK(MuHashFinal(abc) != MuHashFinal(one));
+
+    // Removing elements, directly or by combining sets, restores earlier states
+    MuHash3072 ac = abc;
+    ac.Remove(b, sizeof(b));
+    MuHash3072 acset;
+    acset.Insert(a, sizeof(a)).Insert(c, sizeof(c));
+    BOOST_CHECK(MuHashFinal(ac) == MuHashFinal(acset));
+
+    MuHash3072 delta;
+    delta.Insert(b, sizeof(b));
+    MuHash3072 combined = acset;
+    combined *= delta;
+    BOOST_CHECK(MuHashFinal(combined) == MuHashFinal(abc));
+    combined /= delta;
+    BOOST_CHECK(MuHashFinal(combined) == MuHashFinal(acset));
+
+    // Finalize normalizes the state but keeps the value
+    MuHash3072 normalized = ac;
+    std::vector<unsigned char> out(32);
+    normalized.Finalize(&out[0]);
+    BOOST_CHECK(MuHashFinal(normalized) == MuHashFinal(acset));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,62 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "key.h"
+#include "main.h"
+#include "masternode-collateral.h"
+#include "random.h"
+#include "script/standard.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(masternode_collateral_tests)
+
+static COutPoint AddCollateral(const CPubKey& pubkey, CAmount nValue)
+{
+    COutPoint outpoint(GetRandHash(), 0);
+    CTxOut out(nValue, GetScriptForDestination(pubkey.GetID()));
+    LOCK(cs_main);
+    pcoinsTip->AddCoin(outpoint, Coin(out, chainActive.Height(), false, false), false);
+    return outpoint;
+}
+
+BOOST_AUTO_TEST_CASE(collateral_check)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    int64_t nConfirmedTime = 0;
+
+    masternodeCollateral.TipChanged();
+
+    BOOST_CHECK_EQUAL(masternodeCollateral.Check(COutPoint(GetRandHash(), 0), pubkey, nConfirmedTime), COLLATERAL_SPENT);
+
+    COutPoint outpointSmall = AddCollateral(pubkey, MASTERNODE_COLLATERAL_AMOUNT - 1);
+    BOOST_CHECK_EQUAL(masternodeCollateral.Check(outpointSmall, pubkey, nConfirmedTime), COLLATERAL_INVALID_AMOUNT);
+
+    // a fresh collateral is only one block deep
+    COutPoint outpoint = AddCollateral(pubkey, MASTERNODE_COLLATERAL_AMOUNT);
+    BOOST_CHECK_EQUAL(masternodeCollateral.Check(outpoint, keyOther.GetPubKey(), nConfirmedTime), COLLATERAL_INVALID_PUBKEY);
+    BOOST_CHECK_EQUAL(masternodeCollateral.Check(outpoint, pubkey, nConfirmedTime), COLLATERAL_IMMATURE);
+
+    // the lookup is cached until the tip moves
+    {
+        LOCK(cs_main);
+        pcoinsTip->SpendCoin(outpoint);
+    }
+    BOOST_CHECK_EQUAL(masternodeCollateral.Check(outpoint, pubkey, nConfirmedTime), COLLATERAL_IMMATURE);
+    masternodeCollateral.TipChanged();
+    BOOST_CHECK_EQUAL(masternodeCollateral.Check(outpoint, pubkey, nConfirmedTime), COLLATERAL_SPENT);
+
+    {
+        LOCK(cs_main);
+        pcoinsTip->SpendCoin(outpointSmall);
+    }
+    masternodeCollateral.TipChanged();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -99,4 +99,48 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorDescendantTest)
+{
+    // Chain of three transactions: parent -> child -> grandchild
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0) {
+            tx[i].vin[0].prevout.hash = tx[i - 1].GetHash();
+            tx[i].vin[0].prevout.n = 0;
+        }
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL * (3 - i);
+    }
+
+    CTxMemPool testPool(CFeeRate(0));
+    for (int i = 0; i < 3; i++)
+        testPool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], 1000 * (i + 1), 0, 0.0, 1));
+
+    CTxMemPool::txiter parent = testPool.mapTx.find(tx[0].GetHash());
+    CTxMemPool::txiter grandchild = testPool.mapTx.find(tx[2].GetHash());
+    BOOST_CHECK_EQUAL(parent->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(parent->GetModFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(grandchild->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandchild->GetModFeesWithAncestors(), 6000);
+
+    // Prioritising the middle transaction is reflected on both sides of it
+    testPool.PrioritiseTransaction(tx[1].GetHash(), tx[1].GetHash().ToString(), 0.0, 500);
+    BOOST_CHECK_EQUAL(parent->GetModFeesWithDescendants(), 6500);
+    BOOST_CHECK_EQUAL(grandchild->GetModFeesWithAncestors(), 6500);
+
+    // The grandchild's package now has the highest fee rate
+    BOOST_CHECK(testPool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == tx[2].GetHash());
+
+    // Removing the child takes the grandchild with it and updates the parent
+    std::list<CTransaction> removed;
+    testPool.remove(tx[1], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK_EQUAL(testPool.size(), 1);
+    BOOST_CHECK_EQUAL(parent->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(parent->GetModFeesWithDescendants(), 1000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
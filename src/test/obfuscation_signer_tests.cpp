@@ -0,0 +1,47 @@
+// Copyright (c) 2018 The Bare developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "obfuscation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(obfuscation_signer_tests)
+
+BOOST_AUTO_TEST_CASE(verify_message_cache)
+{
+    CObfuScationSigner signer;
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    std::string strError;
+
+    std::string strMessage = "mnp 1234";
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(signer.SignMessage(strMessage, strError, vchSig, key));
+
+    // the second check of the same signature is answered from the cache,
+    // which must still tell signers apart
+    BOOST_CHECK(signer.VerifyMessage(pubkey, vchSig, strMessage, strError));
+    BOOST_CHECK(signer.VerifyMessage(pubkey, vchSig, strMessage, strError));
+    BOOST_CHECK(!signer.VerifyMessage(keyOther.GetPubKey(), vchSig, strMessage, strError));
+    BOOST_CHECK(!signer.VerifyMessage(pubkey, vchSig, strMessage + "x", strError));
+
+    // a signer recovered ahead of time by a verification thread
+    std::string strMessage2 = "mvote 5678";
+    std::vector<unsigned char> vchSig2;
+    BOOST_CHECK(signer.SignMessage(strMessage2, strError, vchSig2, key));
+    BOOST_CHECK(signer.RecoverSigner(vchSig2, strMessage2) == pubkey.GetID());
+    BOOST_CHECK(!signer.VerifyMessage(keyOther.GetPubKey(), vchSig2, strMessage2, strError));
+    BOOST_CHECK(signer.VerifyMessage(pubkey, vchSig2, strMessage2, strError));
+    BOOST_CHECK(signer.RecoverSigner(vchSig2, strMessage2) == pubkey.GetID());
+
+    // a corrupted signature never verifies
+    vchSig[10] ^= 1;
+    BOOST_CHECK(!signer.VerifyMessage(pubkey, vchSig, strMessage, strError));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
@@ -181,6 +182,50 @@ BOOST_AUTO_TEST_CASE(json_parse_errors)
     BOOST_CHECK_THROW(ParseNonRFCJSONValue("3J98t1WpEZ73CNmQviecrnyiWrnqRhWNL"), std::runtime_error);
 }
 
+static boost::thread_group* pthreadsBatch = NULL;
+
+static bool QueueBatchWork(const boost::function<void(void)>& func)
+{
+    pthreadsBatch->create_thread(func);
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    mapArgs["-rpcbatchconcurrency"] = "3";
+
+    // decodescript is threadSafe, the unknown method in the middle is not
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 9; i++) {
+        UniValue req(UniValue::VOBJ);
+        req.push_back(Pair("id", i));
+        req.push_back(Pair("method", i == 4 ? "nosuchmethod" : "decodescript"));
+        UniValue params(UniValue::VARR);
+        params.push_back(strprintf("%02x", 0x51 + i)); // OP_1 + i
+        req.push_back(Pair("params", params));
+        vReq.push_back(req);
+    }
+
+    boost::thread_group threads;
+    pthreadsBatch = &threads;
+    UniValue ret;
+    BOOST_CHECK(ret.read(JSONRPCExecBatch(vReq, &QueueBatchWork)));
+    threads.join_all();
+    pthreadsBatch = NULL;
+    mapArgs.erase("-rpcbatchconcurrency");
+
+    BOOST_CHECK_EQUAL(ret.size(), 9);
+    for (int i = 0; i < 9; i++) {
+        BOOST_CHECK_EQUAL(find_value(ret[i], "id").get_int(), i);
+        if (i == 4) {
+            BOOST_CHECK(!find_value(ret[i], "error").isNull());
+        } else {
+            BOOST_CHECK(find_value(ret[i], "error").isNull());
+            BOOST_CHECK_EQUAL(find_value(find_value(ret[i], "result"), "asm").get_str(), strprintf("%d", i + 1));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(rpc_ban)
 {
     BOOST_CHECK_NO_THROW(CallRPC(string("clearbanned")));
@@ -35,6 +35,7 @@ struct TestingSetup {
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
         noui_connect();
+        InitSignatureCache();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
 #endif
@@ -4,6 +4,11 @@
 
 #include "wallet.h"
 
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txmempool.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -21,6 +26,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_AUTO_TEST_SUITE(wallet_tests)
@@ -305,4 +312,79 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(wallet_utxo_index)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    CAmount nUnconfirmed = pwalletMain->GetUnconfirmedBalance();
+    CAmount nBalance = pwalletMain->GetBalance();
+
+    // An unconfirmed payment to us shows up in the unconfirmed balance and,
+    // when unconfirmed coins are asked for, in AvailableCoins
+    CMutableTransaction txPay;
+    txPay.vin.resize(1);
+    txPay.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txPay.vout.resize(1);
+    txPay.vout[0].nValue = 10 * COIN;
+    txPay.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction tx1(txPay);
+    mempool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 0, 0, 0.0, 1));
+    pwalletMain->SyncTransaction(tx1, NULL);
+
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + 10 * COIN);
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + 10 * COIN);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), nBalance);
+
+    vector<COutput> vAvailable;
+    pwalletMain->AvailableCoins(vAvailable, false);
+    bool fFound = false;
+    BOOST_FOREACH (const COutput& out, vAvailable)
+        fFound |= out.tx->GetHash() == tx1.GetHash() && out.i == 0;
+    BOOST_CHECK(fFound);
+
+    // Spending it takes it out of both
+    CMutableTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(tx1.GetHash(), 0));
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = 10 * COIN;
+    txSpend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx2(txSpend);
+    mempool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 0, 0, 0.0, 1));
+    pwalletMain->SyncTransaction(tx2, NULL);
+
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+    pwalletMain->AvailableCoins(vAvailable, false);
+    BOOST_FOREACH (const COutput& out, vAvailable)
+        BOOST_CHECK(out.tx->GetHash() != tx1.GetHash());
+
+    std::list<CTransaction> removed;
+    mempool.remove(tx1, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(wallet_rescan)
+{
+    CBlockIndex* pindexGenesis;
+    CScript scriptGenesis;
+    {
+        LOCK(cs_main);
+        pindexGenesis = chainActive.Genesis();
+        BOOST_REQUIRE(pindexGenesis);
+        CBlock block;
+        BOOST_REQUIRE(ReadBlockFromDisk(block, pindexGenesis));
+        scriptGenesis = block.vtx[0].vout[0].scriptPubKey;
+    }
+
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(pindexGenesis, true), 0);
+
+    // Watching the genesis output makes the rescan pick up its coinbase
+    BOOST_CHECK(pwalletMain->AddWatchOnly(scriptGenesis));
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(pindexGenesis, true), 1);
+    BOOST_CHECK(pwalletMain->nScanStartTime == 0);
+    BOOST_CHECK(pwalletMain->RemoveWatchOnly(scriptGenesis));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 
 #include "txdb.h"
 
+#include "blockfilter.h"
 #include "main.h"
 #include "pow.h"
 #include "random.h"
@@ -14,16 +15,84 @@
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+namespace
 {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+/** Key of a per-outpoint coin record: 'C' + txid + VARINT(n) */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key('C') {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/**
+ * Per-transaction coin record as stored under 'c' before the switch to
+ * per-outpoint records. Only read by CCoinsViewDB::Upgrade().
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 1: IsCoinBase()
+ * - bit 2: IsCoinStake()
+ * - bits 4,8: vout[0] and vout[1] are not spent
+ * - the higher bits encode N, the number of non-zero bytes in the following bitvector.
+ */
+struct CLegacyCoins {
+    bool fCoinBase;
+    bool fCoinStake;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CLegacyCoins() : fCoinBase(false), fCoinStake(false), nHeight(0) {}
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0;
+        int nTxVersion = 0;
+        ::Unserialize(s, VARINT(nTxVersion), nType, nVersion);
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        fCoinStake = (nCode & 2) != 0;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 4) != 0;
+        vAvail[1] = (nCode & 8) != 0;
+        unsigned int nMaskCode = (nCode / 16) + ((nCode & 12) != 0 ? 0 : 1);
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++)
+                vAvail.push_back((chAvail & (1 << p)) != 0);
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
@@ -35,14 +104,14 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewDB::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256& txid) const
+bool CCoinsViewDB::HaveCoin(const COutPoint& outpoint) const
 {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -60,7 +129,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
@@ -70,16 +143,68 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed coins (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+bool CCoinsViewDB::Upgrade()
 {
-    if (!Read('S', salt)) {
-        salt = GetRandHash();
-        Write('S', salt);
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'c';
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid())
+        return true;
+
+    LogPrintf("Upgrading utxo-set database...\n");
+    size_t nTxs = 0;
+    size_t nCoins = 0;
+    CLevelDBBatch batch;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'c')
+                break;
+            uint256 txid;
+            ssKey >> txid;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CLegacyCoins old;
+            ssValue >> old;
+
+            COutPoint outpoint(txid, 0);
+            for (size_t i = 0; i < old.vout.size(); ++i) {
+                if (!old.vout[i].IsNull() && !old.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(old.vout[i], old.nHeight, old.fCoinBase, old.fCoinStake);
+                    outpoint.n = i;
+                    batch.Write(CoinEntry(&outpoint), newcoin);
+                    nCoins++;
+                }
+            }
+            batch.Erase(make_pair('c', txid));
+            if (++nTxs % 100000 == 0) {
+                if (!db.WriteBatch(batch))
+                    return error("%s : failed to write upgraded coins", __func__);
+                batch.Clear();
+                LogPrintf("Upgrading utxo-set database... %u transactions, %u coins\n", (unsigned int)nTxs, (unsigned int)nCoins);
+            }
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
+    if (!db.WriteBatch(batch))
+        return error("%s : failed to write upgraded coins", __func__);
+    LogPrintf("Upgraded utxo-set database: %u transactions, %u coins\n", (unsigned int)nTxs, (unsigned int)nCoins);
+    return true;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+{
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
@@ -133,6 +258,8 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    uint256 prevhash = 0;
+    bool fHaveTx = false;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -140,41 +267,134 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'c') {
+            if (chType == 'C') {
+                // coins of one transaction are adjacent; hash them as one record
+                COutPoint outpoint;
+                ssKey >> outpoint.hash;
+                ssKey >> VARINT(outpoint.n);
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+                Coin coin;
+                ssValue >> coin;
+                if (!fHaveTx || outpoint.hash != prevhash) {
+                    if (fHaveTx)
+                        ss << VARINT(0);
+                    ss << outpoint.hash;
+                    ss << VARINT(coin.nHeight * 4 + (coin.fCoinStake ? 2 : 0) + (coin.fCoinBase ? 1 : 0));
+                    prevhash = outpoint.hash;
+                    fHaveTx = true;
+                    stats.nTransactions++;
                 }
+                stats.nTransactionOutputs++;
+                ss << VARINT(outpoint.n + 1);
+                ss << coin.out;
+                nTotalAmount += coin.out.nValue;
                 stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
             }
             pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (fHaveTx)
+        ss << VARINT(0);
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+bool CCoinsViewDB::GetUTXOStats(CUTXOStats& stats) const
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'C';
+    pcursor->Seek(ssKeySet.str());
+
+    stats = CUTXOStats();
+    stats.hashBlock = GetBestBlock();
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'C')
+                break;
+            COutPoint outpoint;
+            ssKey >> outpoint.hash;
+            ssKey >> VARINT(outpoint.n);
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            Coin coin;
+            ssValue >> coin;
+            stats.AddCoin(outpoint, coin);
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+/** Worker of CCoinsViewDB::ParallelScan: claims txid ranges (by first key byte) until none are left */
+static void ScanCoinRanges(CLevelDBWrapper* pdb, const leveldb::Snapshot* snapshot, CCoinsScanVisitor* pvisitor, CCoinsScanProgress* pprogress, std::atomic<int>* pnNextRange, std::atomic<bool>* pfError)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator(snapshot));
+    int nRange;
+    while (!pprogress->fAbort && !*pfError && (nRange = (*pnNextRange)++) < CCoinsViewDB::SCAN_RANGES) {
+        const char start[2] = {'C', (char)nRange};
+        pcursor->Seek(leveldb::Slice(start, sizeof(start)));
+        uint64_t nCoins = 0;
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() < 2 || slKey[0] != 'C' || (unsigned char)slKey[1] != nRange)
+                break;
+            if ((++nCoins & 0xfff) == 0 && pprogress->fAbort)
+                break;
+            try {
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                COutPoint outpoint;
+                ssKey >> chType;
+                ssKey >> outpoint.hash;
+                ssKey >> VARINT(outpoint.n);
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                Coin coin;
+                ssValue >> coin;
+                pvisitor->Visit(outpoint, coin);
+            } catch (std::exception& e) {
+                LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+                *pfError = true;
+                break;
+            }
+        }
+        if (!pcursor->status().ok()) {
+            LogPrintf("%s : LevelDB iteration failure: %s\n", __func__, pcursor->status().ToString());
+            *pfError = true;
+        }
+        pprogress->nCoins += nCoins;
+        pprogress->nRangesDone++;
+    }
+}
+
+bool CCoinsViewDB::ParallelScan(const leveldb::Snapshot* snapshot, CCoinsScanVisitor& visitor, int nThreads, CCoinsScanProgress& progress)
+{
+    std::atomic<int> nNextRange(0);
+    std::atomic<bool> fError(false);
+
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ScanCoinRanges, &db, snapshot, &visitor, &progress, &nNextRange, &fError));
+    ScanCoinRanges(&db, snapshot, &visitor, &progress, &nNextRange, &fError);
+    threadGroup.join_all();
+
+    if (fError)
+        return error("%s : failed to read the coin database", __func__);
+    return !progress.fAbort;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256& txid, CDiskTxPos& pos)
 {
     return Read(make_pair('t', txid), pos);
@@ -188,53 +408,132 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddrIndex(uint160 addrid, std::vector<CExtDiskTxPos> &list) {
+bool CBlockTreeDB::ReadAddressIndex(unsigned char type, const uint160& hashBytes, std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> >& vEntries, int nStartHeight, unsigned int nStartTxIndex, int nEndHeight, size_t nMaxTxs)
+{
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
-    uint64_t lookupid;
-    {
-        CHashWriter ss(SER_GETHASH, 0);
-        ss << salt;
-        ss << addrid;
-        lookupid = (ss.GetHash()).GetLow64();
-    }
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('A', CAddressIndexIteratorKey(type, hashBytes, nStartHeight, nStartTxIndex));
+    pcursor->Seek(ssKeySet.str());
 
-    CDataStream firstKey(SER_DISK, CLIENT_VERSION);
-    firstKey << make_pair('a', lookupid);
-    pcursor->Seek(firstKey.str());
-
-    for(pcursor->Seek(firstKey.str()); pcursor->Valid(); pcursor->Next()) {
-        leveldb::Slice key = pcursor->key();
-        CDataStream ssKey(key.data(), key.data() + key.size(), SER_DISK, CLIENT_VERSION);
-        char id;
-        ssKey >> id;
-        if(id == 'a') {
-            uint64_t lid;
-            ssKey >> lid;
-            if(lid == lookupid) {
-                CExtDiskTxPos position;
-                ssKey >> position;
-                list.push_back(position);
-            } else {
+    // entries of one transaction are adjacent, so counting hash changes counts transactions
+    uint256 hashLastTx = 0;
+    size_t nTxs = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'A')
+                break;
+            CAddressIndexKey key;
+            ssKey >> key;
+            if (key.type != type || key.hashBytes != hashBytes)
                 break;
+            if (nEndHeight > 0 && key.nBlockHeight > nEndHeight)
+                break;
+            if (key.txhash != hashLastTx) {
+                if (nMaxTxs > 0 && nTxs == nMaxTxs)
+                    break;
+                hashLastTx = key.txhash;
+                nTxs++;
             }
-        } else {
-            break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressIndexValue value;
+            ssValue >> value;
+            vEntries.push_back(std::make_pair(key, value));
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(unsigned char type, const uint160& hashBytes, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('U', CAddressUnspentKey(type, hashBytes, uint256(0), 0));
+    pcursor->Seek(ssKeySet.str());
+
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'U')
+                break;
+            CAddressUnspentKey key;
+            ssKey >> key;
+            if (key.type != type || key.hashBytes != hashBytes)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue value;
+            ssValue >> value;
+            vUnspent.push_back(std::make_pair(key, value));
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
     return true;
 }
 
-bool CBlockTreeDB::AddAddrIndex(const std::vector<std::pair<uint160, CExtDiskTxPos> > &list) {
-    unsigned char foo[0];
+bool CBlockTreeDB::ReadSpentIndex(const COutPoint& outpoint, CSpentIndexValue& value)
+{
+    return Read(make_pair('p', outpoint), value);
+}
+
+bool CBlockTreeDB::ReadAddressBalance(unsigned char type, const uint160& hashBytes, CAddressBalance& balance)
+{
+    balance = CAddressBalance();
+    if (!Exists(make_pair('B', make_pair(type, hashBytes))))
+        return true;
+    return Read(make_pair('B', make_pair(type, hashBytes)), balance);
+}
+
+bool CBlockTreeDB::UpdateAddressIndex(const CAddressIndexBatch& update, bool fConnect)
+{
     CLevelDBBatch batch;
-    for (std::vector<std::pair<uint160, CExtDiskTxPos> >::const_iterator it=list.begin(); it!=list.end(); it++) {
-        CHashWriter ss(SER_GETHASH, 0);
-        ss << salt;
-        ss << it->first;
-        batch.Write(make_pair(make_pair('a', (ss.GetHash()).GetLow64()), it->second), FLATDATA(foo));
+    for (std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> >::const_iterator it = update.vDeltas.begin(); it != update.vDeltas.end(); it++) {
+        if (fConnect)
+            batch.Write(make_pair('A', it->first), it->second);
+        else
+            batch.Erase(make_pair('A', it->first));
+    }
+    // applied in order, so an output created and spent within the same block ends up erased
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = update.vUnspent.begin(); it != update.vUnspent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('U', it->first));
+        else
+            batch.Write(make_pair('U', it->first), it->second);
     }
-    return WriteBatch(batch, true);
+    for (std::vector<std::pair<COutPoint, CSpentIndexValue> >::const_iterator it = update.vSpent.begin(); it != update.vSpent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('p', it->first));
+        else
+            batch.Write(make_pair('p', it->first), it->second);
+    }
+    for (std::map<std::pair<unsigned char, uint160>, CAddressBalance>::const_iterator it = update.mapBalance.begin(); it != update.mapBalance.end(); it++) {
+        CAddressBalance balance;
+        if (!ReadAddressBalance(it->first.first, it->first.second, balance))
+            return false;
+        balance.nReceived += it->second.nReceived;
+        balance.nSent += it->second.nSent;
+        if (balance.nReceived == 0 && balance.nSent == 0)
+            batch.Erase(make_pair('B', it->first));
+        else
+            batch.Write(make_pair('B', it->first), balance);
+    }
+    return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string& name, bool fValue)
@@ -261,6 +560,36 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
+bool CBlockTreeDB::WriteUTXOTotals(const uint256& hashBlock, const CUTXOTotals& totals)
+{
+    return Write(make_pair('S', hashBlock), totals);
+}
+
+bool CBlockTreeDB::ReadUTXOTotals(const uint256& hashBlock, CUTXOTotals& totals)
+{
+    return Read(make_pair('S', hashBlock), totals);
+}
+
+bool CBlockTreeDB::WriteUTXOStats(const CUTXOStats& stats)
+{
+    return Write('M', stats);
+}
+
+bool CBlockTreeDB::ReadUTXOStats(CUTXOStats& stats)
+{
+    return Read('M', stats);
+}
+
+bool CBlockTreeDB::WriteBlockFilter(const uint256& hashBlock, const CBlockFilterEntry& entry)
+{
+    return Write(make_pair('G', hashBlock), entry);
+}
+
+bool CBlockTreeDB::ReadBlockFilter(const uint256& hashBlock, CBlockFilterEntry& entry)
+{
+    return Read(make_pair('G', hashBlock), entry);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
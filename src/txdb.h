@@ -11,13 +11,14 @@
 #include "leveldbwrapper.h"
 #include "main.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
-class CCoins;
 class uint256;
+struct CBlockFilterEntry;
 
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 100;
@@ -26,6 +27,23 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
+/** Receives the coins walked by CCoinsViewDB::ParallelScan. Visit() is called from several threads at once. */
+class CCoinsScanVisitor
+{
+public:
+    virtual ~CCoinsScanVisitor() {}
+    virtual void Visit(const COutPoint& outpoint, const Coin& coin) = 0;
+};
+
+/** Progress of a CCoinsViewDB::ParallelScan; may be polled and aborted from other threads */
+struct CCoinsScanProgress {
+    std::atomic<int> nRangesDone;
+    std::atomic<uint64_t> nCoins;
+    std::atomic<bool> fAbort;
+
+    CCoinsScanProgress() : nRangesDone(0), nCoins(0), fAbort(false) {}
+};
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
@@ -35,11 +53,27 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Convert legacy per-transaction ('c') records to per-outpoint ('C') records
+    bool Upgrade();
+
+    //! Compute the rolling UTXO set statistics from scratch by scanning the whole set
+    bool GetUTXOStats(CUTXOStats& stats) const;
+
+    //! The coin key space is split into this many txid ranges for ParallelScan
+    static const int SCAN_RANGES = 256;
+
+    //! Consistent view of the database for ParallelScan. Flush pcoinsTip first, and release it when done.
+    const leveldb::Snapshot* GetSnapshot() { return db.GetSnapshot(); }
+    void ReleaseSnapshot(const leveldb::Snapshot* snapshot) { db.ReleaseSnapshot(snapshot); }
+
+    //! Walk every coin in the snapshot on nThreads threads. Does not need cs_main. False on error or abort.
+    bool ParallelScan(const leveldb::Snapshot* snapshot, CCoinsScanVisitor& visitor, int nThreads, CCoinsScanProgress& progress);
 };
 
 /** Access to the block database (blocks/index/) */
@@ -49,7 +83,6 @@ public:
     CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
 private:
-    uint256 salt;
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 
@@ -63,12 +96,22 @@ public:
     bool ReadReindexing(bool& fReindex);
     bool ReadTxIndex(const uint256& txid, CDiskTxPos& pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >& list);
-    bool ReadAddrIndex(uint160 addrid, std::vector<CExtDiskTxPos> &list);
-    bool AddAddrIndex(const std::vector<std::pair<uint160, CExtDiskTxPos> > &list);
+    /** Read address index entries from (nStartHeight, nStartTxIndex) on, up to nEndHeight and nMaxTxs transactions (0 = unlimited) */
+    bool ReadAddressIndex(unsigned char type, const uint160& hashBytes, std::vector<std::pair<CAddressIndexKey, CAddressIndexValue> >& vEntries, int nStartHeight = 0, unsigned int nStartTxIndex = 0, int nEndHeight = 0, size_t nMaxTxs = 0);
+    bool ReadAddressUnspentIndex(unsigned char type, const uint160& hashBytes, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent);
+    bool ReadSpentIndex(const COutPoint& outpoint, CSpentIndexValue& value);
+    bool ReadAddressBalance(unsigned char type, const uint160& hashBytes, CAddressBalance& balance);
+    bool UpdateAddressIndex(const CAddressIndexBatch& update, bool fConnect);
     bool WriteFlag(const std::string& name, bool fValue);
     bool ReadFlag(const std::string& name, bool& fValue);
     bool WriteInt(const std::string& name, int nValue);
     bool ReadInt(const std::string& name, int& nValue);
+    bool WriteUTXOTotals(const uint256& hashBlock, const CUTXOTotals& totals);
+    bool ReadUTXOTotals(const uint256& hashBlock, CUTXOTotals& totals);
+    bool WriteUTXOStats(const CUTXOStats& stats);
+    bool ReadUTXOStats(CUTXOStats& stats);
+    bool WriteBlockFilter(const uint256& hashBlock, const CBlockFilterEntry& entry);
+    bool ReadBlockFilter(const uint256& hashBlock, CBlockFilterEntry& entry);
     bool LoadBlockIndexGuts();
 };
 
@@ -17,6 +17,9 @@
 
 #include <boost/circular_buffer.hpp>
 
+#include <cmath>
+#include <limits>
+
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -25,13 +28,12 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
     sigOpCost(_sigOpsCost)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    Init();
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight), sigOpCost(0)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-    nTxCost = GetTransactionCost(_tx);
+    Init();
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -39,10 +41,33 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
     *this = other;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(): nFee(0), nTxCost(0), nModSize(0), nTime(0), dPriority(0.0)
+CTxMemPoolEntry::CTxMemPoolEntry(): nFee(0), nTxSize(0), nTxCost(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), nHeight(0), sigOpCost(0), feeDelta(0),
+                                    nCountWithDescendants(1), nSizeWithDescendants(0), nModFeesWithDescendants(0),
+                                    nCountWithAncestors(1), nSizeWithAncestors(0), nModFeesWithAncestors(0), nSigOpCostWithAncestors(0),
+                                    vTxHashesIdx(0)
 {
 }
 
+void CTxMemPoolEntry::Init()
+{
+    vTxHashesIdx = 0;
+    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    nTxCost = GetTransactionCost(tx);
+    nModSize = tx.CalculateModifiedSize(nTxSize);
+    // the transaction object plus its input and output vectors
+    nUsageSize = sizeof(CTransaction) + tx.vin.size() * sizeof(CTxIn) + tx.vout.size() * sizeof(CTxOut) + nTxSize;
+    feeDelta = 0;
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = GetTxSize();
+    nModFeesWithDescendants = nFee;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = GetTxSize();
+    nModFeesWithAncestors = nFee;
+    nSigOpCostWithAncestors = sigOpCost;
+}
+
 size_t CTxMemPoolEntry::GetTxSize() const {
     return GetVirtualTransactionSize(tx);
 }
@@ -50,11 +75,38 @@ size_t CTxMemPoolEntry::GetTxSize() const {
 double CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
     CAmount nValueIn = tx.GetValueOut() + nFee;
-    double deltaPriority = ((double)(currentHeight - nHeight) * nValueIn) / nModSize;
+    double deltaPriority = nModSize ? ((double)(currentHeight - nHeight) * nValueIn) / nModSize : 0;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount newFeeDelta)
+{
+    nModFeesWithDescendants += newFeeDelta - feeDelta;
+    nModFeesWithAncestors += newFeeDelta - feeDelta;
+    feeDelta = newFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int64_t modifySigOpCost)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+    nSigOpCostWithAncestors += modifySigOpCost;
+    assert(int(nSigOpCostWithAncestors) >= 0);
+}
+
 /**
  * Keep track of fee/priority for transactions confirmed within N blocks
  */
@@ -370,6 +422,12 @@ public:
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) : nTransactionsUpdated(0),
                                                        minRelayFee(_minRelayFee)
 {
+    totalTxSize = 0;
+    cachedInnerUsage = 0;
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
+
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
     // of transactions in the pool
@@ -388,17 +446,10 @@ CTxMemPool::~CTxMemPool()
     delete minerPolicyEstimator;
 }
 
-void CTxMemPool::pruneSpent(const uint256& hashTx, CCoins& coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -414,32 +465,310 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+// Approximate heap overhead of one node in a std::set/std::map (red-black tree)
+static const size_t TREE_NODE_OVERHEAD = 4 * sizeof(void*);
+static const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolParents(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.parents;
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolChildren(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.children;
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    if (add && mapLinks[entry].children.insert(child).second) {
+        cachedInnerUsage += sizeof(txiter) + TREE_NODE_OVERHEAD;
+    } else if (!add && mapLinks[entry].children.erase(child)) {
+        cachedInnerUsage -= sizeof(txiter) + TREE_NODE_OVERHEAD;
+    }
+}
+
+void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
+{
+    if (add && mapLinks[entry].parents.insert(parent).second) {
+        cachedInnerUsage += sizeof(txiter) + TREE_NODE_OVERHEAD;
+    } else if (!add && mapLinks[entry].parents.erase(parent)) {
+        cachedInnerUsage -= sizeof(txiter) + TREE_NODE_OVERHEAD;
+    }
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents) const
+{
+    LOCK(cs);
+
+    setEntries parentHashes;
+    const CTransaction& tx = entry.GetTx();
+
+    if (fSearchForParents) {
+        // Get parents of this transaction that are in the mempool
+        // GetMemPoolParents() is only valid for entries in the mempool, so we
+        // iterate mapTx to find parents.
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            txiter piter = mapTx.find(tx.vin[i].prevout.hash);
+            if (piter != mapTx.end()) {
+                parentHashes.insert(piter);
+                if (parentHashes.size() + 1 > limitAncestorCount) {
+                    errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+                    return false;
+                }
+            }
+        }
+    } else {
+        // If we're not searching for parents, we require this to be an
+        // entry in the mempool already.
+        txiter it = mapTx.iterator_to(entry);
+        parentHashes = GetMemPoolParents(it);
+    }
+
+    size_t totalSizeWithAncestors = entry.GetTxSize();
+
+    while (!parentHashes.empty()) {
+        txiter stageit = *parentHashes.begin();
+
+        setAncestors.insert(stageit);
+        parentHashes.erase(stageit);
+        totalSizeWithAncestors += stageit->GetTxSize();
+
+        if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantSize);
+            return false;
+        } else if (stageit->GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantCount);
+            return false;
+        } else if (totalSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+            return false;
+        }
+
+        const setEntries& setMemPoolParents = GetMemPoolParents(stageit);
+        BOOST_FOREACH (const txiter& phash, setMemPoolParents) {
+            // If this is a new ancestor, add it.
+            if (setAncestors.count(phash) == 0) {
+                parentHashes.insert(phash);
+            }
+            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(txiter entryit, setEntries& setDescendants) const
+{
+    setEntries stage;
+    if (setDescendants.count(entryit) == 0) {
+        stage.insert(entryit);
+    }
+    // Traverse down the children of entry, only adding children that are not
+    // accounted for in setDescendants already (because those children have either
+    // already been walked, or will be walked in this iteration).
+    while (!stage.empty()) {
+        txiter it = *stage.begin();
+        setDescendants.insert(it);
+        stage.erase(it);
+
+        const setEntries& setChildren = GetMemPoolChildren(it);
+        BOOST_FOREACH (const txiter& childiter, setChildren) {
+            if (!setDescendants.count(childiter)) {
+                stage.insert(childiter);
+            }
+        }
+    }
+}
+
+void CTxMemPool::UpdateEntryAncestorState(txiter it)
+{
+    setEntries setAncestors;
+    std::string dummy;
+    CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+    int64_t nSize = it->GetTxSize();
+    CAmount nModFees = it->GetModifiedFee();
+    int64_t nSigOpCost = it->GetSigOpCost();
+    BOOST_FOREACH (txiter ancestorIt, setAncestors) {
+        nSize += ancestorIt->GetTxSize();
+        nModFees += ancestorIt->GetModifiedFee();
+        nSigOpCost += ancestorIt->GetSigOpCost();
+    }
+    mapTx.modify(it, update_ancestor_state(nSize - it->GetSizeWithAncestors(), nModFees - it->GetModFeesWithAncestors(),
+                         (int64_t)setAncestors.size() + 1 - it->GetCountWithAncestors(), nSigOpCost - it->GetSigOpCostWithAncestors()));
+}
+
+void CTxMemPool::UpdateEntryDescendantState(txiter it)
+{
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+
+    int64_t nSize = 0;
+    CAmount nModFees = 0;
+    BOOST_FOREACH (txiter descendantIt, setDescendants) {
+        nSize += descendantIt->GetTxSize();
+        nModFees += descendantIt->GetModifiedFee();
+    }
+    mapTx.modify(it, update_descendant_state(nSize - it->GetSizeWithDescendants(), nModFees - it->GetModFeesWithDescendants(),
+                         (int64_t)setDescendants.size() - it->GetCountWithDescendants()));
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
-        for (unsigned int i = 0; i < tx.vin.size(); i++)
-            mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
-        nTransactionsUpdated++;
-        totalTxSize += entry.GetTxSize();
+
+    setEntries setAncestors;
+    std::string dummy;
+    CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+
+    txiter newit = mapTx.insert(entry).first;
+    mapLinks.insert(make_pair(newit, TxLinks()));
+    vTxHashes.push_back(std::make_pair(newit->GetTx().GetWitnessHash(), newit));
+    newit->vTxHashesIdx = vTxHashes.size() - 1;
+
+    // Update transaction for any feeDelta created by PrioritiseTransaction
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+    if (pos != mapDeltas.end() && pos->second.second != 0)
+        mapTx.modify(newit, update_fee_delta(pos->second.second));
+
+    cachedInnerUsage += entry.DynamicMemoryUsage();
+
+    const CTransaction& tx = newit->GetTx();
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+        txiter parentit = mapTx.find(tx.vin[i].prevout.hash);
+        if (parentit != mapTx.end()) {
+            UpdateParent(newit, parentit, true);
+            UpdateChild(parentit, newit, true);
+        }
     }
+
+    // Every ancestor gains this entry as a descendant, and this entry's
+    // ancestor aggregates are the sum over its ancestors
+    int64_t nSizeAncestors = 0;
+    CAmount nModFeesAncestors = 0;
+    int64_t nSigOpCostAncestors = 0;
+    BOOST_FOREACH (txiter ancestorIt, setAncestors) {
+        mapTx.modify(ancestorIt, update_descendant_state(newit->GetTxSize(), newit->GetModifiedFee(), 1));
+        nSizeAncestors += ancestorIt->GetTxSize();
+        nModFeesAncestors += ancestorIt->GetModifiedFee();
+        nSigOpCostAncestors += ancestorIt->GetSigOpCost();
+    }
+    mapTx.modify(newit, update_ancestor_state(nSizeAncestors, nModFeesAncestors, setAncestors.size(), nSigOpCostAncestors));
+
+    // A transaction returning from a disconnected block may already have
+    // spenders in the pool. Link them and recompute the affected aggregates;
+    // this does not happen for transactions relayed normally.
+    bool fHaveChildren = false;
+    for (std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hash, 0)); it != mapNextTx.end() && it->first.hash == hash; ++it) {
+        txiter childit = mapTx.find(it->second.ptx->GetHash());
+        assert(childit != mapTx.end());
+        UpdateChild(newit, childit, true);
+        UpdateParent(childit, newit, true);
+        fHaveChildren = true;
+    }
+    if (fHaveChildren) {
+        setEntries setDescendants;
+        CalculateDescendants(newit, setDescendants);
+        BOOST_FOREACH (txiter descendantIt, setDescendants) {
+            if (descendantIt != newit)
+                UpdateEntryAncestorState(descendantIt);
+        }
+        UpdateEntryDescendantState(newit);
+        BOOST_FOREACH (txiter ancestorIt, setAncestors)
+            UpdateEntryDescendantState(ancestorIt);
+    }
+
+    nTransactionsUpdated++;
+    totalTxSize += entry.GetTxSize();
+
+    NotifyEntryAdded(tx);
     return true;
 }
 
+void CTxMemPool::UpdateForRemoveFromMempool(const setEntries& entriesToRemove)
+{
+    // Compute all the adjustments before unlinking anything, as the
+    // ancestor and descendant walks rely on the links.
+    BOOST_FOREACH (txiter removeIt, entriesToRemove) {
+        setEntries setAncestors;
+        std::string dummy;
+        CalculateMemPoolAncestors(*removeIt, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        BOOST_FOREACH (txiter ancestorIt, setAncestors)
+            mapTx.modify(ancestorIt, update_descendant_state(-(int64_t)removeIt->GetTxSize(), -removeIt->GetModifiedFee(), -1));
+
+        setEntries setDescendants;
+        CalculateDescendants(removeIt, setDescendants);
+        setDescendants.erase(removeIt);
+        BOOST_FOREACH (txiter descendantIt, setDescendants)
+            mapTx.modify(descendantIt, update_ancestor_state(-(int64_t)removeIt->GetTxSize(), -removeIt->GetModifiedFee(), -1, -removeIt->GetSigOpCost()));
+    }
+    BOOST_FOREACH (txiter removeIt, entriesToRemove) {
+        BOOST_FOREACH (txiter parentIt, GetMemPoolParents(removeIt))
+            UpdateChild(parentIt, removeIt, false);
+        BOOST_FOREACH (txiter childIt, GetMemPoolChildren(removeIt))
+            UpdateParent(childIt, removeIt, false);
+    }
+}
+
+void CTxMemPool::removeUnchecked(txiter it)
+{
+    const CTransaction& tx = it->GetTx();
+    NotifyEntryRemoved(tx);
+    BOOST_FOREACH (const CTxIn& txin, tx.vin)
+        mapNextTx.erase(txin.prevout);
+
+    if (vTxHashes.size() > 1) {
+        vTxHashes[it->vTxHashesIdx] = vTxHashes.back();
+        vTxHashes[it->vTxHashesIdx].second->vTxHashesIdx = it->vTxHashesIdx;
+        vTxHashes.pop_back();
+        if (vTxHashes.size() * 2 < vTxHashes.capacity())
+            vTxHashes.shrink_to_fit();
+    } else {
+        vTxHashes.clear();
+    }
+
+    totalTxSize -= it->GetTxSize();
+    cachedInnerUsage -= it->DynamicMemoryUsage();
+    cachedInnerUsage -= (mapLinks[it].parents.size() + mapLinks[it].children.size()) * (sizeof(txiter) + TREE_NODE_OVERHEAD);
+    mapLinks.erase(it);
+    mapTx.erase(it);
+    nTransactionsUpdated++;
+}
+
+void CTxMemPool::RemoveStaged(const setEntries& stage, std::list<CTransaction>& removed)
+{
+    AssertLockHeld(cs);
+    UpdateForRemoveFromMempool(stage);
+    BOOST_FOREACH (const txiter& it, stage) {
+        removed.push_back(it->GetTx());
+        removeUnchecked(it);
+    }
+}
 
 void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        std::deque<uint256> txToRemove;
-        txToRemove.push_back(origTx.GetHash());
-        if (fRecursive && !mapTx.count(origTx.GetHash())) {
+        setEntries txToRemove;
+        txiter origit = mapTx.find(origTx.GetHash());
+        if (origit != mapTx.end()) {
+            txToRemove.insert(origit);
+        } else if (fRecursive) {
             // If recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
             // happen during chain re-orgs if origTx isn't re-accepted into
@@ -448,31 +777,19 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                 std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
-                txToRemove.push_back(it->second.ptx->GetHash());
+                txiter nextit = mapTx.find(it->second.ptx->GetHash());
+                assert(nextit != mapTx.end());
+                txToRemove.insert(nextit);
             }
         }
-        while (!txToRemove.empty()) {
-            uint256 hash = txToRemove.front();
-            txToRemove.pop_front();
-            if (!mapTx.count(hash))
-                continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
-            if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                    if (it == mapNextTx.end())
-                        continue;
-                    txToRemove.push_back(it->second.ptx->GetHash());
-                }
-            }
-            BOOST_FOREACH (const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-
-            removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
+        setEntries setAllRemoves;
+        if (fRecursive) {
+            BOOST_FOREACH (txiter it, txToRemove)
+                CalculateDescendants(it, setAllRemoves);
+        } else {
+            setAllRemoves.swap(txToRemove);
         }
+        RemoveStaged(setAllRemoves, removed);
     }
 }
 
@@ -481,15 +798,15 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end())
                 continue;
-            const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-            if (fSanityCheck) assert(coins);
-            if (!coins || ((coins->IsCoinBase() || coins->IsCoinStake()) && nMemPoolHeight - coins->nHeight < (unsigned)Params().COINBASE_MATURITY())) {
+            const Coin& coin = pcoins->AccessCoin(txin.prevout);
+            if (fSanityCheck) assert(!coin.IsSpent());
+            if (coin.IsSpent() || ((coin.IsCoinBase() || coin.IsCoinStake()) && nMemPoolHeight - coin.nHeight < (unsigned)Params().COINBASE_MATURITY())) {
                 transactionsToRemove.push_back(tx);
                 break;
             }
@@ -525,9 +842,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
     BOOST_FOREACH (const CTransaction& tx, vtx) {
-        uint256 hash = tx.GetHash();
-        if (mapTx.count(hash))
-            entries.push_back(mapTx[hash]);
+        txiter it = mapTx.find(tx.GetHash());
+        if (it != mapTx.end())
+            entries.push_back(*it);
     }
     minerPolicyEstimator->seenBlock(entries, nBlockHeight, minRelayFee);
     BOOST_FOREACH (const CTransaction& tx, vtx) {
@@ -536,15 +853,25 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it)
+        NotifyEntryRemoved(it->GetTx());
+    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    vTxHashes.clear();
     totalTxSize = 0;
+    cachedInnerUsage = 0;
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
 }
 
@@ -561,21 +888,22 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
 
     LOCK(cs);
     list<const CTxMemPoolEntry*> waitingOnDependants;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
-        checkTotal += it->second.GetTxSize();
-        const CTransaction& tx = it->second.GetTx();
+        checkTotal += it->GetTxSize();
+        const CTransaction& tx = it->GetTx();
         bool fDependsWait = false;
+        setEntries setParentCheck;
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end()) {
-                const CTransaction& tx2 = it2->second.GetTx();
+                const CTransaction& tx2 = it2->GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
+                setParentCheck.insert(it2);
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
             std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
@@ -584,8 +912,40 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
             assert(it3->second.n == i);
             i++;
         }
+        assert(setParentCheck == GetMemPoolParents(it));
+
+        // Verify the cached ancestor aggregates
+        setEntries setAncestors;
+        std::string dummy;
+        CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        int64_t nSigOpCheck = it->GetSigOpCost();
+        BOOST_FOREACH (txiter ancestorIt, setAncestors) {
+            nSizeCheck += ancestorIt->GetTxSize();
+            nFeesCheck += ancestorIt->GetModifiedFee();
+            nSigOpCheck += ancestorIt->GetSigOpCost();
+        }
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+        assert(it->GetSigOpCostWithAncestors() == nSigOpCheck);
+
+        // ... and the descendant ones
+        setEntries setDescendants;
+        CalculateDescendants(it, setDescendants);
+        uint64_t nDescendantSizeCheck = 0;
+        CAmount nDescendantFeesCheck = 0;
+        BOOST_FOREACH (txiter descendantIt, setDescendants) {
+            nDescendantSizeCheck += descendantIt->GetTxSize();
+            nDescendantFeesCheck += descendantIt->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size());
+        assert(it->GetSizeWithDescendants() == nDescendantSizeCheck);
+        assert(it->GetModFeesWithDescendants() == nDescendantFeesCheck);
+
         if (fDependsWait)
-            waitingOnDependants.push_back(&it->second);
+            waitingOnDependants.push_back(&(*it));
         else {
             CValidationState state;
             CTxUndo undo;
@@ -611,9 +971,9 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     }
     for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
-        const CTransaction& tx = it2->second.GetTx();
+        indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         assert(it2 != mapTx.end());
+        const CTransaction& tx = it2->GetTx();
         assert(&tx == it->second.ptx);
         assert(tx.vin.size() > it->second.n);
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
@@ -628,8 +988,8 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        vtxid.push_back((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vtxid.push_back(mi->GetTx().GetHash());
 }
 
 void CTxMemPool::getTransactions(std::set<uint256>& setTxid)
@@ -637,19 +997,112 @@ void CTxMemPool::getTransactions(std::set<uint256>& setTxid)
     setTxid.clear();
 
     LOCK(cs);
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        setTxid.insert((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        setTxid.insert(mi->GetTx().GetHash());
 }
 
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
-    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end()) return false;
-    result = i->second.GetTx();
+    result = i->GetTx();
     return true;
 }
 
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    // Estimate the overhead of mapTx to be 15 pointers per entry: a hash
+    // bucket and node for the txid index plus three ordered index nodes.
+    return mapTx.size() * (sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) +
+           mapNextTx.size() * (sizeof(std::pair<const COutPoint, CInPoint>) + TREE_NODE_OVERHEAD) +
+           mapLinks.size() * (sizeof(std::pair<const txiter, TxLinks>) + TREE_NODE_OVERHEAD) +
+           mapDeltas.size() * (sizeof(std::pair<const uint256, std::pair<double, CAmount> >) + TREE_NODE_OVERHEAD) +
+           vTxHashes.capacity() * sizeof(std::pair<uint256, txiter>) +
+           cachedInnerUsage;
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(rollingMinimumFeeRate);
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (DynamicMemoryUsage() < sizelimit / 4)
+            halflife /= 4;
+        else if (DynamicMemoryUsage() < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(rollingMinimumFeeRate), minRelayFee);
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+
+        // We set the new mempool min fee to the feerate of the removed set, plus the
+        // relay fee (ie some value under which we consider txn to have 0 fee).
+        // This way, we don't allow txn to enter mempool with feerate equal to
+        // txn which were removed with no block in between.
+        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        removed = CFeeRate(removed.GetFeePerK() + minRelayFee.GetFeePerK());
+        trackPackageRemoved(removed);
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+        setEntries stage;
+        CalculateDescendants(mapTx.project<0>(it), stage);
+        nTxnRemoved += stage.size();
+        std::list<CTransaction> removedTxs;
+        RemoveStaged(stage, removedTxs);
+    }
+
+    if (maxFeeRateRemoved > CFeeRate(0))
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+}
+
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    indexed_transaction_set::index<entry_time>::type::iterator it = mapTx.get<entry_time>().begin();
+    setEntries toremove;
+    while (it != mapTx.get<entry_time>().end() && it->GetTime() < time) {
+        toremove.insert(mapTx.project<0>(it));
+        it++;
+    }
+    setEntries stage;
+    BOOST_FOREACH (txiter removeit, toremove)
+        CalculateDescendants(removeit, stage);
+    std::list<CTransaction> removed;
+    RemoveStaged(stage, removed);
+    return stage.size();
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -699,6 +1152,22 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            mapTx.modify(it, update_fee_delta(deltas.second));
+            // Keep the packages this transaction belongs to in step
+            setEntries setAncestors;
+            std::string dummy;
+            CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+            BOOST_FOREACH (txiter ancestorIt, setAncestors)
+                mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            setDescendants.erase(it);
+            BOOST_FOREACH (txiter descendantIt, setDescendants)
+                mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
+            NotifyEntryPrioritised(hash);
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -723,20 +1192,25 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
 
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) {}
 
-bool CCoinsViewMemPool::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewMemPool::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
     CTransaction tx;
-    if (mempool.lookup(txid, tx)) {
-        coins = CCoins(tx, MEMPOOL_HEIGHT);
-        return true;
+    if (mempool.lookup(outpoint.hash, tx)) {
+        if (outpoint.n < tx.vout.size()) {
+            coin = Coin(tx.vout[outpoint.n], MEMPOOL_HEIGHT, false, false);
+            return true;
+        } else {
+            return false;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256& txid) const
+bool CCoinsViewMemPool::HaveCoin(const COutPoint& outpoint) const
 {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+    Coin coin;
+    return GetCoin(outpoint, coin);
 }
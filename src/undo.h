@@ -12,9 +12,11 @@
 
 /** Undo information for a CTxIn
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Contains the prevout's CTxOut being spent and its metadata (coinbase
+ *  or coinstake, height). Records written before the switch to
+ *  per-outpoint coins only carry the metadata for the last spent output of
+ *  a transaction, and have nHeight 0 otherwise. The transaction version is
+ *  no longer known and written as 0.
  */
 class CTxInUndo
 {
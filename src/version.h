@@ -12,7 +12,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70715;
+static const int PROTOCOL_VERSION = 70716;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -42,5 +42,8 @@ static const int MEMPOOL_GD_VERSION = 60002;
 //! "filter*" commands are disabled without NODE_BLOOM after and including this version
 static const int NO_BLOOM_VERSION = 70000;
 
+//! short-id-based block download starts with this version
+static const int SHORT_IDS_BLOCKS_VERSION = 70716;
+
 
 #endif // BITCOIN_VERSION_H
@@ -12,6 +12,7 @@
 #include "wallet.h"
 
 #include "base58.h"
+#include "blockfilter.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
 #include "kernel.h"
@@ -463,6 +464,85 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+/**
+ * Spent by a wallet transaction that is in the main chain. Unlike IsSpent
+ * this only changes when a block is connected or disconnected, and swiftTX
+ * locks do not count.
+ */
+bool CWallet::IsSpentInMainChain(const COutPoint& outpoint) const
+{
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain(false) >= 1)
+            return true;
+    }
+    return false;
+}
+
+void CWallet::QueueWalletUTXO(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        setWalletUTXOPending.insert(COutPoint(hash, i));
+
+    // Whatever it spends may have been confirmed spent, or no longer be if
+    // the transaction just left the main chain
+    if (!wtx.IsCoinBase()) {
+        BOOST_FOREACH (const CTxIn& txin, wtx.vin)
+            setWalletUTXOPending.insert(txin.prevout);
+    }
+}
+
+void CWallet::SettleWalletUTXO(const COutPoint& outpoint) const
+{
+    std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(outpoint.hash);
+    if (mit != mapWallet.end() && outpoint.n < mit->second.vout.size() &&
+        IsMine(mit->second.vout[outpoint.n]) != ISMINE_NO && !IsSpentInMainChain(outpoint))
+        setWalletUTXO.insert(outpoint);
+    else
+        setWalletUTXO.erase(outpoint);
+}
+
+void CWallet::SyncWalletUTXO() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fWalletUTXORebuild) {
+        setWalletUTXO.clear();
+        setWalletUTXOPending.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+            for (unsigned int i = 0; i < it->second.vout.size(); i++)
+                SettleWalletUTXO(COutPoint(it->first, i));
+        }
+        fWalletUTXORebuild = false;
+        LogPrint("selectcoins", "SyncWalletUTXO : %u unspent outputs in %u wallet transactions\n", setWalletUTXO.size(), mapWallet.size());
+        return;
+    }
+
+    BOOST_FOREACH (const COutPoint& outpoint, setWalletUTXOPending)
+        SettleWalletUTXO(outpoint);
+    setWalletUTXOPending.clear();
+}
+
+void CWallet::GetWalletUTXOTxs(std::vector<const CWalletTx*>& vTxRet) const
+{
+    SyncWalletUTXO();
+
+    vTxRet.clear();
+    BOOST_FOREACH (const COutPoint& outpoint, setWalletUTXO) {
+        // the set is ordered by txid first, so the outputs of a transaction are adjacent
+        if (!vTxRet.empty() && vTxRet.back()->GetHash() == outpoint.hash)
+            continue;
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(outpoint.hash);
+        if (mit != mapWallet.end())
+            vTxRet.push_back(&mit->second);
+    }
+}
+
 bool CWallet::GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet, std::string strTxHash, std::string strOutputIndex)
 {
     // wait for reindex and/or import to finish
@@ -631,6 +711,9 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet)
             item.second.MarkDirty();
+        // keys or scripts may have been imported, which changes what is ours
+        fWalletUTXORebuild = true;
+        fBalancesCached = false;
     }
 }
 
@@ -644,6 +727,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         AddToSpends(hash);
+        fWalletUTXORebuild = true;
+        fBalancesCached = false;
     } else {
         LOCK(cs_wallet);
         // Inserts only if not already there, returns tx inserted or tx found
@@ -691,6 +776,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        QueueWalletUTXO(wtx);
+        fBalancesCached = false;
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -749,8 +836,11 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        if (mapWallet.erase(hash)) {
             CWalletDB(strWalletFile).EraseTx(hash);
+            fWalletUTXORebuild = true;
+            fBalancesCached = false;
+        }
     }
     return;
 }
@@ -1414,43 +1504,379 @@ bool CWalletTx::WriteToDisk()
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  */
+/**
+ * The scripts a rescan looks for, copied from the key store once so that the
+ * matching threads need no lock. Pay-to-pubkey(-hash), pay-to-script-hash and
+ * witness v0 outputs are decided by the copy alone; anything else (bare
+ * multisig, nonstandard scripts) is still asked of IsMine. It may flag outputs
+ * that are not ours, AddToWalletIfInvolvingMe has the last word.
+ *
+ * With -blockfilterindex, a block whose filter matches none of the scripts is
+ * not read at all. Spends are caught too, as the filter holds the scripts of
+ * the spent outputs. Outputs only IsMine recognizes, like bare multisig to our
+ * keys without the script imported, are missed in such blocks.
+ */
+class CWalletScanFilter
+{
+private:
+    const CKeyStore& keystore;
+    std::set<CScript> setScripts;
+    GCSFilter::ElementSet setFilterElements;
+
+    static bool IsCoveredScript(const CScript& script)
+    {
+        if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+            script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG)
+            return true;
+        if (((script.size() == 35 && script[0] == 33) || (script.size() == 67 && script[0] == 65)) &&
+            script[script.size() - 1] == OP_CHECKSIG)
+            return true;
+        if ((script.size() == 22 && script[0] == OP_0 && script[1] == 20) ||
+            (script.size() == 34 && script[0] == OP_0 && script[1] == 32))
+            return true;
+        return script.IsPayToScriptHash();
+    }
+
+public:
+    explicit CWalletScanFilter(const CBasicKeyStore& keystoreIn) : keystore(keystoreIn)
+    {
+        std::set<CKeyID> setKeys;
+        keystoreIn.GetKeys(setKeys);
+        BOOST_FOREACH (const CKeyID& keyID, setKeys) {
+            setScripts.insert(GetScriptForDestination(keyID));
+            CPubKey pubkey;
+            if (keystoreIn.GetPubKey(keyID, pubkey))
+                setScripts.insert(GetScriptForRawPubKey(pubkey));
+        }
+
+        // A witness program is ours only if it is a known script itself
+        std::vector<CScript> vScripts;
+        keystoreIn.GetCScripts(vScripts);
+        BOOST_FOREACH (const CScript& script, vScripts) {
+            setScripts.insert(GetScriptForDestination(CScriptID(script)));
+            setScripts.insert(script);
+        }
+
+        WatchOnlySet setWatchOnly;
+        keystoreIn.GetWatchOnly(setWatchOnly);
+        setScripts.insert(setWatchOnly.begin(), setWatchOnly.end());
+
+        if (fBlockFilterIndex) {
+            BOOST_FOREACH (const CScript& script, setScripts)
+                setFilterElements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    //! Whether the indexed filter of the block rules out anything for the wallet
+    bool IsBlockSkippable(const uint256& hashBlock) const
+    {
+        if (setFilterElements.empty())
+            return false;
+        CBlockFilterEntry entry;
+        if (!GetBlockFilter(hashBlock, entry))
+            return false;
+        try {
+            return !CBlockFilter(hashBlock, entry.vchFilter).GetFilter().MatchAny(setFilterElements);
+        } catch (const std::exception& e) {
+            LogPrintf("%s : bad filter for block %s - %s\n", __func__, hashBlock.ToString(), e.what());
+            return false;
+        }
+    }
+
+    bool IsRelevant(const CTxOut& txout) const
+    {
+        if (setScripts.count(txout.scriptPubKey))
+            return true;
+        if (IsCoveredScript(txout.scriptPubKey))
+            return false;
+        return ::IsMine(keystore, txout.scriptPubKey) != ISMINE_NO;
+    }
+};
+
+/**
+ * Read-ahead and matching stages of a rescan. One thread reads the raw blocks
+ * in chain order, the matching threads deserialize them and flag the
+ * transactions with an output that may be ours, and the rescanning thread
+ * takes the finished blocks in order with Wait() and Release().
+ */
+class CWalletScanPipeline
+{
+public:
+    struct CScanBlock {
+        std::vector<char> vchRaw;
+        size_t nRawSize;
+        CBlock block;
+        std::vector<bool> vRelevant; //!< per transaction of block
+        bool fFailed;
+        bool fSkipped; //!< ruled out by the block filter, block is empty
+
+        CScanBlock() : nRawSize(0), fFailed(false), fSkipped(false) {}
+    };
+
+private:
+    const std::vector<std::pair<CBlockIndex*, CDiskBlockPos> >& vBlocks;
+    const CWalletScanFilter& filter;
+    std::vector<CScanBlock> vSlots; //!< ring of RESCAN_READAHEAD_BLOCKS, block i in vSlots[i % size]
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    size_t nRead;     //!< blocks read from disk
+    size_t nMatching; //!< blocks taken by a matching thread
+    size_t nMatched;  //!< blocks with their matching finished, counted in order
+    std::vector<bool> vMatched;
+    size_t nReleased; //!< blocks handed back by the rescanning thread
+    size_t nBytesAhead;
+    bool fStop;
+
+    boost::thread_group threadGroup;
+
+    CScanBlock& Slot(size_t i) { return vSlots[i % vSlots.size()]; }
+
+    void ReadThread()
+    {
+        RenameThread("bare-rescanread");
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                // The batch being added is always read, or Wait() could not return
+                while (!fStop && i >= nReleased + RESCAN_COMMIT_BLOCKS &&
+                       (i - nReleased >= vSlots.size() || nBytesAhead >= RESCAN_READAHEAD_BYTES))
+                    cond.wait(lock);
+                if (fStop)
+                    return;
+            }
+
+            // The slot is ours until nRead moves past it
+            CScanBlock& slot = Slot(i);
+            slot.fSkipped = filter.IsBlockSkippable(vBlocks[i].first->GetBlockHash());
+            slot.fFailed = !slot.fSkipped && !ReadRawBlockFromDisk(slot.vchRaw, vBlocks[i].second);
+            slot.nRawSize = slot.vchRaw.size();
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nBytesAhead += slot.nRawSize;
+            nRead = i + 1;
+            cond.notify_all();
+        }
+    }
+
+    void MatchThread()
+    {
+        RenameThread("bare-rescanmatch");
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nMatching >= nRead && nMatching < vBlocks.size())
+                    cond.wait(lock);
+                if (fStop || nMatching >= vBlocks.size())
+                    return;
+                i = nMatching++;
+            }
+
+            CScanBlock& slot = Slot(i);
+            slot.block.SetNull();
+            slot.vRelevant.clear();
+            if (!slot.fFailed && !slot.fSkipped) {
+                try {
+                    CDataStream ss(slot.vchRaw, SER_DISK, CLIENT_VERSION);
+                    ss >> slot.block;
+                } catch (const std::exception& e) {
+                    LogPrintf("%s : deserialize error - %s\n", __func__, e.what());
+                    slot.fFailed = true;
+                }
+            }
+            std::vector<char>().swap(slot.vchRaw);
+            if (!slot.fFailed && !slot.fSkipped && slot.block.GetHash() != vBlocks[i].first->GetBlockHash()) {
+                LogPrintf("%s : block %s read from disk does not match the index\n", __func__, vBlocks[i].first->GetBlockHash().ToString());
+                slot.fFailed = true;
+            }
+            if (slot.fFailed) {
+                slot.block.SetNull();
+            } else {
+                slot.vRelevant.resize(slot.block.vtx.size(), false);
+                for (unsigned int t = 0; t < slot.block.vtx.size(); t++) {
+                    BOOST_FOREACH (const CTxOut& txout, slot.block.vtx[t].vout) {
+                        if (filter.IsRelevant(txout)) {
+                            slot.vRelevant[t] = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vMatched[i % vMatched.size()] = true;
+            while (nMatched < nMatching && vMatched[nMatched % vMatched.size()]) {
+                vMatched[nMatched % vMatched.size()] = false;
+                nMatched++;
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    CWalletScanPipeline(const std::vector<std::pair<CBlockIndex*, CDiskBlockPos> >& vBlocksIn, const CWalletScanFilter& filterIn, int nThreads)
+        : vBlocks(vBlocksIn), filter(filterIn), vSlots(RESCAN_READAHEAD_BLOCKS), nRead(0), nMatching(0), nMatched(0),
+          vMatched(RESCAN_READAHEAD_BLOCKS, false), nReleased(0), nBytesAhead(0), fStop(false)
+    {
+        threadGroup.create_thread(boost::bind(&CWalletScanPipeline::ReadThread, this));
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CWalletScanPipeline::MatchThread, this));
+    }
+
+    ~CWalletScanPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        threadGroup.join_all();
+    }
+
+    //! Wait until the blocks before nEnd are matched; they stay valid until released
+    void Wait(size_t nEnd)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nMatched < nEnd)
+            cond.wait(lock);
+    }
+
+    const CScanBlock& Get(size_t i) { return Slot(i); }
+
+    //! Hand the blocks before nEnd back to the read-ahead
+    void Release(size_t nEnd)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (; nReleased < nEnd; nReleased++) {
+            CScanBlock& slot = Slot(nReleased);
+            nBytesAhead -= slot.nRawSize;
+            slot.block.SetNull();
+        }
+        cond.notify_all();
+    }
+};
+
+/** Publishes the progress of a rescan on the wallet for as long as it runs */
+class CWalletScanProgressReporter
+{
+private:
+    CWallet* pwallet;
+
+public:
+    explicit CWalletScanProgressReporter(CWallet* pwalletIn) : pwallet(pwalletIn)
+    {
+        pwallet->dScanProgress = 0.0;
+        pwallet->nScanStartTime = GetTime();
+    }
+
+    ~CWalletScanProgressReporter()
+    {
+        pwallet->nScanStartTime = 0;
+        pwallet->dScanProgress = 0.0;
+    }
+};
+
+/**
+ * Scan the active chain from pindexStart for transactions of the wallet.
+ * Blocks are read ahead and matched against the wallet's scripts on other
+ * threads; cs_main and cs_wallet are only taken to add a batch of
+ * RESCAN_COMMIT_BLOCKS blocks, so the node keeps running meanwhile. Callers
+ * should therefore not hold them. Blocks connected during the scan are
+ * scanned once more at the end under the locks, for transactions spending
+ * outputs the scan found after the wallet saw those blocks.
+ */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
     int64_t nNow = GetTime();
+    CWalletScanProgressReporter reporter(this);
 
-    CBlockIndex* pindex = pindexStart;
+    std::vector<std::pair<CBlockIndex*, CDiskBlockPos> > vBlocks;
+    double dProgressStart, dProgressTip;
     {
-        LOCK2(cs_main, cs_wallet);
+        LOCK(cs_main);
+        CBlockIndex* pindex = pindexStart;
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        set<uint256> setAddedToWallet;
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        for (; pindex; pindex = chainActive.Next(pindex))
+            vBlocks.push_back(std::make_pair(pindex, pindex->GetBlockPos()));
+
+        dProgressStart = Checkpoints::GuessVerificationProgress(vBlocks.empty() ? NULL : vBlocks.front().first, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+    }
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    if (!vBlocks.empty()) {
+        size_t nSkipped = 0;
+        int nThreads = std::min(MAX_RESCAN_THREADS, std::max(1, (int)boost::thread::hardware_concurrency() - 1));
+        CWalletScanFilter filter(*this);
+        CWalletScanPipeline pipeline(vBlocks, filter, nThreads);
+        LogPrintf("Rescanning %u blocks from height %d with %d matching threads\n", vBlocks.size(), vBlocks.front().first->nHeight, nThreads);
+
+        for (size_t nBatch = 0; nBatch < vBlocks.size(); nBatch += RESCAN_COMMIT_BLOCKS) {
+            size_t nEnd = std::min(vBlocks.size(), nBatch + RESCAN_COMMIT_BLOCKS);
+            pipeline.Wait(nEnd);
+            {
+                LOCK2(cs_main, cs_wallet);
+                for (size_t i = nBatch; i < nEnd; i++) {
+                    CBlockIndex* pindex = vBlocks[i].first;
+                    const CWalletScanPipeline::CScanBlock& scan = pipeline.Get(i);
+                    if (scan.fSkipped) {
+                        nSkipped++;
+                        continue;
+                    }
+                    if (scan.fFailed) {
+                        LogPrintf("ScanForWalletTransactions : failed to read block %s at height %d\n", pindex->GetBlockHash().ToString(), pindex->nHeight);
+                        continue;
+                    }
+                    // Disconnected since; its replacement reached the wallet through SyncTransaction
+                    if (!chainActive.Contains(pindex))
+                        continue;
+
+                    for (unsigned int t = 0; t < scan.block.vtx.size(); t++) {
+                        const CTransaction& tx = scan.block.vtx[t];
+                        bool fCandidate = scan.vRelevant[t] || mapWallet.count(tx.GetHash());
+                        for (unsigned int n = 0; !fCandidate && n < tx.vin.size(); n++)
+                            fCandidate = mapWallet.count(tx.vin[n].prevout.hash) > 0;
+                        if (fCandidate && AddToWalletIfInvolvingMe(tx, &scan.block, fUpdate))
+                            ret++;
+                    }
+                }
 
+                CBlockIndex* pindexLast = vBlocks[nEnd - 1].first;
+                double dProgress = dProgressTip - dProgressStart > 0.0 ? (Checkpoints::GuessVerificationProgress(pindexLast, false) - dProgressStart) / (dProgressTip - dProgressStart) : 1.0;
+                dScanProgress = std::max(0.0, std::min(1.0, dProgress));
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindexLast->nHeight, Checkpoints::GuessVerificationProgress(pindexLast));
+                }
+            }
+            pipeline.Release(nEnd);
+            ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dScanProgress * 100))));
+        }
+        if (nSkipped > 0)
+            LogPrintf("Rescan skipped %u of %u blocks by their block filters\n", nSkipped, vBlocks.size());
+    }
+
+    {
+        // Blocks connected while the pipeline ran
+        LOCK2(cs_main, cs_wallet);
+        CBlockIndex* pindex = vBlocks.empty() ? NULL : chainActive.Next(chainActive.FindFork(vBlocks.back().first));
+        for (; pindex; pindex = chainActive.Next(pindex)) {
             CBlock block;
             ReadBlockFromDisk(block, pindex);
             BOOST_FOREACH (CTransaction& tx, block.vtx) {
                 if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
                     ret++;
             }
-
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
-            }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1555,19 +1981,46 @@ void CWallet::ResendWalletTransactions()
  * @{
  */
 
-CAmount CWallet::GetBalance() const
+CWallet::CWalletBalances CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+    LOCK2(cs_main, cs_wallet);
+    uint256 hashTip = chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256(0);
+    unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    if (fBalancesCached && hashBalancesTip == hashTip && nBalancesMempoolUpdated == nMempoolUpdated)
+        return cachedBalances;
+
+    CWalletBalances balances = {};
+    bool fCacheable = true;
+    std::vector<const CWalletTx*> vWalletUTXOTxs;
+    GetWalletUTXOTxs(vWalletUTXOTxs);
+    BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
+        bool fFinal = IsFinalTx(*pcoin);
+        if (!fFinal)
+            fCacheable = false;
+
+        bool fTrusted = pcoin->IsTrusted();
+        if (fTrusted) {
+            balances.nBalance += pcoin->GetAvailableCredit();
+            balances.nWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
         }
+        if (!fFinal || (!fTrusted && pcoin->GetDepthInMainChain() == 0)) {
+            balances.nUnconfirmed += pcoin->GetAvailableCredit();
+            balances.nUnconfirmedWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        balances.nImmature += pcoin->GetImmatureCredit();
+        balances.nImmatureWatchOnly += pcoin->GetImmatureWatchOnlyCredit();
     }
 
-    return nTotal;
+    cachedBalances = balances;
+    fBalancesCached = fCacheable;
+    hashBalancesTip = hashTip;
+    nBalancesMempoolUpdated = nMempoolUpdated;
+    return balances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nBalance;
 }
 
 CAmount CWallet::GetUnlockedCoins() const
@@ -1577,9 +2030,9 @@ CAmount CWallet::GetUnlockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetUnlockedCredit();
         }
@@ -1595,9 +2048,9 @@ CAmount CWallet::GetLockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetLockedCredit();
         }
@@ -1613,9 +2066,9 @@ CAmount CWallet::GetAnonymizableBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAnonymizableCredit();
         }
@@ -1631,9 +2084,9 @@ CAmount CWallet::GetAnonymizedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAnonymizedCredit();
         }
@@ -1653,10 +2106,10 @@ double CWallet::GetAverageAnonymizedRounds() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 CTxIn vin = CTxIn(hash, i);
@@ -1685,10 +2138,10 @@ CAmount CWallet::GetNormalizedAnonymizedBalance() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 CTxIn vin = CTxIn(hash, i);
@@ -1712,9 +2165,9 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
             nTotal += pcoin->GetDenominatedCredit(unconfirmed);
         }
     }
@@ -1724,71 +2177,27 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmatureWatchOnly;
 }
 
 CAmount CWallet::GetLockedWatchOnlyBalance() const
@@ -1796,8 +2205,9 @@ CAmount CWallet::GetLockedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetLockedWatchOnlyCredit();
         }
@@ -1814,10 +2224,10 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
+        std::vector<const CWalletTx*> vWalletUTXOTxs;
+        GetWalletUTXOTxs(vWalletUTXOTxs);
+        BOOST_FOREACH (const CWalletTx* pcoin, vWalletUTXOTxs) {
+            const uint256& wtxid = pcoin->GetHash();
             if (!CheckFinalTx(*pcoin))
                 continue;
 
@@ -1866,11 +2276,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
                 if (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1)
                     continue;
 
-                if (IsLockedCoin((*it).first, i) && nCoinType != ONLY_1000)
+                if (IsLockedCoin(wtxid, i) && nCoinType != ONLY_1000)
                     continue;
                 if (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue)
                     continue;
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
+                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
                     continue;
 
                 bool fIsSpendable = false;
@@ -2794,12 +3204,16 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
-    bool fKernelFound = false;
 
     //prevent staking a time that won't be accepted
     if (GetAdjustedTime() <= chainActive.Tip()->nTime)
         MilliSleep(10000);
 
+    // Precompute the constant part of every kernel hash, then let the search engine hash the timestamps
+    vector<pair<const CWalletTx*, unsigned int> > vStakeCoins;
+    vector<CStakeKernelCandidate> vCandidates;
+    vStakeCoins.reserve(setStakeCoins.size());
+    vCandidates.reserve(setStakeCoins.size());
     BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setStakeCoins) {
         //make sure that enough time has elapsed between
         CBlockIndex* pindex = NULL;
@@ -2812,77 +3226,70 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             continue;
         }
 
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
+        CStakeKernelCandidate candidate(COutPoint(pcoin.first->GetHash(), pcoin.second), pindex, pcoin.first->vout[pcoin.second].nValue);
+        if (!PrepareStakeKernelCandidate(candidate, nBits))
+            continue;
+        vStakeCoins.push_back(pcoin);
+        vCandidates.push_back(candidate);
+    }
 
-        uint256 hashProofOfStake = 0;
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
+    uint256 hashProofOfStake = 0;
+    int nKernel = -1;
+    nTxNewTime = GetAdjustedTime();
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (CheckStakeKernelHash(nBits, block, *pcoin.first, prevoutStake, nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
-            //Double check that this will pass time requirements
-            if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
-                continue;
-            }
+    //kernels at or below the median time past would not be accepted
+    if (!SearchStakeKernel(vCandidates, nTxNewTime, nHashDrift, chainActive.Tip()->GetMedianTimePast(), nKernel, hashProofOfStake))
+        return false;
 
-            // Found a kernel
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : kernel found\n");
-
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("CreateCoinStake : failed to parse kernel\n");
-                break;
-            }
+    const pair<const CWalletTx*, unsigned int>& pcoin = vStakeCoins[nKernel];
+
+    // Found a kernel
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : kernel found\n");
+
+    vector<valtype> vSolutions;
+    txnouttype whichType;
+    CScript scriptPubKeyOut;
+    scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
+    if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
+        LogPrintf("CreateCoinStake : failed to parse kernel\n");
+        return false;
+    }
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+    if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_WITNESS_V0_KEYHASH) {
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+        return false; // only support pay to public key and pay to address
+    }
+    if (whichType == TX_PUBKEYHASH) // pay to address type
+    {
+        //convert to pay to public key type
+        CKey key;
+        if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
             if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_WITNESS_V0_KEYHASH) {
-                if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                break; // only support pay to public key and pay to address
-            }
-            if (whichType == TX_PUBKEYHASH) // pay to address type
-            {
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                    break; // unable to find corresponding public key
-                }
+                LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+            return false; // unable to find corresponding public key
+        }
 
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            } else
-                scriptPubKeyOut = scriptPubKeyKernel;
+        scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+    } else
+        scriptPubKeyOut = scriptPubKeyKernel;
 
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit += pcoin.first->vout[pcoin.second].nValue;
-            vwtxPrev.push_back(pcoin.first);
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+    txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
+    nCredit += pcoin.first->vout[pcoin.second].nValue;
+    vwtxPrev.push_back(pcoin.first);
+    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
 
-            //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
-            const CBlockIndex* pIndex0 = chainActive.Tip();
-            uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetBlockValue(pIndex0->nHeight+1);
+    //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
+    uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetBlockValue(chainActive.Tip()->nHeight+1);
 
-            //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
-            if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+    //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
+    if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
 
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
-            fKernelFound = true;
-            break;
-        }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
-    }
-    if (!fKernelFound)
-        return false;
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
 
     // Calculate reward
     CAmount nReward;
@@ -3597,6 +4004,8 @@ bool CWallet::UpdatedTransaction(const uint256& hashTx)
         // Only notify UI if this transaction is in this wallet
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
         if (mi != mapWallet.end()) {
+            // a swiftTX lock changes the depth the balances see
+            fBalancesCached = false;
             NotifyTransactionChanged(this, hashTx, CT_UPDATED);
             return true;
         }
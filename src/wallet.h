@@ -24,6 +24,7 @@
 #include "walletdb.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -55,6 +56,14 @@ static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWa
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 //! -custombackupthreshold default
 static const int DEFAULT_CUSTOMBACKUPTHRESHOLD = 1;
+//! Blocks a rescan may read and match ahead of the block it is adding to the wallet
+static const unsigned int RESCAN_READAHEAD_BLOCKS = 256;
+//! Bytes of raw block data a rescan may read ahead of the batch it is adding to the wallet
+static const size_t RESCAN_READAHEAD_BYTES = 32 * 1024 * 1024;
+//! Blocks a rescan adds to the wallet per acquisition of cs_main and cs_wallet
+static const unsigned int RESCAN_COMMIT_BLOCKS = 64;
+//! Maximum number of threads matching blocks against the wallet during a rescan
+static const int MAX_RESCAN_THREADS = 8;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -176,6 +185,48 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Outputs of wallet transactions that are ours and not spent by a wallet
+     * transaction in the main chain, so that balances and AvailableCoins do
+     * not have to walk all of mapWallet. The set may hold more than what is
+     * spendable (the usual spent, trust and maturity checks still run on the
+     * transactions it lists) but never less. AddToWallet only queues the
+     * outpoints it touches; readers settle them under cs_main.
+     */
+    mutable std::set<COutPoint> setWalletUTXO;
+    mutable std::set<COutPoint> setWalletUTXOPending;
+    mutable bool fWalletUTXORebuild;
+
+    void QueueWalletUTXO(const CWalletTx& wtx);
+    void SettleWalletUTXO(const COutPoint& outpoint) const;
+    void SyncWalletUTXO() const;
+    bool IsSpentInMainChain(const COutPoint& outpoint) const;
+
+    //! Wallet transactions with at least one output in setWalletUTXO, in txid order
+    void GetWalletUTXOTxs(std::vector<const CWalletTx*>& vTxRet) const;
+
+    struct CWalletBalances {
+        CAmount nBalance;
+        CAmount nUnconfirmed;
+        CAmount nImmature;
+        CAmount nWatchOnly;
+        CAmount nUnconfirmedWatchOnly;
+        CAmount nImmatureWatchOnly;
+    };
+
+    /**
+     * Running totals behind GetBalance and friends. They stay valid until the
+     * tip moves, the mempool changes or a wallet transaction is added or
+     * updated; a wallet holding non-final transactions is never cached since
+     * those can turn final with the clock alone.
+     */
+    mutable CWalletBalances cachedBalances;
+    mutable bool fBalancesCached;
+    mutable uint256 hashBalancesTip;
+    mutable unsigned int nBalancesMempoolUpdated;
+
+    CWalletBalances GetBalances() const;
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const;
@@ -259,6 +310,11 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
+        fWalletUTXORebuild = true;
+        fBalancesCached = false;
+        nBalancesMempoolUpdated = 0;
+        nScanStartTime = 0;
+        dScanProgress = 0.0;
 
         // Stake Settings
         nHashDrift = 45;
@@ -309,6 +365,10 @@ public:
 
     int64_t nTimeFirstKey;
 
+    //! When the running rescan started (0 if none) and the share of its blocks done, for getwalletinfo
+    std::atomic<int64_t> nScanStartTime;
+    std::atomic<double> dScanProgress;
+
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
     //! check whether we are allowed to upgrade (or already support) to the named feature
@@ -143,6 +143,54 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
+// Free function for zero-copy message parts: drops the reference on the cached block
+static void zmq_release_cached_block(void *data, void *hint)
+{
+    delete static_cast<CCachedBlockRef*>(hint);
+}
+
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const CCachedBlockRef& pblock)
+{
+    assert(psocket);
+    assert(!pblock->vSerialized.empty());
+
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], nSequence);
+
+    if (zmq_send(psocket, command, strlen(command), ZMQ_SNDMORE) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        return false;
+    }
+
+    zmq_msg_t msg;
+    CCachedBlockRef* pref = new CCachedBlockRef(pblock);
+    int rc = zmq_msg_init_data(&msg, (void*)&pblock->vSerialized[0], pblock->vSerialized.size(), zmq_release_cached_block, pref);
+    if (rc != 0)
+    {
+        delete pref;
+        zmqError("Unable to initialize ZMQ msg");
+        return false;
+    }
+    rc = zmq_msg_send(&msg, psocket, ZMQ_SNDMORE);
+    zmq_msg_close(&msg);
+    if (rc == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        return false;
+    }
+
+    if (zmq_send(psocket, msgseq, sizeof(uint32_t), 0) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        return false;
+    }
+
+    nSequence++;
+
+    return true;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
@@ -177,6 +225,11 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
+    // The tip was just connected, so its bytes are normally in the recent-block cache
+    CCachedBlockRef pcached = recentBlocks.Get(pindex->GetBlockHash());
+    if (pcached)
+        return SendMessage(MSG_RAWBLOCK, pcached);
+
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     {
         LOCK(cs_main);
@@ -6,6 +6,7 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include "zmqabstractnotifier.h"
+#include "blockcache.h"
 
 class CBlockIndex;
 
@@ -24,6 +25,10 @@ public:
     */
     bool SendMessage(const char *command, const void* data, size_t size);
 
+    /* as above, but the data part points into the serialized bytes of a
+       cached block, which are kept alive until ZMQ has sent them */
+    bool SendMessage(const char *command, const CCachedBlockRef& pblock);
+
     bool Initialize(void *pcontext);
     void Shutdown();
 };